@@ -0,0 +1,1026 @@
+/******************************************************************************
+*
+*  Project:  rl2kmz
+*  Purpose:  synthetic grids and polygons, stage and end to end benchmarks
+*  Author:   Kyle Shannon <kyle at pobox dot com>
+*
+*******************************************************************************
+*
+* This is free and unencumbered software released into the public domain.
+*
+* Anyone is free to copy, modify, publish, use, compile, sell, or
+* distribute this software, either in source code form or as a compiled
+* binary, for any purpose, commercial or non-commercial, and by any
+* means.
+*
+* In jurisdictions that recognize copyright laws, the author or authors
+* of this software dedicate any and all copyright interest in the
+* software to the public domain. We make this dedication for the benefit
+* of the public at large and to the detriment of our heirs and
+* successors. We intend this dedication to be an overt act of
+* relinquishment in perpetuity of all present and future rights to this
+* software under copyright law.
+*
+* THIS SOFTWARE WAS DEVELOPED AT THE ROCKY MOUNTAIN RESEARCH STATION (RMRS)
+* MISSOULA FIRE SCIENCES LABORATORY BY EMPLOYEES OF THE FEDERAL GOVERNMENT
+* IN THE COURSE OF THEIR OFFICIAL DUTIES. PURSUANT TO TITLE 17 SECTION 105
+* OF THE UNITED STATES CODE, THIS SOFTWARE IS NOT SUBJECT TO COPYRIGHT
+* PROTECTION AND IS IN THE PUBLIC DOMAIN. RMRS MISSOULA FIRE SCIENCES
+* LABORATORY ASSUMES NO RESPONSIBILITY WHATSOEVER FOR ITS USE BY OTHER
+* PARTIES,  AND MAKES NO GUARANTEES, EXPRESSED OR IMPLIED, ABOUT ITS QUALITY,
+* RELIABILITY, OR ANY OTHER CHARACTERISTIC.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+* IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+* OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+* ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+* OTHER DEALINGS IN THE SOFTWARE.
+*
+* For more information, please refer to <http://unlicense.org>
+*
+******************************************************************************/
+
+#include <math.h>
+
+#include "gdal.h"
+#include "ogr_api.h"
+#include "cpl_conv.h"
+#include "cpl_string.h"
+
+#include "rlport.h"
+#include "rlcolor.h"
+#include "rlcontext.h"
+#include "rlkml.h"
+#include "rlkmz.h"
+#include "rlperf.h"
+#include "rlpng.h"
+#include "rlraster.h"
+#include "rltile.h"
+#include "rlutil.h"
+#include "rlwarp.h"
+
+/*
+** Every synthetic grid covers the same box over CONUS in the LAEA of the
+** real grids, larger grids just have smaller pixels.
+*/
+#define RL_BENCH_WEST    -2400000.0
+#define RL_BENCH_NORTH    1300000.0
+#define RL_BENCH_WIDTH    4800000.0
+#define RL_BENCH_HEIGHT   3200000.0
+
+#define RL_BENCH_NODATA   -9999
+
+/* Rain cells across the grid, whatever its size */
+#define RL_BENCH_CELLS    48
+
+/* Rows generated and written at a time */
+#define RL_BENCH_STRIP    256
+
+typedef struct
+{
+    const char *pszName;
+    int nXSize;
+    int nYSize;
+} RLBenchScale;
+
+/*
+** CONUS at 1 km up to 100k x 100k.  Any other size can be given as XxY.
+*/
+static const RLBenchScale asScales[] =
+{
+    { "small",      1200,    800 },
+    { "conus",      4800,   3200 },
+    { "conus250",  19200,  12800 },
+    { "10k",       10000,  10000 },
+    { "30k",       30000,  30000 },
+    { "100k",     100000, 100000 }
+};
+
+/*
+** What to generate.  The same settings always give the same files.
+*/
+typedef struct
+{
+    int nXSize;
+    int nYSize;
+    /* Fraction of the grid with rain, roughly */
+    double dfSparsity;
+    /* Fraction of pixels with a strike, half 10000 and half 20000 */
+    double dfStrikes;
+    /* Fraction of the columns that are nodata, half west and half east */
+    double dfNoData;
+    int nPolygons;
+    int nVertices;
+    GUIntBig nSeed;
+} RLBenchGrid;
+
+/*
+** Settings shared by every benchmark.
+*/
+typedef struct
+{
+    char **papszConfig;
+    RLColorTable *psTable;
+    int nThreads;
+    int bPalette;
+    RLPngOptions sPngOptions;
+    RLDeflateOptions sKmzOptions;
+    int nTileSize;
+    double dfWarpMemory;
+    /* Largest colour buffer the colorize stage may allocate, in bytes */
+    double dfMaxMemory;
+    const char *pszWorkDir;
+    const char *pszPerfLog;
+    int nRepeat;
+    int bKeep;
+} RLBench;
+
+/*
+** splitmix64 finaliser.  Every value is hashed from its coordinates and the
+** seed alone, so a grid is the same however it is written.
+*/
+static GUIntBig Mix( GUIntBig nKey )
+{
+    nKey += (GUIntBig) 0x9e3779b97f4a7c15ULL;
+    nKey = ( nKey ^ ( nKey >> 30 ) ) * (GUIntBig) 0xbf58476d1ce4e5b9ULL;
+    nKey = ( nKey ^ ( nKey >> 27 ) ) * (GUIntBig) 0x94d049bb133111ebULL;
+    return nKey ^ ( nKey >> 31 );
+}
+
+/*
+** Uniform value in [0,1) for a point, with nSalt telling apart the values
+** drawn for different purposes.
+*/
+static double Uniform( GUIntBig nSeed, int nSalt, GIntBig nX, GIntBig nY )
+{
+    GUIntBig nKey;
+    nKey = Mix( nSeed ^ (GUIntBig) nSalt );
+    nKey = Mix( nKey ^ (GUIntBig) nX );
+    nKey = Mix( nKey ^ (GUIntBig) nY );
+    return (double) ( nKey >> 11 ) * ( 1.0 / 9007199254740992.0 );
+}
+
+/*
+** Write a synthetic rain and lightning grid to the GeoTIFF pszFile.  Rain
+** falls in smooth cells, from 1 at the edges up to 121, over roughly
+** dfSparsity of the grid.  Strikes are scattered uniformly over
+** everything else and the west and east edges are nodata, like the ocean
+** around the real grids.
+*/
+static CPLErr GenerateGrid( const RLBenchGrid *psGrid, const char *pszFile )
+{
+    GDALDriverH hDriver;
+    GDALDatasetH hDS;
+    GDALRasterBandH hBand;
+    char **papszOptions = NULL;
+    char *pszTmpFile;
+    GInt32 *panStrip, *panRow;
+    double adfGT[6], *padfCells;
+    double dfCell, dfY, dfX, dfT, dfValue, dfStrike;
+    int nXSize = psGrid->nXSize, nYSize = psGrid->nYSize;
+    int nCells, nWest, nEast, nLines, iRow, iLine, i, j, x;
+    CPLErr eErr = CE_None;
+
+    hDriver = GDALGetDriverByName( "GTiff" );
+    if( !hDriver )
+    {
+        CPLError( CE_Failure, CPLE_AppDefined, "GTiff driver not available" );
+        return CE_Failure;
+    }
+    papszOptions = CSLSetNameValue( papszOptions, "TILED", "YES" );
+    papszOptions = CSLSetNameValue( papszOptions, "COMPRESS", "DEFLATE" );
+    papszOptions = CSLSetNameValue( papszOptions, "PREDICTOR", "2" );
+    papszOptions = CSLSetNameValue( papszOptions, "SPARSE_OK", "TRUE" );
+    papszOptions = CSLSetNameValue( papszOptions, "BIGTIFF", "IF_SAFER" );
+    pszTmpFile = CPLStrdup( CPLSPrintf( "%s.tmp", pszFile ) );
+    hDS = GDALCreate( hDriver, pszTmpFile, nXSize, nYSize, 1, GDT_Int32,
+                      papszOptions );
+    CSLDestroy( papszOptions );
+    panStrip = (GInt32*) VSIMalloc3( sizeof( GInt32 ), nXSize,
+                                     RL_BENCH_STRIP );
+    if( !hDS || !panStrip )
+    {
+        CPLError( CE_Failure, CPLE_AppDefined, "Could not create %s",
+                  pszTmpFile );
+        if( hDS )
+            GDALClose( hDS );
+        VSIFree( panStrip );
+        CPLFree( pszTmpFile );
+        return CE_Failure;
+    }
+    adfGT[0] = RL_BENCH_WEST;
+    adfGT[1] = RL_BENCH_WIDTH / nXSize;
+    adfGT[2] = 0.0;
+    adfGT[3] = RL_BENCH_NORTH;
+    adfGT[4] = 0.0;
+    adfGT[5] = -RL_BENCH_HEIGHT / nYSize;
+    GDALSetGeoTransform( hDS, adfGT );
+    GDALSetProjection( hDS, RL_SRC_WKT );
+    hBand = GDALGetRasterBand( hDS, 1 );
+    GDALSetRasterNoDataValue( hBand, RL_BENCH_NODATA );
+
+    /*
+    ** The rain is value noise, random values on a coarse lattice
+    ** interpolated bilinearly.  The lattice is interpolated down to a row
+    ** once per row, then along it per pixel.
+    */
+    dfCell = (double) nXSize / RL_BENCH_CELLS;
+    nCells = RL_BENCH_CELLS + 2;
+    padfCells = (double*) CPLMalloc( sizeof( double ) * nCells );
+    nWest = (int) ( nXSize * psGrid->dfNoData / 2.0 );
+    nEast = nXSize - nWest;
+
+    for( iRow = 0; iRow < nYSize && eErr == CE_None; iRow += nLines )
+    {
+        nLines = MIN( RL_BENCH_STRIP, nYSize - iRow );
+        for( iLine = 0; iLine < nLines; iLine++ )
+        {
+            dfY = ( iRow + iLine ) / dfCell;
+            j = (int) dfY;
+            dfT = dfY - j;
+            for( i = 0; i < nCells; i++ )
+            {
+                padfCells[i] =
+                    Uniform( psGrid->nSeed, 0, i, j ) * ( 1.0 - dfT ) +
+                    Uniform( psGrid->nSeed, 0, i, j + 1 ) * dfT;
+            }
+            panRow = panStrip + (size_t) iLine * nXSize;
+            for( x = 0; x < nXSize; x++ )
+            {
+                if( x < nWest || x >= nEast )
+                {
+                    panRow[x] = RL_BENCH_NODATA;
+                    continue;
+                }
+                dfStrike = Uniform( psGrid->nSeed, 1, x, iRow + iLine );
+                if( dfStrike < psGrid->dfStrikes )
+                {
+                    panRow[x] = dfStrike < psGrid->dfStrikes / 2.0 ?
+                                10000 : 20000;
+                    continue;
+                }
+                dfX = x / dfCell;
+                i = (int) dfX;
+                dfT = dfX - i;
+                dfValue = padfCells[i] * ( 1.0 - dfT ) +
+                          padfCells[i + 1] * dfT;
+                if( dfValue < psGrid->dfSparsity )
+                    panRow[x] = 1 + (GInt32) ( 120.0 * ( 1.0 - dfValue /
+                                               psGrid->dfSparsity ) );
+                else
+                    panRow[x] = 0;
+            }
+        }
+        eErr = GDALRasterIO( hBand, GF_Write, 0, iRow, nXSize, nLines,
+                             panStrip, nXSize, nLines, GDT_Int32, 0, 0 );
+    }
+    GDALClose( hDS );
+    CPLFree( padfCells );
+    VSIFree( panStrip );
+
+    if( eErr == CE_None && VSIRename( pszTmpFile, pszFile ) != 0 )
+    {
+        CPLError( CE_Failure, CPLE_FileIO, "Could not rename %s to %s",
+                  pszTmpFile, pszFile );
+        eErr = CE_Failure;
+    }
+    if( eErr != CE_None )
+        VSIUnlink( pszTmpFile );
+    CPLFree( pszTmpFile );
+    return eErr;
+}
+
+/*
+** Write a synthetic SPC fire weather outlook kmz: irregular polygons over
+** CONUS named Elevated, Critical and Extreme, half of them Elevated so the
+** filter has something to drop.
+*/
+static CPLErr GeneratePolygons( const RLBenchGrid *psGrid,
+                                const char *pszFile )
+{
+    RLBuffer sKml;
+    RLKmzWriter *psKmz;
+    const char *pszName;
+    double dfLon, dfLat, dfRadius, dfAngle, dfR;
+    int nVertices = MAX( 3, psGrid->nVertices );
+    int i, j;
+    CPLErr eErr;
+
+    memset( &sKml, 0, sizeof( sKml ) );
+    RLKmlBeginDocument( &sKml, "spc_day1firewx" );
+    RLKmlBeginFolder( &sKml, "Day 1 Fire Weather Outlook" );
+    for( i = 0; i < psGrid->nPolygons; i++ )
+    {
+        if( i % 2 == 0 )
+            pszName = "Elevated";
+        else
+            pszName = i % 4 == 1 ? "Critical" : "Extreme";
+        dfLon = -122.0 + 52.0 * Uniform( psGrid->nSeed, 2, i, 0 );
+        dfLat = 27.0 + 21.0 * Uniform( psGrid->nSeed, 2, i, 1 );
+        dfRadius = 0.25 + 2.0 * Uniform( psGrid->nSeed, 2, i, 2 );
+        RLBufferPrintf( &sKml, "<Placemark>\n<name>%s</name>\n<Polygon>" \
+                        "<outerBoundaryIs><LinearRing><coordinates>",
+                        pszName );
+        /* Star shaped, so the ring never crosses itself */
+        for( j = 0; j <= nVertices; j++ )
+        {
+            dfAngle = 2.0 * M_PI * ( j % nVertices ) / nVertices;
+            dfR = dfRadius * ( 0.6 + 0.4 * Uniform( psGrid->nSeed, 3, i,
+                                                    j % nVertices ) );
+            RLBufferPrintf( &sKml, "%.6f,%.6f ",
+                            dfLon + dfR * cos( dfAngle ) /
+                                    cos( dfLat * M_PI / 180.0 ),
+                            dfLat + dfR * sin( dfAngle ) );
+        }
+        RLBufferPrintf( &sKml, "</coordinates></LinearRing>" \
+                        "</outerBoundaryIs></Polygon>\n</Placemark>\n" );
+    }
+    RLKmlEndFolder( &sKml );
+    RLKmlEndDocument( &sKml );
+
+    psKmz = RLKmzCreate( pszFile, NULL );
+    if( !psKmz )
+    {
+        RLBufferFree( &sKml );
+        return CE_Failure;
+    }
+    eErr = RLKmzAddFile( psKmz, "doc.kml", sKml.pabyData, sKml.nSize, TRUE );
+    if( RLKmzClose( psKmz, eErr == CE_None ) != CE_None )
+        eErr = CE_Failure;
+    RLBufferFree( &sKml );
+    return eErr;
+}
+
+/*
+** Write a plain grey png for the title and legends.
+*/
+static CPLErr GenerateImage( const char *pszFile, int nXSize, int nYSize )
+{
+    VSILFILE *fp;
+    RLPngWriter *psPng;
+    GByte *pabyRows;
+    CPLErr eErr;
+
+    fp = VSIFOpenL( pszFile, "wb" );
+    if( !fp )
+    {
+        CPLError( CE_Failure, CPLE_OpenFailed, "Could not create %s",
+                  pszFile );
+        return CE_Failure;
+    }
+    pabyRows = (GByte*) CPLMalloc( (size_t) 4 * nXSize * nYSize );
+    memset( pabyRows, 160, (size_t) 4 * nXSize * nYSize );
+    psPng = RLPngCreate( nXSize, nYSize, 4, NULL, 0, NULL, RLVSIWrite, fp );
+    eErr = psPng ? RLPngWriteRows( psPng, pabyRows, nYSize ) : CE_Failure;
+    if( psPng && RLPngFinish( psPng ) != CE_None )
+        eErr = CE_Failure;
+    if( VSIFCloseL( fp ) != 0 )
+        eErr = CE_Failure;
+    CPLFree( pabyRows );
+    return eErr;
+}
+
+/*
+** RLWriteFunc that only counts, so encoding is timed without any I/O.
+*/
+static size_t CountBytes( const void *pData, size_t nBytes, void *pUserData )
+{
+    (void) pData;
+    *(GUIntBig*) pUserData += nBytes;
+    return nBytes;
+}
+
+/*
+** Decode the whole grid a strip at a time, the floor under every raster
+** stage.
+*/
+static CPLErr ReadGrid( GDALDatasetH hDS )
+{
+    GDALRasterBandH hBand;
+    GInt32 *panStrip;
+    int nXSize, nYSize, nLines, iRow;
+    CPLErr eErr = CE_None;
+
+    hBand = GDALGetRasterBand( hDS, 1 );
+    nXSize = GDALGetRasterXSize( hDS );
+    nYSize = GDALGetRasterYSize( hDS );
+    panStrip = (GInt32*) VSIMalloc3( sizeof( GInt32 ), nXSize,
+                                     RL_BENCH_STRIP );
+    if( !panStrip )
+        return CE_Failure;
+    for( iRow = 0; iRow < nYSize && eErr == CE_None; iRow += nLines )
+    {
+        nLines = MIN( RL_BENCH_STRIP, nYSize - iRow );
+        eErr = GDALRasterIO( hBand, GF_Read, 0, iRow, nXSize, nLines,
+                             panStrip, nXSize, nLines, GDT_Int32, 0, 0 );
+    }
+    VSIFree( panStrip );
+    return eErr;
+}
+
+/*
+** Render the polygons to placemarks the way a conversion does, without
+** the clipping and simplifying.  Returns the number of bytes of kml.
+*/
+static CPLErr RenderPlacemarks( const char *pszFile, GUIntBig *pnBytes )
+{
+    GDALDatasetH hKmlIn;
+    OGRLayerH hLayerIn, hSqlLayer;
+    OGRFeatureH hFeature;
+    RLKmlPlacemarkPlan *psPlan;
+    RLBuffer sPlacemarks;
+    char **papszStyleMap;
+
+    hKmlIn = OGROpen( pszFile, FALSE, NULL );
+    if( !hKmlIn )
+    {
+        CPLError( CE_Failure, CPLE_OpenFailed, "Could not open %s", pszFile );
+        return CE_Failure;
+    }
+    hLayerIn = GDALDatasetGetLayer( hKmlIn, 0 );
+    hSqlLayer = GDALDatasetExecuteSQL( hKmlIn,
+                                       CPLSPrintf( "SELECT * FROM \"%s\" " \
+                                                   "WHERE " RL_POLYGON_FILTER \
+                                                   " ORDER BY Name ASC",
+                                                   OGR_L_GetName( hLayerIn ) ),
+                                       NULL, NULL );
+    if( !hSqlLayer )
+    {
+        GDALClose( hKmlIn );
+        return CE_Failure;
+    }
+    papszStyleMap = CSLSetNameValue( NULL, "Extreme", "extreme" );
+    papszStyleMap = CSLSetNameValue( papszStyleMap, "Critical", "critical" );
+    psPlan = RLKmlCreatePlacemarkPlan( OGR_L_GetLayerDefn( hSqlLayer ),
+                                       "Name", papszStyleMap );
+    CSLDestroy( papszStyleMap );
+
+    memset( &sPlacemarks, 0, sizeof( sPlacemarks ) );
+    while( ( hFeature = OGR_L_GetNextFeature( hSqlLayer ) ) != NULL )
+    {
+        RLKmlWritePlacemark( &sPlacemarks, psPlan, hFeature );
+        OGR_F_Destroy( hFeature );
+    }
+    GDALDatasetReleaseResultSet( hKmlIn, hSqlLayer );
+    GDALClose( hKmlIn );
+    RLKmlDestroyPlacemarkPlan( psPlan );
+    *pnBytes = sPlacemarks.nSize;
+    RLBufferFree( &sPlacemarks );
+    return CE_None;
+}
+
+static GDALDatasetH OpenGrid( const char *pszGridFile )
+{
+    GDALDatasetH hDS;
+    hDS = GDALOpen( pszGridFile, GA_ReadOnly );
+    if( !hDS )
+        CPLError( CE_Failure, CPLE_OpenFailed, "Could not open %s",
+                  pszGridFile );
+    return hDS;
+}
+
+/*
+** Append a line to the perf log.
+*/
+static void WriteLine( const RLBench *psBench, const RLBuffer *psLine )
+{
+    VSILFILE *fp;
+    fp = VSIFOpenL( psBench->pszPerfLog, "ab" );
+    if( !fp )
+    {
+        CPLError( CE_Warning, CPLE_FileIO, "Could not write to %s",
+                  psBench->pszPerfLog );
+        return;
+    }
+    VSIFWriteL( psLine->pabyData, 1, psLine->nSize, fp );
+    VSIFCloseL( fp );
+}
+
+/*
+** Time each stage on its own: reading the grid, the scan and colourize
+** passes, the warp, png encoding of the whole warped grid, the
+** super-overlay and rendering the polygons.  The grid is opened again for
+** each stage so none of them starts with the blocks of the last one in
+** the GDAL cache.  The timings go to the perf log as one line, with the
+** name of the scale as the destination.
+*/
+static CPLErr BenchStages( const RLBench *psBench, const char *pszGridFile,
+                           const char *pszPolyFile, const char *pszScale )
+{
+    RLPerf sPerf;
+    RLBuffer sLine;
+    RLWarpedGrid *psGrid = NULL;
+    RLKmzWriter *psKmz;
+    GDALDatasetH hDS;
+    GByte *pabyColors;
+    char **papszWarpOptions;
+    char *pszKmzFile;
+    GUIntBig nGridBytes, nBytes;
+    int anWindow[4], nXSize, nYSize, nBands, iStage;
+    CPLErr eErr = CE_None;
+
+    hDS = OpenGrid( pszGridFile );
+    if( !hDS )
+        return CE_Failure;
+    nXSize = GDALGetRasterXSize( hDS );
+    nYSize = GDALGetRasterYSize( hDS );
+    nGridBytes = (GUIntBig) nXSize * nYSize * sizeof( GInt32 );
+    nBands = psBench->bPalette ? 1 : 4;
+    RLPerfStart( &sPerf );
+
+    iStage = RLPerfBegin( &sPerf, "read" );
+    eErr = ReadGrid( hDS );
+    RLPerfEnd( &sPerf, iStage, nGridBytes, 0 );
+    GDALClose( hDS );
+
+    if( eErr == CE_None && ( hDS = OpenGrid( pszGridFile ) ) == NULL )
+        eErr = CE_Failure;
+    if( eErr == CE_None )
+    {
+        iStage = RLPerfBegin( &sPerf, "scan" );
+        eErr = RLColorizeDataset( hDS, psBench->psTable, psBench->nThreads,
+                                  nBands, NULL, anWindow, NULL );
+        RLPerfEnd( &sPerf, iStage, nGridBytes, 0 );
+        GDALClose( hDS );
+    }
+
+    /* The colour buffer is the whole grid, skipped if it won't fit */
+    if( eErr == CE_None &&
+        (double) nXSize * nYSize * nBands <= psBench->dfMaxMemory &&
+        ( hDS = OpenGrid( pszGridFile ) ) != NULL )
+    {
+        iStage = RLPerfBegin( &sPerf, "colorize" );
+        pabyColors = (GByte*) VSIMalloc3( nBands, nXSize, nYSize );
+        if( pabyColors )
+            eErr = RLColorizeDataset( hDS, psBench->psTable,
+                                      psBench->nThreads, nBands, pabyColors,
+                                      anWindow, NULL );
+        else
+            eErr = CE_Failure;
+        RLPerfEnd( &sPerf, iStage, nGridBytes,
+                   (GUIntBig) nXSize * nYSize * nBands );
+        VSIFree( pabyColors );
+        GDALClose( hDS );
+    }
+    else if( eErr == CE_None &&
+             (double) nXSize * nYSize * nBands > psBench->dfMaxMemory )
+    {
+        CPLDebug( "RL2KMZ", "Skipping colorize, the %dx%d colour buffer " \
+                  "is over the memory limit", nXSize, nYSize );
+    }
+
+    hDS = NULL;
+    if( eErr == CE_None && ( hDS = OpenGrid( pszGridFile ) ) == NULL )
+        eErr = CE_Failure;
+    if( eErr == CE_None )
+    {
+        iStage = RLPerfBegin( &sPerf, "warp" );
+        papszWarpOptions =
+            CSLSetNameValue( NULL, "NUM_THREADS",
+                             CPLSPrintf( "%d", psBench->nThreads ) );
+        papszWarpOptions =
+            CSLSetNameValue( papszWarpOptions, "WARP_MEMORY",
+                             CPLSPrintf( "%.0f", psBench->dfWarpMemory ) );
+        psGrid = RLCreateWarpedGrid( hDS, RL_SRC_WKT, RL_DST_WKT,
+                                     papszWarpOptions );
+        CSLDestroy( papszWarpOptions );
+        RLPerfEnd( &sPerf, iStage, nGridBytes, 0 );
+        if( !psGrid )
+            eErr = CE_Failure;
+    }
+
+    if( eErr == CE_None )
+    {
+        anWindow[0] = 0;
+        anWindow[1] = 0;
+        RLGetWarpedGridInfo( psGrid, &anWindow[2], &anWindow[3], NULL, NULL,
+                             NULL );
+        nBytes = 0;
+        iStage = RLPerfBegin( &sPerf, "png" );
+        eErr = RLEncodeWarpedGridPng( psGrid, anWindow, psBench->psTable,
+                                      psBench->bPalette,
+                                      &psBench->sPngOptions, CountBytes,
+                                      &nBytes );
+        RLPerfEnd( &sPerf, iStage, 0, nBytes );
+    }
+
+    if( eErr == CE_None )
+    {
+        pszKmzFile =
+            CPLStrdup( CPLFormFilename( psBench->pszWorkDir,
+                                        CPLSPrintf( "tiles_%s", pszScale ),
+                                        "kmz" ) );
+        iStage = RLPerfBegin( &sPerf, "superoverlay" );
+        psKmz = RLKmzCreate( pszKmzFile, &psBench->sKmzOptions );
+        if( psKmz )
+        {
+            eErr = RLWriteSuperOverlay( psGrid, anWindow, psBench->psTable,
+                                        psBench->bPalette,
+                                        &psBench->sPngOptions,
+                                        psBench->nTileSize,
+                                        psBench->nThreads, psKmz, "tiles" );
+            nBytes = RLKmzGetBytesWritten( psKmz );
+            RLKmzClose( psKmz, FALSE );
+        }
+        else
+        {
+            eErr = CE_Failure;
+            nBytes = 0;
+        }
+        RLPerfEnd( &sPerf, iStage, 0, nBytes );
+        CPLFree( pszKmzFile );
+    }
+    RLDestroyWarpedGrid( psGrid );
+    if( hDS )
+        GDALClose( hDS );
+
+    if( eErr == CE_None )
+    {
+        nBytes = 0;
+        iStage = RLPerfBegin( &sPerf, "polygons" );
+        eErr = RenderPlacemarks( pszPolyFile, &nBytes );
+        RLPerfEnd( &sPerf, iStage, 0, nBytes );
+    }
+
+    memset( &sLine, 0, sizeof( sLine ) );
+    RLPerfWriteJSON( &sPerf, pszGridFile, pszScale, eErr, 0, &sLine );
+    WriteLine( psBench, &sLine );
+    RLBufferFree( &sLine );
+    return eErr;
+}
+
+/*
+** Convert the grid twice on one context, the first time reading the
+** polygons and images and the second finding them warm.  The context
+** writes its own perf log lines.
+*/
+static CPLErr BenchEndToEnd( const RLBench *psBench, const char *pszGridFile,
+                             const char *pszScale )
+{
+    RLContext *psCtx;
+    char *pszDstFile;
+    int i;
+    CPLErr eErr = CE_None;
+
+    psCtx = RLCreateContext( psBench->papszConfig );
+    if( !psCtx )
+        return CE_Failure;
+    pszDstFile =
+        CPLStrdup( CPLFormFilename( psBench->pszWorkDir,
+                                    CPLSPrintf( "rl2kmz_%s", pszScale ),
+                                    "kmz" ) );
+    for( i = 0; i < 2 && eErr == CE_None; i++ )
+        eErr = RLProcessGrid( psCtx, pszGridFile, pszDstFile );
+    if( !psBench->bKeep )
+        VSIUnlink( pszDstFile );
+    CPLFree( pszDstFile );
+    RLDestroyContext( psCtx );
+    return eErr;
+}
+
+/*
+** Generate the grid for a scale unless it's already in the work
+** directory, then run the benchmarks on it.
+*/
+static CPLErr RunScale( const RLBench *psBench, RLBenchGrid *psGrid,
+                        const char *pszPolyFile, const char *pszScale,
+                        int bGenerateOnly )
+{
+    VSIStatBufL sStat;
+    char *pszGridFile;
+    const char *pszName;
+    int i;
+    CPLErr eErr = CE_None;
+
+    for( i = 0; i < (int) ( sizeof( asScales ) / sizeof( asScales[0] ) );
+         i++ )
+    {
+        if( EQUAL( pszScale, asScales[i].pszName ) )
+            break;
+    }
+    if( i < (int) ( sizeof( asScales ) / sizeof( asScales[0] ) ) )
+    {
+        psGrid->nXSize = asScales[i].nXSize;
+        psGrid->nYSize = asScales[i].nYSize;
+    }
+    else if( sscanf( pszScale, "%dx%d", &psGrid->nXSize,
+                     &psGrid->nYSize ) != 2 ||
+             psGrid->nXSize < 1 || psGrid->nYSize < 1 )
+    {
+        CPLError( CE_Failure, CPLE_IllegalArg, "Unknown scale %s",
+                  pszScale );
+        return CE_Failure;
+    }
+
+    pszName = CPLSPrintf( "grid_%dx%d_%g_%g_%g_" CPL_FRMT_GUIB,
+                          psGrid->nXSize, psGrid->nYSize,
+                          psGrid->dfSparsity, psGrid->dfStrikes,
+                          psGrid->dfNoData, psGrid->nSeed );
+    pszGridFile = CPLStrdup( CPLFormFilename( psBench->pszWorkDir, pszName,
+                                              "tif" ) );
+    if( VSIStatL( pszGridFile, &sStat ) != 0 )
+    {
+        CPLDebug( "RL2KMZ", "Generating %s", pszGridFile );
+        eErr = GenerateGrid( psGrid, pszGridFile );
+    }
+    for( i = 0; i < psBench->nRepeat && eErr == CE_None && !bGenerateOnly;
+         i++ )
+    {
+        eErr = BenchStages( psBench, pszGridFile, pszPolyFile, pszScale );
+        if( eErr == CE_None )
+            eErr = BenchEndToEnd( psBench, pszGridFile, pszScale );
+    }
+    CPLFree( pszGridFile );
+    return eErr;
+}
+
+/*
+** Check the perf log lines from nOffset on against papszBudgets.  A stage
+** name with _s after it is the most wall time in seconds of any one run of
+** the stage, wall_s that of a whole line and rss_mb the peak resident
+** memory in megabytes.  Returns the number of budgets overrun, counting
+** failed runs as one each.
+*/
+static int CheckBudgets( char **papszBudgets, const char *pszPerfLog,
+                         vsi_l_offset nOffset )
+{
+    VSILFILE *fp;
+    const char *pszLine, *pszStage, *pszBudget;
+    char szStage[64];
+    double dfWall, dfLimit;
+    GIntBig nPeakRSS;
+    int nLines = 0, nOver = 0;
+
+    fp = VSIFOpenL( pszPerfLog, "rb" );
+    if( !fp || VSIFSeekL( fp, nOffset, SEEK_SET ) != 0 )
+    {
+        CPLError( CE_Failure, CPLE_OpenFailed, "Could not read %s",
+                  pszPerfLog );
+        if( fp )
+            VSIFCloseL( fp );
+        return 1;
+    }
+    while( ( pszLine = CPLReadLineL( fp ) ) != NULL )
+    {
+        if( !STARTS_WITH( pszLine, "{\"src\":" ) )
+            continue;
+        nLines++;
+        if( !strstr( pszLine, "\"status\":\"ok\"" ) )
+        {
+            printf( "Failed run: %s\n", pszLine );
+            nOver++;
+            continue;
+        }
+        /* The totals come before the stages */
+        pszStage = strstr( pszLine, "\"wall_s\":" );
+        pszBudget = CSLFetchNameValue( papszBudgets, "wall_s" );
+        if( pszStage && pszBudget &&
+            sscanf( pszStage, "\"wall_s\":%lf", &dfWall ) == 1 &&
+            dfWall > ( dfLimit = CPLAtof( pszBudget ) ) )
+        {
+            printf( "Over budget: %.3f s against %.3f s for %.80s\n",
+                    dfWall, dfLimit, pszLine );
+            nOver++;
+        }
+        pszStage = strstr( pszLine, "\"peak_rss_kb\":" );
+        pszBudget = CSLFetchNameValue( papszBudgets, "rss_mb" );
+        if( pszStage && pszBudget &&
+            sscanf( pszStage, "\"peak_rss_kb\":" CPL_FRMT_GIB,
+                    &nPeakRSS ) == 1 &&
+            nPeakRSS / 1024.0 > ( dfLimit = CPLAtof( pszBudget ) ) )
+        {
+            printf( "Over budget: %.0f MB against %.0f MB for %.80s\n",
+                    nPeakRSS / 1024.0, dfLimit, pszLine );
+            nOver++;
+        }
+
+        pszStage = strstr( pszLine, "\"stages\":[" );
+        while( pszStage &&
+               ( pszStage = strstr( pszStage, "{\"name\":\"" ) ) != NULL )
+        {
+            if( sscanf( pszStage, "{\"name\":\"%63[^\"]\",\"wall_s\":%lf",
+                        szStage, &dfWall ) != 2 )
+            {
+                break;
+            }
+            pszStage++;
+            pszBudget = CSLFetchNameValue( papszBudgets,
+                                           CPLSPrintf( "%s_s", szStage ) );
+            if( pszBudget && dfWall > ( dfLimit = CPLAtof( pszBudget ) ) )
+            {
+                printf( "Over budget: %s took %.3f s against %.3f s\n",
+                        szStage, dfWall, dfLimit );
+                nOver++;
+            }
+        }
+    }
+    VSIFCloseL( fp );
+    if( nLines == 0 )
+    {
+        printf( "No runs in %s to check\n", pszPerfLog );
+        nOver++;
+    }
+    else if( nOver == 0 )
+    {
+        printf( "%d runs within budget\n", nLines );
+    }
+    return nOver;
+}
+
+void Usage()
+{
+    int i;
+    printf( "Usage: rl2kmz_bench [-c config_file] [--perf log_file] " \
+            "[--dir work_dir]\n" );
+    printf( "                    [--scale name|XxY]... [--sparsity f] " \
+            "[--strikes f]\n" );
+    printf( "                    [--nodata f] [--polygons n] " \
+            "[--vertices n] [--seed n]\n" );
+    printf( "                    [--repeat n] [--max_memory mb] " \
+            "[--generate_only] [--keep]\n" );
+    printf( "                    [--budget budget_file]\n" );
+    printf( "\n" );
+    printf( "Generates synthetic grids and SPC polygons in work_dir, then\n" );
+    printf( "times each stage on its own and whole conversions, one line\n" );
+    printf( "of JSON per run to log_file, /vsistdout/ by default.  Grids\n" );
+    printf( "are kept and reused by later runs with the same settings.\n" );
+    printf( "With --budget the lines of this run are checked against the\n" );
+    printf( "limits in budget_file, which needs log_file to be a file.\n" );
+    printf( "Scales:" );
+    for( i = 0; i < (int) ( sizeof( asScales ) / sizeof( asScales[0] ) );
+         i++ )
+    {
+        printf( " %s (%dx%d)", asScales[i].pszName, asScales[i].nXSize,
+                asScales[i].nYSize );
+    }
+    printf( "\nsmall and conus run by default.\n" );
+    exit( 1 );
+}
+
+int main( int argc, char *argv[] )
+{
+    RLBench sBench;
+    RLBenchGrid sGrid;
+    VSIStatBufL sStat;
+    char **papszScales = NULL, **papszBudgets = NULL;
+    vsi_l_offset nLogOffset = 0;
+    char *pszPolyFile, *pszPolyLayer, *pszImage;
+    int bGenerateOnly = FALSE;
+    int rc = RL_OK;
+    int i;
+
+    memset( &sBench, 0, sizeof( sBench ) );
+    sBench.pszWorkDir = "rl2kmz_bench";
+    sBench.pszPerfLog = "/vsistdout/";
+    sBench.nRepeat = 1;
+    sBench.dfMaxMemory = 2048.0 * 1024.0 * 1024.0;
+
+    memset( &sGrid, 0, sizeof( sGrid ) );
+    sGrid.dfSparsity = 0.1;
+    sGrid.dfStrikes = 0.001;
+    sGrid.dfNoData = 0.1;
+    sGrid.nPolygons = 40;
+    sGrid.nVertices = 200;
+    sGrid.nSeed = 1;
+
+    for( i = 1; i < argc; i++ )
+    {
+        if( ( EQUAL( argv[i], "-c" ) || EQUAL( argv[i], "--config" ) ) &&
+            i + 1 < argc )
+        {
+            CSLDestroy( sBench.papszConfig );
+            sBench.papszConfig = CSLLoad2( argv[++i], -1, -1, NULL );
+            if( !sBench.papszConfig )
+                Usage();
+        }
+        else if( EQUAL( argv[i], "--perf" ) && i + 1 < argc )
+            sBench.pszPerfLog = argv[++i];
+        else if( EQUAL( argv[i], "--dir" ) && i + 1 < argc )
+            sBench.pszWorkDir = argv[++i];
+        else if( EQUAL( argv[i], "--scale" ) && i + 1 < argc )
+            papszScales = CSLAddString( papszScales, argv[++i] );
+        else if( EQUAL( argv[i], "--sparsity" ) && i + 1 < argc )
+            sGrid.dfSparsity = CPLAtof( argv[++i] );
+        else if( EQUAL( argv[i], "--strikes" ) && i + 1 < argc )
+            sGrid.dfStrikes = CPLAtof( argv[++i] );
+        else if( EQUAL( argv[i], "--nodata" ) && i + 1 < argc )
+            sGrid.dfNoData = CPLAtof( argv[++i] );
+        else if( EQUAL( argv[i], "--polygons" ) && i + 1 < argc )
+            sGrid.nPolygons = atoi( argv[++i] );
+        else if( EQUAL( argv[i], "--vertices" ) && i + 1 < argc )
+            sGrid.nVertices = atoi( argv[++i] );
+        else if( EQUAL( argv[i], "--seed" ) && i + 1 < argc )
+        {
+            i++;
+            sGrid.nSeed = CPLScanUIntBig( argv[i], (int) strlen( argv[i] ) );
+        }
+        else if( EQUAL( argv[i], "--repeat" ) && i + 1 < argc )
+            sBench.nRepeat = MAX( 1, atoi( argv[++i] ) );
+        else if( EQUAL( argv[i], "--max_memory" ) && i + 1 < argc )
+            sBench.dfMaxMemory = CPLAtof( argv[++i] ) * 1024.0 * 1024.0;
+        else if( EQUAL( argv[i], "--generate_only" ) )
+            bGenerateOnly = TRUE;
+        else if( EQUAL( argv[i], "--keep" ) )
+            sBench.bKeep = TRUE;
+        else if( EQUAL( argv[i], "--budget" ) && i + 1 < argc )
+        {
+            CSLDestroy( papszBudgets );
+            papszBudgets = CSLLoad2( argv[++i], -1, -1, NULL );
+            if( !papszBudgets )
+                Usage();
+        }
+        else
+            Usage();
+    }
+    if( !papszScales )
+    {
+        papszScales = CSLAddString( papszScales, "small" );
+        papszScales = CSLAddString( papszScales, "conus" );
+    }
+
+    if( papszBudgets && STARTS_WITH( sBench.pszPerfLog, "/vsistdout/" ) )
+        Usage();
+
+    GDALAllRegister();
+    VSIMkdirRecursive( sBench.pszWorkDir, 0755 );
+    /* Only the lines of this run count against the budgets */
+    if( papszBudgets && VSIStatL( sBench.pszPerfLog, &sStat ) == 0 )
+        nLogOffset = (vsi_l_offset) sStat.st_size;
+
+    /*
+    ** The polygons and images every scale shares.  The config points the
+    ** conversions at them and logs to the same place as the stages.
+    */
+    pszPolyFile =
+        CPLStrdup( CPLFormFilename( sBench.pszWorkDir,
+                                    CPLSPrintf( "spc_%d_%d_" CPL_FRMT_GUIB,
+                                                sGrid.nPolygons,
+                                                sGrid.nVertices,
+                                                sGrid.nSeed ),
+                                    "kmz" ) );
+    if( GeneratePolygons( &sGrid, pszPolyFile ) != CE_None )
+        rc = RL_ERR;
+    /* Read through /vsizip/, so the KML driver will do without LIBKML */
+    pszPolyLayer = CPLStrdup( CPLSPrintf( "/vsizip/%s/doc.kml",
+                                          pszPolyFile ) );
+    pszImage = CPLStrdup( CPLFormFilename( sBench.pszWorkDir, "image",
+                                           "png" ) );
+    if( rc == RL_OK && GenerateImage( pszImage, 256, 64 ) != CE_None )
+        rc = RL_ERR;
+    sBench.papszConfig = CSLSetNameValue( sBench.papszConfig, "poly_kml",
+                                          pszPolyLayer );
+    sBench.papszConfig = CSLSetNameValue( sBench.papszConfig,
+                                          "dry_ltng_title", pszImage );
+    sBench.papszConfig = CSLSetNameValue( sBench.papszConfig,
+                                          "dry_ltng_legend", pszImage );
+    sBench.papszConfig = CSLSetNameValue( sBench.papszConfig,
+                                          "poly_legend", pszImage );
+    sBench.papszConfig = CSLSetNameValue( sBench.papszConfig, "perf_log",
+                                          sBench.pszPerfLog );
+
+    /* The stages run with the settings a conversion would use */
+    sBench.psTable = RLCreateColorTable( sBench.papszConfig );
+    if( !sBench.psTable )
+        rc = RL_ERR;
+    sBench.nThreads =
+        RLGetThreadCount( CSLFetchNameValue( sBench.papszConfig,
+                                             "num_threads" ) );
+    sBench.bPalette =
+        sBench.psTable && sBench.psTable->nPaletteCount > 0 &&
+        EQUAL( CSLFetchNameValueDef( sBench.papszConfig, "png_format",
+                                     "palette" ), "palette" );
+    RLPngGetOptions( sBench.papszConfig, &sBench.sPngOptions );
+    RLDeflateGetOptions( sBench.papszConfig, "kmz", &sBench.sKmzOptions );
+    sBench.nTileSize =
+        atoi( CSLFetchNameValueDef( sBench.papszConfig, "tile_size",
+                                    CPLSPrintf( "%d", RL_TILE_SIZE ) ) );
+    sBench.dfWarpMemory =
+        CPLAtof( CSLFetchNameValueDef( sBench.papszConfig, "warp_memory",
+                                       "256" ) ) * 1024.0 * 1024.0;
+
+    for( i = 0; rc == RL_OK && papszScales[i] != NULL; i++ )
+    {
+        if( RunScale( &sBench, &sGrid, pszPolyLayer, papszScales[i],
+                      bGenerateOnly ) != CE_None )
+        {
+            rc = RL_ERR;
+        }
+    }
+    if( rc == RL_OK && papszBudgets && !bGenerateOnly &&
+        CheckBudgets( papszBudgets, sBench.pszPerfLog, nLogOffset ) > 0 )
+    {
+        rc = RL_ERR;
+    }
+
+    RLDestroyColorTable( sBench.psTable );
+    CSLDestroy( sBench.papszConfig );
+    CSLDestroy( papszScales );
+    CSLDestroy( papszBudgets );
+    CPLFree( pszPolyFile );
+    CPLFree( pszPolyLayer );
+    CPLFree( pszImage );
+
+    return rc;
+}
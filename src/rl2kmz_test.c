@@ -0,0 +1,1268 @@
+/******************************************************************************
+*
+*  Project:  rl2kmz
+*  Purpose:  golden and variant tests of whole conversions
+*  Author:   Kyle Shannon <kyle at pobox dot com>
+*
+*******************************************************************************
+*
+* This is free and unencumbered software released into the public domain.
+*
+* Anyone is free to copy, modify, publish, use, compile, sell, or
+* distribute this software, either in source code form or as a compiled
+* binary, for any purpose, commercial or non-commercial, and by any
+* means.
+*
+* In jurisdictions that recognize copyright laws, the author or authors
+* of this software dedicate any and all copyright interest in the
+* software to the public domain. We make this dedication for the benefit
+* of the public at large and to the detriment of our heirs and
+* successors. We intend this dedication to be an overt act of
+* relinquishment in perpetuity of all present and future rights to this
+* software under copyright law.
+*
+* THIS SOFTWARE WAS DEVELOPED AT THE ROCKY MOUNTAIN RESEARCH STATION (RMRS)
+* MISSOULA FIRE SCIENCES LABORATORY BY EMPLOYEES OF THE FEDERAL GOVERNMENT
+* IN THE COURSE OF THEIR OFFICIAL DUTIES. PURSUANT TO TITLE 17 SECTION 105
+* OF THE UNITED STATES CODE, THIS SOFTWARE IS NOT SUBJECT TO COPYRIGHT
+* PROTECTION AND IS IN THE PUBLIC DOMAIN. RMRS MISSOULA FIRE SCIENCES
+* LABORATORY ASSUMES NO RESPONSIBILITY WHATSOEVER FOR ITS USE BY OTHER
+* PARTIES,  AND MAKES NO GUARANTEES, EXPRESSED OR IMPLIED, ABOUT ITS QUALITY,
+* RELIABILITY, OR ANY OTHER CHARACTERISTIC.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+* IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+* OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+* ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+* OTHER DEALINGS IN THE SOFTWARE.
+*
+* For more information, please refer to <http://unlicense.org>
+*
+******************************************************************************/
+
+#include <math.h>
+
+#include "gdal.h"
+#include "cpl_conv.h"
+#include "cpl_string.h"
+
+#include "rlport.h"
+#include "rl2kmz.h"
+
+/* Exit code of a test with nothing to compare against, for ctest */
+#define RL_TEST_SKIP 77
+
+/*
+** Numbers in the kml may differ by this much, relative to the larger of 1
+** and the expected value.  Bounds are written with 10 decimals.
+*/
+#define RL_TEST_TOLERANCE 1e-8
+
+/* Differences reported for each entry before the rest are only counted */
+#define RL_TEST_MAX_REPORTS 5
+
+/* What an incremental conversion did with the raster of the last kmz */
+#define RL_TEST_REBUILT     0
+#define RL_TEST_REUSED      1
+#define RL_TEST_UP_TO_DATE  2
+
+/* Date the incremental conversions switch to and back from */
+#define RL_TEST_OTHER_DATE "Day 2 Fire Weather Outlook valid 16 Oct 2026"
+
+static const char * const apszOutcomes[] =
+{
+    "rebuilt", "reused", "up to date"
+};
+
+/* Debug messages of the conversions that say what became of the raster */
+static int nReusedMessages = 0;
+static int nUpToDateMessages = 0;
+
+static int CompareNames( const void *a, const void *b )
+{
+    return strcmp( *(const char * const *) a, *(const char * const *) b );
+}
+
+/*
+** The files under pszDir, a directory or a /vsizip/ kmz, relative to it
+** and sorted.
+*/
+static char ** ListFiles( const char *pszDir )
+{
+    VSIStatBufL sStat;
+    char **papszEntries, **papszFiles = NULL;
+    int i;
+
+    papszEntries = VSIReadDirRecursive( pszDir );
+    for( i = 0; papszEntries && papszEntries[i]; i++ )
+    {
+        if( VSIStatL( CPLSPrintf( "%s/%s", pszDir, papszEntries[i] ),
+                      &sStat ) == 0 && !VSI_ISDIR( sStat.st_mode ) )
+        {
+            papszFiles = CSLAddString( papszFiles, papszEntries[i] );
+        }
+    }
+    CSLDestroy( papszEntries );
+    if( papszFiles )
+        qsort( papszFiles, CSLCount( papszFiles ), sizeof( char* ),
+               CompareNames );
+    return papszFiles;
+}
+
+static int StartsNumber( const char *pszText )
+{
+    if( *pszText == '-' || *pszText == '+' || *pszText == '.' )
+        pszText++;
+    return *pszText >= '0' && *pszText <= '9';
+}
+
+/*
+** Compare two kml documents character by character, except that numbers
+** only have to agree to RL_TEST_TOLERANCE.  Returns the differences.
+*/
+static int CompareText( const char *pszName, const char *pszExpected,
+                        const char *pszActual )
+{
+    const char *pszA = pszExpected, *pszB = pszActual;
+    char *pszEndA, *pszEndB;
+    double dfA, dfB;
+    int nLine = 1;
+
+    while( *pszA && *pszB )
+    {
+        if( StartsNumber( pszA ) && StartsNumber( pszB ) )
+        {
+            dfA = CPLStrtod( pszA, &pszEndA );
+            dfB = CPLStrtod( pszB, &pszEndB );
+            if( pszEndA > pszA && pszEndB > pszB )
+            {
+                if( fabs( dfA - dfB ) >
+                    RL_TEST_TOLERANCE * MAX( 1.0, fabs( dfA ) ) )
+                {
+                    printf( "%s:%d: expected %.*s, got %.*s\n", pszName,
+                            nLine, (int) ( pszEndA - pszA ), pszA,
+                            (int) ( pszEndB - pszB ), pszB );
+                    return 1;
+                }
+                pszA = pszEndA;
+                pszB = pszEndB;
+                continue;
+            }
+        }
+        if( *pszA != *pszB )
+        {
+            printf( "%s:%d: expected \"%.40s\", got \"%.40s\"\n", pszName,
+                    nLine, pszA, pszB );
+            return 1;
+        }
+        if( *pszA == '\n' )
+            nLine++;
+        pszA++;
+        pszB++;
+    }
+    if( *pszA || *pszB )
+    {
+        printf( "%s:%d: %s ends early\n", pszName, nLine,
+                *pszA ? "output" : "expected output" );
+        return 1;
+    }
+    return 0;
+}
+
+/*
+** Decode a png to RGBA, whatever its bands, palette or transparency.
+*/
+static GByte * ReadRGBA( const char *pszFile, int *pnXSize, int *pnYSize )
+{
+    GDALDatasetH hDS;
+    GDALRasterBandH hBand;
+    GDALColorTableH hCT;
+    const GDALColorEntry *psEntry;
+    GByte *pabyRGBA, *pabyIndex, *pabyPixel;
+    int nXSize, nYSize, nBands, nPixels, i;
+    int anChannels[4];
+    CPLErr eErr = CE_None;
+
+    hDS = GDALOpen( pszFile, GA_ReadOnly );
+    if( !hDS )
+        return NULL;
+    nXSize = GDALGetRasterXSize( hDS );
+    nYSize = GDALGetRasterYSize( hDS );
+    nBands = GDALGetRasterCount( hDS );
+    nPixels = nXSize * nYSize;
+    pabyRGBA = (GByte*) VSIMalloc3( 4, nXSize, nYSize );
+    if( !pabyRGBA || nBands < 1 || nBands > 4 )
+    {
+        VSIFree( pabyRGBA );
+        GDALClose( hDS );
+        return NULL;
+    }
+    memset( pabyRGBA, 255, (size_t) 4 * nPixels );
+
+    hBand = GDALGetRasterBand( hDS, 1 );
+    hCT = GDALGetRasterColorTable( hBand );
+    if( nBands == 1 && hCT )
+    {
+        pabyIndex = (GByte*) CPLMalloc( nPixels );
+        eErr = GDALRasterIO( hBand, GF_Read, 0, 0, nXSize, nYSize, pabyIndex,
+                             nXSize, nYSize, GDT_Byte, 0, 0 );
+        for( i = 0; i < nPixels && eErr == CE_None; i++ )
+        {
+            psEntry = GDALGetColorEntry( hCT, pabyIndex[i] );
+            pabyPixel = pabyRGBA + (size_t) 4 * i;
+            if( !psEntry )
+                continue;
+            pabyPixel[0] = (GByte) psEntry->c1;
+            pabyPixel[1] = (GByte) psEntry->c2;
+            pabyPixel[2] = (GByte) psEntry->c3;
+            pabyPixel[3] = (GByte) psEntry->c4;
+        }
+        CPLFree( pabyIndex );
+    }
+    else
+    {
+        /* Grey, grey and alpha, RGB or RGBA */
+        for( i = 0; i < 4; i++ )
+            anChannels[i] = 0;
+        if( nBands < 3 )
+        {
+            anChannels[0] = anChannels[1] = anChannels[2] = 1;
+            anChannels[3] = nBands == 2 ? 2 : 0;
+        }
+        else
+        {
+            anChannels[0] = 1;
+            anChannels[1] = 2;
+            anChannels[2] = 3;
+            anChannels[3] = nBands == 4 ? 4 : 0;
+        }
+        for( i = 0; i < 4 && eErr == CE_None; i++ )
+        {
+            if( anChannels[i] == 0 )
+                continue;
+            eErr = GDALRasterIO( GDALGetRasterBand( hDS, anChannels[i] ),
+                                 GF_Read, 0, 0, nXSize, nYSize,
+                                 pabyRGBA + i, nXSize, nYSize, GDT_Byte, 4,
+                                 4 * nXSize );
+        }
+    }
+    GDALClose( hDS );
+    if( eErr != CE_None )
+    {
+        VSIFree( pabyRGBA );
+        return NULL;
+    }
+    *pnXSize = nXSize;
+    *pnYSize = nYSize;
+    return pabyRGBA;
+}
+
+/*
+** Compare the decoded pixels of two pngs, so the encoding may change but
+** not a single colour.  Returns the differences.
+*/
+static int CompareImages( const char *pszName, const char *pszExpected,
+                          const char *pszActual )
+{
+    GByte *pabyA, *pabyB;
+    int nXA = 0, nYA = 0, nXB = 0, nYB = 0, nDiffs = 0, i;
+
+    pabyA = ReadRGBA( pszExpected, &nXA, &nYA );
+    pabyB = ReadRGBA( pszActual, &nXB, &nYB );
+    if( !pabyA || !pabyB )
+    {
+        printf( "%s: could not decode the %s png\n", pszName,
+                pabyA ? "output" : "expected" );
+        nDiffs = 1;
+    }
+    else if( nXA != nXB || nYA != nYB )
+    {
+        printf( "%s: expected %dx%d pixels, got %dx%d\n", pszName, nXA, nYA,
+                nXB, nYB );
+        nDiffs = 1;
+    }
+    else
+    {
+        for( i = 0; i < nXA * nYA; i++ )
+        {
+            if( memcmp( pabyA + (size_t) 4 * i, pabyB + (size_t) 4 * i,
+                        4 ) == 0 )
+            {
+                continue;
+            }
+            if( nDiffs++ < RL_TEST_MAX_REPORTS )
+            {
+                printf( "%s: pixel %d,%d expected %d,%d,%d,%d, got " \
+                        "%d,%d,%d,%d\n", pszName, i % nXA, i / nXA,
+                        pabyA[4 * i], pabyA[4 * i + 1], pabyA[4 * i + 2],
+                        pabyA[4 * i + 3], pabyB[4 * i], pabyB[4 * i + 1],
+                        pabyB[4 * i + 2], pabyB[4 * i + 3] );
+            }
+        }
+        if( nDiffs > RL_TEST_MAX_REPORTS )
+            printf( "%s: %d pixels differ\n", pszName, nDiffs );
+    }
+    VSIFree( pabyA );
+    VSIFree( pabyB );
+    return nDiffs;
+}
+
+/*
+** Compare every file of pszActual with the one of the same name in
+** pszExpected, each a directory or a /vsizip/ kmz.  The kml must match up
+** to the tolerance on numbers, which covers the overlay bounds, pngs must
+** decode to the same pixels and anything else must match byte for byte.
+** Returns the differences.
+*/
+static int CompareTrees( const char *pszExpectedDir,
+                         const char *pszActualDir )
+{
+    char **papszExpected, **papszActual;
+    GByte *pabyA = NULL, *pabyB = NULL;
+    vsi_l_offset nSizeA, nSizeB;
+    char *pszExpected, *pszActual, *pszFileA, *pszFileB;
+    const char *pszName, *pszExt;
+    int nDiffs = 0, i;
+
+    /* Either may be a CPLSPrintf() buffer, which the loop reuses */
+    pszExpected = CPLStrdup( pszExpectedDir );
+    pszActual = CPLStrdup( pszActualDir );
+    papszExpected = ListFiles( pszExpected );
+    papszActual = ListFiles( pszActual );
+    if( CSLCount( papszExpected ) != CSLCount( papszActual ) )
+    {
+        printf( "%s: expected %d files, got %d\n", pszActual,
+                CSLCount( papszExpected ), CSLCount( papszActual ) );
+        nDiffs++;
+    }
+    for( i = 0; papszExpected && papszExpected[i]; i++ )
+    {
+        pszName = papszExpected[i];
+        if( CSLFindString( papszActual, pszName ) < 0 )
+        {
+            printf( "%s: missing %s\n", pszActual, pszName );
+            nDiffs++;
+            continue;
+        }
+        pszFileA = CPLStrdup( CPLSPrintf( "%s/%s", pszExpected, pszName ) );
+        pszFileB = CPLStrdup( CPLSPrintf( "%s/%s", pszActual, pszName ) );
+        pszExt = CPLGetExtension( pszName );
+        if( EQUAL( pszExt, "png" ) )
+        {
+            nDiffs += CompareImages( pszName, pszFileA, pszFileB );
+        }
+        else if( !VSIIngestFile( NULL, pszFileA, &pabyA, &nSizeA, -1 ) ||
+                 !VSIIngestFile( NULL, pszFileB, &pabyB, &nSizeB, -1 ) )
+        {
+            printf( "%s: could not read it\n", pszName );
+            nDiffs++;
+        }
+        else if( EQUAL( pszExt, "kml" ) )
+        {
+            /* VSIIngestFile() terminates what it reads */
+            nDiffs += CompareText( pszName, (const char*) pabyA,
+                                   (const char*) pabyB );
+        }
+        else if( nSizeA != nSizeB || memcmp( pabyA, pabyB, nSizeA ) != 0 )
+        {
+            printf( "%s: contents differ\n", pszName );
+            nDiffs++;
+        }
+        VSIFree( pabyA );
+        VSIFree( pabyB );
+        pabyA = pabyB = NULL;
+        CPLFree( pszFileA );
+        CPLFree( pszFileB );
+    }
+    for( i = 0; papszActual && papszActual[i]; i++ )
+    {
+        if( CSLFindString( papszExpected, papszActual[i] ) < 0 )
+        {
+            printf( "%s: unexpected %s\n", pszActual, papszActual[i] );
+            nDiffs++;
+        }
+    }
+    CSLDestroy( papszExpected );
+    CSLDestroy( papszActual );
+    CPLFree( pszExpected );
+    CPLFree( pszActual );
+    return nDiffs;
+}
+
+/*
+** Replace the golden outputs in pszGoldenDir with the files of the kmz.
+*/
+static CPLErr UpdateGolden( const char *pszKmz, const char *pszGoldenDir )
+{
+    VSIStatBufL sStat;
+    VSILFILE *fp;
+    GByte *pabyData;
+    vsi_l_offset nSize;
+    char **papszFiles;
+    char *pszFile;
+    int i;
+    CPLErr eErr = CE_None;
+
+    if( VSIStatL( pszGoldenDir, &sStat ) == 0 )
+        VSIRmdirRecursive( pszGoldenDir );
+    papszFiles = ListFiles( pszKmz );
+    for( i = 0; papszFiles && papszFiles[i] && eErr == CE_None; i++ )
+    {
+        if( !VSIIngestFile( NULL, CPLSPrintf( "%s/%s", pszKmz,
+                                              papszFiles[i] ),
+                            &pabyData, &nSize, -1 ) )
+        {
+            eErr = CE_Failure;
+            break;
+        }
+        pszFile = CPLStrdup( CPLSPrintf( "%s/%s", pszGoldenDir,
+                                         papszFiles[i] ) );
+        VSIMkdirRecursive( CPLGetPath( pszFile ), 0755 );
+        fp = VSIFOpenL( pszFile, "wb" );
+        if( !fp || VSIFWriteL( pabyData, 1, (size_t) nSize, fp ) != nSize )
+        {
+            CPLError( CE_Failure, CPLE_FileIO, "Could not write %s",
+                      pszFile );
+            eErr = CE_Failure;
+        }
+        if( fp && VSIFCloseL( fp ) != 0 )
+            eErr = CE_Failure;
+        VSIFree( pabyData );
+        CPLFree( pszFile );
+    }
+    CSLDestroy( papszFiles );
+    if( eErr == CE_None )
+        printf( "Wrote %d golden files to %s\n", i, pszGoldenDir );
+    return eErr;
+}
+
+/*
+** Compare a kmz with pszGoldenDir/pszName, or with bUpdate replace that
+** with its files.  Returns RL_TEST_SKIP if there are no golden outputs and
+** they aren't required.
+*/
+static int CheckGolden( const char *pszKmz, const char *pszGoldenDir,
+                        const char *pszName, int bUpdate,
+                        int bRequireGolden )
+{
+    VSIStatBufL sStat;
+    char *pszKmzCopy, *pszGoldenCase;
+    int rc = RL_OK;
+
+    /* Either may be a CPLSPrintf() buffer, which the comparison reuses */
+    pszKmzCopy = CPLStrdup( pszKmz );
+    pszGoldenCase = CPLStrdup( CPLFormFilename( pszGoldenDir, pszName,
+                                                NULL ) );
+    if( bUpdate )
+    {
+        if( UpdateGolden( pszKmzCopy, pszGoldenCase ) != CE_None )
+            rc = RL_ERR;
+    }
+    else if( VSIStatL( pszGoldenCase, &sStat ) != 0 )
+    {
+        printf( "No golden outputs in %s, make them with --update\n",
+                pszGoldenCase );
+        rc = bRequireGolden ? RL_ERR : RL_TEST_SKIP;
+    }
+    else if( CompareTrees( pszGoldenCase, pszKmzCopy ) != 0 )
+    {
+        printf( "%s: differs from %s\n", pszKmzCopy, pszGoldenCase );
+        rc = RL_ERR;
+    }
+    CPLFree( pszKmzCopy );
+    CPLFree( pszGoldenCase );
+    return rc;
+}
+
+/*
+** The configuration of a case, pszCase.conf in the data directory, with
+** the polygons, images and date file there and any overrides.
+*/
+static char ** LoadCase( const char *pszDataDir, const char *pszCase,
+                         char **papszSet )
+{
+    char **papszConfig, **papszPair;
+    int i;
+
+    papszConfig = CSLLoad2( CPLFormFilename( pszDataDir, pszCase, "conf" ),
+                            -1, -1, NULL );
+    if( !papszConfig )
+        return NULL;
+    /* Read through /vsizip/, so the KML driver will do without LIBKML */
+    papszConfig =
+        CSLSetNameValue( papszConfig, "poly_kml",
+                         CPLSPrintf( "/vsizip/%s/doc.kml",
+                                     CPLFormFilename( pszDataDir, "polygons",
+                                                      "kmz" ) ) );
+    papszConfig =
+        CSLSetNameValue( papszConfig, "dry_ltng_title",
+                         CPLFormFilename( pszDataDir, "title", "png" ) );
+    papszConfig =
+        CSLSetNameValue( papszConfig, "dry_ltng_legend",
+                         CPLFormFilename( pszDataDir, "legend", "png" ) );
+    papszConfig =
+        CSLSetNameValue( papszConfig, "poly_legend",
+                         CPLFormFilename( pszDataDir, "critical", "png" ) );
+    papszConfig =
+        CSLSetNameValue( papszConfig, "date_file",
+                         CPLFormFilename( pszDataDir, "dates", "txt" ) );
+    for( i = 0; papszSet && papszSet[i]; i++ )
+    {
+        papszPair = CSLTokenizeString2( papszSet[i], "=", 0 );
+        if( CSLCount( papszPair ) == 2 )
+            papszConfig = CSLSetNameValue( papszConfig, papszPair[0],
+                                           papszPair[1] );
+        CSLDestroy( papszPair );
+    }
+    return papszConfig;
+}
+
+/*
+** The suffixes of the reduced copies a config asks for, the part of each
+** reduced_outputs entry before the ':'.
+*/
+static char ** ReducedSuffixes( char **papszConfig )
+{
+    char **papszSuffixes;
+    char *pszColon;
+    int i;
+
+    papszSuffixes =
+        CSLTokenizeString2( CSLFetchNameValueDef( papszConfig,
+                                                  "reduced_outputs", "" ),
+                            " ,", 0 );
+    for( i = 0; papszSuffixes && papszSuffixes[i]; i++ )
+    {
+        pszColon = strchr( papszSuffixes[i], ':' );
+        if( pszColon )
+            *pszColon = '\0';
+    }
+    return papszSuffixes;
+}
+
+/*
+** Convert the grid of a case to pszOutDir/pszCase.kmz, then again on the
+** same context with everything warm to pszOutDir/warm/pszCase.kmz, which
+** has to come out the same, reduced copies included.  The kml is named
+** after the kmz, so both have the same name.  Returns the differences, or
+** -1 if a conversion failed.
+*/
+static int ConvertCase( char **papszConfig, const char *pszSrcFile,
+                        const char *pszCase, const char *pszOutDir )
+{
+    RLContext *psCtx;
+    char **papszSuffixes;
+    char *pszDstFile, *pszWarmFile, *pszReduced;
+    int nDiffs = -1, i;
+
+    psCtx = RLCreateContext( papszConfig );
+    if( !psCtx )
+        return -1;
+    papszSuffixes = ReducedSuffixes( papszConfig );
+    pszDstFile = CPLStrdup( CPLFormFilename( pszOutDir, pszCase, "kmz" ) );
+    pszWarmFile =
+        CPLStrdup( CPLSPrintf( "%s/warm/%s.kmz", pszOutDir, pszCase ) );
+    VSIMkdirRecursive( CPLGetPath( pszWarmFile ), 0755 );
+    VSIUnlink( pszDstFile );
+    VSIUnlink( pszWarmFile );
+    for( i = 0; papszSuffixes && papszSuffixes[i]; i++ )
+    {
+        VSIUnlink( CPLSPrintf( "%s/%s_%s.kmz", pszOutDir, pszCase,
+                               papszSuffixes[i] ) );
+        VSIUnlink( CPLSPrintf( "%s/warm/%s_%s.kmz", pszOutDir, pszCase,
+                               papszSuffixes[i] ) );
+    }
+    if( RLProcessGrid( psCtx, pszSrcFile, pszDstFile ) == CE_None &&
+        RLProcessGrid( psCtx, pszSrcFile, pszWarmFile ) == CE_None )
+    {
+        nDiffs = CompareTrees( CPLSPrintf( "/vsizip/%s", pszDstFile ),
+                               CPLSPrintf( "/vsizip/%s", pszWarmFile ) );
+    }
+    for( i = 0; nDiffs >= 0 && papszSuffixes && papszSuffixes[i]; i++ )
+    {
+        pszReduced = CPLStrdup( CPLSPrintf( "%s_%s.kmz", pszCase,
+                                            papszSuffixes[i] ) );
+        nDiffs += CompareTrees( CPLSPrintf( "/vsizip/%s/%s", pszOutDir,
+                                            pszReduced ),
+                                CPLSPrintf( "/vsizip/%s/warm/%s", pszOutDir,
+                                            pszReduced ) );
+        CPLFree( pszReduced );
+    }
+    RLDestroyContext( psCtx );
+    CSLDestroy( papszSuffixes );
+    CPLFree( pszDstFile );
+    CPLFree( pszWarmFile );
+    return nDiffs;
+}
+
+/*
+** Count the messages saying the raster was reused or the kmz was up to
+** date, passing on anything but debug messages.
+*/
+static void CPL_STDCALL CountIncremental( CPLErr eErrClass,
+                                          CPLErrorNum nError,
+                                          const char *pszMessage )
+{
+    if( eErrClass != CE_Debug )
+        CPLDefaultErrorHandler( eErrClass, nError, pszMessage );
+    else if( strstr( pszMessage, "Reusing the raster of" ) )
+        nReusedMessages++;
+    else if( strstr( pszMessage, "is up to date" ) )
+        nUpToDateMessages++;
+}
+
+/*
+** Write nSize bytes to pszFile, replacing it.
+*/
+static CPLErr WriteData( const char *pszFile, const void *pData,
+                         size_t nSize )
+{
+    VSILFILE *fp;
+    CPLErr eErr = CE_None;
+
+    fp = VSIFOpenL( pszFile, "wb" );
+    if( !fp || VSIFWriteL( pData, 1, nSize, fp ) != nSize )
+        eErr = CE_Failure;
+    if( fp && VSIFCloseL( fp ) != 0 )
+        eErr = CE_Failure;
+    if( eErr != CE_None )
+        printf( "Could not write %s\n", pszFile );
+    return eErr;
+}
+
+static CPLErr WriteText( const char *pszFile, const char *pszText )
+{
+    return WriteData( pszFile, pszText, strlen( pszText ) );
+}
+
+/*
+** Read the first band of a grid as Int32, with its geotransform and its
+** nodata value, -9999 if it has none.
+*/
+static GInt32 * ReadGrid( const char *pszFile, int *pnXSize, int *pnYSize,
+                          double *padfGeoTransform, GInt32 *pnNoData )
+{
+    GDALDatasetH hDS;
+    GDALRasterBandH hBand;
+    GInt32 *panData = NULL;
+    int nXSize, nYSize, bHasNoData = FALSE;
+    double dfNoData;
+
+    hDS = GDALOpen( pszFile, GA_ReadOnly );
+    if( !hDS )
+        return NULL;
+    nXSize = GDALGetRasterXSize( hDS );
+    nYSize = GDALGetRasterYSize( hDS );
+    hBand = GDALGetRasterBand( hDS, 1 );
+    if( GDALGetGeoTransform( hDS, padfGeoTransform ) == CE_None )
+        panData = (GInt32*) VSIMalloc3( sizeof( GInt32 ), nXSize, nYSize );
+    if( panData &&
+        GDALRasterIO( hBand, GF_Read, 0, 0, nXSize, nYSize, panData, nXSize,
+                      nYSize, GDT_Int32, 0, 0 ) != CE_None )
+    {
+        VSIFree( panData );
+        panData = NULL;
+    }
+    dfNoData = GDALGetRasterNoDataValue( hBand, &bHasNoData );
+    GDALClose( hDS );
+    if( !panData )
+    {
+        printf( "Could not read %s\n", pszFile );
+        return NULL;
+    }
+    *pnXSize = nXSize;
+    *pnYSize = nYSize;
+    *pnNoData = bHasNoData ? (GInt32) dfNoData : -9999;
+    return panData;
+}
+
+/*
+** Write a grid as an Arc/Info ASCII grid, like the ones of the cases.
+** The corners are written in full, so the geotransform reads back the
+** same.
+*/
+static CPLErr WriteGrid( const char *pszFile, const GInt32 *panData,
+                         int nXSize, int nYSize,
+                         const double *padfGeoTransform, GInt32 nNoData )
+{
+    VSILFILE *fp;
+    int i;
+    CPLErr eErr = CE_None;
+
+    fp = VSIFOpenL( pszFile, "wb" );
+    if( !fp )
+    {
+        printf( "Could not write %s\n", pszFile );
+        return CE_Failure;
+    }
+    VSIFPrintfL( fp, "ncols %d\nnrows %d\nxllcorner %.17g\n" \
+                 "yllcorner %.17g\ncellsize %.17g\nNODATA_value %d\n",
+                 nXSize, nYSize, padfGeoTransform[0],
+                 padfGeoTransform[3] + nYSize * padfGeoTransform[5],
+                 padfGeoTransform[1], nNoData );
+    for( i = 0; i < nXSize * nYSize; i++ )
+        VSIFPrintfL( fp, "%d%c", panData[i],
+                     ( i + 1 ) % nXSize == 0 ? '\n' : ' ' );
+    if( VSIFCloseL( fp ) != 0 )
+    {
+        printf( "Could not write %s\n", pszFile );
+        eErr = CE_Failure;
+    }
+    return eErr;
+}
+
+/*
+** Convert pszSrcFile to pszDstFile in incremental mode, which has to do
+** nExpected with the raster of the kmz already there.  The kmz is compared
+** with pszPlainKmz, unless pszPlainKmz is NULL.  Returns the differences,
+** or -1 if the conversion failed.
+*/
+static int ConvertIncremental( RLContext *psCtx, const char *pszSrcFile,
+                               const char *pszDstFile, const char *pszStep,
+                               int nExpected, const char *pszPlainKmz )
+{
+    CPLErrorHandler pfnOldHandler;
+    char *pszOldDebug;
+    CPLErr eErr;
+    int nOutcome, nDiffs;
+
+    /* The messages may come from any thread of the conversion */
+    nReusedMessages = 0;
+    nUpToDateMessages = 0;
+    pszOldDebug = CPLStrdup( CPLGetConfigOption( "CPL_DEBUG", "OFF" ) );
+    CPLSetConfigOption( "CPL_DEBUG", "ON" );
+    pfnOldHandler = CPLSetErrorHandler( CountIncremental );
+    eErr = RLProcessGrid( psCtx, pszSrcFile, pszDstFile );
+    CPLSetErrorHandler( pfnOldHandler );
+    CPLSetConfigOption( "CPL_DEBUG", pszOldDebug );
+    CPLFree( pszOldDebug );
+    if( eErr != CE_None )
+    {
+        printf( "%s: the conversion failed\n", pszStep );
+        return -1;
+    }
+    nOutcome = nUpToDateMessages > 0 ? RL_TEST_UP_TO_DATE :
+               nReusedMessages > 0 ? RL_TEST_REUSED : RL_TEST_REBUILT;
+    if( nOutcome != nExpected )
+    {
+        printf( "%s: expected the raster to be %s, it was %s\n", pszStep,
+                apszOutcomes[nExpected], apszOutcomes[nOutcome] );
+        return 1;
+    }
+    if( !pszPlainKmz )
+        return 0;
+    nDiffs = CompareTrees( pszPlainKmz, CPLSPrintf( "/vsizip/%s",
+                                                    pszDstFile ) );
+    if( nDiffs > 0 )
+        printf( "%s: differs from the plain conversion\n", pszStep );
+    return nDiffs;
+}
+
+/*
+** Convert the grid of a case in incremental mode on one context, with a
+** date file of its own in pszOutDir: from scratch, with nothing changed,
+** with the date file rewritten as it was, with a new date and with the
+** old one back, and over a kmz that isn't the one the manifest describes.
+** Only the new date and the old one back may reuse the raster, unless
+** there are reduced copies to make again, and every kmz but the one with
+** the new date has to match pszPlainKmz.  Returns the differences, or -1
+** if a conversion failed.
+*/
+static int CheckIncremental( char **papszCaseConfig, const char *pszSrcFile,
+                             const char *pszCase, const char *pszOutDir,
+                             const char *pszPlainKmz )
+{
+    RLContext *psCtx = NULL;
+    char **papszConfig, **papszSuffixes;
+    GByte *pabyDate = NULL;
+    char *pszDstFile, *pszDates, *pszKml = NULL;
+    int nDiffs = -1, nReuse;
+
+    pszDstFile = CPLStrdup( CPLFormFilename( pszOutDir, pszCase, "kmz" ) );
+    pszDates = CPLStrdup( CPLFormFilename( pszOutDir, "dates", "txt" ) );
+    VSIMkdirRecursive( pszOutDir, 0755 );
+    VSIUnlink( pszDstFile );
+    VSIUnlink( CPLSPrintf( "%s.manifest", pszDstFile ) );
+    papszConfig = CSLDuplicate( papszCaseConfig );
+    papszSuffixes = ReducedSuffixes( papszConfig );
+    nReuse = CSLCount( papszSuffixes ) > 0 ? RL_TEST_REBUILT :
+                                             RL_TEST_REUSED;
+    CSLDestroy( papszSuffixes );
+    if( VSIIngestFile( NULL, CSLFetchNameValue( papszConfig, "date_file" ),
+                       &pabyDate, NULL, -1 ) &&
+        WriteText( pszDates, (const char*) pabyDate ) == CE_None )
+    {
+        papszConfig = CSLSetNameValue( papszConfig, "incremental", "YES" );
+        papszConfig = CSLSetNameValue( papszConfig, "date_file", pszDates );
+        psCtx = RLCreateContext( papszConfig );
+    }
+    if( psCtx )
+        nDiffs = ConvertIncremental( psCtx, pszSrcFile, pszDstFile,
+                                     "first", RL_TEST_REBUILT, pszPlainKmz );
+    if( nDiffs == 0 )
+        nDiffs = ConvertIncremental( psCtx, pszSrcFile, pszDstFile,
+                                     "unchanged", RL_TEST_UP_TO_DATE,
+                                     NULL );
+    /* A new time on the same contents is no change */
+    if( nDiffs == 0 &&
+        WriteText( pszDates, (const char*) pabyDate ) == CE_None )
+    {
+        nDiffs = ConvertIncremental( psCtx, pszSrcFile, pszDstFile,
+                                     "date rewritten", RL_TEST_UP_TO_DATE,
+                                     NULL );
+    }
+    /* A kmz replacing one from the same second can't be reused */
+    if( nDiffs == 0 )
+        CPLSleep( 1.0 );
+    if( nDiffs == 0 && WriteText( pszDates, RL_TEST_OTHER_DATE ) == CE_None )
+    {
+        nDiffs = ConvertIncremental( psCtx, pszSrcFile, pszDstFile,
+                                     "new date", nReuse, NULL );
+        if( nDiffs == 0 &&
+            ( !VSIIngestFile( NULL, CPLSPrintf( "/vsizip/%s/doc.kml",
+                                                pszDstFile ),
+                              (GByte**) &pszKml, NULL, -1 ) ||
+              !strstr( pszKml, RL_TEST_OTHER_DATE ) ) )
+        {
+            printf( "new date: not in the kml\n" );
+            nDiffs = 1;
+        }
+    }
+    if( nDiffs == 0 &&
+        WriteText( pszDates, (const char*) pabyDate ) == CE_None )
+    {
+        nDiffs = ConvertIncremental( psCtx, pszSrcFile, pszDstFile,
+                                     "old date back", nReuse,
+                                     pszPlainKmz );
+    }
+    /*
+    ** The manifest no longer describes the kmz, nothing can be reused.  The
+    ** kmz made again is read here through /vsizip/ too, which would take
+    ** it for the last one if it were from the same second.
+    */
+    if( nDiffs == 0 )
+        CPLSleep( 1.0 );
+    if( nDiffs == 0 && WriteText( pszDstFile, "not a kmz" ) == CE_None )
+    {
+        nDiffs = ConvertIncremental( psCtx, pszSrcFile, pszDstFile,
+                                     "kmz replaced", RL_TEST_REBUILT,
+                                     pszPlainKmz );
+    }
+    if( psCtx )
+        RLDestroyContext( psCtx );
+    else
+        printf( "Could not set up the incremental conversions\n" );
+    CSLDestroy( papszConfig );
+    VSIFree( pabyDate );
+    VSIFree( pszKml );
+    CPLFree( pszDstFile );
+    CPLFree( pszDates );
+    return nDiffs;
+}
+
+/*
+** Convert the grid of a case read into memory, as an application embedding
+** the converter would: wrapped with RLWrapGrid() and converted with
+** RLProcessDatasetToBuffer(), written to pszOutDir/pszCase.kmz.
+*/
+static CPLErr ConvertWrapped( char **papszConfig, const char *pszSrcFile,
+                              const char *pszCase, const char *pszOutDir )
+{
+    RLContext *psCtx;
+    GDALDatasetH hDS = NULL;
+    GInt32 *panData;
+    GByte *pabyKmz = NULL;
+    double adfGeoTransform[6];
+    size_t nSize = 0;
+    char *pszDstFile;
+    GInt32 nNoData;
+    int nXSize, nYSize;
+    CPLErr eErr = CE_Failure;
+
+    psCtx = RLCreateContext( papszConfig );
+    if( !psCtx )
+        return CE_Failure;
+    panData = ReadGrid( pszSrcFile, &nXSize, &nYSize, adfGeoTransform,
+                        &nNoData );
+    if( panData )
+        hDS = RLWrapGrid( panData, nXSize, nYSize, adfGeoTransform,
+                          &nNoData, NULL );
+    if( hDS )
+        pabyKmz = RLProcessDatasetToBuffer( psCtx, hDS, pszCase, &nSize );
+    if( pabyKmz )
+    {
+        pszDstFile = CPLStrdup( CPLFormFilename( pszOutDir, pszCase,
+                                                 "kmz" ) );
+        VSIMkdirRecursive( pszOutDir, 0755 );
+        eErr = WriteData( pszDstFile, pabyKmz, nSize );
+        CPLFree( pszDstFile );
+    }
+    if( eErr != CE_None )
+        printf( "Could not convert %s from memory\n", pszSrcFile );
+    if( hDS )
+        GDALClose( hDS );
+    CPLFree( pabyKmz );
+    VSIFree( panData );
+    RLDestroyContext( psCtx );
+    return eErr;
+}
+
+/*
+** Convert a series of three steps to pszOutDir/pszCase.kmz: the grid of a
+** case, the same grid with its northern half gone and the grid again.
+** Each step has to be shown from its time until the next and its png has
+** to match the one of its grid converted on its own, pszPlainKmz for the
+** whole grid.  A series with a step off the grid of the first has to
+** fail.  Returns the differences, or -1 if a conversion failed.
+*/
+static int CheckSeries( char **papszConfig, const char *pszSrcFile,
+                        const char *pszCase, const char *pszOutDir,
+                        const char *pszPlainKmz )
+{
+    static const char * const apszTimes[] =
+    {
+        "2026-10-15T18:00:00Z", "2026-10-15T19:00:00Z",
+        "2026-10-15T20:00:00Z", NULL
+    };
+    RLContext *psCtx = NULL;
+    CPLErrorHandler pfnOldHandler;
+    VSIStatBufL sStat;
+    GInt32 *panData;
+    double adfGeoTransform[6];
+    char **papszSrcFiles = NULL;
+    char *pszDstFile, *pszPartFile, *pszPartKmz, *pszShiftedFile;
+    char *pszOffFile, *pszKml = NULL, *pszExpected, *pszText;
+    GInt32 nNoData;
+    int nXSize, nYSize, nEnds = 0, nDiffs = -1, i;
+    CPLErr eErr = CE_Failure;
+
+    pszDstFile = CPLStrdup( CPLFormFilename( pszOutDir, pszCase, "kmz" ) );
+    pszPartFile = CPLStrdup( CPLFormFilename( pszOutDir, "part", "asc" ) );
+    pszPartKmz = CPLStrdup( CPLFormFilename( pszOutDir, "part", "kmz" ) );
+    pszShiftedFile =
+        CPLStrdup( CPLFormFilename( pszOutDir, "shifted", "asc" ) );
+    pszOffFile = CPLStrdup( CPLFormFilename( pszOutDir, "off_grid",
+                                             "kmz" ) );
+    VSIMkdirRecursive( pszOutDir, 0755 );
+    VSIUnlink( pszDstFile );
+    VSIUnlink( pszPartKmz );
+    VSIUnlink( pszOffFile );
+
+    /* The step off the grid is one cell east of it */
+    panData = ReadGrid( pszSrcFile, &nXSize, &nYSize, adfGeoTransform,
+                        &nNoData );
+    if( panData )
+    {
+        adfGeoTransform[0] += adfGeoTransform[1];
+        eErr = WriteGrid( pszShiftedFile, panData, nXSize, nYSize,
+                          adfGeoTransform, nNoData );
+        adfGeoTransform[0] -= adfGeoTransform[1];
+        for( i = 0; i < nXSize * ( nYSize / 2 ); i++ )
+            panData[i] = nNoData;
+        if( eErr == CE_None )
+            eErr = WriteGrid( pszPartFile, panData, nXSize, nYSize,
+                              adfGeoTransform, nNoData );
+        VSIFree( panData );
+    }
+    if( eErr == CE_None )
+        psCtx = RLCreateContext( papszConfig );
+    papszSrcFiles = CSLAddString( papszSrcFiles, pszSrcFile );
+    papszSrcFiles = CSLAddString( papszSrcFiles, pszPartFile );
+    papszSrcFiles = CSLAddString( papszSrcFiles, pszSrcFile );
+    if( psCtx &&
+        RLProcessGrid( psCtx, pszPartFile, pszPartKmz ) == CE_None &&
+        RLProcessSeries( psCtx, papszSrcFiles, (char**) apszTimes,
+                         pszDstFile ) == CE_None )
+    {
+        nDiffs = 0;
+    }
+    else
+    {
+        printf( "Could not convert the series of %s\n", pszSrcFile );
+    }
+
+    /* Step i from time i to time i + 1, the last from then on */
+    if( nDiffs == 0 &&
+        !VSIIngestFile( NULL, CPLSPrintf( "/vsizip/%s/doc.kml",
+                                          pszDstFile ),
+                        (GByte**) &pszKml, NULL, -1 ) )
+    {
+        printf( "%s: could not read the kml\n", pszDstFile );
+        nDiffs = -1;
+    }
+    for( i = 0; nDiffs == 0 && apszTimes[i]; i++ )
+    {
+        if( !strstr( pszKml, CPLSPrintf( "<begin>%s</begin>",
+                                         apszTimes[i] ) ) ||
+            ( i > 0 && !strstr( pszKml, CPLSPrintf( "<end>%s</end>",
+                                                    apszTimes[i] ) ) ) )
+        {
+            printf( "series: step %d isn't shown from %s\n", i,
+                    apszTimes[i] );
+            nDiffs++;
+        }
+    }
+    pszText = nDiffs == 0 ? strstr( pszKml, "<end>" ) : NULL;
+    for( ; pszText; pszText = strstr( pszText + 1, "<end>" ) )
+        nEnds++;
+    if( nDiffs == 0 && nEnds != CSLCount( (char**) apszTimes ) - 1 )
+    {
+        printf( "series: expected %d ends of steps, got %d\n",
+                CSLCount( (char**) apszTimes ) - 1, nEnds );
+        nDiffs++;
+    }
+    for( i = 0; nDiffs >= 0 && apszTimes[i]; i++ )
+    {
+        if( i == 1 )
+            pszExpected = CPLStrdup(
+                CPLSPrintf( "/vsizip/%s/layers/rainandlightning.png",
+                            pszPartKmz ) );
+        else
+            pszExpected = CPLStrdup(
+                CPLSPrintf( "%s/layers/rainandlightning.png",
+                            pszPlainKmz ) );
+        pszText = CPLStrdup(
+            CPLSPrintf( "layers/rainandlightning_%04d.png", i ) );
+        nDiffs += CompareImages( pszText, pszExpected,
+                                 CPLSPrintf( "/vsizip/%s/%s", pszDstFile,
+                                             pszText ) );
+        CPLFree( pszExpected );
+        CPLFree( pszText );
+    }
+
+    /* The messages may come from any thread of the conversion */
+    if( nDiffs >= 0 )
+    {
+        CPLFree( papszSrcFiles[1] );
+        papszSrcFiles[1] = CPLStrdup( pszShiftedFile );
+        pfnOldHandler = CPLSetErrorHandler( CPLQuietErrorHandler );
+        eErr = RLProcessSeries( psCtx, papszSrcFiles, (char**) apszTimes,
+                                pszOffFile );
+        CPLSetErrorHandler( pfnOldHandler );
+        if( eErr == CE_None || VSIStatL( pszOffFile, &sStat ) == 0 )
+        {
+            printf( "series: a step off the grid was converted\n" );
+            nDiffs++;
+        }
+    }
+    if( psCtx )
+        RLDestroyContext( psCtx );
+    CSLDestroy( papszSrcFiles );
+    VSIFree( pszKml );
+    CPLFree( pszDstFile );
+    CPLFree( pszPartFile );
+    CPLFree( pszPartKmz );
+    CPLFree( pszShiftedFile );
+    CPLFree( pszOffFile );
+    return nDiffs;
+}
+
+void Usage()
+{
+    printf( "Usage: rl2kmz_test [--data data_dir] [--dir work_dir] " \
+            "[--golden golden_dir]\n" );
+    printf( "                   [--update] [--require_golden] " \
+            "[--incremental]\n" );
+    printf( "                   [--memory] [--series] " \
+            "[--set key=value]... case\n" );
+    printf( "\n" );
+    printf( "Converts data_dir/case.asc with data_dir/case.conf into\n" );
+    printf( "work_dir, twice on one context.  With --set it is converted\n" );
+    printf( "again with the overrides and has to come out the same.  With\n" );
+    printf( "--incremental it is converted again and again in incremental\n" );
+    printf( "mode, which may only reuse the raster when the date changes\n" );
+    printf( "and has to come out the same.  With --memory it is converted\n" );
+    printf( "again from a buffer and has to come out the same.  With\n" );
+    printf( "--series it is converted as a series of steps too.  With\n" );
+    printf( "--golden it is compared with golden_dir/case, its reduced\n" );
+    printf( "copies with golden_dir/case_suffix and the series with\n" );
+    printf( "golden_dir/case_series, which --update replaces.  Exits\n" );
+    printf( "with 77 when there are no golden outputs yet, or fails with\n" );
+    printf( "--require_golden.\n" );
+    exit( 1 );
+}
+
+int main( int argc, char *argv[] )
+{
+    const char *pszDataDir = ".";
+    const char *pszWorkDir = "rl2kmz_test";
+    const char *pszGoldenDir = NULL;
+    const char *pszCase = NULL;
+    char **papszSet = NULL, **papszConfig, **papszSuffixes;
+    char *pszSrcFile, *pszPlainDir, *pszSetDir, *pszIncrementalDir;
+    char *pszMemoryDir, *pszSeriesDir, *pszKmz;
+    int bUpdate = FALSE;
+    int bRequireGolden = FALSE;
+    int bIncremental = FALSE;
+    int bMemory = FALSE;
+    int bSeries = FALSE;
+    int nDiffs;
+    int rc = RL_OK;
+    int i;
+
+    for( i = 1; i < argc; i++ )
+    {
+        if( EQUAL( argv[i], "--data" ) && i + 1 < argc )
+            pszDataDir = argv[++i];
+        else if( EQUAL( argv[i], "--dir" ) && i + 1 < argc )
+            pszWorkDir = argv[++i];
+        else if( EQUAL( argv[i], "--golden" ) && i + 1 < argc )
+            pszGoldenDir = argv[++i];
+        else if( EQUAL( argv[i], "--update" ) )
+            bUpdate = TRUE;
+        else if( EQUAL( argv[i], "--require_golden" ) )
+            bRequireGolden = TRUE;
+        else if( EQUAL( argv[i], "--incremental" ) )
+            bIncremental = TRUE;
+        else if( EQUAL( argv[i], "--memory" ) )
+            bMemory = TRUE;
+        else if( EQUAL( argv[i], "--series" ) )
+            bSeries = TRUE;
+        else if( EQUAL( argv[i], "--set" ) && i + 1 < argc &&
+                 strchr( argv[i + 1], '=' ) )
+            papszSet = CSLAddString( papszSet, argv[++i] );
+        else if( argv[i][0] != '-' && !pszCase )
+            pszCase = argv[i];
+        else
+            Usage();
+    }
+    if( !pszCase || ( bUpdate && !pszGoldenDir ) )
+        Usage();
+
+    GDALAllRegister();
+
+    pszSrcFile = CPLStrdup( CPLFormFilename( pszDataDir, pszCase, "asc" ) );
+    pszPlainDir = CPLStrdup( CPLFormFilename( pszWorkDir, "plain", NULL ) );
+    pszSetDir = CPLStrdup( CPLFormFilename( pszWorkDir, "set", NULL ) );
+    pszIncrementalDir =
+        CPLStrdup( CPLFormFilename( pszWorkDir, "incremental", NULL ) );
+    pszMemoryDir = CPLStrdup( CPLFormFilename( pszWorkDir, "memory", NULL ) );
+    pszSeriesDir = CPLStrdup( CPLFormFilename( pszWorkDir, "series", NULL ) );
+    pszKmz = CPLStrdup( CPLSPrintf( "/vsizip/%s/%s.kmz", pszPlainDir,
+                                    pszCase ) );
+    papszConfig = LoadCase( pszDataDir, pszCase, NULL );
+    nDiffs = papszConfig ? ConvertCase( papszConfig, pszSrcFile, pszCase,
+                                        pszPlainDir ) : -1;
+    CSLDestroy( papszConfig );
+    if( nDiffs < 0 )
+    {
+        printf( "Could not convert %s\n", pszSrcFile );
+        rc = RL_ERR;
+    }
+    else if( nDiffs > 0 )
+    {
+        printf( "%s: the warm conversion differs\n", pszCase );
+        rc = RL_ERR;
+    }
+
+    /* The same grid with the overrides, against the plain conversion */
+    if( rc == RL_OK && papszSet )
+    {
+        papszConfig = LoadCase( pszDataDir, pszCase, papszSet );
+        nDiffs = papszConfig ? ConvertCase( papszConfig, pszSrcFile,
+                                            pszCase, pszSetDir ) : -1;
+        if( nDiffs == 0 )
+            nDiffs = CompareTrees( pszKmz,
+                                   CPLSPrintf( "/vsizip/%s/%s.kmz",
+                                               pszSetDir, pszCase ) );
+        CSLDestroy( papszConfig );
+        if( nDiffs != 0 )
+        {
+            printf( "%s: differs with the overrides\n", pszCase );
+            rc = RL_ERR;
+        }
+    }
+
+    /* Incremental conversions, against the plain one */
+    if( rc == RL_OK && bIncremental )
+    {
+        papszConfig = LoadCase( pszDataDir, pszCase, papszSet );
+        nDiffs = papszConfig ?
+                 CheckIncremental( papszConfig, pszSrcFile, pszCase,
+                                   pszIncrementalDir, pszKmz ) : -1;
+        CSLDestroy( papszConfig );
+        if( nDiffs != 0 )
+        {
+            printf( "%s: differs converted incrementally\n", pszCase );
+            rc = RL_ERR;
+        }
+    }
+
+    /* From a buffer in memory, against the plain conversion */
+    if( rc == RL_OK && bMemory )
+    {
+        papszConfig = LoadCase( pszDataDir, pszCase, papszSet );
+        nDiffs = -1;
+        if( papszConfig &&
+            ConvertWrapped( papszConfig, pszSrcFile, pszCase,
+                            pszMemoryDir ) == CE_None )
+        {
+            nDiffs = CompareTrees( pszKmz, CPLSPrintf( "/vsizip/%s/%s.kmz",
+                                                       pszMemoryDir,
+                                                       pszCase ) );
+        }
+        CSLDestroy( papszConfig );
+        if( nDiffs != 0 )
+        {
+            printf( "%s: differs converted from memory\n", pszCase );
+            rc = RL_ERR;
+        }
+    }
+
+    /* A series of steps, each against a single overlay */
+    if( rc == RL_OK && bSeries )
+    {
+        papszConfig = LoadCase( pszDataDir, pszCase, papszSet );
+        nDiffs = papszConfig ?
+                 CheckSeries( papszConfig, pszSrcFile, pszCase,
+                              pszSeriesDir, pszKmz ) : -1;
+        CSLDestroy( papszConfig );
+        if( nDiffs != 0 )
+        {
+            printf( "%s: differs converted as a series\n", pszCase );
+            rc = RL_ERR;
+        }
+    }
+
+    if( rc == RL_OK && pszGoldenDir )
+    {
+        rc = CheckGolden( pszKmz, pszGoldenDir, pszCase, bUpdate,
+                          bRequireGolden );
+        papszConfig = LoadCase( pszDataDir, pszCase, NULL );
+        papszSuffixes = ReducedSuffixes( papszConfig );
+        for( i = 0; rc == RL_OK && papszSuffixes && papszSuffixes[i]; i++ )
+        {
+            rc = CheckGolden( CPLSPrintf( "/vsizip/%s/%s_%s.kmz",
+                                          pszPlainDir, pszCase,
+                                          papszSuffixes[i] ),
+                              pszGoldenDir,
+                              CPLSPrintf( "%s_%s", pszCase,
+                                          papszSuffixes[i] ),
+                              bUpdate, bRequireGolden );
+        }
+        if( rc == RL_OK && bSeries )
+        {
+            rc = CheckGolden( CPLSPrintf( "/vsizip/%s/%s.kmz", pszSeriesDir,
+                                          pszCase ),
+                              pszGoldenDir,
+                              CPLSPrintf( "%s_series", pszCase ), bUpdate,
+                              bRequireGolden );
+        }
+        CSLDestroy( papszSuffixes );
+        CSLDestroy( papszConfig );
+    }
+
+    CPLFree( pszSrcFile );
+    CPLFree( pszPlainDir );
+    CPLFree( pszSetDir );
+    CPLFree( pszIncrementalDir );
+    CPLFree( pszMemoryDir );
+    CPLFree( pszSeriesDir );
+    CPLFree( pszKmz );
+    CSLDestroy( papszSet );
+    GDALDestroyDriverManager();
+
+    return rc;
+}
@@ -0,0 +1,246 @@
+/******************************************************************************
+*
+*  Project:  rl2kmz
+*  Purpose:  static image assets
+*  Author:   Kyle Shannon <kyle at pobox dot com>
+*
+*******************************************************************************
+*
+* This is free and unencumbered software released into the public domain.
+*
+* Anyone is free to copy, modify, publish, use, compile, sell, or
+* distribute this software, either in source code form or as a compiled
+* binary, for any purpose, commercial or non-commercial, and by any
+* means.
+*
+* In jurisdictions that recognize copyright laws, the author or authors
+* of this software dedicate any and all copyright interest in the
+* software to the public domain. We make this dedication for the benefit
+* of the public at large and to the detriment of our heirs and
+* successors. We intend this dedication to be an overt act of
+* relinquishment in perpetuity of all present and future rights to this
+* software under copyright law.
+*
+* THIS SOFTWARE WAS DEVELOPED AT THE ROCKY MOUNTAIN RESEARCH STATION (RMRS)
+* MISSOULA FIRE SCIENCES LABORATORY BY EMPLOYEES OF THE FEDERAL GOVERNMENT
+* IN THE COURSE OF THEIR OFFICIAL DUTIES. PURSUANT TO TITLE 17 SECTION 105
+* OF THE UNITED STATES CODE, THIS SOFTWARE IS NOT SUBJECT TO COPYRIGHT
+* PROTECTION AND IS IN THE PUBLIC DOMAIN. RMRS MISSOULA FIRE SCIENCES
+* LABORATORY ASSUMES NO RESPONSIBILITY WHATSOEVER FOR ITS USE BY OTHER
+* PARTIES,  AND MAKES NO GUARANTEES, EXPRESSED OR IMPLIED, ABOUT ITS QUALITY,
+* RELIABILITY, OR ANY OTHER CHARACTERISTIC.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+* IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+* OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+* ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+* OTHER DEALINGS IN THE SOFTWARE.
+*
+* For more information, please refer to <http://unlicense.org>
+*
+******************************************************************************/
+
+#include "cpl_atomic_ops.h"
+#include "cpl_conv.h"
+#include "cpl_multiproc.h"
+#include "cpl_string.h"
+
+#include "rlasset.h"
+#include "rlutil.h"
+
+/*
+** Write a file through a temporary name so a reader never sees it half
+** written.  The name is unique to the call, contexts of one process may
+** share a cache_dir.
+*/
+static int WriteAtomic( const char *pszFile, const GByte *pabyData,
+                        size_t nSize )
+{
+    static volatile int nTmpFiles = 0;
+    VSILFILE *fp;
+    char *pszTmpFile;
+    int nRet = RL_OK;
+
+    pszTmpFile = CPLStrdup( CPLSPrintf( "%s.%d.%d.tmp", pszFile,
+                                        (int) CPLGetPID(),
+                                        CPLAtomicInc( &nTmpFiles ) ) );
+    fp = VSIFOpenL( pszTmpFile, "wb" );
+    if( !fp )
+    {
+        CPLFree( pszTmpFile );
+        return RL_ERR;
+    }
+    if( VSIFWriteL( pabyData, 1, nSize, fp ) != nSize )
+        nRet = RL_ERR;
+    if( VSIFCloseL( fp ) != 0 )
+        nRet = RL_ERR;
+    if( nRet == RL_OK && VSIRename( pszTmpFile, pszFile ) != 0 )
+        nRet = RL_ERR;
+    if( nRet != RL_OK )
+        VSIUnlink( pszTmpFile );
+    CPLFree( pszTmpFile );
+    return nRet;
+}
+
+/*
+** Look for the data derived from a file in the cache.  It is used if the
+** size and content hash nSourceHash of the original still match those
+** recorded, a copy or rewrite keeping the modification time included, and
+** the data still hashes to the recorded value.
+*/
+static GByte * ReadCachedAsset( const char *pszData, const char *pszMeta,
+                                const VSIStatBufL *psStat,
+                                GUIntBig nSourceHash, vsi_l_offset *pnSize )
+{
+    VSIStatBufL sMetaStat;
+    char **papszMeta;
+    GByte *pabyData = NULL;
+    vsi_l_offset nSize = 0;
+    GUIntBig nHash;
+    int bMatch;
+
+    if( VSIStatL( pszMeta, &sMetaStat ) != 0 )
+        return NULL;
+    papszMeta = CSLLoad2( pszMeta, 10, 1024, NULL );
+    bMatch = papszMeta &&
+             CPLScanUIntBig( CSLFetchNameValueDef( papszMeta, "size", "" ),
+                             32 ) == (GUIntBig) psStat->st_size &&
+             EQUAL( CPLSPrintf( CPL_FRMT_GUIB, nSourceHash ),
+                    CSLFetchNameValueDef( papszMeta, "source", "" ) );
+    if( bMatch && VSIIngestFile( NULL, pszData, &pabyData, &nSize, -1 ) )
+    {
+        nHash = RLHashBytes( RL_HASH_INIT, pabyData, (size_t) nSize );
+        if( CPLScanUIntBig( CSLFetchNameValueDef( papszMeta, "bytes", "" ),
+                            32 ) != (GUIntBig) nSize ||
+            !EQUAL( CPLSPrintf( CPL_FRMT_GUIB, nHash ),
+                    CSLFetchNameValueDef( papszMeta, "hash", "" ) ) )
+        {
+            CPLDebug( "RL2KMZ", "Cached copy %s is corrupt", pszData );
+            VSIFree( pabyData );
+            pabyData = NULL;
+        }
+    }
+    CSLDestroy( papszMeta );
+    *pnSize = pabyData ? nSize : 0;
+    return pabyData;
+}
+
+/*
+** RLDeriveFunc for the bytes of the file as is.
+*/
+static GByte * IngestAsset( const char *pszFile, vsi_l_offset *pnSize,
+                            void *pUserData )
+{
+    GByte *pabyData = NULL;
+    (void) pUserData;
+    if( !VSIIngestFile( NULL, pszFile, &pabyData, pnSize, -1 ) )
+    {
+        CPLError( CE_Failure, CPLE_FileIO, "Could not read %s", pszFile );
+        return NULL;
+    }
+    return pabyData;
+}
+
+/*
+** Derive data from pszFile with pfnDerive.  With pszCacheDir set the
+** result is kept there, along with the size and a content hash of pszFile
+** and a hash of the result, so it is only derived again once pszFile
+** changes.  pszVariant tells apart different data derived from
+** the same file, it should name everything besides the file the result
+** depends on.  Returns a VSIMalloc()ed buffer, or NULL on failure.
+*/
+GByte * RLReadDerivedAsset( const char *pszFile, const char *pszCacheDir,
+                            const char *pszVariant, RLDeriveFunc pfnDerive,
+                            void *pUserData, vsi_l_offset *pnSize )
+{
+    VSIStatBufL sStat;
+    GByte *pabyData = NULL;
+    char **papszMeta = NULL;
+    char *pszData = NULL, *pszMeta = NULL;
+    const char *pszName;
+    GUIntBig nKey, nSourceHash = RL_HASH_INIT;
+
+    *pnSize = 0;
+    if( VSIStatL( pszFile, &sStat ) != 0 )
+    {
+        CPLError( CE_Failure, CPLE_OpenFailed, "Could not stat %s", pszFile );
+        return NULL;
+    }
+    /* Hashed before deriving, a change during it shows up next time */
+    if( pszCacheDir && !RLHashFile( pszFile, &nSourceHash ) )
+    {
+        CPLDebug( "RL2KMZ", "Could not hash %s, not caching it", pszFile );
+        pszCacheDir = NULL;
+    }
+    if( pszCacheDir )
+    {
+        nKey = RLHashString( RL_HASH_INIT, pszFile );
+        nKey = RLHashString( nKey, pszVariant );
+        pszName = CPLSPrintf( "asset_" CPL_FRMT_GUIB, nKey );
+        pszData = CPLStrdup( CPLFormFilename( pszCacheDir, pszName, "dat" ) );
+        pszMeta = CPLStrdup( CPLFormFilename( pszCacheDir, pszName, "meta" ) );
+        pabyData = ReadCachedAsset( pszData, pszMeta, &sStat, nSourceHash,
+                                    pnSize );
+        if( pabyData )
+        {
+            CPLDebug( "RL2KMZ", "Using cached copy of %s", pszFile );
+            CPLFree( pszData );
+            CPLFree( pszMeta );
+            return pabyData;
+        }
+    }
+
+    pabyData = pfnDerive( pszFile, pnSize, pUserData );
+    if( !pabyData )
+    {
+        CPLFree( pszData );
+        CPLFree( pszMeta );
+        return NULL;
+    }
+    if( pszCacheDir )
+    {
+        /* The record goes last, a copy without one is never used */
+        papszMeta = CSLSetNameValue( papszMeta, "file", pszFile );
+        if( pszVariant )
+            papszMeta = CSLSetNameValue( papszMeta, "variant", pszVariant );
+        papszMeta = CSLSetNameValue( papszMeta, "size",
+                                     CPLSPrintf( CPL_FRMT_GUIB,
+                                                 (GUIntBig) sStat.st_size ) );
+        papszMeta = CSLSetNameValue( papszMeta, "source",
+                                     CPLSPrintf( CPL_FRMT_GUIB,
+                                                 nSourceHash ) );
+        papszMeta = CSLSetNameValue( papszMeta, "bytes",
+                                     CPLSPrintf( CPL_FRMT_GUIB,
+                                                 (GUIntBig) *pnSize ) );
+        papszMeta = CSLSetNameValue( papszMeta, "hash",
+                                     CPLSPrintf( CPL_FRMT_GUIB,
+                                     RLHashBytes( RL_HASH_INIT, pabyData,
+                                                  (size_t) *pnSize ) ) );
+        VSIMkdir( pszCacheDir, 0755 );
+        VSIUnlink( pszMeta );
+        if( WriteAtomic( pszData, pabyData, (size_t) *pnSize ) != RL_OK ||
+            !CSLSave( papszMeta, pszMeta ) )
+        {
+            CPLError( CE_Warning, CPLE_FileIO, "Could not cache %s in %s",
+                      pszFile, pszCacheDir );
+            VSIUnlink( pszMeta );
+        }
+        CSLDestroy( papszMeta );
+    }
+    CPLFree( pszData );
+    CPLFree( pszMeta );
+    return pabyData;
+}
+
+/*
+** Read the bytes of a static image, the title and legends, for storing in
+** the kmz as is.  A cached copy would have to be checked by reading the
+** image anyway, so none is kept.  Returns a VSIMalloc()ed buffer, or NULL
+** on failure.
+*/
+GByte * RLReadAsset( const char *pszFile, vsi_l_offset *pnSize )
+{
+    return IngestAsset( pszFile, pnSize, NULL );
+}
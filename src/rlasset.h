@@ -0,0 +1,68 @@
+/******************************************************************************
+*
+*  Project:  rl2kmz
+*  Purpose:  static image assets
+*  Author:   Kyle Shannon <kyle at pobox dot com>
+*
+*******************************************************************************
+*
+* This is free and unencumbered software released into the public domain.
+*
+* Anyone is free to copy, modify, publish, use, compile, sell, or
+* distribute this software, either in source code form or as a compiled
+* binary, for any purpose, commercial or non-commercial, and by any
+* means.
+*
+* In jurisdictions that recognize copyright laws, the author or authors
+* of this software dedicate any and all copyright interest in the
+* software to the public domain. We make this dedication for the benefit
+* of the public at large and to the detriment of our heirs and
+* successors. We intend this dedication to be an overt act of
+* relinquishment in perpetuity of all present and future rights to this
+* software under copyright law.
+*
+* THIS SOFTWARE WAS DEVELOPED AT THE ROCKY MOUNTAIN RESEARCH STATION (RMRS)
+* MISSOULA FIRE SCIENCES LABORATORY BY EMPLOYEES OF THE FEDERAL GOVERNMENT
+* IN THE COURSE OF THEIR OFFICIAL DUTIES. PURSUANT TO TITLE 17 SECTION 105
+* OF THE UNITED STATES CODE, THIS SOFTWARE IS NOT SUBJECT TO COPYRIGHT
+* PROTECTION AND IS IN THE PUBLIC DOMAIN. RMRS MISSOULA FIRE SCIENCES
+* LABORATORY ASSUMES NO RESPONSIBILITY WHATSOEVER FOR ITS USE BY OTHER
+* PARTIES,  AND MAKES NO GUARANTEES, EXPRESSED OR IMPLIED, ABOUT ITS QUALITY,
+* RELIABILITY, OR ANY OTHER CHARACTERISTIC.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+* IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+* OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+* ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+* OTHER DEALINGS IN THE SOFTWARE.
+*
+* For more information, please refer to <http://unlicense.org>
+*
+******************************************************************************/
+
+#ifndef RLASSET_H_
+#define RLASSET_H_
+
+#include "cpl_vsi.h"
+
+#include "rlport.h"
+
+CPL_C_START
+
+/*
+** Produce the data derived from pszFile, a VSIMalloc()ed buffer of
+** *pnSize bytes, or NULL on failure.
+*/
+typedef GByte * (*RLDeriveFunc)( const char *pszFile, vsi_l_offset *pnSize,
+                                 void *pUserData );
+
+GByte * RLReadDerivedAsset( const char *pszFile, const char *pszCacheDir,
+                            const char *pszVariant, RLDeriveFunc pfnDerive,
+                            void *pUserData, vsi_l_offset *pnSize );
+GByte * RLReadAsset( const char *pszFile, vsi_l_offset *pnSize );
+
+CPL_C_END
+
+#endif /* RLASSET_H_ */
@@ -0,0 +1,687 @@
+/******************************************************************************
+*
+*  Project:  rl2kmz
+*  Purpose:  classify rain/lightning values into colours
+*  Author:   Kyle Shannon <kyle at pobox dot com>
+*
+*******************************************************************************
+*
+* This is free and unencumbered software released into the public domain.
+*
+* Anyone is free to copy, modify, publish, use, compile, sell, or
+* distribute this software, either in source code form or as a compiled
+* binary, for any purpose, commercial or non-commercial, and by any
+* means.
+*
+* In jurisdictions that recognize copyright laws, the author or authors
+* of this software dedicate any and all copyright interest in the
+* software to the public domain. We make this dedication for the benefit
+* of the public at large and to the detriment of our heirs and
+* successors. We intend this dedication to be an overt act of
+* relinquishment in perpetuity of all present and future rights to this
+* software under copyright law.
+*
+* THIS SOFTWARE WAS DEVELOPED AT THE ROCKY MOUNTAIN RESEARCH STATION (RMRS)
+* MISSOULA FIRE SCIENCES LABORATORY BY EMPLOYEES OF THE FEDERAL GOVERNMENT
+* IN THE COURSE OF THEIR OFFICIAL DUTIES. PURSUANT TO TITLE 17 SECTION 105
+* OF THE UNITED STATES CODE, THIS SOFTWARE IS NOT SUBJECT TO COPYRIGHT
+* PROTECTION AND IS IN THE PUBLIC DOMAIN. RMRS MISSOULA FIRE SCIENCES
+* LABORATORY ASSUMES NO RESPONSIBILITY WHATSOEVER FOR ITS USE BY OTHER
+* PARTIES,  AND MAKES NO GUARANTEES, EXPRESSED OR IMPLIED, ABOUT ITS QUALITY,
+* RELIABILITY, OR ANY OTHER CHARACTERISTIC.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+* IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+* OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+* ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+* OTHER DEALINGS IN THE SOFTWARE.
+*
+* For more information, please refer to <http://unlicense.org>
+*
+******************************************************************************/
+
+#include <limits.h>
+
+/*
+** The vector kernels are picked by the instruction set the file is built
+** for.  RL_NO_SIMD builds the scalar ones alone, for testing against.
+*/
+#if defined(__AVX2__) && !defined(RL_NO_SIMD)
+#define RL_CLASSIFY_AVX2
+#include <immintrin.h>
+#elif defined(__SSE2__) && !defined(RL_NO_SIMD)
+#define RL_CLASSIFY_SSE2
+#include <emmintrin.h>
+#endif
+
+#include "cpl_conv.h"
+#include "cpl_string.h"
+
+#include "rlcolor.h"
+
+/*
+** The remap from paul, used when the config does not supply any color_
+** entries.  0 and nodata fall in no class and are transparent.
+*/
+static const RLColorClass asDefaultClasses[] =
+{
+    {     1,    10, { 204, 191, 102, 255 }, 0, FALSE },
+    {    11,    25, { 230, 176,   0, 255 }, 0, FALSE },
+    {    26,    50, { 255, 255, 130, 255 }, 0, FALSE },
+    {    51,    91, { 163, 230,   0, 255 }, 0, FALSE },
+    {    92,   100, { 112, 187,   0, 255 }, 0, FALSE },
+    {   101,  5000, { 112, 188,   0, 255 }, 0, FALSE },
+    { 10000, 10000, {   0,   0, 255, 255 }, 0, TRUE }, /* negative strike */
+    { 20000, 20000, { 255,   0,   0, 255 }, 0, TRUE }  /* positive strike */
+};
+
+static int CompareClasses( const void *a, const void *b )
+{
+    const RLColorClass *psA = (const RLColorClass*) a;
+    const RLColorClass *psB = (const RLColorClass*) b;
+    if( psA->nMin < psB->nMin )
+        return -1;
+    if( psA->nMin > psB->nMin )
+        return 1;
+    return 0;
+}
+
+/*
+** Parse a single color_ entry of the form "min max red green blue alpha",
+** optionally followed by "keep".
+*/
+static int ParseColorClass( const char *pszKey, const char *pszValue,
+                            RLColorClass *psClass )
+{
+    char **papszTokens;
+    int i, nValue, nTokens;
+
+    papszTokens = CSLTokenizeString2( pszValue, " \t,", 0 );
+    nTokens = CSLCount( papszTokens );
+    if( ( nTokens != 6 && nTokens != 7 ) ||
+        ( nTokens == 7 && !EQUAL( papszTokens[6], "keep" ) ) )
+    {
+        CPLError( CE_Failure, CPLE_AppDefined,
+                  "Invalid colour class %s, expected " \
+                  "min max red green blue alpha [keep]", pszKey );
+        CSLDestroy( papszTokens );
+        return RL_ERR;
+    }
+    psClass->bKeep = nTokens == 7;
+    psClass->nMin = atoi( papszTokens[0] );
+    psClass->nMax = atoi( papszTokens[1] );
+    for( i = 0; i < 4; i++ )
+    {
+        nValue = atoi( papszTokens[i + 2] );
+        if( nValue < 0 || nValue > 255 )
+        {
+            CPLError( CE_Failure, CPLE_AppDefined,
+                      "Invalid colour component %d in %s", nValue, pszKey );
+            CSLDestroy( papszTokens );
+            return RL_ERR;
+        }
+        psClass->abyRGBA[i] = (GByte) nValue;
+    }
+    CSLDestroy( papszTokens );
+    if( psClass->nMin > psClass->nMax )
+    {
+        CPLError( CE_Failure, CPLE_AppDefined,
+                  "Invalid range %d to %d in %s", psClass->nMin,
+                  psClass->nMax, pszKey );
+        return RL_ERR;
+    }
+    return RL_OK;
+}
+
+/*
+** Build the dense lookup table if the classes are compact enough.
+*/
+static void CompileLut( RLColorTable *psTable )
+{
+    GIntBig nSpan;
+    GUInt32 nPacked;
+    int i, j;
+
+    psTable->nLutMin = 0;
+    psTable->nLutSize = 0;
+    psTable->panLut = NULL;
+    if( psTable->nClassCount == 0 )
+        return;
+
+    nSpan = (GIntBig) psTable->pasClasses[psTable->nClassCount - 1].nMax -
+            psTable->pasClasses[0].nMin + 1;
+    if( nSpan > RL_MAX_LUT_SIZE )
+    {
+        CPLDebug( "RL2KMZ", "Colour classes span " CPL_FRMT_GIB " values, " \
+                  "using breakpoint search", nSpan );
+        return;
+    }
+
+    psTable->nLutMin = psTable->pasClasses[0].nMin;
+    psTable->nLutSize = (GUInt32) nSpan;
+    psTable->panLut = (GUInt32*) CPLCalloc( sizeof( GUInt32 ),
+                                            psTable->nLutSize + 1 );
+    /* Padded so a 32 bit gather at the last entry stays in bounds */
+    psTable->pabyIndexLut = (GByte*) CPLCalloc( 1, psTable->nLutSize + 4 );
+    for( i = 0; i < psTable->nClassCount; i++ )
+    {
+        memcpy( &nPacked, psTable->pasClasses[i].abyRGBA, 4 );
+        for( j = psTable->pasClasses[i].nMin;
+             j <= psTable->pasClasses[i].nMax; j++ )
+        {
+            psTable->panLut[j - psTable->nLutMin] = nPacked;
+            psTable->pabyIndexLut[j - psTable->nLutMin] =
+                (GByte) psTable->pasClasses[i].iPalette;
+        }
+    }
+}
+
+/*
+** Assign each class a palette entry, sharing entries between classes of
+** the same colour.  Entry 0 is transparent.
+*/
+static void CompilePalette( RLColorTable *psTable )
+{
+    GByte *pabyEntry;
+    int i, j;
+
+    psTable->pabyPalette = (GByte*) CPLCalloc( 4, RL_MAX_PALETTE_SIZE );
+    psTable->nPaletteCount = 1;
+    for( i = 0; i < psTable->nClassCount; i++ )
+    {
+        pabyEntry = psTable->pasClasses[i].abyRGBA;
+        for( j = 0; j < psTable->nPaletteCount; j++ )
+        {
+            if( memcmp( psTable->pabyPalette + j * 4, pabyEntry, 4 ) == 0 )
+                break;
+        }
+        if( j == psTable->nPaletteCount )
+        {
+            if( j == RL_MAX_PALETTE_SIZE )
+            {
+                CPLDebug( "RL2KMZ", "More than %d distinct colours, no " \
+                          "palette available", RL_MAX_PALETTE_SIZE );
+                psTable->nPaletteCount = 0;
+                for( j = 0; j < psTable->nClassCount; j++ )
+                    psTable->pasClasses[j].iPalette = 0;
+                return;
+            }
+            memcpy( psTable->pabyPalette + j * 4, pabyEntry, 4 );
+            psTable->nPaletteCount++;
+        }
+        psTable->pasClasses[i].iPalette = j;
+    }
+}
+
+/*
+** Create a colour table from the color_ entries in the config, or the
+** default remap if there are none.
+*/
+RLColorTable * RLCreateColorTable( char **papszConfig )
+{
+    RLColorTable *psTable;
+    const char *pszValue;
+    char *pszKey;
+    int i;
+
+    psTable = (RLColorTable*) CPLCalloc( sizeof( RLColorTable ), 1 );
+    for( i = 0; papszConfig != NULL && papszConfig[i] != NULL; i++ )
+    {
+        pszKey = NULL;
+        pszValue = CPLParseNameValue( papszConfig[i], &pszKey );
+        if( pszKey && pszValue && STARTS_WITH_CI( pszKey, "color_" ) )
+        {
+            psTable->pasClasses = (RLColorClass*)
+                CPLRealloc( psTable->pasClasses, sizeof( RLColorClass ) *
+                            ( psTable->nClassCount + 1 ) );
+            if( ParseColorClass( pszKey, pszValue,
+                    psTable->pasClasses + psTable->nClassCount ) != RL_OK )
+            {
+                CPLFree( pszKey );
+                RLDestroyColorTable( psTable );
+                return NULL;
+            }
+            psTable->nClassCount++;
+        }
+        CPLFree( pszKey );
+    }
+    if( psTable->nClassCount == 0 )
+    {
+        psTable->nClassCount = sizeof( asDefaultClasses ) /
+                               sizeof( asDefaultClasses[0] );
+        psTable->pasClasses = (RLColorClass*)
+            CPLMalloc( sizeof( asDefaultClasses ) );
+        memcpy( psTable->pasClasses, asDefaultClasses,
+                sizeof( asDefaultClasses ) );
+    }
+
+    qsort( psTable->pasClasses, psTable->nClassCount,
+           sizeof( RLColorClass ), CompareClasses );
+    for( i = 1; i < psTable->nClassCount; i++ )
+    {
+        if( psTable->pasClasses[i].nMin <= psTable->pasClasses[i - 1].nMax )
+        {
+            CPLError( CE_Failure, CPLE_AppDefined,
+                      "Colour classes %d-%d and %d-%d overlap",
+                      psTable->pasClasses[i - 1].nMin,
+                      psTable->pasClasses[i - 1].nMax,
+                      psTable->pasClasses[i].nMin,
+                      psTable->pasClasses[i].nMax );
+            RLDestroyColorTable( psTable );
+            return NULL;
+        }
+    }
+    psTable->nKeepMin = INT_MAX;
+    psTable->nKeepMax = INT_MIN;
+    for( i = 0; i < psTable->nClassCount; i++ )
+    {
+        if( !psTable->pasClasses[i].bKeep )
+            continue;
+        psTable->nKeepMin = MIN( psTable->nKeepMin,
+                                 psTable->pasClasses[i].nMin );
+        psTable->nKeepMax = MAX( psTable->nKeepMax,
+                                 psTable->pasClasses[i].nMax );
+    }
+    CompilePalette( psTable );
+    CompileLut( psTable );
+    return psTable;
+}
+
+/*
+** Make the classes marked keep transparent, for when the strikes are
+** drawn as points rather than in the overlay.  They are still found by
+** RLGetKeptClass().
+*/
+void RLHideKeptClasses( RLColorTable *psTable )
+{
+    int i;
+
+    for( i = 0; i < psTable->nClassCount; i++ )
+    {
+        if( psTable->pasClasses[i].bKeep )
+            memset( psTable->pasClasses[i].abyRGBA, 0, 4 );
+    }
+    CPLFree( psTable->pabyPalette );
+    CPLFree( psTable->panLut );
+    CPLFree( psTable->pabyIndexLut );
+    psTable->pabyIndexLut = NULL;
+    CompilePalette( psTable );
+    CompileLut( psTable );
+}
+
+void RLDestroyColorTable( RLColorTable *psTable )
+{
+    if( !psTable )
+        return;
+    CPLFree( psTable->pasClasses );
+    CPLFree( psTable->pabyPalette );
+    CPLFree( psTable->panLut );
+    CPLFree( psTable->pabyIndexLut );
+    CPLFree( psTable );
+}
+
+/*
+** Fetch the nodata value of an integer band.  Returns FALSE if there is no
+** nodata value, or if it can never compare equal to an Int32 pixel.
+*/
+int RLGetNoDataInt32( GDALRasterBandH hBand, GInt32 *pnNoData )
+{
+    double dfNoData;
+    int bHasNoData;
+
+    dfNoData = GDALGetRasterNoDataValue( hBand, &bHasNoData );
+    if( !bHasNoData || dfNoData < INT_MIN || dfNoData > INT_MAX ||
+        dfNoData != (double) (GInt32) dfNoData )
+    {
+        return FALSE;
+    }
+    *pnNoData = (GInt32) dfNoData;
+    return TRUE;
+}
+
+/*
+** Find the class holding nValue, or NULL.
+*/
+static const RLColorClass * SearchClasses( const RLColorTable *psTable,
+                                           GInt32 nValue )
+{
+    int nLow, nHigh, nMid;
+
+    nLow = 0;
+    nHigh = psTable->nClassCount - 1;
+    while( nLow <= nHigh )
+    {
+        nMid = nLow + ( nHigh - nLow ) / 2;
+        if( nValue < psTable->pasClasses[nMid].nMin )
+            nHigh = nMid - 1;
+        else if( nValue > psTable->pasClasses[nMid].nMax )
+            nLow = nMid + 1;
+        else
+            return psTable->pasClasses + nMid;
+    }
+    return NULL;
+}
+
+/*
+** Index of the class marked keep holding nValue, or -1.
+*/
+int RLGetKeptClass( const RLColorTable *psTable, GInt32 nValue )
+{
+    const RLColorClass *psClass;
+
+    if( nValue < psTable->nKeepMin || nValue > psTable->nKeepMax )
+        return -1;
+    psClass = SearchClasses( psTable, nValue );
+    if( !psClass || !psClass->bKeep )
+        return -1;
+    return (int) ( psClass - psTable->pasClasses );
+}
+
+/*
+** Widen the span of pixels that aren't fully transparent to the pixels set
+** in nMask, bit j being pixel iBase + j.  Spans are grown front to back.
+*/
+static void AddToSpan( unsigned int nMask, size_t iBase, size_t *pnFirst,
+                       size_t *pnLast, int *pbAny )
+{
+    int iLow = 0, iHigh = 31;
+
+    while( !( nMask & ( 1U << iLow ) ) )
+        iLow++;
+    while( !( nMask & ( 1U << iHigh ) ) )
+        iHigh--;
+    if( !*pbAny )
+        *pnFirst = iBase + iLow;
+    *pnLast = iBase + iHigh;
+    *pbAny = TRUE;
+}
+
+/*
+** Classify nCount Int32 values into pixel interleaved RGBA.  pnNoData may be
+** NULL if the source has no nodata value.  If pnFirst and pnLast aren't
+** NULL they receive the first and last pixel with a non zero alpha, and
+** FALSE is returned when there are none.
+*/
+int RLClassifyInt32( const RLColorTable *psTable, const GInt32 *panSrc,
+                     const GInt32 *pnNoData, GByte *pabyRGBA, size_t nCount,
+                     size_t *pnFirst, size_t *pnLast )
+{
+    const GUInt32 *panLut = psTable->panLut;
+    const GUInt32 nMin = (GUInt32) psTable->nLutMin;
+    const GUInt32 nSize = psTable->nLutSize;
+    const RLColorClass *psClass;
+    const int bSpan = pnFirst != NULL && pnLast != NULL;
+    GUInt32 nIndex, nPacked;
+    size_t i = 0;
+    int bAny = FALSE;
+
+    if( panLut == NULL )
+    {
+        for( ; i < nCount; i++ )
+        {
+            nPacked = 0;
+            if( !pnNoData || panSrc[i] != *pnNoData )
+            {
+                psClass = SearchClasses( psTable, panSrc[i] );
+                if( psClass )
+                    memcpy( &nPacked, psClass->abyRGBA, 4 );
+            }
+            memcpy( pabyRGBA + i * 4, &nPacked, 4 );
+            if( bSpan && pabyRGBA[i * 4 + 3] != 0 )
+                AddToSpan( 1, i, pnFirst, pnLast, &bAny );
+        }
+        return bAny;
+    }
+
+#if defined(RL_CLASSIFY_AVX2)
+    {
+        const __m256i vMin = _mm256_set1_epi32( (int) nMin );
+        const __m256i vSize = _mm256_set1_epi32( (int) nSize );
+        const __m256i vNoData = _mm256_set1_epi32( pnNoData ? *pnNoData : 0 );
+        const __m256i vAlpha = _mm256_set1_epi32( (int) 0xFF000000U );
+        __m256i vSrc, vIndex, vPacked;
+        unsigned int nMask;
+        for( ; i + 8 <= nCount; i += 8 )
+        {
+            vSrc = _mm256_loadu_si256( (const __m256i*) ( panSrc + i ) );
+            vIndex = _mm256_min_epu32( _mm256_sub_epi32( vSrc, vMin ), vSize );
+            vPacked = _mm256_i32gather_epi32( (const int*) panLut, vIndex, 4 );
+            if( pnNoData )
+                vPacked = _mm256_andnot_si256(
+                    _mm256_cmpeq_epi32( vSrc, vNoData ), vPacked );
+            _mm256_storeu_si256( (__m256i*) ( pabyRGBA + i * 4 ), vPacked );
+            if( bSpan )
+            {
+                nMask = ~_mm256_movemask_ps( _mm256_castsi256_ps(
+                    _mm256_cmpeq_epi32( _mm256_and_si256( vPacked, vAlpha ),
+                                        _mm256_setzero_si256() ) ) ) & 0xFF;
+                if( nMask )
+                    AddToSpan( nMask, i, pnFirst, pnLast, &bAny );
+            }
+        }
+    }
+#elif defined(RL_CLASSIFY_SSE2)
+    {
+        /* No unsigned compare or gather in SSE2, bias into signed range. */
+        const __m128i vBias = _mm_set1_epi32( INT_MIN );
+        const __m128i vMin = _mm_set1_epi32( (int) nMin );
+        const __m128i vSize = _mm_set1_epi32( (int) nSize );
+        const __m128i vSizeBiased = _mm_xor_si128( vSize, vBias );
+        const __m128i vNoData = _mm_set1_epi32( pnNoData ? *pnNoData : 0 );
+        const __m128i vAlpha = _mm_set1_epi32( (int) 0xFF000000U );
+        __m128i vSrc, vIndex, vInRange, vPacked;
+        GUInt32 anIndex[4], anPacked[4];
+        unsigned int nMask;
+        for( ; i + 4 <= nCount; i += 4 )
+        {
+            vSrc = _mm_loadu_si128( (const __m128i*) ( panSrc + i ) );
+            vIndex = _mm_sub_epi32( vSrc, vMin );
+            vInRange = _mm_cmplt_epi32( _mm_xor_si128( vIndex, vBias ),
+                                        vSizeBiased );
+            vIndex = _mm_or_si128( _mm_and_si128( vInRange, vIndex ),
+                                   _mm_andnot_si128( vInRange, vSize ) );
+            _mm_storeu_si128( (__m128i*) anIndex, vIndex );
+            anPacked[0] = panLut[anIndex[0]];
+            anPacked[1] = panLut[anIndex[1]];
+            anPacked[2] = panLut[anIndex[2]];
+            anPacked[3] = panLut[anIndex[3]];
+            vPacked = _mm_loadu_si128( (const __m128i*) anPacked );
+            if( pnNoData )
+                vPacked = _mm_andnot_si128( _mm_cmpeq_epi32( vSrc, vNoData ),
+                                            vPacked );
+            _mm_storeu_si128( (__m128i*) ( pabyRGBA + i * 4 ), vPacked );
+            if( bSpan )
+            {
+                nMask = ~_mm_movemask_ps( _mm_castsi128_ps(
+                    _mm_cmpeq_epi32( _mm_and_si128( vPacked, vAlpha ),
+                                     _mm_setzero_si128() ) ) ) & 0xF;
+                if( nMask )
+                    AddToSpan( nMask, i, pnFirst, pnLast, &bAny );
+            }
+        }
+    }
+#endif
+
+    for( ; i < nCount; i++ )
+    {
+        nIndex = (GUInt32) panSrc[i] - nMin;
+        nPacked = panLut[nIndex < nSize ? nIndex : nSize];
+        if( pnNoData && panSrc[i] == *pnNoData )
+            nPacked = 0;
+        memcpy( pabyRGBA + i * 4, &nPacked, 4 );
+        if( bSpan && pabyRGBA[i * 4 + 3] != 0 )
+            AddToSpan( 1, i, pnFirst, pnLast, &bAny );
+    }
+    return bAny;
+}
+
+/*
+** Classify nCount Int32 values into indices of the palette.  The table must
+** have a palette.  If pnFirst and pnLast aren't NULL they receive the first
+** and last pixel off palette entry 0, and FALSE is returned when there are
+** none.
+*/
+int RLClassifyInt32ToIndex( const RLColorTable *psTable,
+                            const GInt32 *panSrc, const GInt32 *pnNoData,
+                            GByte *pabyIndex, size_t nCount,
+                            size_t *pnFirst, size_t *pnLast )
+{
+    const GByte *pabyLut = psTable->pabyIndexLut;
+    const GUInt32 nMin = (GUInt32) psTable->nLutMin;
+    const GUInt32 nSize = psTable->nLutSize;
+    const RLColorClass *psClass;
+    const int bSpan = pnFirst != NULL && pnLast != NULL;
+    GUInt32 nIndex;
+    size_t i = 0;
+    int bAny = FALSE;
+
+    if( pabyLut == NULL )
+    {
+        for( ; i < nCount; i++ )
+        {
+            pabyIndex[i] = 0;
+            if( !pnNoData || panSrc[i] != *pnNoData )
+            {
+                psClass = SearchClasses( psTable, panSrc[i] );
+                if( psClass )
+                    pabyIndex[i] = (GByte) psClass->iPalette;
+            }
+            if( bSpan && pabyIndex[i] != 0 )
+                AddToSpan( 1, i, pnFirst, pnLast, &bAny );
+        }
+        return bAny;
+    }
+
+#if defined(RL_CLASSIFY_AVX2)
+    {
+        const __m256i vMin = _mm256_set1_epi32( (int) nMin );
+        const __m256i vSize = _mm256_set1_epi32( (int) nSize );
+        const __m256i vByte = _mm256_set1_epi32( 0xFF );
+        const __m256i vNoData = _mm256_set1_epi32( pnNoData ? *pnNoData : 0 );
+        __m256i vSrc, vIndex, vValue;
+        __m128i vPacked;
+        unsigned int nMask;
+        for( ; i + 8 <= nCount; i += 8 )
+        {
+            vSrc = _mm256_loadu_si256( (const __m256i*) ( panSrc + i ) );
+            vIndex = _mm256_min_epu32( _mm256_sub_epi32( vSrc, vMin ), vSize );
+            vValue = _mm256_and_si256(
+                _mm256_i32gather_epi32( (const int*) pabyLut, vIndex, 1 ),
+                vByte );
+            if( pnNoData )
+                vValue = _mm256_andnot_si256(
+                    _mm256_cmpeq_epi32( vSrc, vNoData ), vValue );
+            vPacked = _mm_packus_epi32(
+                _mm256_castsi256_si128( vValue ),
+                _mm256_extracti128_si256( vValue, 1 ) );
+            vPacked = _mm_packus_epi16( vPacked, vPacked );
+            _mm_storel_epi64( (__m128i*) ( pabyIndex + i ), vPacked );
+            if( bSpan )
+            {
+                nMask = ~_mm256_movemask_ps( _mm256_castsi256_ps(
+                    _mm256_cmpeq_epi32( vValue,
+                                        _mm256_setzero_si256() ) ) ) & 0xFF;
+                if( nMask )
+                    AddToSpan( nMask, i, pnFirst, pnLast, &bAny );
+            }
+        }
+    }
+#endif
+
+    for( ; i < nCount; i++ )
+    {
+        nIndex = (GUInt32) panSrc[i] - nMin;
+        pabyIndex[i] = pabyLut[nIndex < nSize ? nIndex : nSize];
+        if( pnNoData && panSrc[i] == *pnNoData )
+            pabyIndex[i] = 0;
+        if( bSpan && pabyIndex[i] != 0 )
+            AddToSpan( 1, i, pnFirst, pnLast, &bAny );
+    }
+    return bAny;
+}
+
+/*
+** Reduce every nFactor by nFactor block of an nXSize by nYSize Int32 grid
+** to one value, for a coarser overlay of the same categories.  Classes
+** marked keep win wherever they occur in a block, the highest first, so
+** single strike pixels survive, unless they are hidden.  Otherwise the
+** most common class wins, ties going to the higher class, with values in
+** no class counting as a class of their own.  Nodata only wins a block of
+** nothing else.  Each value written is the lowest of its class, or for no
+** class the first value seen.  panDst takes (nXSize + nFactor - 1) /
+** nFactor by (nYSize + nFactor - 1) / nFactor values.
+*/
+void RLReduceClasses( const RLColorTable *psTable, const GInt32 *panSrc,
+                      int nXSize, int nYSize, const GInt32 *pnNoData,
+                      int nFactor, GInt32 *panDst )
+{
+    const RLColorClass *psClass;
+    const GInt32 *panRow;
+    int *panCounts;
+    int nOtherCount, nBest, iBest, iKeep, iClass;
+    int nDstXSize, nDstYSize, iDstX, iDstY, iX, iY, nXEnd, nYEnd;
+    GInt32 nValue, nOther;
+
+    nDstXSize = ( nXSize + nFactor - 1 ) / nFactor;
+    nDstYSize = ( nYSize + nFactor - 1 ) / nFactor;
+    panCounts = (int*) CPLMalloc( sizeof( int ) *
+                                  MAX( 1, psTable->nClassCount ) );
+    for( iDstY = 0; iDstY < nDstYSize; iDstY++ )
+    {
+        nYEnd = MIN( nYSize, ( iDstY + 1 ) * nFactor );
+        for( iDstX = 0; iDstX < nDstXSize; iDstX++ )
+        {
+            nXEnd = MIN( nXSize, ( iDstX + 1 ) * nFactor );
+            memset( panCounts, 0, sizeof( int ) * psTable->nClassCount );
+            nOtherCount = 0;
+            nOther = 0;
+            iKeep = -1;
+            for( iY = iDstY * nFactor; iY < nYEnd; iY++ )
+            {
+                panRow = panSrc + (size_t) iY * nXSize;
+                for( iX = iDstX * nFactor; iX < nXEnd; iX++ )
+                {
+                    nValue = panRow[iX];
+                    if( pnNoData && nValue == *pnNoData )
+                        continue;
+                    psClass = SearchClasses( psTable, nValue );
+                    if( !psClass )
+                    {
+                        if( nOtherCount++ == 0 )
+                            nOther = nValue;
+                        continue;
+                    }
+                    iClass = (int) ( psClass - psTable->pasClasses );
+                    panCounts[iClass]++;
+                    if( psClass->bKeep && psClass->abyRGBA[3] != 0 &&
+                        iClass > iKeep )
+                        iKeep = iClass;
+                }
+            }
+            iBest = iKeep;
+            if( iBest < 0 )
+            {
+                nBest = nOtherCount;
+                for( iClass = 0; iClass < psTable->nClassCount; iClass++ )
+                {
+                    if( panCounts[iClass] > 0 &&
+                        panCounts[iClass] >= nBest )
+                    {
+                        nBest = panCounts[iClass];
+                        iBest = iClass;
+                    }
+                }
+            }
+            if( iBest >= 0 )
+                nValue = psTable->pasClasses[iBest].nMin;
+            else if( nOtherCount > 0 || !pnNoData )
+                nValue = nOther;
+            else
+                nValue = *pnNoData;
+            *panDst++ = nValue;
+        }
+    }
+    CPLFree( panCounts );
+}
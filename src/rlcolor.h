@@ -0,0 +1,127 @@
+/******************************************************************************
+*
+*  Project:  rl2kmz
+*  Purpose:  classify rain/lightning values into colours
+*  Author:   Kyle Shannon <kyle at pobox dot com>
+*
+*******************************************************************************
+*
+* This is free and unencumbered software released into the public domain.
+*
+* Anyone is free to copy, modify, publish, use, compile, sell, or
+* distribute this software, either in source code form or as a compiled
+* binary, for any purpose, commercial or non-commercial, and by any
+* means.
+*
+* In jurisdictions that recognize copyright laws, the author or authors
+* of this software dedicate any and all copyright interest in the
+* software to the public domain. We make this dedication for the benefit
+* of the public at large and to the detriment of our heirs and
+* successors. We intend this dedication to be an overt act of
+* relinquishment in perpetuity of all present and future rights to this
+* software under copyright law.
+*
+* THIS SOFTWARE WAS DEVELOPED AT THE ROCKY MOUNTAIN RESEARCH STATION (RMRS)
+* MISSOULA FIRE SCIENCES LABORATORY BY EMPLOYEES OF THE FEDERAL GOVERNMENT
+* IN THE COURSE OF THEIR OFFICIAL DUTIES. PURSUANT TO TITLE 17 SECTION 105
+* OF THE UNITED STATES CODE, THIS SOFTWARE IS NOT SUBJECT TO COPYRIGHT
+* PROTECTION AND IS IN THE PUBLIC DOMAIN. RMRS MISSOULA FIRE SCIENCES
+* LABORATORY ASSUMES NO RESPONSIBILITY WHATSOEVER FOR ITS USE BY OTHER
+* PARTIES,  AND MAKES NO GUARANTEES, EXPRESSED OR IMPLIED, ABOUT ITS QUALITY,
+* RELIABILITY, OR ANY OTHER CHARACTERISTIC.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+* IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+* OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+* ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+* OTHER DEALINGS IN THE SOFTWARE.
+*
+* For more information, please refer to <http://unlicense.org>
+*
+******************************************************************************/
+
+#ifndef RLCOLOR_H_
+#define RLCOLOR_H_
+
+#include "gdal.h"
+
+#include "rlport.h"
+
+CPL_C_START
+
+/*
+** Any span of values wider than this is searched by breakpoint instead of
+** being expanded into a dense lookup table.
+*/
+#ifndef RL_MAX_LUT_SIZE
+#define RL_MAX_LUT_SIZE (1 << 20)
+#endif
+
+/*
+** Largest palette a paletted png can carry.
+*/
+#define RL_MAX_PALETTE_SIZE 256
+
+typedef struct
+{
+    int nMin;
+    int nMax;
+    GByte abyRGBA[4];
+    int iPalette;
+    /* Kept through reduction wherever it occurs, see RLReduceClasses() */
+    int bKeep;
+} RLColorClass;
+
+/*
+** A compiled colour table.  Classes are sorted by nMin and may not overlap.
+** Values that fall in no class are transparent.  When the classes span less
+** than RL_MAX_LUT_SIZE values, panLut holds nLutSize + 1 packed RGBA entries
+** starting at nLutMin, with a trailing transparent entry that out of range
+** values are clamped onto.  pabyIndexLut holds the matching palette indices.
+**
+** pabyPalette holds nPaletteCount distinct RGBA colours, entry 0 is always
+** transparent.  nPaletteCount is 0 if there are too many distinct colours
+** for a palette.
+*/
+typedef struct
+{
+    int nClassCount;
+    RLColorClass *pasClasses;
+
+    int nPaletteCount;
+    GByte *pabyPalette;
+
+    int nLutMin;
+    GUInt32 nLutSize;
+    GUInt32 *panLut;
+    GByte *pabyIndexLut;
+
+    /* Span of the classes marked keep, nKeepMin > nKeepMax for none */
+    int nKeepMin;
+    int nKeepMax;
+} RLColorTable;
+
+RLColorTable * RLCreateColorTable( char **papszConfig );
+void RLDestroyColorTable( RLColorTable *psTable );
+void RLHideKeptClasses( RLColorTable *psTable );
+int RLGetKeptClass( const RLColorTable *psTable, GInt32 nValue );
+
+int RLGetNoDataInt32( GDALRasterBandH hBand, GInt32 *pnNoData );
+
+int RLClassifyInt32( const RLColorTable *psTable, const GInt32 *panSrc,
+                     const GInt32 *pnNoData, GByte *pabyRGBA, size_t nCount,
+                     size_t *pnFirst, size_t *pnLast );
+int RLClassifyInt32ToIndex( const RLColorTable *psTable,
+                            const GInt32 *panSrc, const GInt32 *pnNoData,
+                            GByte *pabyIndex, size_t nCount,
+                            size_t *pnFirst, size_t *pnLast );
+
+void RLReduceClasses( const RLColorTable *psTable, const GInt32 *panSrc,
+                      int nXSize, int nYSize, const GInt32 *pnNoData,
+                      int nFactor, GInt32 *panDst );
+
+CPL_C_END
+
+#endif /* RLCOLOR_H_ */
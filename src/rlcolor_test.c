@@ -0,0 +1,392 @@
+/******************************************************************************
+*
+*  Project:  rl2kmz
+*  Purpose:  colour kernels against the original if/else chain
+*  Author:   Kyle Shannon <kyle at pobox dot com>
+*
+*******************************************************************************
+*
+* This is free and unencumbered software released into the public domain.
+*
+* Anyone is free to copy, modify, publish, use, compile, sell, or
+* distribute this software, either in source code form or as a compiled
+* binary, for any purpose, commercial or non-commercial, and by any
+* means.
+*
+* In jurisdictions that recognize copyright laws, the author or authors
+* of this software dedicate any and all copyright interest in the
+* software to the public domain. We make this dedication for the benefit
+* of the public at large and to the detriment of our heirs and
+* successors. We intend this dedication to be an overt act of
+* relinquishment in perpetuity of all present and future rights to this
+* software under copyright law.
+*
+* THIS SOFTWARE WAS DEVELOPED AT THE ROCKY MOUNTAIN RESEARCH STATION (RMRS)
+* MISSOULA FIRE SCIENCES LABORATORY BY EMPLOYEES OF THE FEDERAL GOVERNMENT
+* IN THE COURSE OF THEIR OFFICIAL DUTIES. PURSUANT TO TITLE 17 SECTION 105
+* OF THE UNITED STATES CODE, THIS SOFTWARE IS NOT SUBJECT TO COPYRIGHT
+* PROTECTION AND IS IN THE PUBLIC DOMAIN. RMRS MISSOULA FIRE SCIENCES
+* LABORATORY ASSUMES NO RESPONSIBILITY WHATSOEVER FOR ITS USE BY OTHER
+* PARTIES,  AND MAKES NO GUARANTEES, EXPRESSED OR IMPLIED, ABOUT ITS QUALITY,
+* RELIABILITY, OR ANY OTHER CHARACTERISTIC.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+* IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+* OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+* ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+* OTHER DEALINGS IN THE SOFTWARE.
+*
+* For more information, please refer to <http://unlicense.org>
+*
+******************************************************************************/
+
+#include <limits.h>
+
+#include "cpl_conv.h"
+
+#include "rlport.h"
+#include "rlcolor.h"
+
+/* Exit code of a test the cpu can't run, for ctest */
+#define RL_TEST_SKIP 77
+
+/* Longest run classified, past two AVX2 vectors and a tail */
+#define RL_TEST_MAX_RUN 37
+
+/* What the kernel outputs are filled with before each run */
+#define RL_TEST_JUNK 0xA5
+
+/* Differences reported before the rest are only counted */
+#define RL_TEST_MAX_REPORTS 5
+
+/*
+** Nodata of the old code when the band had none.
+*/
+#define RL_BASELINE_NO_NODATA -1e10
+
+/*
+** Every class edge of the default remap and either side of it, 0, nodata,
+** the strikes and their neighbours, and values past both ends.
+*/
+static const GInt32 anEdgeValues[] =
+{
+    INT_MIN, -32768, -9999, -2, -1, 0, 1, 2, 9, 10, 11, 12, 24, 25, 26, 27,
+    49, 50, 51, 52, 90, 91, 92, 93, 99, 100, 101, 102, 4999, 5000, 5001,
+    9999, 10000, 10001, 19999, 20000, 20001, 32767, INT_MAX
+};
+
+/*
+** A copy of the remap rl2kmz started out with, one band at a time.  Values
+** in no class were left as the row buffers held them, the buffers are
+** cleared first so those come out transparent as the kernels make them.
+*/
+static void BaselineClassify( const GInt32 *panSrcData, double dfNoData,
+                              GByte *pabyRGBA, int nXSize )
+{
+    GByte *pabyRed, *pabyGreen, *pabyBlue, *pabyAlpha;
+    int j;
+
+    pabyRed = (GByte*) CPLCalloc( sizeof( GByte ), MAX( 1, nXSize ) );
+    pabyGreen = (GByte*) CPLCalloc( sizeof( GByte ), MAX( 1, nXSize ) );
+    pabyBlue = (GByte*) CPLCalloc( sizeof( GByte ), MAX( 1, nXSize ) );
+    pabyAlpha = (GByte*) CPLCalloc( sizeof( GByte ), MAX( 1, nXSize ) );
+    for( j = 0; j < nXSize; j++ )
+    {
+        if( panSrcData[j] == dfNoData )
+        {
+            pabyRed[j] = 0;
+            pabyGreen[j] = 0;
+            pabyBlue[j] = 0;
+            pabyAlpha[j] = 0;
+        }
+        else if( panSrcData[j] == 0 )
+        {
+            pabyRed[j] = 0;
+            pabyGreen[j] = 0;
+            pabyBlue[j] = 0;
+            pabyAlpha[j] = 0;
+        }
+        else if( panSrcData[j] >= 1 && panSrcData[j] <= 10 )
+        {
+            pabyRed[j] = 204;
+            pabyGreen[j] = 191;
+            pabyBlue[j] = 102;
+            pabyAlpha[j] = 255;
+        }
+        else if( panSrcData[j] >= 11 && panSrcData[j] <= 25 )
+        {
+            pabyRed[j] = 230;
+            pabyGreen[j] = 176;
+            pabyBlue[j] = 0;
+            pabyAlpha[j] = 255;
+        }
+        else if( panSrcData[j] >= 26 && panSrcData[j] <= 50 )
+        {
+            pabyRed[j] = 255;
+            pabyGreen[j] = 255;
+            pabyBlue[j] = 130;
+            pabyAlpha[j] = 255;
+        }
+        else if( panSrcData[j] >= 51 && panSrcData[j] <= 91 )
+        {
+            pabyRed[j] = 163;
+            pabyGreen[j] = 230;
+            pabyBlue[j] = 0;
+            pabyAlpha[j] = 255;
+        }
+        else if( panSrcData[j] >= 92 && panSrcData[j] <= 100 )
+        {
+            pabyRed[j] = 112;
+            pabyGreen[j] = 187;
+            pabyBlue[j] = 0;
+            pabyAlpha[j] = 255;
+        }
+        else if( panSrcData[j] >= 101 && panSrcData[j] <= 5000 )
+        {
+            pabyRed[j] = 112;
+            pabyGreen[j] = 188;
+            pabyBlue[j] = 0;
+            pabyAlpha[j] = 255;
+        }
+        else if( panSrcData[j] == 10000 )
+        {
+            pabyRed[j] = 0;
+            pabyGreen[j] = 0;
+            pabyBlue[j] = 255;
+            pabyAlpha[j] = 255;
+        }
+        else if( panSrcData[j] == 20000 )
+        {
+            pabyRed[j] = 255;
+            pabyGreen[j] = 0;
+            pabyBlue[j] = 0;
+            pabyAlpha[j] = 255;
+        }
+    }
+    for( j = 0; j < nXSize; j++ )
+    {
+        pabyRGBA[j * 4] = pabyRed[j];
+        pabyRGBA[j * 4 + 1] = pabyGreen[j];
+        pabyRGBA[j * 4 + 2] = pabyBlue[j];
+        pabyRGBA[j * 4 + 3] = pabyAlpha[j];
+    }
+    CPLFree( pabyRed );
+    CPLFree( pabyGreen );
+    CPLFree( pabyBlue );
+    CPLFree( pabyAlpha );
+}
+
+/*
+** Check the span of pixels a kernel reported against the pixels of pabyOut,
+** nBands per pixel with the last one zero when transparent.
+*/
+static int CheckSpan( const char *pszKernel, const GByte *pabyOut,
+                      int nBands, int nCount, int bAny, size_t nFirst,
+                      size_t nLast, const char *pszWhat )
+{
+    int i, iFirst = -1, iLast = -1;
+
+    for( i = 0; i < nCount; i++ )
+    {
+        if( pabyOut[i * nBands + nBands - 1] == 0 )
+            continue;
+        if( iFirst < 0 )
+            iFirst = i;
+        iLast = i;
+    }
+    if( bAny != ( iFirst >= 0 ) ||
+        ( bAny && ( (int) nFirst != iFirst || (int) nLast != iLast ) ) )
+    {
+        printf( "%s() found span %d %d-%d, not %d %d-%d on %s\n", pszKernel,
+                bAny, bAny ? (int) nFirst : -1, bAny ? (int) nLast : -1,
+                iFirst >= 0, iFirst, iLast, pszWhat );
+        return 1;
+    }
+    return 0;
+}
+
+/*
+** Classify nCount values from iStart of panSrc to RGBA and to palette
+** indices, and compare both with the baseline.  The kernel outputs start
+** out filled with junk, so a pixel they skip or one written past the end
+** shows up too.  Returns the differences.
+*/
+static int CompareRun( const RLColorTable *psTable, const GInt32 *panSrc,
+                       int iStart, int nCount, const GInt32 *pnNoData )
+{
+    GByte abyExpected[RL_TEST_MAX_RUN * 4];
+    GByte abyRGBA[RL_TEST_MAX_RUN * 4];
+    GByte abyIndex[RL_TEST_MAX_RUN];
+    GByte abySpanIndex[RL_TEST_MAX_RUN];
+    GByte abyPaletted[RL_TEST_MAX_RUN * 4];
+    char szWhat[80];
+    size_t nFirst = 0, nLast = 0;
+    int nDiffs = 0, bAny, i;
+
+    if( pnNoData )
+        sprintf( szWhat, "%d values from %d, nodata %d", nCount, iStart,
+                 *pnNoData );
+    else
+        sprintf( szWhat, "%d values from %d, no nodata", nCount, iStart );
+    panSrc += iStart;
+    BaselineClassify( panSrc, pnNoData ? *pnNoData : RL_BASELINE_NO_NODATA,
+                      abyExpected, nCount );
+
+    memset( abyRGBA, RL_TEST_JUNK, sizeof( abyRGBA ) );
+    RLClassifyInt32( psTable, panSrc, pnNoData, abyRGBA, nCount, NULL,
+                     NULL );
+    if( memcmp( abyExpected, abyRGBA, (size_t) nCount * 4 ) != 0 )
+    {
+        printf( "RLClassifyInt32() differs on %s\n", szWhat );
+        nDiffs++;
+    }
+    memset( abyRGBA, RL_TEST_JUNK, sizeof( abyRGBA ) );
+    bAny = RLClassifyInt32( psTable, panSrc, pnNoData, abyRGBA, nCount,
+                            &nFirst, &nLast );
+    if( memcmp( abyExpected, abyRGBA, (size_t) nCount * 4 ) != 0 )
+    {
+        printf( "RLClassifyInt32() differs finding the span on %s\n",
+                szWhat );
+        nDiffs++;
+    }
+    nDiffs += CheckSpan( "RLClassifyInt32", abyExpected, 4, nCount, bAny,
+                         nFirst, nLast, szWhat );
+    for( i = nCount * 4; i < RL_TEST_MAX_RUN * 4; i++ )
+    {
+        if( abyRGBA[i] != RL_TEST_JUNK )
+        {
+            printf( "RLClassifyInt32() wrote past the end on %s\n", szWhat );
+            nDiffs++;
+            break;
+        }
+    }
+
+    memset( abyIndex, RL_TEST_JUNK, sizeof( abyIndex ) );
+    RLClassifyInt32ToIndex( psTable, panSrc, pnNoData, abyIndex, nCount,
+                            NULL, NULL );
+    memset( abySpanIndex, RL_TEST_JUNK, sizeof( abySpanIndex ) );
+    bAny = RLClassifyInt32ToIndex( psTable, panSrc, pnNoData, abySpanIndex,
+                                   nCount, &nFirst, &nLast );
+    if( memcmp( abyIndex, abySpanIndex, sizeof( abyIndex ) ) != 0 )
+    {
+        printf( "RLClassifyInt32ToIndex() differs finding the span on %s\n",
+                szWhat );
+        nDiffs++;
+    }
+    nDiffs += CheckSpan( "RLClassifyInt32ToIndex", abyIndex, 1, nCount, bAny,
+                         nFirst, nLast, szWhat );
+    for( i = nCount; i < RL_TEST_MAX_RUN; i++ )
+    {
+        if( abyIndex[i] != RL_TEST_JUNK )
+        {
+            printf( "RLClassifyInt32ToIndex() wrote past the end on %s\n",
+                    szWhat );
+            nDiffs++;
+            break;
+        }
+    }
+    for( i = 0; i < nCount; i++ )
+    {
+        if( abyIndex[i] >= psTable->nPaletteCount )
+        {
+            printf( "RLClassifyInt32ToIndex() wrote entry %d of %d on %s\n",
+                    abyIndex[i], psTable->nPaletteCount, szWhat );
+            return nDiffs + 1;
+        }
+        memcpy( abyPaletted + i * 4, psTable->pabyPalette + abyIndex[i] * 4,
+                4 );
+    }
+    if( memcmp( abyExpected, abyPaletted, (size_t) nCount * 4 ) != 0 )
+    {
+        printf( "RLClassifyInt32ToIndex() differs on %s\n", szWhat );
+        nDiffs++;
+    }
+    return nDiffs;
+}
+
+static const char * KernelName( void )
+{
+#if defined(RL_NO_SIMD)
+    return "scalar";
+#elif defined(__AVX2__)
+    return "AVX2";
+#elif defined(__SSE2__)
+    return "SSE2";
+#else
+    return "scalar";
+#endif
+}
+
+int main( int argc, char *argv[] )
+{
+    RLColorTable *psTable;
+    GInt32 *panValues, anNoData[4];
+    const GInt32 *pnNoData;
+    int nValues, nEdges, iNoData, iStart, nCount, i;
+    int nRuns = 0, nDiffs = 0;
+
+    (void) argc;
+    (void) argv;
+
+#if defined(__AVX2__) && !defined(RL_NO_SIMD) && defined(__GNUC__)
+    if( !__builtin_cpu_supports( "avx2" ) )
+    {
+        printf( "No AVX2 on this cpu\n" );
+        return RL_TEST_SKIP;
+    }
+#endif
+
+    /* The default remap, the one the chain hard codes */
+    psTable = RLCreateColorTable( NULL );
+    if( !psTable )
+        return RL_ERR;
+
+    /*
+    ** The edge values, then again shuffled against each other so every
+    ** lane of a vector sees every kind of value.
+    */
+    nEdges = sizeof( anEdgeValues ) / sizeof( anEdgeValues[0] );
+    nValues = nEdges * 3;
+    panValues = (GInt32*) CPLMalloc( sizeof( GInt32 ) * nValues );
+    for( i = 0; i < nEdges; i++ )
+    {
+        panValues[i] = anEdgeValues[i];
+        panValues[nEdges + i] = anEdgeValues[nEdges - 1 - i];
+        panValues[2 * nEdges + i] = anEdgeValues[( i * 7 ) % nEdges];
+    }
+
+    /* No nodata (entry 0 is unused), the usual one, 0 and one in a class */
+    anNoData[0] = 0;
+    anNoData[1] = -9999;
+    anNoData[2] = 0;
+    anNoData[3] = 15;
+
+    for( iNoData = 0; iNoData < 4; iNoData++ )
+    {
+        pnNoData = iNoData == 0 ? NULL : anNoData + iNoData;
+        /* Every start, so runs are unaligned and end on every tail length */
+        for( iStart = 0; iStart < nValues; iStart++ )
+        {
+            for( nCount = 0; nCount <= RL_TEST_MAX_RUN &&
+                 iStart + nCount <= nValues; nCount++ )
+            {
+                nDiffs += CompareRun( psTable, panValues, iStart, nCount,
+                                      pnNoData );
+                nRuns++;
+                if( nDiffs >= RL_TEST_MAX_REPORTS )
+                    break;
+            }
+            if( nDiffs >= RL_TEST_MAX_REPORTS )
+                break;
+        }
+    }
+    printf( "%s kernels, %s: %d runs, %d differ\n", KernelName(),
+            psTable->panLut ? "lookup table" : "breakpoint search", nRuns,
+            nDiffs );
+
+    CPLFree( panValues );
+    RLDestroyColorTable( psTable );
+    return nDiffs == 0 ? RL_OK : RL_ERR;
+}
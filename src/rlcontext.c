@@ -0,0 +1,2557 @@
+/******************************************************************************
+*
+*  Project:  rl2kmz
+*  Purpose:  conversion of rain and lightning grids with warm shared state
+*  Author:   Kyle Shannon <kyle at pobox dot com>
+*
+*******************************************************************************
+*
+* This is free and unencumbered software released into the public domain.
+*
+* Anyone is free to copy, modify, publish, use, compile, sell, or
+* distribute this software, either in source code form or as a compiled
+* binary, for any purpose, commercial or non-commercial, and by any
+* means.
+*
+* In jurisdictions that recognize copyright laws, the author or authors
+* of this software dedicate any and all copyright interest in the
+* software to the public domain. We make this dedication for the benefit
+* of the public at large and to the detriment of our heirs and
+* successors. We intend this dedication to be an overt act of
+* relinquishment in perpetuity of all present and future rights to this
+* software under copyright law.
+*
+* THIS SOFTWARE WAS DEVELOPED AT THE ROCKY MOUNTAIN RESEARCH STATION (RMRS)
+* MISSOULA FIRE SCIENCES LABORATORY BY EMPLOYEES OF THE FEDERAL GOVERNMENT
+* IN THE COURSE OF THEIR OFFICIAL DUTIES. PURSUANT TO TITLE 17 SECTION 105
+* OF THE UNITED STATES CODE, THIS SOFTWARE IS NOT SUBJECT TO COPYRIGHT
+* PROTECTION AND IS IN THE PUBLIC DOMAIN. RMRS MISSOULA FIRE SCIENCES
+* LABORATORY ASSUMES NO RESPONSIBILITY WHATSOEVER FOR ITS USE BY OTHER
+* PARTIES,  AND MAKES NO GUARANTEES, EXPRESSED OR IMPLIED, ABOUT ITS QUALITY,
+* RELIABILITY, OR ANY OTHER CHARACTERISTIC.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+* IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+* OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+* ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+* OTHER DEALINGS IN THE SOFTWARE.
+*
+* For more information, please refer to <http://unlicense.org>
+*
+******************************************************************************/
+
+#include <math.h>
+#include <signal.h>
+
+#include "gdal.h"
+#include "gdalwarper.h"
+#include "ogr_api.h"
+#include "cpl_string.h"
+#include "cpl_conv.h"
+#include "cpl_atomic_ops.h"
+#include "cpl_multiproc.h"
+
+#include "rlcontext.h"
+#include "rlasset.h"
+#include "rlcolor.h"
+#include "rlkml.h"
+#include "rlkmz.h"
+#include "rlperf.h"
+#include "rlpng.h"
+#include "rlraster.h"
+#include "rlstrike.h"
+#include "rltile.h"
+#include "rlutil.h"
+#include "rlwarp.h"
+
+#ifndef RL_OGR_STYLE_BLACK_NO_FILL
+#define RL_OGR_STYLE_BLACK_NO_FILL "PEN(c:#000000FF,w:2px);BRUSH(fc:#A9A9A9FF)"
+#endif
+#ifndef RL_OGR_STYLE_RED_NO_FILL
+#define RL_OGR_STYLE_RED_NO_FILL   "PEN(c:#FF0000FF,w:1px);BRUSH(fc:#e9967AFF)"
+#endif
+
+#define RL_IMAGE_TITLE        0
+#define RL_IMAGE_LEGEND       1
+#define RL_IMAGE_POLY_LEGEND  2
+#define RL_IMAGE_COUNT        3
+
+/*
+** Format of the manifest kept next to each kmz in incremental mode, bumped
+** whenever what goes into its keys changes.
+*/
+#define RL_MANIFEST_VERSION   1
+
+/*
+** Entry of the overlay png of each step of an animation.
+*/
+#define RL_SERIES_PNG         "layers/rainandlightning_%04d.png"
+
+/*
+** Without a memory_limit, the source grids held by the workers of a series
+** may take up to this fraction of the physical memory.
+*/
+#ifndef RL_SERIES_RAM_FRACTION
+#define RL_SERIES_RAM_FRACTION 0.25
+#endif
+
+/*
+** A reduced copy of each kmz for slow links and small screens, written to
+** dst_suffix.kmz next to it.
+*/
+typedef struct
+{
+    char *pszSuffix;
+    /* Target cell size in degrees, or the longest side in pixels */
+    double dfCellSize;
+    int nMaxPixels;
+} RLReducedOutput;
+
+/*
+** An input read once and kept, along with the size and content hash it
+** had, so it is only loaded again when it changes.
+*/
+typedef struct
+{
+    const char *pszFile;
+    int bLoaded;
+    GIntBig nFileSize;
+    GUIntBig nHash;
+    /* Anything besides the file the data was loaded with */
+    char *pszVariant;
+    RLBuffer sData;
+} RLWarmFile;
+
+struct RLContext
+{
+    char **papszConfig;
+    RLColorTable *psColorTable;
+
+    int nThreads;
+    int nJobs;
+    double dfWarpMemory;
+    /* Ceiling on the raster working memory of one conversion, 0 for none */
+    double dfMemoryLimit;
+    int bWarpFirst;
+    int bSuperOverlay;
+    int nTileSize;
+    int bPalette;
+    int nPngBands;
+    /* Filter and deflate of the overlay pngs, and of the kml entries */
+    RLPngOptions sPngOptions;
+    RLDeflateOptions sKmzOptions;
+
+    /* Borrowed from papszConfig */
+    const char *pszCacheDir;
+    const char *pszDateFile;
+    const char *pszExtremeStyle;
+    const char *pszCriticalStyle;
+
+    /* File each conversion appends a line of JSON timings to, or NULL */
+    const char *pszPerfLog;
+    CPLMutex *hPerfMutex;
+
+    /* Polygon simplification tolerance in overlay pixels, and clipping */
+    double dfSimplify;
+    int bClipPolygons;
+
+    /* Skip grids whose kmz is up to date with dst_file.manifest */
+    int bIncremental;
+
+    /* Reduced copies of the single overlay, from the same pass */
+    int nReducedCount;
+    RLReducedOutput *pasReduced;
+
+    /* Write the strikes as a point layer, with this many clustered levels */
+    int bStrikePoints;
+    int nStrikeLevels;
+    /* RGBA of each colour class, kept before strikes are hidden */
+    GByte *pabyClassColors;
+
+    /* Held while the warm polygons and images are checked and read */
+    CPLMutex *hPolygonMutex;
+    CPLMutex *hImageMutex;
+    /* Placemark kml of the polygons, and the name of their layer */
+    RLWarmFile sPolygons;
+    char *pszLayerName;
+    RLWarmFile asImages[RL_IMAGE_COUNT];
+
+    /* Set by RLStopWatching(), possibly from a signal handler */
+    volatile sig_atomic_t bStopWatching;
+};
+
+/*
+** The warped grid of one conversion and the window of it that is written.
+*/
+typedef struct
+{
+    GDALDatasetH hRainDS;
+    /* Unset for a grid handed in by the caller, which they close */
+    int bOwnRainDS;
+    GDALDatasetH hMemDS;
+    GDALDatasetH hWarpDS;
+    RLWarpedGrid *psWarpGrid;
+    GByte *pabyColors;
+    int nXSize;
+    int nYSize;
+    double adfGeoTransform[6];
+    int anPngWindow[4];
+    /* North, south, east and west of the window */
+    double adfBox[4];
+    /* Strikes found by the scan, with strike points on */
+    RLStrikeIndex sStrikes;
+} RLOverlay;
+
+/*
+** What one conversion takes of the warm polygons and images.  The polygon
+** and image branches fill in their own halves on their own threads.
+*/
+typedef struct
+{
+    RLContext *psCtx;
+    RLPerf *psPerf;
+    CPLErr ePolygonErr;
+    char *pszFolder;
+    RLBuffer sPlacemarks;
+    /* Simplification tolerance in degrees, and north, south, east and west
+       of the box polygons are clipped to */
+    double dfTolerance;
+    int bClip;
+    double adfClipBox[4];
+    CPLErr eImageErr;
+    RLBuffer asImages[RL_IMAGE_COUNT];
+} RLStaticParts;
+
+typedef CPLErr (*RLLoadFunc)( RLContext *psCtx, RLWarmFile *psFile,
+                              void *pUserData );
+
+/*
+** Batch of conversions shared by the workers of RLRunJobs().
+*/
+typedef struct
+{
+    RLContext *psCtx;
+    char **papszSrcFiles;
+    char **papszDstFiles;
+    int nJobCount;
+    volatile int nNextJob;
+    volatile int nErrors;
+} RLJobQueue;
+
+/*
+** One step of an animation: its grid, the span of time it is shown for,
+** and the window of the warped grid over its data.
+*/
+typedef struct
+{
+    const char *pszSrcFile;
+    const char *pszBegin;
+    const char *pszEnd;
+    int anPngWindow[4];
+    /* North, south, east and west of the window */
+    double adfBox[4];
+} RLSeriesStep;
+
+/*
+** Steps of an animation shared by the workers of RLProcessSeries(), which
+** scan them all, then render them once doc.kml is written.
+*/
+typedef struct
+{
+    RLContext *psCtx;
+    RLSeriesStep *pasSteps;
+    int nStepCount;
+    /* Warped grid of the first step, every other one gathers through its
+       index map */
+    RLWarpedGrid *psFirstGrid;
+    char **papszWarpOptions;
+    int nSrcXSize;
+    int nSrcYSize;
+    double adfSrcGeoTransform[6];
+    int nXSize;
+    int nYSize;
+    double adfGeoTransform[6];
+    int bRender;
+    RLKmzWriter *psKmz;
+    CPLMutex *hKmzMutex;
+    volatile int nNextStep;
+    volatile int nErrors;
+} RLSeriesQueue;
+
+static const char * FetchConfigOption( char **papszConfig,
+                                       const char *pszKey,
+                                       const char *pszDefault )
+{
+    const char *pszValue;
+    pszValue = CSLFetchNameValue( papszConfig, pszKey );
+    if( pszValue == NULL )
+    {
+        if( pszDefault )
+        {
+            CPLError( CE_Warning, CPLE_AppDefined,
+                      "Could not find value in configuration, " \
+                      "using default of %s", pszDefault );
+            return pszDefault;
+        }
+        else
+        {
+            return NULL;
+        }
+    }
+    return pszValue;
+}
+
+/*
+** Parse one suffix:size entry of reduced_outputs.
+*/
+static int ParseReducedOutput( const char *pszEntry,
+                               RLReducedOutput *psOutput )
+{
+    const char *pszSize;
+    size_t nLen;
+
+    memset( psOutput, 0, sizeof( RLReducedOutput ) );
+    pszSize = strchr( pszEntry, ':' );
+    if( pszSize && pszSize != pszEntry )
+    {
+        nLen = strlen( ++pszSize );
+        if( nLen > 2 && EQUAL( pszSize + nLen - 2, "px" ) )
+            psOutput->nMaxPixels = atoi( pszSize );
+        else
+            psOutput->dfCellSize = CPLAtof( pszSize );
+    }
+    if( psOutput->nMaxPixels <= 0 && psOutput->dfCellSize <= 0.0 )
+    {
+        CPLError( CE_Failure, CPLE_AppDefined,
+                  "Invalid reduced output %s, expected suffix:cell_size " \
+                  "or suffix:pixelspx", pszEntry );
+        return RL_ERR;
+    }
+    psOutput->pszSuffix = CPLStrdup( pszEntry );
+    psOutput->pszSuffix[pszSize - 1 - pszEntry] = '\0';
+    return RL_OK;
+}
+
+/*
+** Create a context from the parsed config file, which is copied.  The
+** polygons and images are read on the first conversion.
+*/
+RLContext * RLCreateContext( char **papszConfig )
+{
+    RLContext *psCtx;
+    char **papszTokens;
+    const char *pszStrikes;
+    int i;
+
+    psCtx = (RLContext*) CPLCalloc( 1, sizeof( RLContext ) );
+    psCtx->papszConfig = CSLDuplicate( papszConfig );
+    papszConfig = psCtx->papszConfig;
+
+    /* Image file for legend */
+    psCtx->asImages[RL_IMAGE_LEGEND].pszFile =
+        FetchConfigOption( papszConfig, "dry_ltng_legend",
+                           "dry_ltng_legend.png" );
+    /* Title image file */
+    psCtx->asImages[RL_IMAGE_TITLE].pszFile =
+        FetchConfigOption( papszConfig, "dry_ltng_title",
+                           "dry_ltng_title.png" );
+    /* Polygon legend image file */
+    psCtx->asImages[RL_IMAGE_POLY_LEGEND].pszFile =
+        FetchConfigOption( papszConfig, "poly_legend",
+                           "/fsfiles/office/wfas2/dir-key/critical.png" );
+    /* File to look for polygons in */
+    psCtx->sPolygons.pszFile =
+        FetchConfigOption( papszConfig, "poly_kml",
+                           "/fsfiles/office/wfas2/dir-kml/" \
+                           "spc_day1firewx.kmz" );
+    /* Date string file */
+    psCtx->pszDateFile = FetchConfigOption( papszConfig, "date_file", NULL );
+
+    psCtx->pszExtremeStyle =
+        FetchConfigOption( papszConfig, "extreme_style",
+                           RL_OGR_STYLE_BLACK_NO_FILL );
+    psCtx->pszCriticalStyle =
+        FetchConfigOption( papszConfig, "critical_style",
+                           RL_OGR_STYLE_RED_NO_FILL );
+    psCtx->pszCacheDir = CSLFetchNameValue( papszConfig, "cache_dir" );
+    psCtx->pszPerfLog = CSLFetchNameValue( papszConfig, "perf_log" );
+
+    /*
+    ** Simplify the polygons to a fraction of an overlay pixel, and clip
+    ** them to the warped grid.
+    */
+    psCtx->dfSimplify = CPLAtof( CSLFetchNameValueDef( papszConfig,
+                                                       "poly_simplify",
+                                                       "0" ) );
+    psCtx->bClipPolygons = CPLTestBool( CSLFetchNameValueDef( papszConfig,
+                                                              "poly_clip",
+                                                              "NO" ) );
+    /*
+    ** Keep a manifest of the inputs next to each kmz, and only convert
+    ** again once they change.
+    */
+    psCtx->bIncremental = CPLTestBool( CSLFetchNameValueDef( papszConfig,
+                                                             "incremental",
+                                                             "NO" ) );
+
+    /* Worker threads for the raster stages of each conversion */
+    psCtx->nThreads =
+        RLGetThreadCount( CSLFetchNameValue( papszConfig, "num_threads" ) );
+    /* Conversions run at once in batch and watch mode */
+    psCtx->nJobs = atoi( CSLFetchNameValueDef( papszConfig,
+                                               "concurrent_jobs", "1" ) );
+    if( psCtx->nJobs < 1 )
+        psCtx->nJobs = 1;
+    /* Working memory of one warp chunk, in megabytes */
+    psCtx->dfWarpMemory = CPLAtof( CSLFetchNameValueDef( papszConfig,
+                                                         "warp_memory",
+                                                         "256" ) );
+    if( psCtx->dfWarpMemory <= 0.0 )
+        psCtx->dfWarpMemory = 256.0;
+    psCtx->dfWarpMemory *= 1024.0 * 1024.0;
+
+    /*
+    ** Warp the Int32 grid and colourize on the way to the png, or
+    ** colourize the full grid and warp RGBA.  Both are identical with
+    ** nearest neighbour resampling.
+    */
+    psCtx->bWarpFirst = !EQUAL( CSLFetchNameValueDef( papszConfig,
+                                                      "pipeline",
+                                                      "warp_first" ),
+                                "colorize_first" );
+
+    /*
+    ** A single ground overlay, or a super-overlay pyramid of tiles with
+    ** regions for large grids.  Tiles are cut from the warp_first grid.
+    */
+    psCtx->bSuperOverlay = EQUAL( CSLFetchNameValueDef( papszConfig,
+                                                        "overlay",
+                                                        "single" ),
+                                  "superoverlay" );
+    psCtx->nTileSize =
+        atoi( CSLFetchNameValueDef( papszConfig, "tile_size",
+                                    CPLSPrintf( "%d", RL_TILE_SIZE ) ) );
+    if( psCtx->bSuperOverlay && !psCtx->bWarpFirst )
+    {
+        CPLError( CE_Warning, CPLE_AppDefined,
+                  "A super-overlay needs the warp_first pipeline, using it" );
+        psCtx->bWarpFirst = TRUE;
+    }
+
+    /*
+    ** Streaming with a memory ceiling, in megabytes, shared by the
+    ** concurrent conversions.  Only warp_first streams the grid through
+    ** in windows, colorize_first holds a colour buffer of all of it.  Half
+    ** goes to each warp chunk, the rest to the png strips, the scan
+    ** chunks and the encoders.  GDAL's block cache is left to
+    ** GDAL_CACHEMAX.
+    */
+    psCtx->dfMemoryLimit = CPLAtof( CSLFetchNameValueDef( papszConfig,
+                                                          "memory_limit",
+                                                          "0" ) );
+    if( psCtx->dfMemoryLimit > 0.0 )
+    {
+        psCtx->dfMemoryLimit *= 1024.0 * 1024.0 / psCtx->nJobs;
+        if( !psCtx->bWarpFirst )
+        {
+            CPLError( CE_Warning, CPLE_AppDefined,
+                      "memory_limit needs the warp_first pipeline, using it" );
+            psCtx->bWarpFirst = TRUE;
+        }
+        psCtx->dfWarpMemory = MIN( psCtx->dfWarpMemory,
+                                   psCtx->dfMemoryLimit / 2.0 );
+        CPLDebug( "RL2KMZ", "Streaming in %.0f MB per conversion, warp " \
+                  "chunks of %.0f MB", psCtx->dfMemoryLimit / 1048576.0,
+                  psCtx->dfWarpMemory / 1048576.0 );
+    }
+    else
+    {
+        psCtx->dfMemoryLimit = 0.0;
+    }
+
+    /*
+    ** Reduced copies, suffix:size entries where size is a cell size in
+    ** degrees or the longest side with px after it.  They are cut from
+    ** the warped grid as the full overlay is encoded.
+    */
+    papszTokens = CSLTokenizeString2( CSLFetchNameValueDef( papszConfig,
+                                                            "reduced_outputs",
+                                                            "" ),
+                                      " ,", 0 );
+    if( CSLCount( papszTokens ) > 0 &&
+        ( !psCtx->bWarpFirst || psCtx->bSuperOverlay ) )
+    {
+        CPLError( CE_Warning, CPLE_AppDefined,
+                  "reduced_outputs need a single overlay and the " \
+                  "warp_first pipeline, not writing them" );
+        CSLDestroy( papszTokens );
+        papszTokens = NULL;
+    }
+    for( i = 0; papszTokens && papszTokens[i]; i++ )
+    {
+        psCtx->pasReduced = (RLReducedOutput*)
+            CPLRealloc( psCtx->pasReduced, sizeof( RLReducedOutput ) *
+                        ( psCtx->nReducedCount + 1 ) );
+        if( ParseReducedOutput( papszTokens[i], psCtx->pasReduced +
+                                psCtx->nReducedCount ) != RL_OK )
+        {
+            CSLDestroy( papszTokens );
+            RLDestroyContext( psCtx );
+            return NULL;
+        }
+        psCtx->nReducedCount++;
+    }
+    CSLDestroy( papszTokens );
+
+    /* Colour table, color_ entries or the default remap */
+    psCtx->psColorTable = RLCreateColorTable( papszConfig );
+    if( !psCtx->psColorTable )
+    {
+        RLDestroyContext( psCtx );
+        return NULL;
+    }
+
+    /*
+    ** Lightning strikes, the classes marked keep, drawn in the overlay,
+    ** as clustered point placemarks found in the scan, or both.  With
+    ** points only they are transparent in the overlay.
+    */
+    pszStrikes = CSLFetchNameValueDef( papszConfig, "strikes", "raster" );
+    psCtx->bStrikePoints = EQUAL( pszStrikes, "points" ) ||
+                           EQUAL( pszStrikes, "both" );
+    psCtx->nStrikeLevels =
+        atoi( CSLFetchNameValueDef( papszConfig, "strike_levels",
+                                    CPLSPrintf( "%d", RL_STRIKE_LEVELS ) ) );
+    psCtx->nStrikeLevels = MAX( 0, MIN( psCtx->nStrikeLevels, 8 ) );
+    psCtx->pabyClassColors =
+        (GByte*) CPLMalloc( MAX( 1, psCtx->psColorTable->nClassCount ) * 4 );
+    for( i = 0; i < psCtx->psColorTable->nClassCount; i++ )
+        memcpy( psCtx->pabyClassColors + i * 4,
+                psCtx->psColorTable->pasClasses[i].abyRGBA, 4 );
+    if( EQUAL( pszStrikes, "points" ) )
+        RLHideKeptClasses( psCtx->psColorTable );
+
+    /* Paletted or RGBA ground overlay */
+    psCtx->bPalette = EQUAL( CSLFetchNameValueDef( papszConfig,
+                                                   "png_format", "palette" ),
+                             "palette" );
+    if( psCtx->bPalette && psCtx->psColorTable->nPaletteCount == 0 )
+    {
+        CPLError( CE_Warning, CPLE_AppDefined,
+                  "Too many colours for a paletted png, writing RGBA" );
+        psCtx->bPalette = FALSE;
+    }
+    psCtx->nPngBands = psCtx->bPalette ? 1 : 4;
+
+    /*
+    ** Row filter, zlib level and strategy of the pngs and of the
+    ** compressed kmz entries, with deflate_threads deflating large ones
+    ** in parallel blocks.
+    */
+    RLPngGetOptions( papszConfig, &psCtx->sPngOptions );
+    RLDeflateGetOptions( papszConfig, "kmz", &psCtx->sKmzOptions );
+
+    return psCtx;
+}
+
+void RLDestroyContext( RLContext *psCtx )
+{
+    int i;
+    if( !psCtx )
+        return;
+    RLDestroyColorTable( psCtx->psColorTable );
+    RLBufferFree( &psCtx->sPolygons.sData );
+    CPLFree( psCtx->sPolygons.pszVariant );
+    for( i = 0; i < RL_IMAGE_COUNT; i++ )
+        RLBufferFree( &psCtx->asImages[i].sData );
+    CPLFree( psCtx->pszLayerName );
+    for( i = 0; i < psCtx->nReducedCount; i++ )
+        CPLFree( psCtx->pasReduced[i].pszSuffix );
+    CPLFree( psCtx->pasReduced );
+    CPLFree( psCtx->pabyClassColors );
+    if( psCtx->hPolygonMutex )
+        CPLDestroyMutex( psCtx->hPolygonMutex );
+    if( psCtx->hImageMutex )
+        CPLDestroyMutex( psCtx->hImageMutex );
+    if( psCtx->hPerfMutex )
+        CPLDestroyMutex( psCtx->hPerfMutex );
+    CSLDestroy( psCtx->papszConfig );
+    CPLFree( psCtx );
+}
+
+/*
+** Number of conversions RLRunJobs() and RLWatchDirectory() run at once.
+*/
+int RLGetJobCount( const RLContext *psCtx )
+{
+    return psCtx->nJobs;
+}
+
+/*
+** Read the bytes of a static image.
+*/
+static CPLErr LoadImage( RLContext *psCtx, RLWarmFile *psFile,
+                         void *pUserData )
+{
+    GByte *pabyData;
+    vsi_l_offset nSize;
+
+    (void) pUserData;
+    pabyData = RLReadAsset( psFile->pszFile, &nSize );
+    if( !pabyData )
+        return CE_Failure;
+    RLBufferFree( &psFile->sData );
+    psFile->sData.pabyData = pabyData;
+    psFile->sData.nSize = (size_t) nSize;
+    psFile->sData.nAlloc = (size_t) nSize;
+    return CE_None;
+}
+
+/*
+** Clip the geometry of hFeature to the box hClip and simplify it, if asked
+** to.  Returns FALSE if nothing of it is left.
+*/
+static int PrepareGeometry( OGRFeatureH hFeature, OGRGeometryH hClip,
+                            double dfTolerance )
+{
+    OGRGeometryH hGeom, hNew;
+
+    hGeom = OGR_F_GetGeometryRef( hFeature );
+    if( !hGeom )
+        return TRUE;
+    if( hClip )
+    {
+        if( !OGR_G_Intersects( hGeom, hClip ) )
+            return FALSE;
+        if( !OGR_G_Within( hGeom, hClip ) )
+        {
+            hNew = OGR_G_Intersection( hGeom, hClip );
+            if( !hNew || OGR_G_IsEmpty( hNew ) )
+            {
+                OGR_G_DestroyGeometry( hNew );
+                return FALSE;
+            }
+            OGR_F_SetGeometryDirectly( hFeature, hNew );
+            hGeom = hNew;
+        }
+    }
+    if( dfTolerance > 0.0 )
+    {
+        hNew = OGR_G_SimplifyPreserveTopology( hGeom, dfTolerance );
+        if( hNew && !OGR_G_IsEmpty( hNew ) )
+            OGR_F_SetGeometryDirectly( hFeature, hNew );
+        else
+            OGR_G_DestroyGeometry( hNew );
+    }
+    return TRUE;
+}
+
+/*
+** Polygon over the north, south, east and west box padfBox.
+*/
+static OGRGeometryH CreateBoxPolygon( const double *padfBox )
+{
+    OGRGeometryH hRing, hPoly;
+
+    hRing = OGR_G_CreateGeometry( wkbLinearRing );
+    OGR_G_AddPoint_2D( hRing, padfBox[3], padfBox[0] );
+    OGR_G_AddPoint_2D( hRing, padfBox[2], padfBox[0] );
+    OGR_G_AddPoint_2D( hRing, padfBox[2], padfBox[1] );
+    OGR_G_AddPoint_2D( hRing, padfBox[3], padfBox[1] );
+    OGR_G_AddPoint_2D( hRing, padfBox[3], padfBox[0] );
+    hPoly = OGR_G_CreateGeometry( wkbPolygon );
+    OGR_G_AddGeometryDirectly( hPoly, hRing );
+    return hPoly;
+}
+
+/*
+** RLDeriveFunc rendering the polygons, except the Elevated areas, as
+** placemarks, with the Extreme and Critical areas styled from the config.
+** pUserData is the RLStaticParts with the clip box and tolerance.  The
+** result is the name of the layer and its terminator, then the kml.
+*/
+static GByte * RenderPolygons( const char *pszFile, vsi_l_offset *pnSize,
+                               void *pUserData )
+{
+    const RLStaticParts *psParts = (const RLStaticParts*) pUserData;
+    GDALDatasetH hKmlIn;
+    OGRLayerH hLayerIn, hSqlLayer;
+    OGRFeatureH hFeature;
+    OGRGeometryH hClip;
+    RLKmlPlacemarkPlan *psPlan;
+    RLBuffer sPlacemarks;
+    char **papszStyleMap;
+    const char *pszLayerName, *pszSql;
+
+    hKmlIn = OGROpen( pszFile, FALSE, NULL );
+    if( !hKmlIn )
+    {
+        CPLError( CE_Failure, CPLE_OpenFailed, "Could not open %s", pszFile );
+        return NULL;
+    }
+    hLayerIn = GDALDatasetGetLayer( hKmlIn, 0 );
+    pszLayerName = OGR_L_GetName( hLayerIn );
+    pszSql = CPLSPrintf( "SELECT * FROM \"%s\" WHERE " RL_POLYGON_FILTER " " \
+                         "ORDER BY Name ASC", pszLayerName );
+    hSqlLayer = GDALDatasetExecuteSQL( hKmlIn, pszSql, NULL, NULL );
+    if( !hSqlLayer )
+    {
+        GDALClose( hKmlIn );
+        return NULL;
+    }
+
+    /* Fields and styles are worked out once for the whole layer */
+    papszStyleMap = CSLSetNameValue( NULL, "Extreme", "extreme" );
+    papszStyleMap = CSLSetNameValue( papszStyleMap, "Critical", "critical" );
+    psPlan = RLKmlCreatePlacemarkPlan( OGR_L_GetLayerDefn( hSqlLayer ),
+                                       "Name", papszStyleMap );
+    CSLDestroy( papszStyleMap );
+
+    hClip = psParts->bClip ? CreateBoxPolygon( psParts->adfClipBox ) : NULL;
+    memset( &sPlacemarks, 0, sizeof( sPlacemarks ) );
+    RLBufferWrite( pszLayerName, strlen( pszLayerName ) + 1, &sPlacemarks );
+    OGR_L_ResetReading( hSqlLayer );
+    while( ( hFeature = OGR_L_GetNextFeature( hSqlLayer ) ) != NULL )
+    {
+        if( !PrepareGeometry( hFeature, hClip, psParts->dfTolerance ) )
+        {
+            OGR_F_Destroy( hFeature );
+            continue;
+        }
+        RLKmlWritePlacemark( &sPlacemarks, psPlan, hFeature );
+        OGR_F_Destroy( hFeature );
+    }
+    GDALDatasetReleaseResultSet( hKmlIn, hSqlLayer );
+    GDALClose( hKmlIn );
+    OGR_G_DestroyGeometry( hClip );
+    RLKmlDestroyPlacemarkPlan( psPlan );
+
+    *pnSize = sPlacemarks.nSize;
+    return sPlacemarks.pabyData;
+}
+
+/*
+** Read the rendered polygons, from the cache when poly_kml hasn't changed
+** since they were last rendered with the same clipping and tolerance.
+*/
+static CPLErr LoadPolygons( RLContext *psCtx, RLWarmFile *psFile,
+                            void *pUserData )
+{
+    GByte *pabyData;
+    vsi_l_offset nSize;
+    size_t nNameLen;
+
+    pabyData = RLReadDerivedAsset( psFile->pszFile, psCtx->pszCacheDir,
+                                   psFile->pszVariant, RenderPolygons,
+                                   pUserData, &nSize );
+    if( !pabyData )
+        return CE_Failure;
+    nNameLen = 0;
+    while( nNameLen < nSize && pabyData[nNameLen] != '\0' )
+        nNameLen++;
+    if( nNameLen == nSize )
+    {
+        CPLError( CE_Failure, CPLE_AppDefined,
+                  "Invalid rendered polygons for %s", psFile->pszFile );
+        VSIFree( pabyData );
+        return CE_Failure;
+    }
+    CPLFree( psCtx->pszLayerName );
+    psCtx->pszLayerName = CPLStrdup( (const char*) pabyData );
+    RLBufferFree( &psFile->sData );
+    RLBufferWrite( pabyData + nNameLen + 1, (size_t) nSize - nNameLen - 1,
+                   &psFile->sData );
+    VSIFree( pabyData );
+    return CE_None;
+}
+
+/*
+** Make sure psFile holds what is in its file, loading it with pfnLoad if
+** it hasn't been yet, or the file or pszVariant have changed since.  A
+** file is taken to be unchanged while its size and content hash are, as
+** for the cache.  If the file can't be reached a copy already loaded with
+** pszVariant is used.  The size of a file loaded is added to *pnBytesRead.
+*/
+static CPLErr RefreshWarmFile( RLContext *psCtx, RLWarmFile *psFile,
+                               const char *pszVariant, RLLoadFunc pfnLoad,
+                               void *pUserData, GUIntBig *pnBytesRead )
+{
+    VSIStatBufL sStat;
+    GUIntBig nHash = RL_HASH_INIT;
+    int bSameVariant;
+
+    bSameVariant = EQUAL( psFile->pszVariant ? psFile->pszVariant : "",
+                          pszVariant ? pszVariant : "" );
+    /* Hashed before loading, a change during it shows up next time */
+    if( VSIStatL( psFile->pszFile, &sStat ) != 0 ||
+        !RLHashFile( psFile->pszFile, &nHash ) )
+    {
+        if( psFile->bLoaded && bSameVariant )
+        {
+            CPLDebug( "RL2KMZ", "Could not read %s, using the loaded copy",
+                      psFile->pszFile );
+            return CE_None;
+        }
+        CPLError( CE_Failure, CPLE_OpenFailed, "Could not read %s",
+                  psFile->pszFile );
+        return CE_Failure;
+    }
+    if( psFile->bLoaded && bSameVariant &&
+        psFile->nFileSize == (GIntBig) sStat.st_size &&
+        psFile->nHash == nHash )
+    {
+        return CE_None;
+    }
+    CPLDebug( "RL2KMZ", "Loading %s", psFile->pszFile );
+    CPLFree( psFile->pszVariant );
+    psFile->pszVariant = pszVariant ? CPLStrdup( pszVariant ) : NULL;
+    psFile->bLoaded = FALSE;
+    if( pfnLoad( psCtx, psFile, pUserData ) != CE_None )
+        return CE_Failure;
+    psFile->bLoaded = TRUE;
+    *pnBytesRead += (GUIntBig) sStat.st_size;
+    psFile->nFileSize = (GIntBig) sStat.st_size;
+    psFile->nHash = nHash;
+    return CE_None;
+}
+
+/*
+** First line of the date file, for naming the polygon folder, or NULL.
+*/
+static char * ReadDateString( const char *pszDateFile )
+{
+    VSILFILE *fin;
+    const char *pszLine;
+    char *pszDateString = NULL;
+
+    if( !pszDateFile )
+        return NULL;
+    fin = VSIFOpenL( pszDateFile, "rb" );
+    if( fin )
+    {
+        pszLine = CPLReadLine2L( fin, 100, NULL );
+        if( pszLine && !EQUAL( pszLine, "" ) )
+            pszDateString = CPLStrdup( pszLine );
+        VSIFCloseL( fin );
+    }
+    return pszDateString;
+}
+
+static void ReleaseOverlay( RLOverlay *psOverlay )
+{
+    /* The warped VRT holds a reference to its source, close it first */
+    RLDestroyWarpedGrid( psOverlay->psWarpGrid );
+    if( psOverlay->hWarpDS )
+        GDALClose( psOverlay->hWarpDS );
+    if( psOverlay->hMemDS )
+        GDALClose( psOverlay->hMemDS );
+    VSIFree( psOverlay->pabyColors );
+    RLClearStrikeIndex( &psOverlay->sStrikes );
+    if( psOverlay->hRainDS && psOverlay->bOwnRainDS )
+        GDALClose( psOverlay->hRainDS );
+    memset( psOverlay, 0, sizeof( RLOverlay ) );
+}
+
+/*
+** Warp the grid opened in psOverlay to geographic coordinates, then find
+** the window of the warped grid over the data.  With strike points on the
+** strikes are gathered and placed in the same pass.
+*/
+static CPLErr PrepareOverlay( RLContext *psCtx, RLOverlay *psOverlay,
+                              RLPerf *psPerf )
+{
+    const char *pszSrcWkt, *pszDstWkt;
+    char **papszWarpOptions;
+    GDALWarpOptions *psWarpOptions;
+    GUIntBig nGridBytes;
+    RLStrikeIndex *psStrikes;
+    int anDataWindow[4], iStage;
+    int *panPngWindow = psOverlay->anPngWindow;
+    double *padfGT = psOverlay->adfGeoTransform;
+
+    GDALGetGeoTransform( psOverlay->hRainDS, padfGT );
+
+    psOverlay->nXSize = GDALGetRasterXSize( psOverlay->hRainDS );
+    psOverlay->nYSize = GDALGetRasterYSize( psOverlay->hRainDS );
+    nGridBytes = (GUIntBig) psOverlay->nXSize * psOverlay->nYSize *
+                 sizeof( GInt32 );
+
+    pszSrcWkt = RL_SRC_WKT;
+    pszDstWkt = RL_DST_WKT;
+    psStrikes = psCtx->bStrikePoints ? &psOverlay->sStrikes : NULL;
+
+    if( psCtx->bWarpFirst )
+    {
+        /*
+        ** Warp the single Int32 band as is, it is colourized a strip at a
+        ** time as the png is encoded.  A classify only pass finds the
+        ** extent of the data so only that part is warped.
+        */
+        iStage = RLPerfBegin( psPerf, "scan" );
+        if( RLColorizeDataset( psOverlay->hRainDS, psCtx->psColorTable,
+                               psCtx->nThreads, psCtx->nPngBands, NULL,
+                               anDataWindow, psStrikes ) != CE_None )
+        {
+            return CE_Failure;
+        }
+        RLPerfEnd( psPerf, iStage, nGridBytes, 0 );
+
+        iStage = RLPerfBegin( psPerf, "warp" );
+        papszWarpOptions =
+            CSLSetNameValue( NULL, "NUM_THREADS",
+                             CPLSPrintf( "%d", psCtx->nThreads ) );
+        papszWarpOptions =
+            CSLSetNameValue( papszWarpOptions, "WARP_MEMORY",
+                             CPLSPrintf( "%.0f", psCtx->dfWarpMemory ) );
+        if( psCtx->dfMemoryLimit > 0.0 )
+        {
+            papszWarpOptions =
+                CSLSetNameValue( papszWarpOptions, "MAX_MEMORY",
+                                 CPLSPrintf( "%.0f",
+                                             psCtx->dfMemoryLimit ) );
+        }
+        if( psCtx->pszCacheDir )
+        {
+            papszWarpOptions =
+                CSLSetNameValue( papszWarpOptions, "CACHE_DIR",
+                                 psCtx->pszCacheDir );
+        }
+        psOverlay->psWarpGrid = RLCreateWarpedGrid( psOverlay->hRainDS,
+                                                    pszSrcWkt, pszDstWkt,
+                                                    papszWarpOptions );
+        CSLDestroy( papszWarpOptions );
+        if( !psOverlay->psWarpGrid )
+            return CE_Failure;
+        RLGetWarpedGridInfo( psOverlay->psWarpGrid, &psOverlay->nXSize,
+                             &psOverlay->nYSize, NULL, padfGT, NULL );
+        RLPerfEnd( psPerf, iStage, 0, 0 );
+    }
+    else
+    {
+        /*
+        ** Colourize the grid into an interleaved RGBA or palette index
+        ** buffer, block by block on all of our threads, and hand it to the
+        ** warper as a MEM dataset.
+        */
+        iStage = RLPerfBegin( psPerf, "colorize" );
+        psOverlay->pabyColors =
+            (GByte*) VSIMalloc3( psCtx->nPngBands, psOverlay->nXSize,
+                                 psOverlay->nYSize );
+        if( !psOverlay->pabyColors )
+        {
+            CPLError( CE_Failure, CPLE_OutOfMemory,
+                      "Could not allocate %dx%d colour buffer",
+                      psOverlay->nXSize, psOverlay->nYSize );
+            return CE_Failure;
+        }
+        if( RLColorizeDataset( psOverlay->hRainDS, psCtx->psColorTable,
+                               psCtx->nThreads, psCtx->nPngBands,
+                               psOverlay->pabyColors, anDataWindow,
+                               psStrikes ) != CE_None )
+        {
+            return CE_Failure;
+        }
+        RLPerfEnd( psPerf, iStage, nGridBytes,
+                   nGridBytes / sizeof( GInt32 ) * psCtx->nPngBands );
+
+        iStage = RLPerfBegin( psPerf, "warp" );
+        psOverlay->hMemDS =
+            RLWrapBuffer( psOverlay->pabyColors, psOverlay->nXSize,
+                          psOverlay->nYSize, psCtx->nPngBands, padfGT,
+                          GDALGetProjectionRef( psOverlay->hRainDS ) );
+        if( !psOverlay->hMemDS )
+            return CE_Failure;
+
+        psWarpOptions = GDALCreateWarpOptions();
+        psWarpOptions->dfWarpMemoryLimit = psCtx->dfWarpMemory;
+        psWarpOptions->papszWarpOptions =
+            CSLSetNameValue( psWarpOptions->papszWarpOptions, "NUM_THREADS",
+                             CPLSPrintf( "%d", psCtx->nThreads ) );
+
+        psOverlay->hWarpDS =
+            GDALAutoCreateWarpedVRT( psOverlay->hMemDS, pszSrcWkt, pszDstWkt,
+                                     GRA_NearestNeighbour, 0.0,
+                                     psWarpOptions );
+
+        GDALDestroyWarpOptions( psWarpOptions );
+        if( !psOverlay->hWarpDS )
+            return CE_Failure;
+        GDALGetGeoTransform( psOverlay->hWarpDS, padfGT );
+        psOverlay->nXSize = GDALGetRasterXSize( psOverlay->hWarpDS );
+        psOverlay->nYSize = GDALGetRasterYSize( psOverlay->hWarpDS );
+        RLPerfEnd( psPerf, iStage, 0, 0 );
+    }
+    /*
+    ** Crop the overlay to the part of the warped grid over the data.  With
+    ** no data at all a single transparent pixel is left.
+    */
+    iStage = RLPerfBegin( psPerf, "window" );
+    if( anDataWindow[2] == 0 ||
+        !RLMapSourceWindow( psOverlay->hRainDS, pszSrcWkt, pszDstWkt, padfGT,
+                            psOverlay->nXSize, psOverlay->nYSize,
+                            anDataWindow, panPngWindow ) )
+    {
+        panPngWindow[0] = 0;
+        panPngWindow[1] = 0;
+        panPngWindow[2] = 1;
+        panPngWindow[3] = 1;
+    }
+    CPLDebug( "RL2KMZ", "Overlay window %d,%d %dx%d of %dx%d",
+              panPngWindow[0], panPngWindow[1], panPngWindow[2],
+              panPngWindow[3], psOverlay->nXSize, psOverlay->nYSize );
+    /*
+    ** Bounding box of the ground overlay from the cropped window.
+    */
+    RLGetGridBox( padfGT, panPngWindow[0], panPngWindow[1], panPngWindow[2],
+                  panPngWindow[3], psOverlay->adfBox );
+    if( psStrikes && RLGeoreferenceStrikes( psStrikes, psOverlay->hRainDS,
+                                            pszSrcWkt,
+                                            pszDstWkt ) != CE_None )
+    {
+        return CE_Failure;
+    }
+    RLPerfEnd( psPerf, iStage, 0, 0 );
+    return CE_None;
+}
+
+/*
+** Vector branch of a conversion: bring the polygons up to date and take a
+** copy of their placemarks, in a folder named for the date.
+*/
+static void PolygonBranch( void *pArg )
+{
+    RLStaticParts *psParts = (RLStaticParts*) pArg;
+    RLContext *psCtx = psParts->psCtx;
+    RLWarmFile *psFile = &psCtx->sPolygons;
+    const double *padfBox = psParts->adfClipBox;
+    char *pszVariant;
+    GUIntBig nBytesRead = 0;
+    int iStage;
+
+    /* Everything the rendered polygons depend on besides poly_kml */
+    pszVariant = CPLStrdup( CPLSPrintf( "placemarks %d " RL_POLYGON_FILTER
+                                        " clip %d %.9g %.9g %.9g %.9g"
+                                        " simplify %.9g",
+                                        RL_KML_PLACEMARK_VERSION,
+                                        psParts->bClip,
+                                        padfBox[0], padfBox[1], padfBox[2],
+                                        padfBox[3], psParts->dfTolerance ) );
+
+    iStage = RLPerfBegin( psParts->psPerf, "polygons" );
+    psParts->pszFolder = ReadDateString( psCtx->pszDateFile );
+    CPLCreateOrAcquireMutex( &psCtx->hPolygonMutex, 1000.0 );
+    psParts->ePolygonErr = RefreshWarmFile( psCtx, psFile, pszVariant,
+                                            LoadPolygons, psParts,
+                                            &nBytesRead );
+    if( psParts->ePolygonErr == CE_None )
+    {
+        RLBufferWrite( psFile->sData.pabyData, psFile->sData.nSize,
+                       &psParts->sPlacemarks );
+        if( !psParts->pszFolder )
+            psParts->pszFolder = CPLStrdup( psCtx->pszLayerName );
+    }
+    CPLReleaseMutex( psCtx->hPolygonMutex );
+    CPLFree( pszVariant );
+    RLPerfEnd( psParts->psPerf, iStage, nBytesRead,
+               psParts->sPlacemarks.nSize );
+}
+
+/*
+** Asset branch of a conversion: bring the images up to date and take a
+** copy of their bytes.
+*/
+static void ImageBranch( void *pArg )
+{
+    RLStaticParts *psParts = (RLStaticParts*) pArg;
+    RLContext *psCtx = psParts->psCtx;
+    RLWarmFile *psFile;
+    GUIntBig nBytesRead = 0, nBytesWritten = 0;
+    int i, iStage;
+
+    iStage = RLPerfBegin( psParts->psPerf, "images" );
+    CPLCreateOrAcquireMutex( &psCtx->hImageMutex, 1000.0 );
+    psParts->eImageErr = CE_None;
+    for( i = 0; i < RL_IMAGE_COUNT && psParts->eImageErr == CE_None; i++ )
+    {
+        psFile = &psCtx->asImages[i];
+        psParts->eImageErr = RefreshWarmFile( psCtx, psFile, NULL,
+                                              LoadImage, NULL, &nBytesRead );
+        if( psParts->eImageErr == CE_None )
+            nBytesWritten += RLBufferWrite( psFile->sData.pabyData,
+                                            psFile->sData.nSize,
+                                            &psParts->asImages[i] );
+    }
+    CPLReleaseMutex( psCtx->hImageMutex );
+    RLPerfEnd( psParts->psPerf, iStage, nBytesRead, nBytesWritten );
+}
+
+static void ReleaseStaticParts( RLStaticParts *psParts )
+{
+    int i;
+    CPLFree( psParts->pszFolder );
+    RLBufferFree( &psParts->sPlacemarks );
+    for( i = 0; i < RL_IMAGE_COUNT; i++ )
+        RLBufferFree( &psParts->asImages[i] );
+}
+
+/*
+** Work out how the polygons are clipped and simplified for the grid
+** hRainDS, then start the polygon and image branches on threads of their
+** own.  FinishStaticParts() waits for them.
+*/
+static void StartStaticParts( RLContext *psCtx, GDALDatasetH hRainDS,
+                              RLPerf *psPerf, RLStaticParts *psParts,
+                              CPLJoinableThread **pahThreads )
+{
+    double adfGeoTransform[6];
+    int nXSize, nYSize;
+
+    memset( psParts, 0, sizeof( RLStaticParts ) );
+    psParts->psCtx = psCtx;
+    psParts->psPerf = psPerf;
+
+    /*
+    ** The polygons are clipped to the whole warped grid rather than the
+    ** window over the data, they matter where it is dry too, and simplified
+    ** to a fraction of its pixel size.  Both are known before warping.
+    */
+    if( psCtx->bClipPolygons || psCtx->dfSimplify > 0.0 )
+    {
+        if( RLSuggestWarpedGrid( hRainDS, RL_SRC_WKT, RL_DST_WKT,
+                                 adfGeoTransform, &nXSize,
+                                 &nYSize ) == CE_None )
+        {
+            psParts->bClip = psCtx->bClipPolygons;
+            if( psParts->bClip )
+                RLGetGridBox( adfGeoTransform, 0, 0, nXSize, nYSize,
+                              psParts->adfClipBox );
+            psParts->dfTolerance = psCtx->dfSimplify *
+                                   fabs( adfGeoTransform[1] );
+        }
+    }
+
+    /*
+    ** The polygons, the images and the raster don't depend on each other
+    ** until the kmz is written, so the first two are brought up to date on
+    ** threads of their own while the grid is scanned and warped.
+    */
+    pahThreads[0] = CPLCreateJoinableThread( PolygonBranch, psParts );
+    if( !pahThreads[0] )
+        PolygonBranch( psParts );
+    pahThreads[1] = CPLCreateJoinableThread( ImageBranch, psParts );
+    if( !pahThreads[1] )
+        ImageBranch( psParts );
+}
+
+static CPLErr FinishStaticParts( RLStaticParts *psParts,
+                                 CPLJoinableThread **pahThreads )
+{
+    if( pahThreads[0] )
+        CPLJoinThread( pahThreads[0] );
+    if( pahThreads[1] )
+        CPLJoinThread( pahThreads[1] );
+    if( psParts->ePolygonErr != CE_None )
+        return psParts->ePolygonErr;
+    return psParts->eImageErr;
+}
+
+/*
+** Store the title and legend images under layers/ in the kmz, they are
+** already compressed.
+*/
+static CPLErr WriteImages( const RLContext *psCtx,
+                           const RLStaticParts *psParts, RLKmzWriter *psKmz )
+{
+    CPLErr eErr = CE_None;
+    int i;
+
+    for( i = 0; i < RL_IMAGE_COUNT && eErr == CE_None; i++ )
+    {
+        eErr = RLKmzAddFile( psKmz,
+                             CPLSPrintf( "layers/%s", CPLGetFilename(
+                                 psCtx->asImages[i].pszFile ) ),
+                             psParts->asImages[i].pabyData,
+                             psParts->asImages[i].nSize, FALSE );
+    }
+    return eErr;
+}
+
+/*
+** Assemble doc.kml in memory: the polygon styles and placemarks, the rain
+** and lightning overlay and the legends.  Images are stored under layers/
+** in the kmz.  With pasSteps set the overlay is a folder of one timed
+** overlay per step of an animation, and psOverlay isn't used.  Otherwise
+** strike points are linked from their own entry.
+*/
+static void WriteDocument( const RLContext *psCtx, const RLOverlay *psOverlay,
+                           const RLSeriesStep *pasSteps, int nStepCount,
+                           const RLStaticParts *psParts, const char *pszName,
+                           RLBuffer *psDoc )
+{
+    const RLWarmFile *pasImages = psCtx->asImages;
+    double adfXY[2], adfSize[2];
+    int i;
+
+    RLKmlBeginDocument( psDoc, pszName );
+    RLKmlWriteStyle( psDoc, "extreme", psCtx->pszExtremeStyle );
+    RLKmlWriteStyle( psDoc, "critical", psCtx->pszCriticalStyle );
+
+    /*
+    ** Copy the polygons into a folder named for the date.
+    */
+    RLKmlBeginFolder( psDoc, psParts->pszFolder );
+    RLBufferWrite( psParts->sPlacemarks.pabyData, psParts->sPlacemarks.nSize,
+                   psDoc );
+    RLKmlEndFolder( psDoc );
+
+    /*
+    ** Add the ground overlay data, or a link to the top of the tile pyramid.
+    */
+    if( pasSteps )
+    {
+        RLKmlBeginFolder( psDoc, "rainandltng" );
+        for( i = 0; i < nStepCount; i++ )
+            RLKmlWriteTimedGroundOverlay( psDoc, pasSteps[i].pszBegin,
+                                          CPLSPrintf( RL_SERIES_PNG, i ), 0,
+                                          pasSteps[i].adfBox,
+                                          pasSteps[i].pszBegin,
+                                          pasSteps[i].pszEnd );
+        RLKmlEndFolder( psDoc );
+    }
+    else if( psCtx->bSuperOverlay )
+    {
+        RLKmlWriteNetworkLink( psDoc, "rainandltng", "tiles/" RL_TILE_ROOT,
+                               NULL, 0, 0 );
+    }
+    else
+    {
+        RLKmlWriteGroundOverlay( psDoc, "rainandltng",
+                                 "layers/rainandlightning.png", 0,
+                                 psOverlay->adfBox );
+    }
+    if( !pasSteps && psCtx->bStrikePoints )
+        RLKmlWriteNetworkLink( psDoc, "strikes", RL_STRIKE_KML, NULL, 0, 0 );
+
+    /*
+    ** Add the title and the legends for dry lightning and the polygons.
+    */
+    adfXY[0] = 0.5;
+    adfXY[1] = 1.0;
+    adfSize[0] = -1.0;
+    adfSize[1] = -1.0;
+    RLKmlWriteScreenOverlay( psDoc, "title",
+                             CPLSPrintf( "layers/%s", CPLGetFilename(
+                                 pasImages[RL_IMAGE_TITLE].pszFile ) ),
+                             adfXY, adfXY, adfSize );
+    adfXY[0] = 0.0;
+    adfXY[1] = 0.0;
+    adfSize[0] = 0.25;
+    adfSize[1] = 0.25;
+    RLKmlWriteScreenOverlay( psDoc, "legend",
+                             CPLSPrintf( "layers/%s", CPLGetFilename(
+                                 pasImages[RL_IMAGE_LEGEND].pszFile ) ),
+                             adfXY, adfXY, adfSize );
+    adfXY[0] = 1.0;
+    adfXY[1] = 0.0;
+    RLKmlWriteScreenOverlay( psDoc, "lgtng_legend",
+                             CPLSPrintf( "layers/%s", CPLGetFilename(
+                                 pasImages[RL_IMAGE_POLY_LEGEND].pszFile ) ),
+                             adfXY, adfXY, NULL );
+    RLKmlEndDocument( psDoc );
+}
+
+/*
+** Append the timings of a conversion to perf_log as one line of JSON.
+** Concurrent conversions take turns so lines don't interleave.
+*/
+static void WritePerfRecord( RLContext *psCtx, const RLPerf *psPerf,
+                             const char *pszSrcFile, const char *pszDstFile,
+                             CPLErr eErr )
+{
+    RLBuffer sLine;
+    VSIStatBufL sStat;
+    VSILFILE *fp;
+    GUIntBig nOutputBytes = 0;
+
+    if( !psPerf )
+        return;
+    if( eErr == CE_None && VSIStatL( pszDstFile, &sStat ) == 0 )
+        nOutputBytes = (GUIntBig) sStat.st_size;
+    memset( &sLine, 0, sizeof( sLine ) );
+    RLPerfWriteJSON( psPerf, pszSrcFile, pszDstFile, eErr, nOutputBytes,
+                     &sLine );
+    CPLCreateOrAcquireMutex( &psCtx->hPerfMutex, 1000.0 );
+    fp = VSIFOpenL( psCtx->pszPerfLog, "ab" );
+    if( fp )
+    {
+        VSIFWriteL( sLine.pabyData, 1, sLine.nSize, fp );
+        VSIFCloseL( fp );
+    }
+    else
+    {
+        CPLError( CE_Warning, CPLE_FileIO, "Could not write to %s",
+                  psCtx->pszPerfLog );
+    }
+    CPLReleaseMutex( psCtx->hPerfMutex );
+    RLBufferFree( &sLine );
+}
+
+/*
+** Fold what pszFile holds into nKey.  The contents are hashed rather than
+** the size and time, grids of one geometry are all the same size and a
+** copy may keep the time of the one it replaces.
+*/
+static GUIntBig HashFileContents( GUIntBig nKey, const char *pszFile )
+{
+    GUIntBig nHash = RL_HASH_INIT;
+
+    if( pszFile && RLHashFile( pszFile, &nHash ) )
+        return RLHashBytes( nKey, &nHash, sizeof( nHash ) );
+    return RLHashString( nKey, "missing" );
+}
+
+/*
+** Key of everything the raster entries of a kmz depend on: the files of
+** the grid and how it is coloured, laid out, reduced and compressed.
+*/
+static GUIntBig RasterKey( const RLContext *psCtx, GDALDatasetH hRainDS )
+{
+    const RLColorClass *psClass;
+    const RLReducedOutput *psReduced;
+    char **papszFiles;
+    GUIntBig nKey;
+    int i;
+
+    nKey = RLHashString( RL_HASH_INIT,
+                         CPLSPrintf( "raster %d %d %d %d %d %d %d",
+                                     RL_MANIFEST_VERSION,
+                                     psCtx->bSuperOverlay, psCtx->nTileSize,
+                                     psCtx->bPalette,
+                                     psCtx->sPngOptions.nFilter,
+                                     psCtx->sPngOptions.sDeflate.nLevel,
+                                     psCtx->sPngOptions.sDeflate.nStrategy ) );
+    nKey = RLHashString( nKey, RL_SRC_WKT );
+    nKey = RLHashString( nKey, RL_DST_WKT );
+    for( i = 0; i < psCtx->psColorTable->nClassCount; i++ )
+    {
+        psClass = psCtx->psColorTable->pasClasses + i;
+        nKey = RLHashString( nKey, CPLSPrintf( "%d %d %d %d %d %d %d",
+                                               psClass->nMin, psClass->nMax,
+                                               psClass->abyRGBA[0],
+                                               psClass->abyRGBA[1],
+                                               psClass->abyRGBA[2],
+                                               psClass->abyRGBA[3],
+                                               psClass->bKeep ) );
+    }
+    for( i = 0; i < psCtx->nReducedCount; i++ )
+    {
+        psReduced = psCtx->pasReduced + i;
+        nKey = RLHashString( nKey, CPLSPrintf( "reduced %s %.9g %d",
+                                               psReduced->pszSuffix,
+                                               psReduced->dfCellSize,
+                                               psReduced->nMaxPixels ) );
+    }
+    if( psCtx->bStrikePoints )
+        nKey = RLHashString( nKey, CPLSPrintf( "strikes %d",
+                                               psCtx->nStrikeLevels ) );
+    papszFiles = GDALGetFileList( hRainDS );
+    for( i = 0; papszFiles && papszFiles[i]; i++ )
+        nKey = HashFileContents( nKey, papszFiles[i] );
+    CSLDestroy( papszFiles );
+    return nKey;
+}
+
+/*
+** Key of everything else in a kmz: the polygons and how they're drawn,
+** the date and the images.
+*/
+static GUIntBig StaticKey( const RLContext *psCtx )
+{
+    GUIntBig nKey;
+    char *pszDate;
+    int i;
+
+    nKey = RLHashString( RL_HASH_INIT,
+                         CPLSPrintf( "static %d %d %d %.9g",
+                                     RL_MANIFEST_VERSION,
+                                     RL_KML_PLACEMARK_VERSION,
+                                     psCtx->bClipPolygons,
+                                     psCtx->dfSimplify ) );
+    nKey = RLHashString( nKey, RL_POLYGON_FILTER );
+    nKey = RLHashString( nKey, psCtx->pszExtremeStyle );
+    nKey = RLHashString( nKey, psCtx->pszCriticalStyle );
+    nKey = HashFileContents( nKey, psCtx->sPolygons.pszFile );
+    for( i = 0; i < RL_IMAGE_COUNT; i++ )
+        nKey = HashFileContents( nKey, psCtx->asImages[i].pszFile );
+    /* The date file is a line, what it says matters rather than when */
+    pszDate = psCtx->pszDateFile ? ReadDateString( psCtx->pszDateFile ) : NULL;
+    nKey = RLHashString( nKey, pszDate );
+    CPLFree( pszDate );
+    return nKey;
+}
+
+/*
+** File name of the reduced copy pszSuffix of the kmz pszDstFile.
+*/
+static char * ReducedFileName( const char *pszDstFile, const char *pszSuffix )
+{
+    char *pszPath, *pszBase, *pszFile;
+
+    /* CPLGetPath() and CPLGetBasename() share a buffer */
+    pszPath = CPLStrdup( CPLGetPath( pszDstFile ) );
+    pszBase = CPLStrdup( CPLSPrintf( "%s_%s", CPLGetBasename( pszDstFile ),
+                                     pszSuffix ) );
+    pszFile = CPLStrdup( CPLFormFilename( pszPath, pszBase, "kmz" ) );
+    CPLFree( pszPath );
+    CPLFree( pszBase );
+    return pszFile;
+}
+
+/*
+** Whether every reduced copy of pszDstFile is there.
+*/
+static int ReducedFilesExist( const RLContext *psCtx,
+                              const char *pszDstFile )
+{
+    VSIStatBufL sStat;
+    char *pszFile;
+    int i, bExists = TRUE;
+
+    for( i = 0; i < psCtx->nReducedCount && bExists; i++ )
+    {
+        pszFile = ReducedFileName( pszDstFile,
+                                   psCtx->pasReduced[i].pszSuffix );
+        bExists = VSIStatL( pszFile, &sStat ) == 0;
+        CPLFree( pszFile );
+    }
+    return bExists;
+}
+
+/*
+** Read dst_file.manifest, if it describes the kmz that is there now.
+*/
+static char ** ReadManifest( const char *pszDstFile )
+{
+    VSIStatBufL sStat, sManifestStat;
+    const char *pszManifest;
+    char **papszManifest;
+
+    pszManifest = CPLSPrintf( "%s.manifest", pszDstFile );
+    if( VSIStatL( pszDstFile, &sStat ) != 0 ||
+        VSIStatL( pszManifest, &sManifestStat ) != 0 )
+    {
+        return NULL;
+    }
+    papszManifest = CSLLoad2( pszManifest, 20, 1024, NULL );
+    if( papszManifest &&
+        ( CPLScanUIntBig( CSLFetchNameValueDef( papszManifest, "kmz_size",
+                                                "" ), 32 ) !=
+          (GUIntBig) sStat.st_size ||
+          CPLScanUIntBig( CSLFetchNameValueDef( papszManifest, "kmz_mtime",
+                                                "" ), 32 ) !=
+          (GUIntBig) sStat.st_mtime ) )
+    {
+        CPLDebug( "RL2KMZ", "%s changed since its manifest", pszDstFile );
+        CSLDestroy( papszManifest );
+        return NULL;
+    }
+    return papszManifest;
+}
+
+/*
+** Record the keys the kmz pszDstFile was made from, its overlay box and
+** the kmz itself, so a later run can tell what is still current.
+** psOldStat is what the kmz it replaced was, NULL if there wasn't one.
+*/
+static void WriteManifest( const char *pszDstFile, GUIntBig nRasterKey,
+                           GUIntBig nStaticKey, const double *padfBox,
+                           const VSIStatBufL *psOldStat )
+{
+    VSIStatBufL sStat;
+    char **papszManifest = NULL;
+    char *pszManifest;
+
+    if( VSIStatL( pszDstFile, &sStat ) != 0 )
+        return;
+    /*
+    ** /vsizip/ keeps the listing of a kmz it has read until the kmz is
+    ** bigger, smaller or newer, so one replaced within the same second
+    ** could be read back through the listing of the old one.  Such a kmz
+    ** is left without a manifest and made again rather than reused.
+    */
+    if( psOldStat && sStat.st_mtime == psOldStat->st_mtime )
+    {
+        CPLDebug( "RL2KMZ", "%s replaced within a second, no manifest",
+                  pszDstFile );
+        VSIUnlink( CPLSPrintf( "%s.manifest", pszDstFile ) );
+        return;
+    }
+    papszManifest = CSLSetNameValue( papszManifest, "raster",
+                                     CPLSPrintf( CPL_FRMT_GUIB,
+                                                 nRasterKey ) );
+    papszManifest = CSLSetNameValue( papszManifest, "static",
+                                     CPLSPrintf( CPL_FRMT_GUIB,
+                                                 nStaticKey ) );
+    papszManifest = CSLSetNameValue( papszManifest, "box",
+                                     CPLSPrintf( "%.17g %.17g %.17g %.17g",
+                                                 padfBox[0], padfBox[1],
+                                                 padfBox[2], padfBox[3] ) );
+    papszManifest = CSLSetNameValue( papszManifest, "kmz_size",
+                                     CPLSPrintf( CPL_FRMT_GUIB,
+                                                 (GUIntBig) sStat.st_size ) );
+    papszManifest = CSLSetNameValue( papszManifest, "kmz_mtime",
+                                     CPLSPrintf( CPL_FRMT_GUIB,
+                                                 (GUIntBig) sStat.st_mtime ) );
+    pszManifest = CPLStrdup( CPLSPrintf( "%s.manifest", pszDstFile ) );
+    if( !CSLSave( papszManifest, pszManifest ) )
+    {
+        CPLError( CE_Warning, CPLE_FileIO, "Could not write %s",
+                  pszManifest );
+        VSIUnlink( pszManifest );
+    }
+    CPLFree( pszManifest );
+    CSLDestroy( papszManifest );
+}
+
+/*
+** Copy the raster entries of the kmz pszOldFile, the overlay png or the
+** tile pyramid and any strike points, into psKmz as they are.
+*/
+static CPLErr CopyRasterEntries( const RLContext *psCtx,
+                                 const char *pszOldFile, RLKmzWriter *psKmz )
+{
+    VSIStatBufL sStat;
+    GByte *pabyData;
+    vsi_l_offset nSize;
+    char **papszEntries;
+    char *pszZip;
+    const char *pszPath;
+    int i;
+    CPLErr eErr = CE_None;
+
+    pszZip = CPLStrdup( CPLSPrintf( "/vsizip/%s", pszOldFile ) );
+    if( psCtx->bSuperOverlay )
+        papszEntries = VSIReadDirRecursive( pszZip );
+    else
+        papszEntries = CSLAddString( NULL, "layers/rainandlightning.png" );
+    if( !psCtx->bSuperOverlay && psCtx->bStrikePoints )
+        papszEntries = CSLAddString( papszEntries, RL_STRIKE_KML );
+    for( i = 0; papszEntries && papszEntries[i] && eErr == CE_None; i++ )
+    {
+        if( psCtx->bSuperOverlay &&
+            !STARTS_WITH( papszEntries[i], "tiles/" ) &&
+            !( psCtx->bStrikePoints &&
+               EQUAL( papszEntries[i], RL_STRIKE_KML ) ) )
+        {
+            continue;
+        }
+        pszPath = CPLSPrintf( "%s/%s", pszZip, papszEntries[i] );
+        if( VSIStatL( pszPath, &sStat ) != 0 || VSI_ISDIR( sStat.st_mode ) )
+            continue;
+        if( !VSIIngestFile( NULL, pszPath, &pabyData, &nSize, -1 ) )
+        {
+            CPLError( CE_Failure, CPLE_FileIO, "Could not read %s",
+                      pszPath );
+            eErr = CE_Failure;
+            break;
+        }
+        /* Stored or deflated as they were written the first time */
+        eErr = RLKmzAddFile( psKmz, papszEntries[i], pabyData,
+                             (size_t) nSize,
+                             EQUAL( CPLGetExtension( papszEntries[i] ),
+                                    "kml" ) );
+        VSIFree( pabyData );
+    }
+    CSLDestroy( papszEntries );
+    CPLFree( pszZip );
+    return eErr;
+}
+
+/*
+** Factor the overlay window is reduced by for a reduced copy.
+*/
+static int ReducedFactor( const RLReducedOutput *psOutput,
+                          const RLOverlay *psOverlay )
+{
+    const int *panWindow = psOverlay->anPngWindow;
+    int nFactor;
+
+    if( psOutput->nMaxPixels > 0 )
+        nFactor = ( MAX( panWindow[2], panWindow[3] ) +
+                    psOutput->nMaxPixels - 1 ) / psOutput->nMaxPixels;
+    else
+        nFactor = (int) floor( psOutput->dfCellSize /
+                               fabs( psOverlay->adfGeoTransform[1] ) + 0.5 );
+    return MAX( 1, nFactor );
+}
+
+/*
+** Start the reduced copies of the kmz pszDstFile, each with its doc.kml
+** and the strike points in psStrikeKml written and its png entry open,
+** and fill in the png target of each after the first one, which is the
+** full overlay.
+*/
+static CPLErr BeginReducedKmz( RLContext *psCtx, const RLOverlay *psOverlay,
+                               const RLStaticParts *psParts,
+                               const RLBuffer *psStrikeKml,
+                               const char *pszDstFile,
+                               RLKmzWriter **papsKmz,
+                               RLPngTarget *pasTargets )
+{
+    RLBuffer sDoc;
+    char *pszFile;
+    CPLErr eErr = CE_None;
+    int i;
+
+    for( i = 0; i < psCtx->nReducedCount && eErr == CE_None; i++ )
+    {
+        pszFile = ReducedFileName( pszDstFile,
+                                   psCtx->pasReduced[i].pszSuffix );
+        papsKmz[i] = RLKmzCreate( pszFile, &psCtx->sKmzOptions );
+        if( !papsKmz[i] )
+        {
+            CPLFree( pszFile );
+            return CE_Failure;
+        }
+        memset( &sDoc, 0, sizeof( sDoc ) );
+        WriteDocument( psCtx, psOverlay, NULL, 0, psParts,
+                       CPLGetBasename( pszFile ), &sDoc );
+        CPLFree( pszFile );
+        eErr = RLKmzAddFile( papsKmz[i], "doc.kml", sDoc.pabyData,
+                             sDoc.nSize, TRUE );
+        RLBufferFree( &sDoc );
+        if( eErr == CE_None && psStrikeKml->nSize > 0 )
+            eErr = RLKmzAddFile( papsKmz[i], RL_STRIKE_KML,
+                                 psStrikeKml->pabyData, psStrikeKml->nSize,
+                                 TRUE );
+        if( eErr == CE_None )
+            eErr = RLKmzBeginFile( papsKmz[i], "layers/rainandlightning.png",
+                                   FALSE );
+        pasTargets[i + 1].nFactor = ReducedFactor( psCtx->pasReduced + i,
+                                                   psOverlay );
+        pasTargets[i + 1].pfnWrite = RLKmzWrite;
+        pasTargets[i + 1].pUserData = papsKmz[i];
+        CPLDebug( "RL2KMZ", "Reducing %s by %d",
+                  psCtx->pasReduced[i].pszSuffix, pasTargets[i + 1].nFactor );
+    }
+    return eErr;
+}
+
+/*
+** Convert the grid opened in psOverlay to the kmz pszDstFile, a document
+** named pszName, and release the overlay.  With pszReuseFile set the
+** raster isn't made again, its entries are copied from that kmz and the
+** overlay box must already be set.  The box is copied to padfBox.  With
+** bReduced set the reduced copies of the overlay are written next to
+** pszDstFile too, when the raster is made.
+*/
+static CPLErr WriteKmz( RLContext *psCtx, RLOverlay *psOverlay,
+                        const char *pszName, const char *pszDstFile,
+                        const char *pszReuseFile, int bReduced,
+                        double *padfBox, RLPerf *psPerf )
+{
+    RLStaticParts sParts;
+    RLBuffer sDoc, sStrikeKml;
+    RLKmzWriter *psKmz, **papsReducedKmz = NULL;
+    RLPngTarget *pasTargets;
+    CPLJoinableThread *ahThreads[2];
+    GUIntBig nWritten, nReducedBytes = 0;
+    int iStage, i, nReduced = 0;
+    CPLErr eErr = CE_None, eStaticErr;
+
+    memset( &sDoc, 0, sizeof( sDoc ) );
+    memset( &sStrikeKml, 0, sizeof( sStrikeKml ) );
+
+    /* The polygons and images are made ready while the grid is warped */
+    StartStaticParts( psCtx, psOverlay->hRainDS, psPerf, &sParts,
+                      ahThreads );
+    if( !pszReuseFile )
+        eErr = PrepareOverlay( psCtx, psOverlay, psPerf );
+    eStaticErr = FinishStaticParts( &sParts, ahThreads );
+    if( eErr == CE_None )
+        eErr = eStaticErr;
+    if( eErr == CE_None )
+    {
+        iStage = RLPerfBegin( psPerf, "document" );
+        WriteDocument( psCtx, psOverlay, NULL, 0, &sParts, pszName, &sDoc );
+        RLPerfEnd( psPerf, iStage, 0, sDoc.nSize );
+    }
+    if( eErr == CE_None && psCtx->bStrikePoints && !pszReuseFile )
+    {
+        iStage = RLPerfBegin( psPerf, "strikes" );
+        RLWriteStrikeKml( &psOverlay->sStrikes, psCtx->psColorTable,
+                          psCtx->pabyClassColors, psOverlay->adfBox,
+                          psCtx->nStrikeLevels, &sStrikeKml );
+        RLPerfEnd( psPerf, iStage,
+                   (GUIntBig) psOverlay->sStrikes.nCount * sizeof( RLStrike ),
+                   sStrikeKml.nSize );
+    }
+
+    /*
+    ** Write the kmz in one pass, doc.kml first, then the overlay and the
+    ** images.  It only replaces dst once it is complete.
+    */
+    psKmz = NULL;
+    if( eErr == CE_None )
+    {
+        psKmz = RLKmzCreate( pszDstFile, &psCtx->sKmzOptions );
+        if( !psKmz )
+            eErr = CE_Failure;
+    }
+    if( eErr == CE_None )
+        eErr = RLKmzAddFile( psKmz, "doc.kml", sDoc.pabyData, sDoc.nSize,
+                             TRUE );
+    RLBufferFree( &sDoc );
+    if( eErr == CE_None && sStrikeKml.nSize > 0 )
+        eErr = RLKmzAddFile( psKmz, RL_STRIKE_KML, sStrikeKml.pabyData,
+                             sStrikeKml.nSize, TRUE );
+
+    /* Reduced copies come out of the same pass over the warped grid */
+    if( bReduced && !pszReuseFile && !psCtx->bSuperOverlay &&
+        psOverlay->psWarpGrid )
+    {
+        nReduced = psCtx->nReducedCount;
+        papsReducedKmz = (RLKmzWriter**)
+            CPLCalloc( sizeof( RLKmzWriter* ), MAX( 1, nReduced ) );
+    }
+
+    /* The rain grid we created, stored as png is already deflated */
+    nWritten = RLKmzGetBytesWritten( psKmz );
+    iStage = RLPerfBegin( psPerf, "raster" );
+    if( eErr == CE_None && pszReuseFile )
+    {
+        eErr = CopyRasterEntries( psCtx, pszReuseFile, psKmz );
+    }
+    else if( eErr == CE_None && nReduced > 0 )
+    {
+        pasTargets = (RLPngTarget*) CPLCalloc( sizeof( RLPngTarget ),
+                                               nReduced + 1 );
+        pasTargets[0].nFactor = 1;
+        pasTargets[0].pfnWrite = RLKmzWrite;
+        pasTargets[0].pUserData = psKmz;
+        eErr = RLKmzBeginFile( psKmz, "layers/rainandlightning.png", FALSE );
+        if( eErr == CE_None )
+            eErr = BeginReducedKmz( psCtx, psOverlay, &sParts, &sStrikeKml,
+                                    pszDstFile, papsReducedKmz, pasTargets );
+        if( eErr == CE_None )
+            eErr = RLEncodeWarpedGridPngs( psOverlay->psWarpGrid,
+                                           psOverlay->anPngWindow,
+                                           psCtx->psColorTable,
+                                           psCtx->bPalette,
+                                           &psCtx->sPngOptions, pasTargets,
+                                           nReduced + 1 );
+        if( RLKmzEndFile( psKmz ) != CE_None )
+            eErr = CE_Failure;
+        for( i = 0; i < nReduced; i++ )
+        {
+            if( papsReducedKmz[i] &&
+                RLKmzEndFile( papsReducedKmz[i] ) != CE_None )
+                eErr = CE_Failure;
+            nReducedBytes += RLKmzGetBytesWritten( papsReducedKmz[i] );
+        }
+        CPLFree( pasTargets );
+    }
+    else if( eErr == CE_None && psCtx->bSuperOverlay )
+    {
+        eErr = RLWriteSuperOverlay( psOverlay->psWarpGrid,
+                                    psOverlay->anPngWindow,
+                                    psCtx->psColorTable, psCtx->bPalette,
+                                    &psCtx->sPngOptions, psCtx->nTileSize,
+                                    psCtx->nThreads, psKmz, "tiles" );
+    }
+    else if( eErr == CE_None )
+    {
+        eErr = RLKmzBeginFile( psKmz, "layers/rainandlightning.png", FALSE );
+        if( eErr == CE_None && psOverlay->psWarpGrid )
+            eErr = RLEncodeWarpedGridPng( psOverlay->psWarpGrid,
+                                          psOverlay->anPngWindow,
+                                          psCtx->psColorTable,
+                                          psCtx->bPalette,
+                                          &psCtx->sPngOptions, RLKmzWrite,
+                                          psKmz );
+        else if( eErr == CE_None )
+            eErr = RLEncodePng( psOverlay->hWarpDS, psOverlay->anPngWindow,
+                                psCtx->psColorTable, psCtx->bPalette,
+                                &psCtx->sPngOptions, RLKmzWrite, psKmz );
+        if( RLKmzEndFile( psKmz ) != CE_None )
+            eErr = CE_Failure;
+    }
+    RLBufferFree( &sStrikeKml );
+    RLPerfEnd( psPerf, iStage,
+               (GUIntBig) psOverlay->anPngWindow[2] *
+               psOverlay->anPngWindow[3] * sizeof( GInt32 ),
+               RLKmzGetBytesWritten( psKmz ) - nWritten + nReducedBytes );
+    if( padfBox )
+        memcpy( padfBox, psOverlay->adfBox, sizeof( psOverlay->adfBox ) );
+    ReleaseOverlay( psOverlay );
+
+    nWritten = RLKmzGetBytesWritten( psKmz );
+    iStage = RLPerfBegin( psPerf, "archive" );
+    if( eErr == CE_None )
+        eErr = WriteImages( psCtx, &sParts, psKmz );
+    for( i = 0; i < nReduced && eErr == CE_None; i++ )
+        eErr = WriteImages( psCtx, &sParts, papsReducedKmz[i] );
+    ReleaseStaticParts( &sParts );
+
+    /* The reduced copies go first, any that fail fail the conversion */
+    nWritten = RLKmzGetBytesWritten( psKmz ) - nWritten;
+    for( i = 0; i < nReduced; i++ )
+    {
+        if( papsReducedKmz[i] &&
+            RLKmzClose( papsReducedKmz[i], eErr == CE_None ) != CE_None )
+            eErr = CE_Failure;
+    }
+    CPLFree( papsReducedKmz );
+    if( psKmz && RLKmzClose( psKmz, eErr == CE_None ) != CE_None )
+        eErr = CE_Failure;
+    RLPerfEnd( psPerf, iStage, 0, nWritten );
+    return eErr;
+}
+
+/*
+** Convert the grid pszSrcFile to the kmz pszDstFile.  The polygons and
+** images are taken from the context, and read again first if their files
+** have changed.  Safe to call from several threads at once.
+*/
+CPLErr RLProcessGrid( RLContext *psCtx, const char *pszSrcFile,
+                      const char *pszDstFile )
+{
+    RLOverlay sOverlay;
+    RLPerf sPerf, *psPerf;
+    VSIStatBufL sOldStat;
+    char **papszManifest = NULL, **papszBox;
+    char *pszName;
+    const char *pszReuseFile = NULL;
+    GUIntBig nRasterKey = 0, nStaticKey = 0;
+    double adfBox[4];
+    int iStage, i, bUpToDate = FALSE, bOldKmz = FALSE;
+    CPLErr eErr;
+
+    memset( &sOverlay, 0, sizeof( sOverlay ) );
+    psPerf = psCtx->pszPerfLog ? &sPerf : NULL;
+    RLPerfStart( psPerf );
+
+    /*
+    ** Open the input Arc/Info Binary Grid
+    */
+    iStage = RLPerfBegin( psPerf, "open" );
+    sOverlay.hRainDS = GDALOpenEx( pszSrcFile, GDAL_OF_READONLY |
+                                   GDAL_OF_RASTER | GDAL_OF_VERBOSE_ERROR,
+                                   NULL, NULL, NULL );
+    sOverlay.bOwnRainDS = TRUE;
+
+    /*
+    ** In incremental mode nothing is done if the inputs are the ones in
+    ** the manifest of the kmz already there.  If only the polygons, date
+    ** or images changed the raster is copied over from it.
+    */
+    if( sOverlay.hRainDS && psCtx->bIncremental )
+    {
+        nRasterKey = RasterKey( psCtx, sOverlay.hRainDS );
+        nStaticKey = StaticKey( psCtx );
+        papszManifest = ReadManifest( pszDstFile );
+        bOldKmz = VSIStatL( pszDstFile, &sOldStat ) == 0;
+    }
+    if( papszManifest &&
+        EQUAL( CSLFetchNameValueDef( papszManifest, "raster", "" ),
+               CPLSPrintf( CPL_FRMT_GUIB, nRasterKey ) ) )
+    {
+        papszBox = CSLTokenizeString2( CSLFetchNameValueDef( papszManifest,
+                                                             "box", "" ),
+                                       " ", 0 );
+        if( EQUAL( CSLFetchNameValueDef( papszManifest, "static", "" ),
+                   CPLSPrintf( CPL_FRMT_GUIB, nStaticKey ) ) )
+        {
+            bUpToDate = ReducedFilesExist( psCtx, pszDstFile );
+        }
+        /* Reduced copies have no raster of their own to copy back */
+        else if( CSLCount( papszBox ) == 4 && psCtx->nReducedCount == 0 )
+        {
+            for( i = 0; i < 4; i++ )
+                sOverlay.adfBox[i] = CPLAtof( papszBox[i] );
+            pszReuseFile = pszDstFile;
+        }
+        CSLDestroy( papszBox );
+    }
+    CSLDestroy( papszManifest );
+    RLPerfEnd( psPerf, iStage, 0, 0 );
+
+    if( bUpToDate )
+    {
+        CPLDebug( "RL2KMZ", "%s is up to date", pszDstFile );
+        ReleaseOverlay( &sOverlay );
+        eErr = CE_None;
+    }
+    else if( sOverlay.hRainDS )
+    {
+        if( pszReuseFile )
+            CPLDebug( "RL2KMZ", "Reusing the raster of %s", pszDstFile );
+        pszName = CPLStrdup( CPLGetBasename( pszDstFile ) );
+        eErr = WriteKmz( psCtx, &sOverlay, pszName, pszDstFile,
+                         pszReuseFile, TRUE, adfBox, psPerf );
+        CPLFree( pszName );
+        if( eErr == CE_None && psCtx->bIncremental )
+            WriteManifest( pszDstFile, nRasterKey, nStaticKey, adfBox,
+                           bOldKmz ? &sOldStat : NULL );
+        else if( psCtx->bIncremental )
+            VSIUnlink( CPLSPrintf( "%s.manifest", pszDstFile ) );
+    }
+    else
+    {
+        eErr = CE_Failure;
+    }
+    if( eErr != CE_None )
+        CPLError( CE_Failure, CPLE_AppDefined, "Failed to convert %s to %s",
+                  pszSrcFile, pszDstFile );
+    WritePerfRecord( psCtx, psPerf, pszSrcFile, pszDstFile, eErr );
+    return eErr;
+}
+
+/*
+** Convert an open grid and hand the whole kmz, a document named pszName,
+** to pfnWrite.  The kmz is built in a /vsimem/ file of its own, nothing
+** touches the disk besides reading the polygons and images.  hSrcDS stays
+** open, it may be one from RLWrapGrid() over a grid in memory.  Safe to
+** call from several threads at once, each with its own dataset.  Only the
+** full kmz is made, not the reduced_outputs copies.
+*/
+CPLErr RLProcessDataset( RLContext *psCtx, GDALDatasetH hSrcDS,
+                         const char *pszName, RLWriteFunc pfnWrite,
+                         void *pUserData )
+{
+    GByte *pabyKmz;
+    size_t nSize;
+    CPLErr eErr;
+
+    pabyKmz = RLProcessDatasetToBuffer( psCtx, hSrcDS, pszName, &nSize );
+    if( !pabyKmz )
+        return CE_Failure;
+    eErr = pfnWrite( pabyKmz, nSize, pUserData ) == nSize ? CE_None :
+                                                            CE_Failure;
+    if( eErr != CE_None )
+        CPLError( CE_Failure, CPLE_FileIO, "Could not write the kmz of %s",
+                  pszName );
+    CPLFree( pabyKmz );
+    return eErr;
+}
+
+/*
+** As RLProcessDataset(), returning the kmz in a buffer to CPLFree(), or
+** NULL on failure.
+*/
+GByte * RLProcessDatasetToBuffer( RLContext *psCtx, GDALDatasetH hSrcDS,
+                                  const char *pszName, size_t *pnSize )
+{
+    static volatile int nMemFiles = 0;
+    RLOverlay sOverlay;
+    RLPerf sPerf, *psPerf;
+    GByte *pabyKmz = NULL;
+    vsi_l_offset nLength = 0;
+    char *pszDstFile;
+    CPLErr eErr;
+
+    *pnSize = 0;
+    memset( &sOverlay, 0, sizeof( sOverlay ) );
+    sOverlay.hRainDS = hSrcDS;
+    psPerf = psCtx->pszPerfLog ? &sPerf : NULL;
+    RLPerfStart( psPerf );
+
+    /* Concurrent calls, on this context or another, never share a file */
+    pszDstFile = CPLStrdup( CPLSPrintf( "/vsimem/rl2kmz_%d.kmz",
+                                        CPLAtomicInc( &nMemFiles ) ) );
+    eErr = WriteKmz( psCtx, &sOverlay, pszName, pszDstFile, NULL, FALSE, NULL,
+                     psPerf );
+    if( eErr != CE_None )
+        CPLError( CE_Failure, CPLE_AppDefined, "Failed to convert %s",
+                  pszName );
+    WritePerfRecord( psCtx, psPerf, GDALGetDescription( hSrcDS ),
+                     pszDstFile, eErr );
+    if( eErr == CE_None )
+        pabyKmz = VSIGetMemFileBuffer( pszDstFile, &nLength, TRUE );
+    VSIUnlink( pszDstFile );
+    CPLFree( pszDstFile );
+    *pnSize = (size_t) nLength;
+    return pabyKmz;
+}
+
+static GDALDatasetH OpenGrid( const char *pszSrcFile )
+{
+    return GDALOpenEx( pszSrcFile, GDAL_OF_READONLY | GDAL_OF_RASTER |
+                       GDAL_OF_VERBOSE_ERROR, NULL, NULL, NULL );
+}
+
+/*
+** Find the window of the warped grid over the data of one step, after
+** checking it lies on the grid of the first.
+*/
+static CPLErr ScanStep( RLSeriesQueue *psQueue, RLSeriesStep *psStep )
+{
+    RLContext *psCtx = psQueue->psCtx;
+    GDALDatasetH hDS;
+    double adfSrcGeoTransform[6];
+    int anDataWindow[4];
+    int *panPngWindow = psStep->anPngWindow;
+    CPLErr eErr;
+
+    hDS = OpenGrid( psStep->pszSrcFile );
+    if( !hDS )
+        return CE_Failure;
+    if( GDALGetRasterXSize( hDS ) != psQueue->nSrcXSize ||
+        GDALGetRasterYSize( hDS ) != psQueue->nSrcYSize ||
+        GDALGetGeoTransform( hDS, adfSrcGeoTransform ) != CE_None ||
+        memcmp( adfSrcGeoTransform, psQueue->adfSrcGeoTransform,
+                sizeof( adfSrcGeoTransform ) ) != 0 )
+    {
+        CPLError( CE_Failure, CPLE_AppDefined,
+                  "%s is not on the grid of %s", psStep->pszSrcFile,
+                  psQueue->pasSteps[0].pszSrcFile );
+        GDALClose( hDS );
+        return CE_Failure;
+    }
+    /* The steps are spread over the threads, each scans on one */
+    eErr = RLColorizeDataset( hDS, psCtx->psColorTable, 1, psCtx->nPngBands,
+                              NULL, anDataWindow, NULL );
+    if( eErr == CE_None &&
+        ( anDataWindow[2] == 0 ||
+          !RLMapSourceWindow( hDS, RL_SRC_WKT, RL_DST_WKT,
+                              psQueue->adfGeoTransform, psQueue->nXSize,
+                              psQueue->nYSize, anDataWindow,
+                              panPngWindow ) ) )
+    {
+        panPngWindow[0] = 0;
+        panPngWindow[1] = 0;
+        panPngWindow[2] = 1;
+        panPngWindow[3] = 1;
+    }
+    RLGetGridBox( psQueue->adfGeoTransform, panPngWindow[0],
+                  panPngWindow[1], panPngWindow[2], panPngWindow[3],
+                  psStep->adfBox );
+    GDALClose( hDS );
+    return eErr;
+}
+
+/*
+** Warp and encode the png of one step in memory, then add it to the kmz.
+** Steps render side by side, so each png is deflated on one thread.
+*/
+static CPLErr RenderStep( RLSeriesQueue *psQueue, int iStep )
+{
+    RLContext *psCtx = psQueue->psCtx;
+    RLSeriesStep *psStep = psQueue->pasSteps + iStep;
+    RLWarpedGrid *psGrid;
+    RLPngOptions sPngOptions;
+    GDALDatasetH hDS;
+    RLBuffer sPng;
+    CPLErr eErr;
+
+    hDS = OpenGrid( psStep->pszSrcFile );
+    if( !hDS )
+        return CE_Failure;
+    psGrid = RLCloneWarpedGrid( psQueue->psFirstGrid, hDS );
+    if( !psGrid )
+        psGrid = RLCreateWarpedGrid( hDS, RL_SRC_WKT, RL_DST_WKT,
+                                     psQueue->papszWarpOptions );
+    if( !psGrid )
+    {
+        GDALClose( hDS );
+        return CE_Failure;
+    }
+    memset( &sPng, 0, sizeof( sPng ) );
+    sPngOptions = psCtx->sPngOptions;
+    sPngOptions.sDeflate.nThreads = 1;
+    eErr = RLEncodeWarpedGridPng( psGrid, psStep->anPngWindow,
+                                  psCtx->psColorTable, psCtx->bPalette,
+                                  &sPngOptions, RLBufferWrite, &sPng );
+    RLDestroyWarpedGrid( psGrid );
+    GDALClose( hDS );
+    if( eErr == CE_None )
+    {
+        CPLCreateOrAcquireMutex( &psQueue->hKmzMutex, 1000.0 );
+        eErr = RLKmzAddFile( psQueue->psKmz, CPLSPrintf( RL_SERIES_PNG,
+                                                         iStep ),
+                             sPng.pabyData, sPng.nSize, FALSE );
+        CPLReleaseMutex( psQueue->hKmzMutex );
+    }
+    RLBufferFree( &sPng );
+    return eErr;
+}
+
+static void SeriesWorker( void *pArg )
+{
+    RLSeriesQueue *psQueue = (RLSeriesQueue*) pArg;
+    CPLErr eErr;
+    int iStep;
+
+    while( psQueue->nErrors == 0 &&
+           ( iStep = CPLAtomicInc( &psQueue->nNextStep ) - 1 ) <
+           psQueue->nStepCount )
+    {
+        if( psQueue->bRender )
+            eErr = RenderStep( psQueue, iStep );
+        else
+            eErr = ScanStep( psQueue, psQueue->pasSteps + iStep );
+        if( eErr != CE_None )
+            CPLAtomicInc( &psQueue->nErrors );
+    }
+}
+
+/*
+** Run every step of psQueue through SeriesWorker() on nWorkers threads.
+*/
+static CPLErr RunSeriesQueue( RLSeriesQueue *psQueue, int nWorkers )
+{
+    CPLJoinableThread **pahThreads;
+    int i;
+
+    psQueue->nNextStep = 0;
+    pahThreads = (CPLJoinableThread**)
+        CPLMalloc( sizeof( CPLJoinableThread* ) * nWorkers );
+    for( i = 0; i < nWorkers; i++ )
+        pahThreads[i] = nWorkers > 1 ?
+                        CPLCreateJoinableThread( SeriesWorker, psQueue ) :
+                        NULL;
+    for( i = 0; i < nWorkers; i++ )
+    {
+        if( pahThreads[i] )
+            CPLJoinThread( pahThreads[i] );
+    }
+    CPLFree( pahThreads );
+    /* Finish anything left by workers that failed to start */
+    SeriesWorker( psQueue );
+    return psQueue->nErrors > 0 ? CE_Failure : CE_None;
+}
+
+/*
+** Convert a series of grids on the same geometry, one per time step, to a
+** single animated kmz pszDstFile.  Step i is shown from papszTimes[i] until
+** the next step, the last one from then on, times being KML dateTime
+** values in order.  The warp is set up once from the first grid, its index
+** map is built once, kept in cache_dir or in memory, and every step
+** gathers through it.  The polygons and images are written once.  The
+** steps are scanned, then warped and encoded, num_threads at a time, one
+** thread each.  A super-overlay isn't made, each step is a single overlay,
+** nor are the reduced_outputs copies or strike points.
+*/
+CPLErr RLProcessSeries( RLContext *psCtx, char **papszSrcFiles,
+                        char **papszTimes, const char *pszDstFile )
+{
+    static volatile int nIndexDirs = 0;
+    RLSeriesQueue sQueue;
+    RLStaticParts sParts;
+    RLPerf sPerf, *psPerf;
+    RLBuffer sDoc;
+    RLKmzWriter *psKmz = NULL;
+    CPLJoinableThread *ahThreads[2];
+    GDALDatasetH hFirstDS;
+    char **papszWarpOptions;
+    char *pszIndexDir = NULL, *pszName;
+    GUIntBig nGridBytes, nWritten;
+    double dfMemory;
+    int i, iStage, nWorkers, bStatic = FALSE;
+    CPLErr eErr = CE_None, eStaticErr;
+
+    memset( &sQueue, 0, sizeof( sQueue ) );
+    memset( &sDoc, 0, sizeof( sDoc ) );
+    sQueue.psCtx = psCtx;
+    sQueue.nStepCount = MIN( CSLCount( papszSrcFiles ),
+                             CSLCount( papszTimes ) );
+    if( sQueue.nStepCount == 0 )
+    {
+        CPLError( CE_Failure, CPLE_IllegalArg, "No grids to animate in %s",
+                  pszDstFile );
+        return CE_Failure;
+    }
+    if( psCtx->bSuperOverlay )
+        CPLError( CE_Warning, CPLE_AppDefined,
+                  "A series is written as single overlays, not a " \
+                  "super-overlay" );
+    if( psCtx->bStrikePoints )
+        CPLError( CE_Warning, CPLE_AppDefined,
+                  "Strike points aren't written for a series" );
+    sQueue.pasSteps = (RLSeriesStep*)
+        CPLCalloc( sizeof( RLSeriesStep ), sQueue.nStepCount );
+    for( i = 0; i < sQueue.nStepCount; i++ )
+    {
+        sQueue.pasSteps[i].pszSrcFile = papszSrcFiles[i];
+        sQueue.pasSteps[i].pszBegin = papszTimes[i];
+        if( i + 1 < sQueue.nStepCount )
+            sQueue.pasSteps[i].pszEnd = papszTimes[i + 1];
+    }
+    psPerf = psCtx->pszPerfLog ? &sPerf : NULL;
+    RLPerfStart( psPerf );
+
+    iStage = RLPerfBegin( psPerf, "open" );
+    hFirstDS = OpenGrid( papszSrcFiles[0] );
+    RLPerfEnd( psPerf, iStage, 0, 0 );
+    if( !hFirstDS )
+        eErr = CE_Failure;
+
+    /*
+    ** Warp the first grid, building the index map the others share.
+    ** Without a cache_dir it is kept in memory for this series only.
+    */
+    if( eErr == CE_None )
+    {
+        StartStaticParts( psCtx, hFirstDS, psPerf, &sParts, ahThreads );
+        bStatic = TRUE;
+
+        iStage = RLPerfBegin( psPerf, "warp" );
+        if( !psCtx->pszCacheDir )
+            pszIndexDir = CPLStrdup( CPLSPrintf( "/vsimem/rl2kmz_series_%d",
+                                                 CPLAtomicInc(
+                                                     &nIndexDirs ) ) );
+        papszWarpOptions =
+            CSLSetNameValue( NULL, "NUM_THREADS",
+                             CPLSPrintf( "%d", psCtx->nThreads ) );
+        papszWarpOptions =
+            CSLSetNameValue( papszWarpOptions, "WARP_MEMORY",
+                             CPLSPrintf( "%.0f", psCtx->dfWarpMemory ) );
+        if( psCtx->dfMemoryLimit > 0.0 )
+        {
+            papszWarpOptions =
+                CSLSetNameValue( papszWarpOptions, "MAX_MEMORY",
+                                 CPLSPrintf( "%.0f",
+                                             psCtx->dfMemoryLimit ) );
+        }
+        papszWarpOptions =
+            CSLSetNameValue( papszWarpOptions, "CACHE_DIR",
+                             pszIndexDir ? pszIndexDir : psCtx->pszCacheDir );
+        sQueue.psFirstGrid = RLCreateWarpedGrid( hFirstDS, RL_SRC_WKT,
+                                                 RL_DST_WKT,
+                                                 papszWarpOptions );
+        /*
+        ** Steps that can't gather through the index map run the warper
+        ** themselves, one thread each as the steps are already spread out.
+        */
+        papszWarpOptions = CSLSetNameValue( papszWarpOptions, "CACHE_DIR",
+                                            NULL );
+        sQueue.papszWarpOptions = CSLSetNameValue( papszWarpOptions,
+                                                   "NUM_THREADS", "1" );
+        if( sQueue.psFirstGrid )
+        {
+            RLGetWarpedGridInfo( sQueue.psFirstGrid, &sQueue.nXSize,
+                                 &sQueue.nYSize, NULL, sQueue.adfGeoTransform,
+                                 NULL );
+            sQueue.nSrcXSize = GDALGetRasterXSize( hFirstDS );
+            sQueue.nSrcYSize = GDALGetRasterYSize( hFirstDS );
+            GDALGetGeoTransform( hFirstDS, sQueue.adfSrcGeoTransform );
+        }
+        else
+        {
+            eErr = CE_Failure;
+        }
+        RLPerfEnd( psPerf, iStage, 0, 0 );
+    }
+
+    /*
+    ** Each worker holds the source values of the step it is on, so only as
+    ** many run as memory_limit has room for, or without one as fit in
+    ** RL_SERIES_RAM_FRACTION of the physical memory shared by the jobs.
+    */
+    nGridBytes = (GUIntBig) sQueue.nSrcXSize * sQueue.nSrcYSize *
+                 sizeof( GInt32 );
+    nWorkers = MAX( 1, MIN( psCtx->nThreads, sQueue.nStepCount ) );
+    dfMemory = psCtx->dfMemoryLimit;
+    if( dfMemory <= 0.0 )
+        dfMemory = (double) CPLGetUsablePhysicalRAM() *
+                   RL_SERIES_RAM_FRACTION / psCtx->nJobs;
+    if( dfMemory > 0.0 && nGridBytes > 0 )
+    {
+        nWorkers = MAX( 1, MIN( nWorkers, (int) ( dfMemory / nGridBytes ) ) );
+        CPLDebug( "RL2KMZ", "Series on %d worker(s), %.0f MB for grids",
+                  nWorkers, dfMemory / 1048576.0 );
+    }
+
+    if( eErr == CE_None )
+    {
+        iStage = RLPerfBegin( psPerf, "scan" );
+        sQueue.bRender = FALSE;
+        eErr = RunSeriesQueue( &sQueue, nWorkers );
+        RLPerfEnd( psPerf, iStage, nGridBytes * sQueue.nStepCount, 0 );
+    }
+    if( bStatic )
+    {
+        eStaticErr = FinishStaticParts( &sParts, ahThreads );
+        if( eErr == CE_None )
+            eErr = eStaticErr;
+    }
+    if( eErr == CE_None )
+    {
+        iStage = RLPerfBegin( psPerf, "document" );
+        pszName = CPLStrdup( CPLGetBasename( pszDstFile ) );
+        WriteDocument( psCtx, NULL, sQueue.pasSteps, sQueue.nStepCount,
+                       &sParts, pszName, &sDoc );
+        CPLFree( pszName );
+        RLPerfEnd( psPerf, iStage, 0, sDoc.nSize );
+
+        psKmz = RLKmzCreate( pszDstFile, &psCtx->sKmzOptions );
+        if( !psKmz )
+            eErr = CE_Failure;
+    }
+    if( eErr == CE_None )
+        eErr = RLKmzAddFile( psKmz, "doc.kml", sDoc.pabyData, sDoc.nSize,
+                             TRUE );
+    RLBufferFree( &sDoc );
+
+    /* Steps are added as they finish, the kml doesn't mind the order */
+    nWritten = RLKmzGetBytesWritten( psKmz );
+    if( eErr == CE_None )
+    {
+        iStage = RLPerfBegin( psPerf, "raster" );
+        sQueue.psKmz = psKmz;
+        sQueue.bRender = TRUE;
+        eErr = RunSeriesQueue( &sQueue, nWorkers );
+        RLPerfEnd( psPerf, iStage, nGridBytes * sQueue.nStepCount,
+                   RLKmzGetBytesWritten( psKmz ) - nWritten );
+    }
+    RLDestroyWarpedGrid( sQueue.psFirstGrid );
+    CSLDestroy( sQueue.papszWarpOptions );
+    if( sQueue.hKmzMutex )
+        CPLDestroyMutex( sQueue.hKmzMutex );
+    if( hFirstDS )
+        GDALClose( hFirstDS );
+    if( pszIndexDir )
+        VSIRmdirRecursive( pszIndexDir );
+    CPLFree( pszIndexDir );
+
+    nWritten = RLKmzGetBytesWritten( psKmz );
+    iStage = RLPerfBegin( psPerf, "archive" );
+    if( eErr == CE_None )
+        eErr = WriteImages( psCtx, &sParts, psKmz );
+    if( bStatic )
+        ReleaseStaticParts( &sParts );
+    nWritten = RLKmzGetBytesWritten( psKmz ) - nWritten;
+    if( psKmz && RLKmzClose( psKmz, eErr == CE_None ) != CE_None )
+        eErr = CE_Failure;
+    RLPerfEnd( psPerf, iStage, 0, nWritten );
+
+    if( eErr != CE_None )
+        CPLError( CE_Failure, CPLE_AppDefined,
+                  "Failed to convert the series of %s to %s",
+                  papszSrcFiles[0], pszDstFile );
+    WritePerfRecord( psCtx, psPerf, papszSrcFiles[0], pszDstFile, eErr );
+    CPLFree( sQueue.pasSteps );
+    return eErr;
+}
+
+static void JobWorker( void *pArg )
+{
+    RLJobQueue *psQueue = (RLJobQueue*) pArg;
+    int iJob;
+
+    while( ( iJob = CPLAtomicInc( &psQueue->nNextJob ) - 1 ) <
+           psQueue->nJobCount )
+    {
+        if( RLProcessGrid( psQueue->psCtx, psQueue->papszSrcFiles[iJob],
+                           psQueue->papszDstFiles[iJob] ) != CE_None )
+        {
+            CPLAtomicInc( &psQueue->nErrors );
+        }
+    }
+}
+
+/*
+** Convert each of papszSrcFiles to the matching entry of papszDstFiles, on
+** a pool of concurrent_jobs workers.  Each conversion still uses
+** num_threads threads for its raster stages.  Returns the number of
+** conversions that failed.
+*/
+int RLRunJobs( RLContext *psCtx, char **papszSrcFiles, char **papszDstFiles )
+{
+    RLJobQueue sQueue;
+    CPLJoinableThread **pahThreads;
+    int i, nWorkers;
+
+    memset( &sQueue, 0, sizeof( sQueue ) );
+    sQueue.psCtx = psCtx;
+    sQueue.papszSrcFiles = papszSrcFiles;
+    sQueue.papszDstFiles = papszDstFiles;
+    sQueue.nJobCount = MIN( CSLCount( papszSrcFiles ),
+                            CSLCount( papszDstFiles ) );
+
+    nWorkers = MAX( 1, MIN( psCtx->nJobs, sQueue.nJobCount ) );
+    if( nWorkers == 1 )
+    {
+        JobWorker( &sQueue );
+        return sQueue.nErrors;
+    }
+    pahThreads = (CPLJoinableThread**)
+        CPLMalloc( sizeof( CPLJoinableThread* ) * nWorkers );
+    for( i = 0; i < nWorkers; i++ )
+        pahThreads[i] = CPLCreateJoinableThread( JobWorker, &sQueue );
+    for( i = 0; i < nWorkers; i++ )
+    {
+        if( pahThreads[i] )
+            CPLJoinThread( pahThreads[i] );
+    }
+    CPLFree( pahThreads );
+    /* Finish anything left by workers that failed to start */
+    JobWorker( &sQueue );
+    return sQueue.nErrors;
+}
+
+/*
+** State of the grid at pszPath for RLWatchDirectory(): the number, total
+** size and newest mtime of the files GDAL reads it from, so a grid that is
+** a directory, like an Arc/Info binary grid, changes as its files are
+** written.  NULL if pszPath can't be opened as a raster.
+*/
+static char * GetGridState( const char *pszPath )
+{
+    GDALDatasetH hDS;
+    VSIStatBufL sStat;
+    char **papszFiles;
+    GIntBig nSize = 0, nMTime = 0;
+    int i, nFiles;
+
+    CPLPushErrorHandler( CPLQuietErrorHandler );
+    hDS = GDALOpenEx( pszPath, GDAL_OF_READONLY | GDAL_OF_RASTER, NULL,
+                      NULL, NULL );
+    CPLPopErrorHandler();
+    if( !hDS )
+        return NULL;
+    papszFiles = GDALGetFileList( hDS );
+    GDALClose( hDS );
+    if( !papszFiles )
+        papszFiles = CSLAddString( papszFiles, pszPath );
+    nFiles = CSLCount( papszFiles );
+    for( i = 0; i < nFiles; i++ )
+    {
+        if( VSIStatL( papszFiles[i], &sStat ) != 0 )
+            continue;
+        nSize += (GIntBig) sStat.st_size;
+        nMTime = MAX( nMTime, (GIntBig) sStat.st_mtime );
+    }
+    CSLDestroy( papszFiles );
+    return CPLStrdup( CPLSPrintf( "%d:" CPL_FRMT_GIB ":" CPL_FRMT_GIB,
+                                  nFiles, nSize, nMTime ) );
+}
+
+/*
+** Ask RLWatchDirectory() on psCtx to return after the grids it is
+** converting, for instance from a signal handler.  The request is cleared
+** when the next RLWatchDirectory() on psCtx starts.
+*/
+void RLStopWatching( RLContext *psCtx )
+{
+    psCtx->bStopWatching = TRUE;
+}
+
+/*
+** Watch pszSrcDir and convert each grid that appears or changes in it to
+** a kmz of the same name in pszDstDir, scanning every dfInterval seconds.
+** A grid is converted once it has looked the same on two scans in a row,
+** so grids still being written are left alone.  Entries GDAL can't open
+** as a raster are skipped.  Grids are remembered by name and the size and
+** mtime of their files while they are in pszSrcDir and forgotten once
+** they leave it.  Returns once RLStopWatching() is called, after dfMaxIdle
+** seconds without a new grid if it is above 0, or if pszSrcDir can't be
+** read.
+*/
+CPLErr RLWatchDirectory( RLContext *psCtx, const char *pszSrcDir,
+                         const char *pszDstDir, double dfInterval,
+                         double dfMaxIdle )
+{
+    char **papszEntries, **papszSeen, **papszDone, **papszLastSeen;
+    char **papszStillDone, **papszSrcFiles, **papszDstFiles;
+    const char *pszEntry, *pszDone;
+    char *pszState, *pszBasename;
+    VSIStatBufL sStat;
+    double dfIdle, dfSleep;
+    int i, nErrors;
+
+    papszDone = NULL;
+    papszLastSeen = NULL;
+    dfIdle = 0.0;
+    if( dfInterval <= 0.0 )
+        dfInterval = RL_WATCH_INTERVAL;
+    psCtx->bStopWatching = FALSE;
+    while( !psCtx->bStopWatching )
+    {
+        if( VSIStatL( pszSrcDir, &sStat ) != 0 || !VSI_ISDIR( sStat.st_mode ) )
+        {
+            CPLError( CE_Failure, CPLE_OpenFailed, "Could not read %s",
+                      pszSrcDir );
+            CSLDestroy( papszDone );
+            CSLDestroy( papszLastSeen );
+            return CE_Failure;
+        }
+        papszEntries = VSIReadDir( pszSrcDir );
+        papszSeen = NULL;
+        papszStillDone = NULL;
+        papszSrcFiles = NULL;
+        papszDstFiles = NULL;
+        for( i = 0; papszEntries && papszEntries[i]; i++ )
+        {
+            pszEntry = papszEntries[i];
+            if( pszEntry[0] == '.' )
+                continue;
+            pszState = GetGridState( CPLFormFilename( pszSrcDir, pszEntry,
+                                                      NULL ) );
+            if( !pszState )
+                continue;
+            papszSeen = CSLSetNameValue( papszSeen, pszEntry, pszState );
+            pszDone = CSLFetchNameValue( papszDone, pszEntry );
+            if( pszDone && EQUAL( pszDone, pszState ) )
+            {
+                papszStillDone = CSLSetNameValue( papszStillDone, pszEntry,
+                                                  pszState );
+                CPLFree( pszState );
+                continue;
+            }
+            if( !EQUAL( CSLFetchNameValueDef( papszLastSeen, pszEntry, "" ),
+                        pszState ) )
+            {
+                CPLFree( pszState );
+                continue;
+            }
+            papszStillDone = CSLSetNameValue( papszStillDone, pszEntry,
+                                              pszState );
+            CPLFree( pszState );
+            papszSrcFiles = CSLAddString( papszSrcFiles,
+                                          CPLFormFilename( pszSrcDir,
+                                                           pszEntry, NULL ) );
+            /* CPLGetBasename() shares CPLFormFilename()'s buffer */
+            pszBasename = CPLStrdup( CPLGetBasename( pszEntry ) );
+            papszDstFiles = CSLAddString( papszDstFiles,
+                                          CPLFormFilename( pszDstDir,
+                                                           pszBasename,
+                                                           "kmz" ) );
+            CPLFree( pszBasename );
+        }
+        CSLDestroy( papszEntries );
+        CSLDestroy( papszLastSeen );
+        papszLastSeen = papszSeen;
+        /* Grids gone from pszSrcDir, or changed since, are forgotten */
+        CSLDestroy( papszDone );
+        papszDone = papszStillDone;
+
+        if( papszSrcFiles )
+        {
+            nErrors = RLRunJobs( psCtx, papszSrcFiles, papszDstFiles );
+            CPLDebug( "RL2KMZ", "Converted %d grids, %d failed",
+                      CSLCount( papszSrcFiles ), nErrors );
+            dfIdle = 0.0;
+        }
+        CSLDestroy( papszSrcFiles );
+        CSLDestroy( papszDstFiles );
+        if( dfMaxIdle > 0.0 && dfIdle >= dfMaxIdle )
+        {
+            CPLDebug( "RL2KMZ", "No new grids in %s for %g seconds",
+                      pszSrcDir, dfIdle );
+            break;
+        }
+        /* Sleep a second at a time to notice RLStopWatching() */
+        for( dfSleep = dfInterval;
+             dfSleep > 0.0 && !psCtx->bStopWatching; dfSleep -= 1.0 )
+        {
+            CPLSleep( MIN( dfSleep, 1.0 ) );
+        }
+        dfIdle += dfInterval;
+    }
+    CSLDestroy( papszDone );
+    CSLDestroy( papszLastSeen );
+    return CE_None;
+}
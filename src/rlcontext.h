@@ -0,0 +1,122 @@
+/******************************************************************************
+*
+*  Project:  rl2kmz
+*  Purpose:  conversion of rain and lightning grids with warm shared state
+*  Author:   Kyle Shannon <kyle at pobox dot com>
+*
+*******************************************************************************
+*
+* This is free and unencumbered software released into the public domain.
+*
+* Anyone is free to copy, modify, publish, use, compile, sell, or
+* distribute this software, either in source code form or as a compiled
+* binary, for any purpose, commercial or non-commercial, and by any
+* means.
+*
+* In jurisdictions that recognize copyright laws, the author or authors
+* of this software dedicate any and all copyright interest in the
+* software to the public domain. We make this dedication for the benefit
+* of the public at large and to the detriment of our heirs and
+* successors. We intend this dedication to be an overt act of
+* relinquishment in perpetuity of all present and future rights to this
+* software under copyright law.
+*
+* THIS SOFTWARE WAS DEVELOPED AT THE ROCKY MOUNTAIN RESEARCH STATION (RMRS)
+* MISSOULA FIRE SCIENCES LABORATORY BY EMPLOYEES OF THE FEDERAL GOVERNMENT
+* IN THE COURSE OF THEIR OFFICIAL DUTIES. PURSUANT TO TITLE 17 SECTION 105
+* OF THE UNITED STATES CODE, THIS SOFTWARE IS NOT SUBJECT TO COPYRIGHT
+* PROTECTION AND IS IN THE PUBLIC DOMAIN. RMRS MISSOULA FIRE SCIENCES
+* LABORATORY ASSUMES NO RESPONSIBILITY WHATSOEVER FOR ITS USE BY OTHER
+* PARTIES,  AND MAKES NO GUARANTEES, EXPRESSED OR IMPLIED, ABOUT ITS QUALITY,
+* RELIABILITY, OR ANY OTHER CHARACTERISTIC.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+* IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+* OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+* ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+* OTHER DEALINGS IN THE SOFTWARE.
+*
+* For more information, please refer to <http://unlicense.org>
+*
+******************************************************************************/
+
+#ifndef RLCONTEXT_H_
+#define RLCONTEXT_H_
+
+#include "gdal.h"
+
+#include "rlport.h"
+#include "rlutil.h"
+
+CPL_C_START
+
+/*
+** Polygons left out of the kmz.
+*/
+#define RL_POLYGON_FILTER "Name!='Elevated'"
+
+/*
+** The rain and lightning grids are in Lambert azimuthal equal area on a
+** sphere, without a usable projection of their own, and go to WGS84.
+*/
+#define RL_SRC_WKT "PROJCS[\"unnamed\",GEOGCS[\"unnamed ellipse" \
+                   "\",DATUM[\"unknown\",SPHEROID[\"unnamed\"," \
+                   "6370997,0]],PRIMEM[\"Greenwich\",0],UNIT[\"" \
+                   "degree\",0.0174532925199433]],PROJECTION[\"" \
+                   "Lambert_Azimuthal_Equal_Area\"]," \
+                   "PARAMETER[\"latitude_of_center\",45]," \
+                   "PARAMETER[\"longitude_of_center\",-100]," \
+                   "PARAMETER[\"false_easting\",0]," \
+                   "PARAMETER[\"false_northing\",0],UNIT[\"Meter\",1]]"
+#define RL_DST_WKT "GEOGCS[\"WGS 84\",DATUM[\"WGS_1984\"," \
+                   "SPHEROID[\"WGS 84\",6378137,298.257223563," \
+                   "AUTHORITY[\"EPSG\",\"7030\"]]," \
+                   "AUTHORITY[\"EPSG\",\"6326\"]]," \
+                   "PRIMEM[\"Greenwich\",0," \
+                   "AUTHORITY[\"EPSG\",\"8901\"]]," \
+                   "UNIT[\"degree\",0.01745329251994328," \
+                   "AUTHORITY[\"EPSG\",\"9122\"]]," \
+                   "AUTHORITY[\"EPSG\",\"4326\"]]"
+
+/*
+** Seconds between scans of a watched directory.
+*/
+#ifndef RL_WATCH_INTERVAL
+#define RL_WATCH_INTERVAL 10.0
+#endif
+
+/*
+** Parsed configuration, colour table, polygon placemarks and static images
+** shared by any number of conversions, concurrent ones included.
+*/
+typedef struct RLContext RLContext;
+
+RLContext * RLCreateContext( char **papszConfig );
+void RLDestroyContext( RLContext *psCtx );
+
+int RLGetJobCount( const RLContext *psCtx );
+
+CPLErr RLProcessGrid( RLContext *psCtx, const char *pszSrcFile,
+                      const char *pszDstFile );
+
+CPLErr RLProcessDataset( RLContext *psCtx, GDALDatasetH hSrcDS,
+                         const char *pszName, RLWriteFunc pfnWrite,
+                         void *pUserData );
+GByte * RLProcessDatasetToBuffer( RLContext *psCtx, GDALDatasetH hSrcDS,
+                                  const char *pszName, size_t *pnSize );
+
+CPLErr RLProcessSeries( RLContext *psCtx, char **papszSrcFiles,
+                        char **papszTimes, const char *pszDstFile );
+
+int RLRunJobs( RLContext *psCtx, char **papszSrcFiles, char **papszDstFiles );
+
+CPLErr RLWatchDirectory( RLContext *psCtx, const char *pszSrcDir,
+                         const char *pszDstDir, double dfInterval,
+                         double dfMaxIdle );
+void RLStopWatching( RLContext *psCtx );
+
+CPL_C_END
+
+#endif /* RLCONTEXT_H_ */
@@ -0,0 +1,576 @@
+/******************************************************************************
+*
+*  Project:  rl2kmz
+*  Purpose:  deflate streams, in parallel blocks on several threads
+*  Author:   Kyle Shannon <kyle at pobox dot com>
+*
+*******************************************************************************
+*
+* This is free and unencumbered software released into the public domain.
+*
+* Anyone is free to copy, modify, publish, use, compile, sell, or
+* distribute this software, either in source code form or as a compiled
+* binary, for any purpose, commercial or non-commercial, and by any
+* means.
+*
+* In jurisdictions that recognize copyright laws, the author or authors
+* of this software dedicate any and all copyright interest in the
+* software to the public domain. We make this dedication for the benefit
+* of the public at large and to the detriment of our heirs and
+* successors. We intend this dedication to be an overt act of
+* relinquishment in perpetuity of all present and future rights to this
+* software under copyright law.
+*
+* THIS SOFTWARE WAS DEVELOPED AT THE ROCKY MOUNTAIN RESEARCH STATION (RMRS)
+* MISSOULA FIRE SCIENCES LABORATORY BY EMPLOYEES OF THE FEDERAL GOVERNMENT
+* IN THE COURSE OF THEIR OFFICIAL DUTIES. PURSUANT TO TITLE 17 SECTION 105
+* OF THE UNITED STATES CODE, THIS SOFTWARE IS NOT SUBJECT TO COPYRIGHT
+* PROTECTION AND IS IN THE PUBLIC DOMAIN. RMRS MISSOULA FIRE SCIENCES
+* LABORATORY ASSUMES NO RESPONSIBILITY WHATSOEVER FOR ITS USE BY OTHER
+* PARTIES,  AND MAKES NO GUARANTEES, EXPRESSED OR IMPLIED, ABOUT ITS QUALITY,
+* RELIABILITY, OR ANY OTHER CHARACTERISTIC.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+* IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+* OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+* ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+* OTHER DEALINGS IN THE SOFTWARE.
+*
+* For more information, please refer to <http://unlicense.org>
+*
+******************************************************************************/
+
+#include <zlib.h>
+
+#include "cpl_atomic_ops.h"
+#include "cpl_conv.h"
+#include "cpl_multiproc.h"
+#include "cpl_string.h"
+
+#include "rldeflate.h"
+
+/*
+** Compressed bytes gathered before they're handed to pfnWrite.
+*/
+#ifndef RL_DEFLATE_OUT_SIZE
+#define RL_DEFLATE_OUT_SIZE 65536
+#endif
+
+/*
+** Each block is primed with the RL_DEFLATE_WINDOW bytes before it, so
+** little is lost to the split.
+*/
+#define RL_DEFLATE_WINDOW 32768
+
+/*
+** One block of a parallel deflate and what it compressed to.
+*/
+typedef struct
+{
+    const GByte *pabyDict;
+    uInt nDictSize;
+    const GByte *pabyIn;
+    uInt nInSize;
+    GByte *pabyOut;
+    uInt nOutAlloc;
+    uInt nOutSize;
+    uLong nAdler;
+} RLDeflateBlock;
+
+/*
+** Blocks of one batch shared by the deflate workers.
+*/
+typedef struct
+{
+    RLDeflateBlock *pasBlocks;
+    int nBlockCount;
+    int nLevel;
+    int nStrategy;
+    int bAdler;
+    volatile int nNextBlock;
+    volatile int nErrors;
+} RLDeflateBatch;
+
+struct RLDeflater
+{
+    /* A zlib stream, header and adler32, or raw deflate */
+    int bZlib;
+    RLDeflateOptions sOptions;
+    RLWriteFunc pfnWrite;
+    void *pUserData;
+    /* One stream on the calling thread */
+    z_stream sStream;
+    GByte *pabyOut;
+    /* Parallel: the window kept from the last batch, then the input of up
+       to nThreads blocks */
+    int bParallel;
+    GByte *pabyBatch;
+    size_t nBatchDict;
+    size_t nBatchUsed;
+    RLDeflateBlock *pasBlocks;
+    uLong nAdler;
+    int bHeaderWritten;
+    CPLErr eErr;
+};
+
+/*
+** Defaults: zlib's level and strategy, one stream.
+*/
+void RLDeflateInitOptions( RLDeflateOptions *psOptions )
+{
+    psOptions->nLevel = Z_DEFAULT_COMPRESSION;
+    psOptions->nStrategy = Z_DEFAULT_STRATEGY;
+    psOptions->nThreads = 1;
+}
+
+/*
+** zlib strategy named default, filtered, huffman, rle or fixed, or -1.
+*/
+static int ParseStrategy( const char *pszStrategy )
+{
+    if( EQUAL( pszStrategy, "default" ) )
+        return Z_DEFAULT_STRATEGY;
+    if( EQUAL( pszStrategy, "filtered" ) )
+        return Z_FILTERED;
+    if( EQUAL( pszStrategy, "huffman" ) )
+        return Z_HUFFMAN_ONLY;
+    if( EQUAL( pszStrategy, "rle" ) )
+        return Z_RLE;
+    if( EQUAL( pszStrategy, "fixed" ) )
+        return Z_FIXED;
+    return -1;
+}
+
+/*
+** Options from the config keys prefix_level, 0 to 9, and prefix_strategy,
+** with the threads from deflate_threads.  Anything missing or invalid is
+** left at the default.
+*/
+void RLDeflateGetOptions( char **papszConfig, const char *pszPrefix,
+                          RLDeflateOptions *psOptions )
+{
+    const char *pszValue;
+    int nStrategy;
+
+    RLDeflateInitOptions( psOptions );
+    pszValue = CSLFetchNameValue( papszConfig,
+                                  CPLSPrintf( "%s_level", pszPrefix ) );
+    if( pszValue && !EQUAL( pszValue, "default" ) )
+    {
+        psOptions->nLevel = atoi( pszValue );
+        if( psOptions->nLevel < 0 || psOptions->nLevel > 9 )
+        {
+            CPLError( CE_Warning, CPLE_AppDefined,
+                      "Invalid %s_level %s, using the default", pszPrefix,
+                      pszValue );
+            psOptions->nLevel = Z_DEFAULT_COMPRESSION;
+        }
+    }
+    pszValue = CSLFetchNameValue( papszConfig,
+                                  CPLSPrintf( "%s_strategy", pszPrefix ) );
+    if( pszValue )
+    {
+        nStrategy = ParseStrategy( pszValue );
+        if( nStrategy < 0 )
+            CPLError( CE_Warning, CPLE_AppDefined,
+                      "Invalid %s_strategy %s, using the default",
+                      pszPrefix, pszValue );
+        else
+            psOptions->nStrategy = nStrategy;
+    }
+    psOptions->nThreads =
+        RLGetThreadCount( CSLFetchNameValueDef( papszConfig,
+                                                "deflate_threads", "1" ) );
+}
+
+static CPLErr Emit( RLDeflater *psDeflater, const void *pData,
+                    size_t nBytes )
+{
+    if( psDeflater->eErr != CE_None || nBytes == 0 )
+        return psDeflater->eErr;
+    if( psDeflater->pfnWrite( pData, nBytes, psDeflater->pUserData ) !=
+        nBytes )
+    {
+        CPLError( CE_Failure, CPLE_FileIO, "Failed to write deflated data" );
+        psDeflater->eErr = CE_Failure;
+    }
+    return psDeflater->eErr;
+}
+
+/*
+** Run the single stream over whatever is in next_in, handing the output
+** on every time the buffer fills.
+*/
+static CPLErr Deflate( RLDeflater *psDeflater, int nFlush )
+{
+    z_stream *psStream = &psDeflater->sStream;
+    int nRet;
+
+    do
+    {
+        nRet = deflate( psStream, nFlush );
+        if( nRet == Z_STREAM_ERROR )
+        {
+            CPLError( CE_Failure, CPLE_AppDefined, "deflate() failed" );
+            psDeflater->eErr = CE_Failure;
+            return CE_Failure;
+        }
+        if( psStream->avail_out == 0 ||
+            ( nFlush == Z_FINISH &&
+              psStream->avail_out < RL_DEFLATE_OUT_SIZE ) )
+        {
+            if( Emit( psDeflater, psDeflater->pabyOut,
+                      RL_DEFLATE_OUT_SIZE - psStream->avail_out ) != CE_None )
+            {
+                return CE_Failure;
+            }
+            psStream->next_out = psDeflater->pabyOut;
+            psStream->avail_out = RL_DEFLATE_OUT_SIZE;
+        }
+    } while( psStream->avail_in > 0 ||
+             ( nFlush == Z_FINISH && nRet != Z_STREAM_END ) );
+    return CE_None;
+}
+
+/*
+** Deflate blocks off the batch until there are none left.  Each is a raw
+** deflate primed with the window before it and ended with a sync flush,
+** so the blocks join up into one stream.
+*/
+static void DeflateWorker( void *pData )
+{
+    RLDeflateBatch *psBatch = (RLDeflateBatch*) pData;
+    RLDeflateBlock *psBlock;
+    z_stream sStream;
+    int iBlock, nRet;
+
+    while( ( iBlock = CPLAtomicInc( &psBatch->nNextBlock ) - 1 ) <
+           psBatch->nBlockCount )
+    {
+        psBlock = psBatch->pasBlocks + iBlock;
+        memset( &sStream, 0, sizeof( sStream ) );
+        if( deflateInit2( &sStream, psBatch->nLevel, Z_DEFLATED, -15, 8,
+                          psBatch->nStrategy ) != Z_OK )
+        {
+            CPLAtomicInc( &psBatch->nErrors );
+            continue;
+        }
+        if( psBlock->nDictSize > 0 &&
+            deflateSetDictionary( &sStream, psBlock->pabyDict,
+                                  psBlock->nDictSize ) != Z_OK )
+        {
+            CPLAtomicInc( &psBatch->nErrors );
+            deflateEnd( &sStream );
+            continue;
+        }
+        sStream.next_in = (Bytef*) psBlock->pabyIn;
+        sStream.avail_in = psBlock->nInSize;
+        sStream.next_out = psBlock->pabyOut;
+        sStream.avail_out = psBlock->nOutAlloc;
+        nRet = deflate( &sStream, Z_SYNC_FLUSH );
+        if( nRet != Z_OK || sStream.avail_in > 0 ||
+            sStream.avail_out == 0 )
+        {
+            CPLAtomicInc( &psBatch->nErrors );
+        }
+        psBlock->nOutSize = psBlock->nOutAlloc - sStream.avail_out;
+        if( psBatch->bAdler )
+            psBlock->nAdler = adler32( adler32( 0L, Z_NULL, 0 ),
+                                       psBlock->pabyIn, psBlock->nInSize );
+        deflateEnd( &sStream );
+    }
+}
+
+/*
+** The zlib header of the parallel path, with the level hint of the level
+** used.
+*/
+static CPLErr WriteHeader( RLDeflater *psDeflater )
+{
+    GByte abyHeader[2];
+    int nLevel = psDeflater->sOptions.nLevel;
+
+    psDeflater->bHeaderWritten = TRUE;
+    psDeflater->nAdler = adler32( 0L, Z_NULL, 0 );
+    if( !psDeflater->bZlib )
+        return psDeflater->eErr;
+    abyHeader[0] = 0x78;
+    abyHeader[1] = (GByte) ( ( nLevel < 0 || nLevel == 6 ? 2 :
+                               nLevel < 2 ? 0 : nLevel < 6 ? 1 : 3 ) << 6 );
+    abyHeader[1] += (GByte) ( 31 - ( abyHeader[0] * 256 + abyHeader[1] ) %
+                              31 );
+    return Emit( psDeflater, abyHeader, 2 );
+}
+
+/*
+** Deflate the input gathered in the batch, a block per worker, and write
+** the blocks out in order.  The last window of the batch is kept to prime
+** the next one.
+*/
+static CPLErr DeflateBatch( RLDeflater *psDeflater )
+{
+    RLDeflateBatch sBatch;
+    RLDeflateBlock *psBlock;
+    CPLJoinableThread **pahThreads;
+    size_t nOffset, nKeep;
+    int i, nThreads;
+
+    if( psDeflater->nBatchUsed == 0 || psDeflater->eErr != CE_None )
+        return psDeflater->eErr;
+    memset( &sBatch, 0, sizeof( sBatch ) );
+    sBatch.pasBlocks = psDeflater->pasBlocks;
+    sBatch.nLevel = psDeflater->sOptions.nLevel;
+    sBatch.nStrategy = psDeflater->sOptions.nStrategy;
+    sBatch.bAdler = psDeflater->bZlib;
+    for( nOffset = 0; nOffset < psDeflater->nBatchUsed;
+         nOffset += RL_DEFLATE_BLOCK_SIZE )
+    {
+        psBlock = psDeflater->pasBlocks + sBatch.nBlockCount++;
+        psBlock->pabyIn = psDeflater->pabyBatch + psDeflater->nBatchDict +
+                          nOffset;
+        psBlock->nInSize = (uInt) MIN( (size_t) RL_DEFLATE_BLOCK_SIZE,
+                                       psDeflater->nBatchUsed - nOffset );
+        psBlock->nDictSize = (uInt) MIN( (size_t) RL_DEFLATE_WINDOW,
+                                         psDeflater->nBatchDict + nOffset );
+        psBlock->pabyDict = psBlock->pabyIn - psBlock->nDictSize;
+    }
+
+    nThreads = MIN( psDeflater->sOptions.nThreads, sBatch.nBlockCount );
+    if( nThreads <= 1 )
+    {
+        DeflateWorker( &sBatch );
+    }
+    else
+    {
+        pahThreads = (CPLJoinableThread**)
+            CPLMalloc( sizeof( CPLJoinableThread* ) * nThreads );
+        for( i = 0; i < nThreads; i++ )
+            pahThreads[i] = CPLCreateJoinableThread( DeflateWorker, &sBatch );
+        for( i = 0; i < nThreads; i++ )
+        {
+            if( pahThreads[i] )
+                CPLJoinThread( pahThreads[i] );
+        }
+        CPLFree( pahThreads );
+        /* Blocks a thread that didn't start left behind */
+        DeflateWorker( &sBatch );
+    }
+    if( sBatch.nErrors > 0 )
+    {
+        CPLError( CE_Failure, CPLE_AppDefined, "deflate() failed" );
+        psDeflater->eErr = CE_Failure;
+        return CE_Failure;
+    }
+
+    if( !psDeflater->bHeaderWritten )
+        WriteHeader( psDeflater );
+    for( i = 0; i < sBatch.nBlockCount; i++ )
+    {
+        psBlock = psDeflater->pasBlocks + i;
+        Emit( psDeflater, psBlock->pabyOut, psBlock->nOutSize );
+        if( psDeflater->bZlib )
+            psDeflater->nAdler = adler32_combine( psDeflater->nAdler,
+                                                  psBlock->nAdler,
+                                                  psBlock->nInSize );
+    }
+
+    nKeep = MIN( (size_t) RL_DEFLATE_WINDOW,
+                 psDeflater->nBatchDict + psDeflater->nBatchUsed );
+    memmove( psDeflater->pabyBatch,
+             psDeflater->pabyBatch + psDeflater->nBatchDict +
+             psDeflater->nBatchUsed - nKeep, nKeep );
+    psDeflater->nBatchDict = nKeep;
+    psDeflater->nBatchUsed = 0;
+    return psDeflater->eErr;
+}
+
+static void FreeDeflater( RLDeflater *psDeflater )
+{
+    int i;
+
+    for( i = 0; psDeflater->pasBlocks &&
+         i < psDeflater->sOptions.nThreads; i++ )
+    {
+        VSIFree( psDeflater->pasBlocks[i].pabyOut );
+    }
+    CPLFree( psDeflater->pasBlocks );
+    VSIFree( psDeflater->pabyBatch );
+    CPLFree( psDeflater->pabyOut );
+    CPLFree( psDeflater );
+}
+
+/*
+** Set up the parallel deflate, a batch of one block per thread.  Returns
+** FALSE if there isn't the memory, to use one stream instead.
+*/
+static int InitParallel( RLDeflater *psDeflater )
+{
+    z_stream sStream;
+    uLong nBound;
+    int i, nThreads = psDeflater->sOptions.nThreads;
+
+    memset( &sStream, 0, sizeof( sStream ) );
+    if( deflateInit2( &sStream, psDeflater->sOptions.nLevel, Z_DEFLATED,
+                      -15, 8, psDeflater->sOptions.nStrategy ) != Z_OK )
+        return FALSE;
+    /* Room for the sync flush marker besides the worst case */
+    nBound = deflateBound( &sStream, RL_DEFLATE_BLOCK_SIZE ) + 64;
+    deflateEnd( &sStream );
+
+    psDeflater->pabyBatch = (GByte*)
+        VSIMalloc( RL_DEFLATE_WINDOW +
+                   (size_t) RL_DEFLATE_BLOCK_SIZE * nThreads );
+    psDeflater->pasBlocks = (RLDeflateBlock*)
+        CPLCalloc( sizeof( RLDeflateBlock ), nThreads );
+    for( i = 0; i < nThreads && psDeflater->pabyBatch; i++ )
+    {
+        psDeflater->pasBlocks[i].nOutAlloc = (uInt) nBound;
+        psDeflater->pasBlocks[i].pabyOut = (GByte*) VSIMalloc( nBound );
+        if( !psDeflater->pasBlocks[i].pabyOut )
+            break;
+    }
+    if( i < nThreads )
+    {
+        for( i = 0; i < nThreads; i++ )
+            VSIFree( psDeflater->pasBlocks[i].pabyOut );
+        CPLFree( psDeflater->pasBlocks );
+        VSIFree( psDeflater->pabyBatch );
+        psDeflater->pasBlocks = NULL;
+        psDeflater->pabyBatch = NULL;
+        CPLDebug( "RL2KMZ", "No memory for a parallel deflate" );
+        return FALSE;
+    }
+    return TRUE;
+}
+
+/*
+** Start a zlib stream if bZlib is set, raw deflate otherwise, handing the
+** output to pfnWrite.  psOptions may be NULL for the defaults.
+** nSizeHint, the bytes that will be written or 0 if not known, keeps
+** small inputs to one stream, they aren't worth the threads.
+*/
+RLDeflater * RLDeflateCreate( int bZlib, const RLDeflateOptions *psOptions,
+                              GUIntBig nSizeHint, RLWriteFunc pfnWrite,
+                              void *pUserData )
+{
+    RLDeflater *psDeflater;
+
+    psDeflater = (RLDeflater*) CPLCalloc( sizeof( RLDeflater ), 1 );
+    psDeflater->bZlib = bZlib;
+    if( psOptions )
+        psDeflater->sOptions = *psOptions;
+    else
+        RLDeflateInitOptions( &psDeflater->sOptions );
+    psDeflater->sOptions.nLevel =
+        MAX( -1, MIN( psDeflater->sOptions.nLevel, 9 ) );
+    psDeflater->sOptions.nThreads = MAX( 1, psDeflater->sOptions.nThreads );
+    psDeflater->pfnWrite = pfnWrite;
+    psDeflater->pUserData = pUserData;
+
+    psDeflater->bParallel = psDeflater->sOptions.nThreads > 1 &&
+                            ( nSizeHint == 0 ||
+                              nSizeHint > RL_DEFLATE_BLOCK_SIZE ) &&
+                            InitParallel( psDeflater );
+    if( !psDeflater->bParallel )
+    {
+        psDeflater->sOptions.nThreads = 1;
+        if( deflateInit2( &psDeflater->sStream, psDeflater->sOptions.nLevel,
+                          Z_DEFLATED, bZlib ? 15 : -15, 8,
+                          psDeflater->sOptions.nStrategy ) != Z_OK )
+        {
+            CPLError( CE_Failure, CPLE_AppDefined, "deflateInit() failed" );
+            FreeDeflater( psDeflater );
+            return NULL;
+        }
+        psDeflater->pabyOut = (GByte*) CPLMalloc( RL_DEFLATE_OUT_SIZE );
+        psDeflater->sStream.next_out = psDeflater->pabyOut;
+        psDeflater->sStream.avail_out = RL_DEFLATE_OUT_SIZE;
+    }
+    return psDeflater;
+}
+
+/*
+** Compress nBytes more.  In parallel the input is gathered until there is
+** a block for every thread.
+*/
+CPLErr RLDeflateWrite( RLDeflater *psDeflater, const void *pData,
+                       size_t nBytes )
+{
+    const GByte *pabyData = (const GByte*) pData;
+    size_t nBatchSize, nCopy;
+
+    if( psDeflater->eErr != CE_None || nBytes == 0 )
+        return psDeflater->eErr;
+    if( !psDeflater->bParallel )
+    {
+        /* avail_in is an uInt, feed anything larger in pieces */
+        while( nBytes > 0 && psDeflater->eErr == CE_None )
+        {
+            nCopy = MIN( nBytes, (size_t) RL_DEFLATE_BLOCK_SIZE );
+            psDeflater->sStream.next_in = (Bytef*) pabyData;
+            psDeflater->sStream.avail_in = (uInt) nCopy;
+            Deflate( psDeflater, Z_NO_FLUSH );
+            pabyData += nCopy;
+            nBytes -= nCopy;
+        }
+        return psDeflater->eErr;
+    }
+
+    nBatchSize = (size_t) RL_DEFLATE_BLOCK_SIZE *
+                 psDeflater->sOptions.nThreads;
+    while( nBytes > 0 && psDeflater->eErr == CE_None )
+    {
+        nCopy = MIN( nBytes, nBatchSize - psDeflater->nBatchUsed );
+        memcpy( psDeflater->pabyBatch + psDeflater->nBatchDict +
+                psDeflater->nBatchUsed, pabyData, nCopy );
+        psDeflater->nBatchUsed += nCopy;
+        pabyData += nCopy;
+        nBytes -= nCopy;
+        if( psDeflater->nBatchUsed == nBatchSize )
+            DeflateBatch( psDeflater );
+    }
+    return psDeflater->eErr;
+}
+
+/*
+** End the stream and free the deflater.  In parallel that is the last
+** batch, an empty final block and, for zlib, the adler32 of all of the
+** input.
+*/
+CPLErr RLDeflateFinish( RLDeflater *psDeflater )
+{
+    static const GByte abyFinal[2] = { 0x03, 0x00 };
+    GByte abyAdler[4];
+    CPLErr eErr;
+
+    if( psDeflater->bParallel )
+    {
+        DeflateBatch( psDeflater );
+        if( !psDeflater->bHeaderWritten )
+            WriteHeader( psDeflater );
+        Emit( psDeflater, abyFinal, 2 );
+        if( psDeflater->bZlib )
+        {
+            abyAdler[0] = (GByte) ( psDeflater->nAdler >> 24 );
+            abyAdler[1] = (GByte) ( psDeflater->nAdler >> 16 );
+            abyAdler[2] = (GByte) ( psDeflater->nAdler >> 8 );
+            abyAdler[3] = (GByte) psDeflater->nAdler;
+            Emit( psDeflater, abyAdler, 4 );
+        }
+    }
+    else
+    {
+        if( psDeflater->eErr == CE_None )
+        {
+            psDeflater->sStream.next_in = NULL;
+            psDeflater->sStream.avail_in = 0;
+            Deflate( psDeflater, Z_FINISH );
+        }
+        deflateEnd( &psDeflater->sStream );
+    }
+    eErr = psDeflater->eErr;
+    FreeDeflater( psDeflater );
+    return eErr;
+}
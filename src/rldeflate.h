@@ -0,0 +1,88 @@
+/******************************************************************************
+*
+*  Project:  rl2kmz
+*  Purpose:  deflate streams, in parallel blocks on several threads
+*  Author:   Kyle Shannon <kyle at pobox dot com>
+*
+*******************************************************************************
+*
+* This is free and unencumbered software released into the public domain.
+*
+* Anyone is free to copy, modify, publish, use, compile, sell, or
+* distribute this software, either in source code form or as a compiled
+* binary, for any purpose, commercial or non-commercial, and by any
+* means.
+*
+* In jurisdictions that recognize copyright laws, the author or authors
+* of this software dedicate any and all copyright interest in the
+* software to the public domain. We make this dedication for the benefit
+* of the public at large and to the detriment of our heirs and
+* successors. We intend this dedication to be an overt act of
+* relinquishment in perpetuity of all present and future rights to this
+* software under copyright law.
+*
+* THIS SOFTWARE WAS DEVELOPED AT THE ROCKY MOUNTAIN RESEARCH STATION (RMRS)
+* MISSOULA FIRE SCIENCES LABORATORY BY EMPLOYEES OF THE FEDERAL GOVERNMENT
+* IN THE COURSE OF THEIR OFFICIAL DUTIES. PURSUANT TO TITLE 17 SECTION 105
+* OF THE UNITED STATES CODE, THIS SOFTWARE IS NOT SUBJECT TO COPYRIGHT
+* PROTECTION AND IS IN THE PUBLIC DOMAIN. RMRS MISSOULA FIRE SCIENCES
+* LABORATORY ASSUMES NO RESPONSIBILITY WHATSOEVER FOR ITS USE BY OTHER
+* PARTIES,  AND MAKES NO GUARANTEES, EXPRESSED OR IMPLIED, ABOUT ITS QUALITY,
+* RELIABILITY, OR ANY OTHER CHARACTERISTIC.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+* IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+* OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+* ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+* OTHER DEALINGS IN THE SOFTWARE.
+*
+* For more information, please refer to <http://unlicense.org>
+*
+******************************************************************************/
+
+#ifndef RLDEFLATE_H_
+#define RLDEFLATE_H_
+
+#include "rlport.h"
+#include "rlutil.h"
+
+CPL_C_START
+
+/*
+** Input deflated as one block by a worker of a parallel deflate.
+*/
+#ifndef RL_DEFLATE_BLOCK_SIZE
+#define RL_DEFLATE_BLOCK_SIZE ( 256 * 1024 )
+#endif
+
+/*
+** How a stream is compressed.  nLevel and nStrategy are zlib's, -1 and 0
+** for its defaults.  With nThreads above 1 the input is deflated as
+** independent blocks on that many threads, each primed with the 32k
+** before it, and joined into one stream that any inflater takes.
+*/
+typedef struct
+{
+    int nLevel;
+    int nStrategy;
+    int nThreads;
+} RLDeflateOptions;
+
+typedef struct RLDeflater RLDeflater;
+
+void RLDeflateInitOptions( RLDeflateOptions *psOptions );
+void RLDeflateGetOptions( char **papszConfig, const char *pszPrefix,
+                          RLDeflateOptions *psOptions );
+
+RLDeflater * RLDeflateCreate( int bZlib, const RLDeflateOptions *psOptions,
+                              GUIntBig nSizeHint, RLWriteFunc pfnWrite,
+                              void *pUserData );
+CPLErr RLDeflateWrite( RLDeflater *psDeflater, const void *pData,
+                       size_t nBytes );
+CPLErr RLDeflateFinish( RLDeflater *psDeflater );
+
+CPL_C_END
+
+#endif /* RLDEFLATE_H_ */
@@ -0,0 +1,447 @@
+/******************************************************************************
+*
+*  Project:  rl2kmz
+*  Purpose:  parallel deflate against zlib's inflate
+*  Author:   Kyle Shannon <kyle at pobox dot com>
+*
+*******************************************************************************
+*
+* This is free and unencumbered software released into the public domain.
+*
+* Anyone is free to copy, modify, publish, use, compile, sell, or
+* distribute this software, either in source code form or as a compiled
+* binary, for any purpose, commercial or non-commercial, and by any
+* means.
+*
+* In jurisdictions that recognize copyright laws, the author or authors
+* of this software dedicate any and all copyright interest in the
+* software to the public domain. We make this dedication for the benefit
+* of the public at large and to the detriment of our heirs and
+* successors. We intend this dedication to be an overt act of
+* relinquishment in perpetuity of all present and future rights to this
+* software under copyright law.
+*
+* THIS SOFTWARE WAS DEVELOPED AT THE ROCKY MOUNTAIN RESEARCH STATION (RMRS)
+* MISSOULA FIRE SCIENCES LABORATORY BY EMPLOYEES OF THE FEDERAL GOVERNMENT
+* IN THE COURSE OF THEIR OFFICIAL DUTIES. PURSUANT TO TITLE 17 SECTION 105
+* OF THE UNITED STATES CODE, THIS SOFTWARE IS NOT SUBJECT TO COPYRIGHT
+* PROTECTION AND IS IN THE PUBLIC DOMAIN. RMRS MISSOULA FIRE SCIENCES
+* LABORATORY ASSUMES NO RESPONSIBILITY WHATSOEVER FOR ITS USE BY OTHER
+* PARTIES,  AND MAKES NO GUARANTEES, EXPRESSED OR IMPLIED, ABOUT ITS QUALITY,
+* RELIABILITY, OR ANY OTHER CHARACTERISTIC.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+* IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+* OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+* ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+* OTHER DEALINGS IN THE SOFTWARE.
+*
+* For more information, please refer to <http://unlicense.org>
+*
+******************************************************************************/
+
+#include <zlib.h>
+
+#include "cpl_conv.h"
+#include "cpl_vsi.h"
+
+#include "rlport.h"
+#include "rldeflate.h"
+#include "rlkmz.h"
+#include "rlpng.h"
+#include "rlutil.h"
+
+/* Longest stretch of fresh bytes, runs and copies in the test data */
+#define RL_TEST_MAX_PIECE 258
+
+/* Size of the png, filtered it is a dozen blocks */
+#define RL_TEST_PNG_XSIZE 1000
+#define RL_TEST_PNG_YSIZE 700
+
+/* Where the kmz is written */
+#define RL_TEST_KMZ "/vsimem/rldeflate_test.kmz"
+
+/*
+** Input of the raw and zlib streams: nothing at all, less than a block,
+** whole blocks, a whole batch of 4 and several batches with a part block
+** at the end.
+*/
+static const size_t anSizes[] =
+{
+    0, 1, RL_DEFLATE_BLOCK_SIZE - 1, RL_DEFLATE_BLOCK_SIZE,
+    RL_DEFLATE_BLOCK_SIZE + 1, 4 * RL_DEFLATE_BLOCK_SIZE,
+    9 * RL_DEFLATE_BLOCK_SIZE + 12345
+};
+
+/* Sizes the input is written in, over and over */
+static const size_t anPieces[] =
+{
+    1, 7, 4093, 100000, 2 * RL_DEFLATE_BLOCK_SIZE + 3
+};
+
+static GUInt32 nSeed = 1;
+
+static int NextRandom( int nRange )
+{
+    nSeed = nSeed * 1103515245 + 12345;
+    return (int) ( ( nSeed >> 8 ) % (GUInt32) nRange );
+}
+
+/*
+** Fill a buffer with fresh bytes, runs and copies of what came up to 32k
+** before, so matches reach back across the block boundaries and only come
+** out right if each block was primed with the window before it.
+*/
+static void FillData( GByte *pabyData, size_t nSize )
+{
+    size_t i = 0, nDistance;
+    int nLength, nKind, j;
+
+    while( i < nSize )
+    {
+        nLength = 1 + NextRandom( RL_TEST_MAX_PIECE );
+        nLength = (int) MIN( (size_t) nLength, nSize - i );
+        nKind = i < 32768 ? NextRandom( 2 ) : NextRandom( 4 );
+        if( nKind == 0 )
+        {
+            for( j = 0; j < nLength; j++ )
+                pabyData[i + j] = (GByte) NextRandom( 256 );
+        }
+        else if( nKind == 1 )
+        {
+            memset( pabyData + i, NextRandom( 256 ), nLength );
+        }
+        else
+        {
+            nDistance = 1 + NextRandom( 32768 );
+            for( j = 0; j < nLength; j++ )
+                pabyData[i + j] = pabyData[i + j - nDistance];
+        }
+        i += nLength;
+    }
+}
+
+/*
+** Inflate a whole zlib stream, or raw deflate, with zlib.  The stream has
+** to end exactly where the input does.  Returns FALSE if it doesn't.
+*/
+static int Inflate( const GByte *pabyIn, size_t nInSize, int bZlib,
+                    RLBuffer *psOut )
+{
+    z_stream sStream;
+    GByte abyOut[65536];
+    int nRet;
+
+    memset( &sStream, 0, sizeof( sStream ) );
+    if( inflateInit2( &sStream, bZlib ? 15 : -15 ) != Z_OK )
+        return FALSE;
+    sStream.next_in = (Bytef*) pabyIn;
+    sStream.avail_in = (uInt) nInSize;
+    do
+    {
+        sStream.next_out = abyOut;
+        sStream.avail_out = sizeof( abyOut );
+        nRet = inflate( &sStream, Z_NO_FLUSH );
+        RLBufferWrite( abyOut, sizeof( abyOut ) - sStream.avail_out, psOut );
+    } while( nRet == Z_OK );
+    inflateEnd( &sStream );
+    return nRet == Z_STREAM_END && sStream.avail_in == 0;
+}
+
+static int CompareInflated( const char *pszWhat, const GByte *pabyIn,
+                            size_t nInSize, int bZlib,
+                            const GByte *pabyExpected, size_t nExpected )
+{
+    RLBuffer sOut;
+    int nDiffs = 0;
+
+    memset( &sOut, 0, sizeof( sOut ) );
+    if( !Inflate( pabyIn, nInSize, bZlib, &sOut ) )
+    {
+        printf( "%s: zlib could not inflate the stream\n", pszWhat );
+        nDiffs++;
+    }
+    else if( sOut.nSize != nExpected ||
+             memcmp( sOut.pabyData, pabyExpected, nExpected ) != 0 )
+    {
+        printf( "%s: inflated %d bytes that differ from the %d written\n",
+                pszWhat, (int) sOut.nSize, (int) nExpected );
+        nDiffs++;
+    }
+    RLBufferFree( &sOut );
+    return nDiffs;
+}
+
+/*
+** Deflate nSize bytes of pabyData with RLDeflate*, in pieces of every
+** size, and inflate them back.  Returns the differences.
+*/
+static int CheckStream( const GByte *pabyData, size_t nSize, int bZlib,
+                        const RLDeflateOptions *psOptions )
+{
+    RLDeflater *psDeflater;
+    RLBuffer sOut;
+    char szWhat[80];
+    size_t nOffset = 0, nPiece;
+    int iPiece = 0, nDiffs;
+
+    sprintf( szWhat, "%s, %d bytes, level %d on %d thread(s)",
+             bZlib ? "zlib" : "raw", (int) nSize, psOptions->nLevel,
+             psOptions->nThreads );
+    memset( &sOut, 0, sizeof( sOut ) );
+    psDeflater = RLDeflateCreate( bZlib, psOptions, 0, RLBufferWrite,
+                                  &sOut );
+    if( !psDeflater )
+    {
+        printf( "%s: RLDeflateCreate() failed\n", szWhat );
+        return 1;
+    }
+    while( nOffset < nSize )
+    {
+        nPiece = anPieces[iPiece++ % ( sizeof( anPieces ) /
+                                       sizeof( anPieces[0] ) )];
+        nPiece = MIN( nPiece, nSize - nOffset );
+        RLDeflateWrite( psDeflater, pabyData + nOffset, nPiece );
+        nOffset += nPiece;
+    }
+    if( RLDeflateFinish( psDeflater ) != CE_None )
+    {
+        printf( "%s: RLDeflateFinish() failed\n", szWhat );
+        RLBufferFree( &sOut );
+        return 1;
+    }
+    nDiffs = CompareInflated( szWhat, sOut.pabyData, sOut.nSize, bZlib,
+                              pabyData, nSize );
+    RLBufferFree( &sOut );
+    return nDiffs;
+}
+
+static GUInt32 GetUInt32BE( const GByte *pabyData )
+{
+    return ( (GUInt32) pabyData[0] << 24 ) | ( (GUInt32) pabyData[1] << 16 ) |
+           ( (GUInt32) pabyData[2] << 8 ) | pabyData[3];
+}
+
+static GUInt32 GetUInt32LE( const GByte *pabyData )
+{
+    return ( (GUInt32) pabyData[3] << 24 ) | ( (GUInt32) pabyData[2] << 16 ) |
+           ( (GUInt32) pabyData[1] << 8 ) | pabyData[0];
+}
+
+/*
+** Encode an RGBA png on nThreads and inflate the joined IDAT chunks into
+** psFiltered, checking the crc of every chunk on the way.
+*/
+static int EncodePng( const GByte *pabyImage, int nThreads,
+                      RLBuffer *psFiltered )
+{
+    RLPngWriter *psPng;
+    RLPngOptions sOptions;
+    RLBuffer sPng, sIdat;
+    size_t nOffset = 8;
+    GUInt32 nLength;
+    int bOk;
+
+    memset( &sPng, 0, sizeof( sPng ) );
+    memset( &sIdat, 0, sizeof( sIdat ) );
+    RLPngInitOptions( &sOptions );
+    sOptions.nFilter = RL_PNG_FILTER_ADAPTIVE;
+    sOptions.sDeflate.nThreads = nThreads;
+    psPng = RLPngCreate( RL_TEST_PNG_XSIZE, RL_TEST_PNG_YSIZE, 4, NULL, 0,
+                         &sOptions, RLBufferWrite, &sPng );
+    bOk = psPng &&
+          RLPngWriteRows( psPng, pabyImage, RL_TEST_PNG_YSIZE ) == CE_None;
+    if( psPng && RLPngFinish( psPng ) != CE_None )
+        bOk = FALSE;
+    while( bOk && nOffset + 12 <= sPng.nSize )
+    {
+        nLength = GetUInt32BE( sPng.pabyData + nOffset );
+        if( nOffset + 12 + nLength > sPng.nSize ||
+            crc32( crc32( 0L, Z_NULL, 0 ), sPng.pabyData + nOffset + 4,
+                   nLength + 4 ) !=
+            GetUInt32BE( sPng.pabyData + nOffset + 8 + nLength ) )
+        {
+            bOk = FALSE;
+            break;
+        }
+        if( memcmp( sPng.pabyData + nOffset + 4, "IDAT", 4 ) == 0 )
+            RLBufferWrite( sPng.pabyData + nOffset + 8, nLength, &sIdat );
+        nOffset += 12 + nLength;
+    }
+    bOk = bOk && nOffset == sPng.nSize &&
+          Inflate( sIdat.pabyData, sIdat.nSize, TRUE, psFiltered );
+    if( !bOk )
+        printf( "png on %d thread(s): broken chunk or IDAT stream\n",
+                nThreads );
+    RLBufferFree( &sPng );
+    RLBufferFree( &sIdat );
+    return bOk;
+}
+
+/*
+** A png deflated on one thread and on several has to inflate to the same
+** filtered rows, as many as the image has.  Returns the differences.
+*/
+static int CheckPng( void )
+{
+    RLBuffer sOne, sMany;
+    GByte *pabyImage;
+    size_t nPixels, i;
+    int nDiffs = 0;
+
+    nPixels = (size_t) RL_TEST_PNG_XSIZE * RL_TEST_PNG_YSIZE;
+    pabyImage = (GByte*) CPLMalloc( nPixels * 4 );
+    FillData( pabyImage, nPixels * 4 );
+    /* Mostly opaque, with gradients for the filters to take out */
+    for( i = 0; i < nPixels; i++ )
+    {
+        pabyImage[i * 4] = (GByte) ( i % RL_TEST_PNG_XSIZE );
+        if( pabyImage[i * 4 + 3] > 32 )
+            pabyImage[i * 4 + 3] = 255;
+    }
+    memset( &sOne, 0, sizeof( sOne ) );
+    memset( &sMany, 0, sizeof( sMany ) );
+    if( !EncodePng( pabyImage, 1, &sOne ) ||
+        !EncodePng( pabyImage, 4, &sMany ) )
+    {
+        nDiffs++;
+    }
+    else if( sOne.nSize != ( (size_t) RL_TEST_PNG_XSIZE * 4 + 1 ) *
+                           RL_TEST_PNG_YSIZE ||
+             sMany.nSize != sOne.nSize ||
+             memcmp( sOne.pabyData, sMany.pabyData, sOne.nSize ) != 0 )
+    {
+        printf( "png: %d filtered bytes on one thread, %d on 4, which " \
+                "differ\n", (int) sOne.nSize, (int) sMany.nSize );
+        nDiffs++;
+    }
+    RLBufferFree( &sOne );
+    RLBufferFree( &sMany );
+    CPLFree( pabyImage );
+    return nDiffs;
+}
+
+/*
+** Write pabyData as a deflated kmz entry on nThreads, then find it after
+** its local header and inflate it, checking the crc and sizes patched
+** into the header.  Returns the differences.
+*/
+static int CheckKmzEntry( const GByte *pabyData, size_t nSize,
+                          int nThreads )
+{
+    RLKmzWriter *psKmz;
+    RLDeflateOptions sOptions;
+    GByte *pabyKmz;
+    vsi_l_offset nKmzSize = 0;
+    size_t nOffset = 0, nPiece, nStart;
+    char szWhat[80];
+    int iPiece = 0, nDiffs = 0;
+
+    sprintf( szWhat, "kmz entry of %d bytes on %d thread(s)", (int) nSize,
+             nThreads );
+    RLDeflateInitOptions( &sOptions );
+    sOptions.nThreads = nThreads;
+    psKmz = RLKmzCreate( RL_TEST_KMZ, &sOptions );
+    if( !psKmz || RLKmzBeginFile( psKmz, "data.bin", TRUE ) != CE_None )
+    {
+        printf( "%s: could not start the kmz\n", szWhat );
+        if( psKmz )
+            RLKmzClose( psKmz, FALSE );
+        return 1;
+    }
+    while( nOffset < nSize )
+    {
+        nPiece = anPieces[iPiece++ % ( sizeof( anPieces ) /
+                                       sizeof( anPieces[0] ) )];
+        nPiece = MIN( nPiece, nSize - nOffset );
+        RLKmzWrite( pabyData + nOffset, nPiece, psKmz );
+        nOffset += nPiece;
+    }
+    if( RLKmzEndFile( psKmz ) != CE_None ||
+        RLKmzClose( psKmz, TRUE ) != CE_None )
+    {
+        printf( "%s: could not write the kmz\n", szWhat );
+        VSIUnlink( RL_TEST_KMZ );
+        return 1;
+    }
+
+    pabyKmz = VSIGetMemFileBuffer( RL_TEST_KMZ, &nKmzSize, FALSE );
+    nStart = pabyKmz && nKmzSize >= 30 ?
+             30 + pabyKmz[26] + ( pabyKmz[27] << 8 ) + pabyKmz[28] +
+             ( pabyKmz[29] << 8 ) : 0;
+    if( nStart == 0 || nKmzSize < nStart ||
+        GetUInt32LE( pabyKmz ) != 0x04034b50 || pabyKmz[8] != Z_DEFLATED ||
+        GetUInt32LE( pabyKmz + 22 ) != nSize ||
+        nStart + GetUInt32LE( pabyKmz + 18 ) > nKmzSize )
+    {
+        printf( "%s: bad local header\n", szWhat );
+        nDiffs++;
+    }
+    else if( GetUInt32LE( pabyKmz + 14 ) !=
+             crc32( crc32( 0L, Z_NULL, 0 ), pabyData, (uInt) nSize ) )
+    {
+        printf( "%s: wrong crc\n", szWhat );
+        nDiffs++;
+    }
+    else
+    {
+        nDiffs += CompareInflated( szWhat, pabyKmz + nStart,
+                                   GetUInt32LE( pabyKmz + 18 ), FALSE,
+                                   pabyData, nSize );
+    }
+    VSIUnlink( RL_TEST_KMZ );
+    return nDiffs;
+}
+
+int main( int argc, char *argv[] )
+{
+    static const int anThreads[] = { 1, 2, 4 };
+    static const int anLevels[] = { Z_DEFAULT_COMPRESSION, 1 };
+    RLDeflateOptions sOptions;
+    GByte *pabyData;
+    size_t nMaxSize;
+    int iSize, iThreads, iLevel, bZlib;
+    int nStreams = 0, nDiffs = 0;
+
+    (void) argc;
+    (void) argv;
+
+    nMaxSize = anSizes[sizeof( anSizes ) / sizeof( anSizes[0] ) - 1];
+    pabyData = (GByte*) CPLMalloc( nMaxSize );
+    FillData( pabyData, nMaxSize );
+
+    for( iSize = 0; iSize < (int) ( sizeof( anSizes ) /
+                                    sizeof( anSizes[0] ) ); iSize++ )
+    {
+        for( iThreads = 0; iThreads < 3; iThreads++ )
+        {
+            for( iLevel = 0; iLevel < 2; iLevel++ )
+            {
+                for( bZlib = FALSE; bZlib <= TRUE; bZlib++ )
+                {
+                    RLDeflateInitOptions( &sOptions );
+                    sOptions.nLevel = anLevels[iLevel];
+                    sOptions.nThreads = anThreads[iThreads];
+                    nDiffs += CheckStream( pabyData, anSizes[iSize],
+                                           bZlib, &sOptions );
+                    nStreams++;
+                }
+            }
+        }
+    }
+
+    nDiffs += CheckPng();
+    nStreams++;
+    for( iThreads = 0; iThreads < 3; iThreads++ )
+    {
+        nDiffs += CheckKmzEntry( pabyData, nMaxSize, anThreads[iThreads] );
+        nStreams++;
+    }
+    printf( "%d streams of up to %d blocks, %d differ\n", nStreams,
+            (int) ( nMaxSize / RL_DEFLATE_BLOCK_SIZE + 1 ), nDiffs );
+
+    CPLFree( pabyData );
+    return nDiffs == 0 ? RL_OK : RL_ERR;
+}
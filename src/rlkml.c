@@ -0,0 +1,651 @@
+/******************************************************************************
+*
+*  Project:  rl2kmz
+*  Purpose:  write kml text
+*  Author:   Kyle Shannon <kyle at pobox dot com>
+*
+*******************************************************************************
+*
+* This is free and unencumbered software released into the public domain.
+*
+* Anyone is free to copy, modify, publish, use, compile, sell, or
+* distribute this software, either in source code form or as a compiled
+* binary, for any purpose, commercial or non-commercial, and by any
+* means.
+*
+* In jurisdictions that recognize copyright laws, the author or authors
+* of this software dedicate any and all copyright interest in the
+* software to the public domain. We make this dedication for the benefit
+* of the public at large and to the detriment of our heirs and
+* successors. We intend this dedication to be an overt act of
+* relinquishment in perpetuity of all present and future rights to this
+* software under copyright law.
+*
+* THIS SOFTWARE WAS DEVELOPED AT THE ROCKY MOUNTAIN RESEARCH STATION (RMRS)
+* MISSOULA FIRE SCIENCES LABORATORY BY EMPLOYEES OF THE FEDERAL GOVERNMENT
+* IN THE COURSE OF THEIR OFFICIAL DUTIES. PURSUANT TO TITLE 17 SECTION 105
+* OF THE UNITED STATES CODE, THIS SOFTWARE IS NOT SUBJECT TO COPYRIGHT
+* PROTECTION AND IS IN THE PUBLIC DOMAIN. RMRS MISSOULA FIRE SCIENCES
+* LABORATORY ASSUMES NO RESPONSIBILITY WHATSOEVER FOR ITS USE BY OTHER
+* PARTIES,  AND MAKES NO GUARANTEES, EXPRESSED OR IMPLIED, ABOUT ITS QUALITY,
+* RELIABILITY, OR ANY OTHER CHARACTERISTIC.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+* IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+* OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+* ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+* OTHER DEALINGS IN THE SOFTWARE.
+*
+* For more information, please refer to <http://unlicense.org>
+*
+******************************************************************************/
+
+#include "cpl_conv.h"
+#include "cpl_string.h"
+
+#include "rlkml.h"
+
+/*
+** Bounding boxes are passed as north, south, east, west.
+*/
+
+/*
+** Append pszText with the XML special characters escaped, without
+** allocating.  Control characters XML can't carry are dropped.
+*/
+static void WriteEscaped( RLBuffer *psKml, const char *pszText )
+{
+    const char *pszRun = pszText;
+    const char *pszEntity;
+
+    for( ; *pszText != '\0'; pszText++ )
+    {
+        switch( *pszText )
+        {
+          case '<':
+            pszEntity = "&lt;";
+            break;
+          case '>':
+            pszEntity = "&gt;";
+            break;
+          case '&':
+            pszEntity = "&amp;";
+            break;
+          case '"':
+            pszEntity = "&quot;";
+            break;
+          default:
+            if( (unsigned char) *pszText >= 0x20 || *pszText == '\t' ||
+                *pszText == '\n' || *pszText == '\r' )
+            {
+                continue;
+            }
+            pszEntity = "";
+            break;
+        }
+        RLBufferWrite( pszRun, pszText - pszRun, psKml );
+        RLBufferAppend( psKml, pszEntity );
+        pszRun = pszText + 1;
+    }
+    RLBufferWrite( pszRun, pszText - pszRun, psKml );
+}
+
+static void WriteText( RLBuffer *psKml, const char *pszElement,
+                       const char *pszText )
+{
+    if( pszText == NULL )
+        return;
+    RLBufferAppend( psKml, "<" );
+    RLBufferAppend( psKml, pszElement );
+    RLBufferAppend( psKml, ">" );
+    WriteEscaped( psKml, pszText );
+    RLBufferAppend( psKml, "</" );
+    RLBufferAppend( psKml, pszElement );
+    RLBufferAppend( psKml, ">\n" );
+}
+
+static void WriteBox( RLBuffer *psKml, const char *pszElement,
+                      const double *padfBox )
+{
+    RLBufferPrintf( psKml, "<%s>\n"
+                           "<north>%.10f</north>\n"
+                           "<south>%.10f</south>\n"
+                           "<east>%.10f</east>\n"
+                           "<west>%.10f</west>\n"
+                           "</%s>\n",
+                    pszElement, padfBox[0], padfBox[1], padfBox[2],
+                    padfBox[3], pszElement );
+}
+
+void RLKmlBeginDocument( RLBuffer *psKml, const char *pszName )
+{
+    RLBufferPrintf( psKml, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+                           "<kml xmlns=\"http://www.opengis.net/kml/2.2\">\n"
+                           "<Document>\n" );
+    WriteText( psKml, "name", pszName );
+}
+
+void RLKmlEndDocument( RLBuffer *psKml )
+{
+    RLBufferPrintf( psKml, "</Document>\n"
+                           "</kml>\n" );
+}
+
+void RLKmlBeginFolder( RLBuffer *psKml, const char *pszName )
+{
+    RLBufferPrintf( psKml, "<Folder>\n" );
+    WriteText( psKml, "name", pszName );
+}
+
+void RLKmlEndFolder( RLBuffer *psKml )
+{
+    RLBufferPrintf( psKml, "</Folder>\n" );
+}
+
+/*
+** KML colours are aabbggrr.
+*/
+static void WriteColor( RLBuffer *psKml, OGRStyleToolH hTool,
+                        const char *pszColor )
+{
+    int nRed, nGreen, nBlue, nAlpha = 255;
+
+    if( pszColor == NULL ||
+        !OGR_ST_GetRGBFromString( hTool, pszColor, &nRed, &nGreen, &nBlue,
+                                  &nAlpha ) )
+    {
+        return;
+    }
+    RLBufferPrintf( psKml, "<color>%02x%02x%02x%02x</color>\n", nAlpha,
+                    nBlue, nGreen, nRed );
+}
+
+/*
+** Write a shared Style from an OGR style string, the PEN part as the
+** LineStyle and the BRUSH part as the PolyStyle.  Other parts are ignored.
+*/
+int RLKmlWriteStyle( RLBuffer *psKml, const char *pszId,
+                     const char *pszStyleString )
+{
+    OGRStyleMgrH hStyleMgr;
+    OGRStyleToolH hTool;
+    const char *pszColor;
+    double dfWidth;
+    int i, bDefault;
+
+    hStyleMgr = OGR_SM_Create( NULL );
+    if( !OGR_SM_InitStyleString( hStyleMgr, pszStyleString ) )
+    {
+        CPLError( CE_Warning, CPLE_AppDefined, "Invalid style string %s",
+                  pszStyleString );
+        OGR_SM_Destroy( hStyleMgr );
+        return RL_ERR;
+    }
+    RLBufferPrintf( psKml, "<Style id=\"%s\">\n", pszId );
+    for( i = 0; i < OGR_SM_GetPartCount( hStyleMgr, NULL ); i++ )
+    {
+        hTool = OGR_SM_GetPart( hStyleMgr, i, NULL );
+        if( !hTool )
+            continue;
+        OGR_ST_SetUnit( hTool, OGRSTUPixel, 1.0 );
+        if( OGR_ST_GetType( hTool ) == OGRSTCPen )
+        {
+            RLBufferPrintf( psKml, "<LineStyle>\n" );
+            pszColor = OGR_ST_GetParamStr( hTool, OGRSTPenColor, &bDefault );
+            WriteColor( psKml, hTool, bDefault ? NULL : pszColor );
+            dfWidth = OGR_ST_GetParamDbl( hTool, OGRSTPenWidth, &bDefault );
+            if( !bDefault )
+                RLBufferPrintf( psKml, "<width>%g</width>\n", dfWidth );
+            RLBufferPrintf( psKml, "</LineStyle>\n" );
+        }
+        else if( OGR_ST_GetType( hTool ) == OGRSTCBrush )
+        {
+            RLBufferPrintf( psKml, "<PolyStyle>\n" );
+            pszColor = OGR_ST_GetParamStr( hTool, OGRSTBrushFColor,
+                                           &bDefault );
+            WriteColor( psKml, hTool, bDefault ? NULL : pszColor );
+            RLBufferPrintf( psKml, "</PolyStyle>\n" );
+        }
+        OGR_ST_Destroy( hTool );
+    }
+    RLBufferPrintf( psKml, "</Style>\n" );
+    OGR_SM_Destroy( hStyleMgr );
+    return RL_OK;
+}
+
+/*
+** Write a shared Style for point placemarks, pszIconHref tinted by the
+** RGBA colour pabyRGBA.  A dfLabelScale of 0 hides the names.
+*/
+void RLKmlWriteIconStyle( RLBuffer *psKml, const char *pszId,
+                          const char *pszIconHref, const GByte *pabyRGBA,
+                          double dfScale, double dfLabelScale )
+{
+    RLBufferPrintf( psKml, "<Style id=\"%s\">\n"
+                           "<IconStyle>\n"
+                           "<color>%02x%02x%02x%02x</color>\n"
+                           "<scale>%g</scale>\n"
+                           "<Icon>\n",
+                    pszId, pabyRGBA[3], pabyRGBA[2], pabyRGBA[1],
+                    pabyRGBA[0], dfScale );
+    WriteText( psKml, "href", pszIconHref );
+    RLBufferPrintf( psKml, "</Icon>\n"
+                           "</IconStyle>\n"
+                           "<LabelStyle>\n"
+                           "<scale>%g</scale>\n"
+                           "</LabelStyle>\n"
+                           "</Style>\n",
+                    dfLabelScale );
+}
+
+/*
+** Placemark fields of a layer, resolved once for all of its features.
+*/
+struct RLKmlPlacemarkPlan
+{
+    int iName;
+    int iDescription;
+    int iStyle;
+    char **papszStyleMap;
+    /* The fields written as ExtendedData, with their opening tags */
+    int nDataCount;
+    int *panDataFields;
+    OGRFieldType *paeDataTypes;
+    char **papszDataTags;
+};
+
+/*
+** Plan the placemarks of features of hDefn.  The Name and Description
+** fields become the name and description, the rest ExtendedData.  The
+** style of a feature is looked up in papszStyleMap, value=style_id pairs,
+** by its pszStyleField value.
+*/
+RLKmlPlacemarkPlan * RLKmlCreatePlacemarkPlan( OGRFeatureDefnH hDefn,
+                                               const char *pszStyleField,
+                                               char **papszStyleMap )
+{
+    RLKmlPlacemarkPlan *psPlan;
+    OGRFieldDefnH hFieldDefn;
+    char *pszEscaped;
+    int i, nFields;
+
+    psPlan = (RLKmlPlacemarkPlan*)
+        CPLCalloc( 1, sizeof( RLKmlPlacemarkPlan ) );
+    nFields = OGR_FD_GetFieldCount( hDefn );
+    psPlan->iName = OGR_FD_GetFieldIndex( hDefn, "Name" );
+    psPlan->iDescription = OGR_FD_GetFieldIndex( hDefn, "Description" );
+    psPlan->iStyle = pszStyleField ?
+                     OGR_FD_GetFieldIndex( hDefn, pszStyleField ) : -1;
+    psPlan->papszStyleMap = CSLDuplicate( papszStyleMap );
+    psPlan->panDataFields = (int*) CPLMalloc( sizeof( int ) *
+                                              MAX( 1, nFields ) );
+    psPlan->paeDataTypes = (OGRFieldType*)
+        CPLMalloc( sizeof( OGRFieldType ) * MAX( 1, nFields ) );
+    for( i = 0; i < nFields; i++ )
+    {
+        if( i == psPlan->iName || i == psPlan->iDescription )
+            continue;
+        hFieldDefn = OGR_FD_GetFieldDefn( hDefn, i );
+        pszEscaped = CPLEscapeString( OGR_Fld_GetNameRef( hFieldDefn ), -1,
+                                      CPLES_XML );
+        psPlan->panDataFields[psPlan->nDataCount] = i;
+        psPlan->paeDataTypes[psPlan->nDataCount] =
+            OGR_Fld_GetType( hFieldDefn );
+        psPlan->papszDataTags =
+            CSLAddString( psPlan->papszDataTags,
+                          CPLSPrintf( "<Data name=\"%s\">\n<value>",
+                                      pszEscaped ) );
+        psPlan->nDataCount++;
+        CPLFree( pszEscaped );
+    }
+    return psPlan;
+}
+
+void RLKmlDestroyPlacemarkPlan( RLKmlPlacemarkPlan *psPlan )
+{
+    if( !psPlan )
+        return;
+    CSLDestroy( psPlan->papszStyleMap );
+    CSLDestroy( psPlan->papszDataTags );
+    CPLFree( psPlan->panDataFields );
+    CPLFree( psPlan->paeDataTypes );
+    CPLFree( psPlan );
+}
+
+/*
+** Write a field value by type.  Numbers and dates are formatted here
+** rather than going through OGR's strings, dates as ISO 8601.
+*/
+static void WriteFieldValue( RLBuffer *psKml, OGRFeatureH hFeature, int i,
+                             OGRFieldType eType )
+{
+    char szValue[64];
+    int nLen, nYear, nMonth, nDay, nHour, nMinute, nTZ;
+    float fSecond;
+
+    switch( eType )
+    {
+      case OFTInteger:
+        nLen = CPLsnprintf( szValue, sizeof( szValue ), "%d",
+                            OGR_F_GetFieldAsInteger( hFeature, i ) );
+        break;
+      case OFTInteger64:
+        nLen = CPLsnprintf( szValue, sizeof( szValue ), CPL_FRMT_GIB,
+                            OGR_F_GetFieldAsInteger64( hFeature, i ) );
+        break;
+      case OFTReal:
+        nLen = CPLsnprintf( szValue, sizeof( szValue ), "%.15g",
+                            OGR_F_GetFieldAsDouble( hFeature, i ) );
+        break;
+      case OFTDate:
+      case OFTTime:
+      case OFTDateTime:
+        OGR_F_GetFieldAsDateTimeEx( hFeature, i, &nYear, &nMonth, &nDay,
+                                    &nHour, &nMinute, &fSecond, &nTZ );
+        if( eType == OFTDate )
+            nLen = CPLsnprintf( szValue, sizeof( szValue ),
+                                "%04d-%02d-%02d", nYear, nMonth, nDay );
+        else if( eType == OFTTime )
+            nLen = CPLsnprintf( szValue, sizeof( szValue ),
+                                "%02d:%02d:%02d", nHour, nMinute,
+                                (int) fSecond );
+        else
+            nLen = CPLsnprintf( szValue, sizeof( szValue ),
+                                "%04d-%02d-%02dT%02d:%02d:%02d%s", nYear,
+                                nMonth, nDay, nHour, nMinute, (int) fSecond,
+                                nTZ == 100 ? "Z" : "" );
+        break;
+      default:
+        WriteEscaped( psKml, OGR_F_GetFieldAsString( hFeature, i ) );
+        return;
+    }
+    RLBufferWrite( szValue, MIN( nLen, (int) sizeof( szValue ) - 1 ),
+                   psKml );
+}
+
+/*
+** Write the points of a simple geometry as a coordinates element.
+*/
+static void WriteCoordinates( RLBuffer *psKml, OGRGeometryH hGeom )
+{
+    char szCoord[96];
+    double dfX, dfY, dfZ;
+    int i, nLen, nPoints, b3D;
+
+    nPoints = OGR_G_GetPointCount( hGeom );
+    b3D = OGR_G_Is3D( hGeom );
+    RLBufferAppend( psKml, "<coordinates>" );
+    for( i = 0; i < nPoints; i++ )
+    {
+        OGR_G_GetPoint( hGeom, i, &dfX, &dfY, &dfZ );
+        if( b3D )
+            nLen = CPLsnprintf( szCoord, sizeof( szCoord ),
+                                "%s%.15g,%.15g,%.15g", i ? " " : "",
+                                dfX, dfY, dfZ );
+        else
+            nLen = CPLsnprintf( szCoord, sizeof( szCoord ), "%s%.15g,%.15g",
+                                i ? " " : "", dfX, dfY );
+        RLBufferWrite( szCoord, MIN( nLen, (int) sizeof( szCoord ) - 1 ),
+                       psKml );
+    }
+    RLBufferAppend( psKml, "</coordinates>" );
+}
+
+static void WriteRing( RLBuffer *psKml, const char *pszBoundary,
+                       OGRGeometryH hRing )
+{
+    RLBufferAppend( psKml, pszBoundary );
+    RLBufferAppend( psKml, "<LinearRing>" );
+    WriteCoordinates( psKml, hRing );
+    RLBufferAppend( psKml, "</LinearRing>" );
+}
+
+/*
+** Write a geometry as kml straight into the buffer.  Anything besides
+** points, lines, polygons and their collections goes through OGR.
+*/
+static void WriteGeometry( RLBuffer *psKml, OGRGeometryH hGeom )
+{
+    char *pszGeom;
+    int i, nCount;
+
+    if( OGR_G_IsEmpty( hGeom ) )
+        return;
+    switch( wkbFlatten( OGR_G_GetGeometryType( hGeom ) ) )
+    {
+      case wkbPoint:
+        RLBufferAppend( psKml, "<Point>" );
+        WriteCoordinates( psKml, hGeom );
+        RLBufferAppend( psKml, "</Point>" );
+        break;
+      case wkbLineString:
+        RLBufferAppend( psKml, "<LineString>" );
+        WriteCoordinates( psKml, hGeom );
+        RLBufferAppend( psKml, "</LineString>" );
+        break;
+      case wkbPolygon:
+        nCount = OGR_G_GetGeometryCount( hGeom );
+        RLBufferAppend( psKml, "<Polygon>" );
+        for( i = 0; i < nCount; i++ )
+        {
+            if( i == 0 )
+            {
+                WriteRing( psKml, "<outerBoundaryIs>",
+                           OGR_G_GetGeometryRef( hGeom, i ) );
+                RLBufferAppend( psKml, "</outerBoundaryIs>" );
+            }
+            else
+            {
+                WriteRing( psKml, "<innerBoundaryIs>",
+                           OGR_G_GetGeometryRef( hGeom, i ) );
+                RLBufferAppend( psKml, "</innerBoundaryIs>" );
+            }
+        }
+        RLBufferAppend( psKml, "</Polygon>" );
+        break;
+      case wkbMultiPoint:
+      case wkbMultiLineString:
+      case wkbMultiPolygon:
+      case wkbGeometryCollection:
+        nCount = OGR_G_GetGeometryCount( hGeom );
+        RLBufferAppend( psKml, "<MultiGeometry>" );
+        for( i = 0; i < nCount; i++ )
+            WriteGeometry( psKml, OGR_G_GetGeometryRef( hGeom, i ) );
+        RLBufferAppend( psKml, "</MultiGeometry>" );
+        break;
+      default:
+        pszGeom = OGR_G_ExportToKML( hGeom, NULL );
+        if( pszGeom )
+            RLBufferAppend( psKml, pszGeom );
+        CPLFree( pszGeom );
+        break;
+    }
+}
+
+/*
+** Write hFeature as a placemark laid out by psPlan.  Geometries are
+** borrowed from the feature and nothing is allocated per feature beyond
+** the growth of the buffer.
+*/
+void RLKmlWritePlacemark( RLBuffer *psKml, const RLKmlPlacemarkPlan *psPlan,
+                          OGRFeatureH hFeature )
+{
+    OGRGeometryH hGeom;
+    const char *pszStyleId = NULL;
+    int i, iField, bExtended = FALSE;
+
+    RLBufferAppend( psKml, "<Placemark>\n" );
+    if( psPlan->iName >= 0 &&
+        OGR_F_IsFieldSetAndNotNull( hFeature, psPlan->iName ) )
+    {
+        WriteText( psKml, "name",
+                   OGR_F_GetFieldAsString( hFeature, psPlan->iName ) );
+    }
+    if( psPlan->iDescription >= 0 &&
+        OGR_F_IsFieldSetAndNotNull( hFeature, psPlan->iDescription ) )
+    {
+        WriteText( psKml, "description",
+                   OGR_F_GetFieldAsString( hFeature, psPlan->iDescription ) );
+    }
+    if( psPlan->iStyle >= 0 &&
+        OGR_F_IsFieldSetAndNotNull( hFeature, psPlan->iStyle ) )
+    {
+        pszStyleId = CSLFetchNameValue( psPlan->papszStyleMap,
+                                        OGR_F_GetFieldAsString(
+                                            hFeature, psPlan->iStyle ) );
+    }
+    if( pszStyleId )
+    {
+        RLBufferAppend( psKml, "<styleUrl>#" );
+        RLBufferAppend( psKml, pszStyleId );
+        RLBufferAppend( psKml, "</styleUrl>\n" );
+    }
+    for( i = 0; i < psPlan->nDataCount; i++ )
+    {
+        iField = psPlan->panDataFields[i];
+        if( !OGR_F_IsFieldSetAndNotNull( hFeature, iField ) )
+            continue;
+        if( !bExtended )
+        {
+            RLBufferAppend( psKml, "<ExtendedData>\n" );
+            bExtended = TRUE;
+        }
+        RLBufferAppend( psKml, psPlan->papszDataTags[i] );
+        WriteFieldValue( psKml, hFeature, iField, psPlan->paeDataTypes[i] );
+        RLBufferAppend( psKml, "</value>\n</Data>\n" );
+    }
+    if( bExtended )
+        RLBufferAppend( psKml, "</ExtendedData>\n" );
+    hGeom = OGR_F_GetGeometryRef( hFeature );
+    if( hGeom && !OGR_G_IsEmpty( hGeom ) )
+    {
+        WriteGeometry( psKml, hGeom );
+        RLBufferAppend( psKml, "\n" );
+    }
+    RLBufferAppend( psKml, "</Placemark>\n" );
+}
+
+/*
+** Point placemark with a shared style, pszName and pszStyleId may be NULL.
+*/
+void RLKmlWritePoint( RLBuffer *psKml, const char *pszName,
+                      const char *pszStyleId, double dfLon, double dfLat )
+{
+    RLBufferAppend( psKml, "<Placemark>\n" );
+    WriteText( psKml, "name", pszName );
+    if( pszStyleId )
+    {
+        RLBufferAppend( psKml, "<styleUrl>#" );
+        RLBufferAppend( psKml, pszStyleId );
+        RLBufferAppend( psKml, "</styleUrl>\n" );
+    }
+    RLBufferPrintf( psKml, "<Point><coordinates>%.6f,%.6f</coordinates>"
+                           "</Point>\n"
+                           "</Placemark>\n",
+                    dfLon, dfLat );
+}
+
+/*
+** Region over padfBox, visible between nMinLod and nMaxLod pixels, -1 for
+** no upper limit.
+*/
+void RLKmlWriteRegion( RLBuffer *psKml, const double *padfBox, int nMinLod,
+                       int nMaxLod )
+{
+    RLBufferPrintf( psKml, "<Region>\n" );
+    WriteBox( psKml, "LatLonAltBox", padfBox );
+    RLBufferPrintf( psKml, "<Lod>\n"
+                           "<minLodPixels>%d</minLodPixels>\n"
+                           "<maxLodPixels>%d</maxLodPixels>\n"
+                           "</Lod>\n"
+                           "</Region>\n",
+                    nMinLod, nMaxLod );
+}
+
+void RLKmlWriteGroundOverlay( RLBuffer *psKml, const char *pszName,
+                              const char *pszHref, int nDrawOrder,
+                              const double *padfBox )
+{
+    RLKmlWriteTimedGroundOverlay( psKml, pszName, pszHref, nDrawOrder,
+                                  padfBox, NULL, NULL );
+}
+
+/*
+** Ground overlay shown from pszBegin until pszEnd, KML dateTime values.
+** Either may be NULL for a span open at that end, both for no TimeSpan.
+*/
+void RLKmlWriteTimedGroundOverlay( RLBuffer *psKml, const char *pszName,
+                                   const char *pszHref, int nDrawOrder,
+                                   const double *padfBox,
+                                   const char *pszBegin,
+                                   const char *pszEnd )
+{
+    RLBufferPrintf( psKml, "<GroundOverlay>\n" );
+    WriteText( psKml, "name", pszName );
+    if( pszBegin || pszEnd )
+    {
+        RLBufferPrintf( psKml, "<TimeSpan>\n" );
+        if( pszBegin )
+            WriteText( psKml, "begin", pszBegin );
+        if( pszEnd )
+            WriteText( psKml, "end", pszEnd );
+        RLBufferPrintf( psKml, "</TimeSpan>\n" );
+    }
+    if( nDrawOrder != 0 )
+        RLBufferPrintf( psKml, "<drawOrder>%d</drawOrder>\n", nDrawOrder );
+    RLBufferPrintf( psKml, "<Icon>\n" );
+    WriteText( psKml, "href", pszHref );
+    RLBufferPrintf( psKml, "</Icon>\n" );
+    WriteBox( psKml, "LatLonBox", padfBox );
+    RLBufferPrintf( psKml, "</GroundOverlay>\n" );
+}
+
+/*
+** Screen overlay placed by fractions of the image and the screen.  A NULL
+** padfSize keeps the image size.
+*/
+void RLKmlWriteScreenOverlay( RLBuffer *psKml, const char *pszName,
+                              const char *pszHref,
+                              const double *padfOverlayXY,
+                              const double *padfScreenXY,
+                              const double *padfSize )
+{
+    static const char szUnits[] =
+        "xunits=\"fraction\" yunits=\"fraction\"";
+
+    RLBufferPrintf( psKml, "<ScreenOverlay>\n" );
+    WriteText( psKml, "name", pszName );
+    RLBufferPrintf( psKml, "<Icon>\n" );
+    WriteText( psKml, "href", pszHref );
+    RLBufferPrintf( psKml, "</Icon>\n"
+                           "<overlayXY x=\"%g\" y=\"%g\" %s/>\n"
+                           "<screenXY x=\"%g\" y=\"%g\" %s/>\n",
+                    padfOverlayXY[0], padfOverlayXY[1], szUnits,
+                    padfScreenXY[0], padfScreenXY[1], szUnits );
+    if( padfSize )
+        RLBufferPrintf( psKml, "<size x=\"%g\" y=\"%g\" %s/>\n",
+                        padfSize[0], padfSize[1], szUnits );
+    RLBufferPrintf( psKml, "</ScreenOverlay>\n" );
+}
+
+/*
+** Network link loaded when its region, if padfBox isn't NULL, is active.
+*/
+void RLKmlWriteNetworkLink( RLBuffer *psKml, const char *pszName,
+                            const char *pszHref, const double *padfBox,
+                            int nMinLod, int nMaxLod )
+{
+    RLBufferPrintf( psKml, "<NetworkLink>\n" );
+    WriteText( psKml, "name", pszName );
+    if( padfBox )
+        RLKmlWriteRegion( psKml, padfBox, nMinLod, nMaxLod );
+    RLBufferPrintf( psKml, "<Link>\n" );
+    WriteText( psKml, "href", pszHref );
+    if( padfBox )
+        RLBufferPrintf( psKml, "<viewRefreshMode>onRegion" \
+                               "</viewRefreshMode>\n" );
+    RLBufferPrintf( psKml, "</Link>\n"
+                           "</NetworkLink>\n" );
+}
@@ -0,0 +1,104 @@
+/******************************************************************************
+*
+*  Project:  rl2kmz
+*  Purpose:  write kml text
+*  Author:   Kyle Shannon <kyle at pobox dot com>
+*
+*******************************************************************************
+*
+* This is free and unencumbered software released into the public domain.
+*
+* Anyone is free to copy, modify, publish, use, compile, sell, or
+* distribute this software, either in source code form or as a compiled
+* binary, for any purpose, commercial or non-commercial, and by any
+* means.
+*
+* In jurisdictions that recognize copyright laws, the author or authors
+* of this software dedicate any and all copyright interest in the
+* software to the public domain. We make this dedication for the benefit
+* of the public at large and to the detriment of our heirs and
+* successors. We intend this dedication to be an overt act of
+* relinquishment in perpetuity of all present and future rights to this
+* software under copyright law.
+*
+* THIS SOFTWARE WAS DEVELOPED AT THE ROCKY MOUNTAIN RESEARCH STATION (RMRS)
+* MISSOULA FIRE SCIENCES LABORATORY BY EMPLOYEES OF THE FEDERAL GOVERNMENT
+* IN THE COURSE OF THEIR OFFICIAL DUTIES. PURSUANT TO TITLE 17 SECTION 105
+* OF THE UNITED STATES CODE, THIS SOFTWARE IS NOT SUBJECT TO COPYRIGHT
+* PROTECTION AND IS IN THE PUBLIC DOMAIN. RMRS MISSOULA FIRE SCIENCES
+* LABORATORY ASSUMES NO RESPONSIBILITY WHATSOEVER FOR ITS USE BY OTHER
+* PARTIES,  AND MAKES NO GUARANTEES, EXPRESSED OR IMPLIED, ABOUT ITS QUALITY,
+* RELIABILITY, OR ANY OTHER CHARACTERISTIC.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+* IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+* OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+* ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+* OTHER DEALINGS IN THE SOFTWARE.
+*
+* For more information, please refer to <http://unlicense.org>
+*
+******************************************************************************/
+
+#ifndef RLKML_H_
+#define RLKML_H_
+
+#include "ogr_api.h"
+
+#include "rlport.h"
+#include "rlutil.h"
+
+CPL_C_START
+
+void RLKmlBeginDocument( RLBuffer *psKml, const char *pszName );
+void RLKmlEndDocument( RLBuffer *psKml );
+void RLKmlBeginFolder( RLBuffer *psKml, const char *pszName );
+void RLKmlEndFolder( RLBuffer *psKml );
+
+int RLKmlWriteStyle( RLBuffer *psKml, const char *pszId,
+                     const char *pszStyleString );
+void RLKmlWriteIconStyle( RLBuffer *psKml, const char *pszId,
+                          const char *pszIconHref, const GByte *pabyRGBA,
+                          double dfScale, double dfLabelScale );
+/*
+** Bumped whenever placemarks are written differently, so placemarks
+** cached by an older version are rendered again.
+*/
+#define RL_KML_PLACEMARK_VERSION 2
+
+typedef struct RLKmlPlacemarkPlan RLKmlPlacemarkPlan;
+
+RLKmlPlacemarkPlan * RLKmlCreatePlacemarkPlan( OGRFeatureDefnH hDefn,
+                                               const char *pszStyleField,
+                                               char **papszStyleMap );
+void RLKmlDestroyPlacemarkPlan( RLKmlPlacemarkPlan *psPlan );
+void RLKmlWritePlacemark( RLBuffer *psKml, const RLKmlPlacemarkPlan *psPlan,
+                          OGRFeatureH hFeature );
+
+void RLKmlWritePoint( RLBuffer *psKml, const char *pszName,
+                      const char *pszStyleId, double dfLon, double dfLat );
+
+void RLKmlWriteRegion( RLBuffer *psKml, const double *padfBox, int nMinLod,
+                       int nMaxLod );
+void RLKmlWriteGroundOverlay( RLBuffer *psKml, const char *pszName,
+                              const char *pszHref, int nDrawOrder,
+                              const double *padfBox );
+void RLKmlWriteTimedGroundOverlay( RLBuffer *psKml, const char *pszName,
+                                   const char *pszHref, int nDrawOrder,
+                                   const double *padfBox,
+                                   const char *pszBegin,
+                                   const char *pszEnd );
+void RLKmlWriteScreenOverlay( RLBuffer *psKml, const char *pszName,
+                              const char *pszHref,
+                              const double *padfOverlayXY,
+                              const double *padfScreenXY,
+                              const double *padfSize );
+void RLKmlWriteNetworkLink( RLBuffer *psKml, const char *pszName,
+                            const char *pszHref, const double *padfBox,
+                            int nMinLod, int nMaxLod );
+
+CPL_C_END
+
+#endif /* RLKML_H_ */
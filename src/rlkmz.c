@@ -0,0 +1,508 @@
+/******************************************************************************
+*
+*  Project:  rl2kmz
+*  Purpose:  write the kmz archive in one pass
+*  Author:   Kyle Shannon <kyle at pobox dot com>
+*
+*******************************************************************************
+*
+* This is free and unencumbered software released into the public domain.
+*
+* Anyone is free to copy, modify, publish, use, compile, sell, or
+* distribute this software, either in source code form or as a compiled
+* binary, for any purpose, commercial or non-commercial, and by any
+* means.
+*
+* In jurisdictions that recognize copyright laws, the author or authors
+* of this software dedicate any and all copyright interest in the
+* software to the public domain. We make this dedication for the benefit
+* of the public at large and to the detriment of our heirs and
+* successors. We intend this dedication to be an overt act of
+* relinquishment in perpetuity of all present and future rights to this
+* software under copyright law.
+*
+* THIS SOFTWARE WAS DEVELOPED AT THE ROCKY MOUNTAIN RESEARCH STATION (RMRS)
+* MISSOULA FIRE SCIENCES LABORATORY BY EMPLOYEES OF THE FEDERAL GOVERNMENT
+* IN THE COURSE OF THEIR OFFICIAL DUTIES. PURSUANT TO TITLE 17 SECTION 105
+* OF THE UNITED STATES CODE, THIS SOFTWARE IS NOT SUBJECT TO COPYRIGHT
+* PROTECTION AND IS IN THE PUBLIC DOMAIN. RMRS MISSOULA FIRE SCIENCES
+* LABORATORY ASSUMES NO RESPONSIBILITY WHATSOEVER FOR ITS USE BY OTHER
+* PARTIES,  AND MAKES NO GUARANTEES, EXPRESSED OR IMPLIED, ABOUT ITS QUALITY,
+* RELIABILITY, OR ANY OTHER CHARACTERISTIC.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+* IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+* OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+* ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+* OTHER DEALINGS IN THE SOFTWARE.
+*
+* For more information, please refer to <http://unlicense.org>
+*
+******************************************************************************/
+
+#include <limits.h>
+#include <time.h>
+
+#include <zlib.h>
+
+#include "cpl_atomic_ops.h"
+#include "cpl_conv.h"
+#include "cpl_multiproc.h"
+#include "cpl_string.h"
+
+#include "rlkmz.h"
+
+#define RL_ZIP_LOCAL_HEADER   0x04034b50
+#define RL_ZIP_CENTRAL_HEADER 0x02014b50
+#define RL_ZIP64_END          0x06064b50
+#define RL_ZIP64_LOCATOR      0x07064b50
+#define RL_ZIP_END            0x06054b50
+
+/*
+** An entry already written, kept for the central directory.
+*/
+typedef struct
+{
+    char *pszName;
+    int bCompress;
+    GUInt32 nCrc;
+    GUIntBig nCompressedSize;
+    GUIntBig nSize;
+    GUIntBig nOffset;
+} RLKmzEntry;
+
+struct RLKmzWriter
+{
+    VSILFILE *fp;
+    char *pszFilename;
+    char *pszTmpFilename;
+    RLDeflateOptions sOptions;
+    /* Modification time of every entry, in dos format */
+    int nDosTime;
+    int nDosDate;
+    RLKmzEntry *pasEntries;
+    int nEntryCount;
+    int nEntryAlloc;
+    /* Where the next byte goes */
+    GUIntBig nOffset;
+    int bFileOpen;
+    int bFailed;
+    /* The open entry: its deflater if compressed, its crc and sizes */
+    RLDeflater *psDeflater;
+    uLong nCrc;
+    GUIntBig nEntrySize;
+    GUIntBig nEntryCompressedSize;
+    /* Bytes handed to entries, before compression */
+    GUIntBig nBytesWritten;
+};
+
+static void PutUInt16( GByte *pabyDst, int nValue )
+{
+    pabyDst[0] = (GByte) nValue;
+    pabyDst[1] = (GByte) ( nValue >> 8 );
+}
+
+static void PutUInt32( GByte *pabyDst, GUInt32 nValue )
+{
+    PutUInt16( pabyDst, (int) ( nValue & 0xffff ) );
+    PutUInt16( pabyDst + 2, (int) ( nValue >> 16 ) );
+}
+
+static void PutUInt64( GByte *pabyDst, GUIntBig nValue )
+{
+    PutUInt32( pabyDst, (GUInt32) ( nValue & 0xffffffff ) );
+    PutUInt32( pabyDst + 4, (GUInt32) ( nValue >> 32 ) );
+}
+
+static void WriteRaw( RLKmzWriter *psKmz, const void *pData, size_t nBytes )
+{
+    if( psKmz->bFailed || nBytes == 0 )
+        return;
+    if( VSIFWriteL( pData, 1, nBytes, psKmz->fp ) != nBytes )
+    {
+        CPLError( CE_Failure, CPLE_FileIO, "Failed to write %s",
+                  psKmz->pszTmpFilename );
+        psKmz->bFailed = TRUE;
+        return;
+    }
+    psKmz->nOffset += nBytes;
+}
+
+/*
+** RLWriteFunc taking the compressed bytes of the open entry.
+*/
+static size_t WriteEntryData( const void *pData, size_t nBytes,
+                              void *pUserData )
+{
+    RLKmzWriter *psKmz = (RLKmzWriter*) pUserData;
+
+    WriteRaw( psKmz, pData, nBytes );
+    psKmz->nEntryCompressedSize += nBytes;
+    return psKmz->bFailed ? 0 : nBytes;
+}
+
+/*
+** Names that aren't plain ascii are flagged as utf-8.
+*/
+static int GetNameFlags( const char *pszName )
+{
+    for( ; *pszName; pszName++ )
+    {
+        if( (GByte) *pszName >= 0x80 )
+            return 0x0800;
+    }
+    return 0;
+}
+
+/*
+** Start a kmz destined for pszFilename.  Entries go to a temporary file
+** beside it until RLKmzClose, so readers only ever see a complete archive.
+** Compressed entries are deflated as psOptions says, NULL for zlib's
+** defaults on one thread.
+*/
+RLKmzWriter * RLKmzCreate( const char *pszFilename,
+                           const RLDeflateOptions *psOptions )
+{
+    static volatile int nTmpFiles = 0;
+    RLKmzWriter *psKmz;
+    struct tm sTime;
+    time_t nNow;
+
+    psKmz = (RLKmzWriter*) CPLCalloc( sizeof( RLKmzWriter ), 1 );
+    psKmz->pszFilename = CPLStrdup( pszFilename );
+    /* Jobs writing the same file each get a temporary of their own */
+    psKmz->pszTmpFilename =
+        CPLStrdup( CPLSPrintf( "%s.%d.%d.tmp", pszFilename,
+                               (int) CPLGetPID(),
+                               CPLAtomicInc( &nTmpFiles ) ) );
+    if( psOptions )
+        psKmz->sOptions = *psOptions;
+    else
+        RLDeflateInitOptions( &psKmz->sOptions );
+    psKmz->fp = VSIFOpenL( psKmz->pszTmpFilename, "wb" );
+    if( !psKmz->fp )
+    {
+        CPLError( CE_Failure, CPLE_FileIO, "Could not create %s",
+                  psKmz->pszTmpFilename );
+        CPLFree( psKmz->pszFilename );
+        CPLFree( psKmz->pszTmpFilename );
+        CPLFree( psKmz );
+        return NULL;
+    }
+    /* Zip entries carry DOS times, which are local */
+    nNow = time( NULL );
+#ifdef _WIN32
+    localtime_s( &sTime, &nNow );
+#else
+    localtime_r( &nNow, &sTime );
+#endif
+    psKmz->nDosTime = ( sTime.tm_hour << 11 ) | ( sTime.tm_min << 5 ) |
+                      ( sTime.tm_sec / 2 );
+    psKmz->nDosDate = ( MAX( 0, sTime.tm_year - 80 ) << 9 ) |
+                      ( ( sTime.tm_mon + 1 ) << 5 ) | sTime.tm_mday;
+    return psKmz;
+}
+
+/*
+** Write the central directory and the end records, zip64 ones when the
+** entries or offsets don't fit the classic fields.
+*/
+static void WriteCentralDirectory( RLKmzWriter *psKmz )
+{
+    GByte abyHeader[56];
+    GByte abyExtra[12];
+    RLKmzEntry *psEntry;
+    GUIntBig nDirOffset, nDirSize, nEndOffset;
+    int i, nExtra, bZip64;
+
+    nDirOffset = psKmz->nOffset;
+    for( i = 0; i < psKmz->nEntryCount && !psKmz->bFailed; i++ )
+    {
+        psEntry = psKmz->pasEntries + i;
+        nExtra = 0;
+        if( psEntry->nOffset >= 0xffffffff )
+        {
+            PutUInt16( abyExtra, 0x0001 );
+            PutUInt16( abyExtra + 2, 8 );
+            PutUInt64( abyExtra + 4, psEntry->nOffset );
+            nExtra = 12;
+        }
+        PutUInt32( abyHeader, RL_ZIP_CENTRAL_HEADER );
+        PutUInt16( abyHeader + 4, nExtra ? 45 : 20 );   /* made by */
+        PutUInt16( abyHeader + 6, nExtra ? 45 : 20 );   /* needed */
+        PutUInt16( abyHeader + 8, GetNameFlags( psEntry->pszName ) );
+        PutUInt16( abyHeader + 10, psEntry->bCompress ? Z_DEFLATED : 0 );
+        PutUInt16( abyHeader + 12, psKmz->nDosTime );
+        PutUInt16( abyHeader + 14, psKmz->nDosDate );
+        PutUInt32( abyHeader + 16, psEntry->nCrc );
+        PutUInt32( abyHeader + 20, (GUInt32) psEntry->nCompressedSize );
+        PutUInt32( abyHeader + 24, (GUInt32) psEntry->nSize );
+        PutUInt16( abyHeader + 28, (int) strlen( psEntry->pszName ) );
+        PutUInt16( abyHeader + 30, nExtra );
+        PutUInt16( abyHeader + 32, 0 );     /* comment */
+        PutUInt16( abyHeader + 34, 0 );     /* disk */
+        PutUInt16( abyHeader + 36, 0 );     /* internal attributes */
+        PutUInt32( abyHeader + 38, 0 );     /* external attributes */
+        PutUInt32( abyHeader + 42, nExtra ? 0xffffffff :
+                                   (GUInt32) psEntry->nOffset );
+        WriteRaw( psKmz, abyHeader, 46 );
+        WriteRaw( psKmz, psEntry->pszName, strlen( psEntry->pszName ) );
+        WriteRaw( psKmz, abyExtra, nExtra );
+    }
+    nDirSize = psKmz->nOffset - nDirOffset;
+
+    bZip64 = psKmz->nEntryCount >= 0xffff || nDirOffset >= 0xffffffff ||
+             nDirSize >= 0xffffffff;
+    if( bZip64 )
+    {
+        nEndOffset = psKmz->nOffset;
+        PutUInt32( abyHeader, RL_ZIP64_END );
+        PutUInt64( abyHeader + 4, 44 );     /* size of the rest */
+        PutUInt16( abyHeader + 12, 45 );
+        PutUInt16( abyHeader + 14, 45 );
+        PutUInt32( abyHeader + 16, 0 );
+        PutUInt32( abyHeader + 20, 0 );
+        PutUInt64( abyHeader + 24, psKmz->nEntryCount );
+        PutUInt64( abyHeader + 32, psKmz->nEntryCount );
+        PutUInt64( abyHeader + 40, nDirSize );
+        PutUInt64( abyHeader + 48, nDirOffset );
+        WriteRaw( psKmz, abyHeader, 56 );
+        PutUInt32( abyHeader, RL_ZIP64_LOCATOR );
+        PutUInt32( abyHeader + 4, 0 );
+        PutUInt64( abyHeader + 8, nEndOffset );
+        PutUInt32( abyHeader + 16, 1 );
+        WriteRaw( psKmz, abyHeader, 20 );
+    }
+    PutUInt32( abyHeader, RL_ZIP_END );
+    PutUInt16( abyHeader + 4, 0 );
+    PutUInt16( abyHeader + 6, 0 );
+    PutUInt16( abyHeader + 8, MIN( psKmz->nEntryCount, 0xffff ) );
+    PutUInt16( abyHeader + 10, MIN( psKmz->nEntryCount, 0xffff ) );
+    PutUInt32( abyHeader + 12, (GUInt32) MIN( nDirSize, 0xffffffff ) );
+    PutUInt32( abyHeader + 16, (GUInt32) MIN( nDirOffset, 0xffffffff ) );
+    PutUInt16( abyHeader + 20, 0 );     /* comment */
+    WriteRaw( psKmz, abyHeader, 22 );
+}
+
+/*
+** Finish the archive and move it into place if bCommit is set and every
+** write succeeded, otherwise throw the temporary file away.
+*/
+CPLErr RLKmzClose( RLKmzWriter *psKmz, int bCommit )
+{
+    CPLErr eErr = CE_None;
+    int i;
+
+    if( !psKmz )
+        return CE_Failure;
+    if( psKmz->bFileOpen )
+        RLKmzEndFile( psKmz );
+    if( bCommit && !psKmz->bFailed )
+        WriteCentralDirectory( psKmz );
+    if( VSIFCloseL( psKmz->fp ) != 0 )
+        psKmz->bFailed = TRUE;
+    if( bCommit && !psKmz->bFailed )
+    {
+        if( VSIRename( psKmz->pszTmpFilename, psKmz->pszFilename ) != 0 )
+        {
+            CPLError( CE_Failure, CPLE_FileIO, "Could not rename %s to %s",
+                      psKmz->pszTmpFilename, psKmz->pszFilename );
+            eErr = CE_Failure;
+        }
+    }
+    else
+    {
+        if( bCommit )
+        {
+            CPLError( CE_Failure, CPLE_FileIO, "Failed to write %s",
+                      psKmz->pszFilename );
+        }
+        eErr = CE_Failure;
+    }
+    if( eErr != CE_None )
+        VSIUnlink( psKmz->pszTmpFilename );
+    for( i = 0; i < psKmz->nEntryCount; i++ )
+        CPLFree( psKmz->pasEntries[i].pszName );
+    CPLFree( psKmz->pasEntries );
+    CPLFree( psKmz->pszFilename );
+    CPLFree( psKmz->pszTmpFilename );
+    CPLFree( psKmz );
+    return eErr;
+}
+
+/*
+** Start an entry with its local header, the crc and sizes left to be
+** filled in once it ends.  nSizeHint, when known, keeps small entries off
+** the parallel deflate.
+*/
+static CPLErr BeginEntry( RLKmzWriter *psKmz, const char *pszName,
+                          int bCompress, GUIntBig nSizeHint )
+{
+    GByte abyHeader[30];
+    RLKmzEntry *psEntry;
+
+    if( psKmz->bFileOpen )
+    {
+        CPLError( CE_Failure, CPLE_AppDefined,
+                  "Can't start %s, another kmz entry is open", pszName );
+        return CE_Failure;
+    }
+    if( psKmz->bFailed )
+        return CE_Failure;
+    if( psKmz->nEntryCount == psKmz->nEntryAlloc )
+    {
+        psKmz->nEntryAlloc = MAX( 16, psKmz->nEntryAlloc * 2 );
+        psKmz->pasEntries = (RLKmzEntry*)
+            CPLRealloc( psKmz->pasEntries,
+                        sizeof( RLKmzEntry ) * psKmz->nEntryAlloc );
+    }
+    psEntry = psKmz->pasEntries + psKmz->nEntryCount;
+    memset( psEntry, 0, sizeof( RLKmzEntry ) );
+    psEntry->pszName = CPLStrdup( pszName );
+    psEntry->bCompress = bCompress;
+    psEntry->nOffset = psKmz->nOffset;
+
+    PutUInt32( abyHeader, RL_ZIP_LOCAL_HEADER );
+    PutUInt16( abyHeader + 4, 20 );
+    PutUInt16( abyHeader + 6, GetNameFlags( pszName ) );
+    PutUInt16( abyHeader + 8, bCompress ? Z_DEFLATED : 0 );
+    PutUInt16( abyHeader + 10, psKmz->nDosTime );
+    PutUInt16( abyHeader + 12, psKmz->nDosDate );
+    memset( abyHeader + 14, 0, 12 );    /* crc and sizes, patched later */
+    PutUInt16( abyHeader + 26, (int) strlen( pszName ) );
+    PutUInt16( abyHeader + 28, 0 );
+    WriteRaw( psKmz, abyHeader, 30 );
+    WriteRaw( psKmz, pszName, strlen( pszName ) );
+
+    psKmz->nCrc = crc32( 0L, Z_NULL, 0 );
+    psKmz->nEntrySize = 0;
+    psKmz->nEntryCompressedSize = 0;
+    psKmz->psDeflater = NULL;
+    if( bCompress && !psKmz->bFailed )
+    {
+        psKmz->psDeflater = RLDeflateCreate( FALSE, &psKmz->sOptions,
+                                             nSizeHint, WriteEntryData,
+                                             psKmz );
+        if( !psKmz->psDeflater )
+            psKmz->bFailed = TRUE;
+    }
+    if( psKmz->bFailed )
+    {
+        CPLFree( psEntry->pszName );
+        return CE_Failure;
+    }
+    psKmz->nEntryCount++;
+    psKmz->bFileOpen = TRUE;
+    return CE_None;
+}
+
+/*
+** Start an entry, deflated or stored.  Entries are written one at a time.
+*/
+CPLErr RLKmzBeginFile( RLKmzWriter *psKmz, const char *pszName,
+                       int bCompress )
+{
+    return BeginEntry( psKmz, pszName, bCompress, 0 );
+}
+
+/*
+** RLWriteFunc appending to the open entry of an RLKmzWriter.
+*/
+size_t RLKmzWrite( const void *pData, size_t nBytes, void *pUserData )
+{
+    RLKmzWriter *psKmz = (RLKmzWriter*) pUserData;
+    const GByte *pabyData = (const GByte*) pData;
+    size_t nLeft;
+    uInt nChunk;
+
+    if( !psKmz->bFileOpen || psKmz->bFailed )
+        return 0;
+    for( nLeft = nBytes; nLeft > 0; nLeft -= nChunk )
+    {
+        nChunk = (uInt) MIN( nLeft, (size_t) INT_MAX );
+        psKmz->nCrc = crc32( psKmz->nCrc, pabyData + ( nBytes - nLeft ),
+                             nChunk );
+    }
+    if( psKmz->psDeflater )
+    {
+        if( RLDeflateWrite( psKmz->psDeflater, pData, nBytes ) != CE_None )
+            psKmz->bFailed = TRUE;
+    }
+    else
+    {
+        WriteEntryData( pData, nBytes, psKmz );
+    }
+    if( psKmz->bFailed )
+        return 0;
+    psKmz->nEntrySize += nBytes;
+    psKmz->nBytesWritten += nBytes;
+    return nBytes;
+}
+
+/*
+** Finish the open entry and fill its crc and sizes into its local header.
+*/
+CPLErr RLKmzEndFile( RLKmzWriter *psKmz )
+{
+    RLKmzEntry *psEntry;
+    GByte abySizes[12];
+
+    if( !psKmz->bFileOpen )
+        return CE_Failure;
+    psKmz->bFileOpen = FALSE;
+    psEntry = psKmz->pasEntries + psKmz->nEntryCount - 1;
+    if( psKmz->psDeflater &&
+        RLDeflateFinish( psKmz->psDeflater ) != CE_None )
+        psKmz->bFailed = TRUE;
+    psKmz->psDeflater = NULL;
+    if( psKmz->bFailed )
+        return CE_Failure;
+    if( psKmz->nEntrySize >= 0xffffffff ||
+        psKmz->nEntryCompressedSize >= 0xffffffff )
+    {
+        CPLError( CE_Failure, CPLE_NotSupported,
+                  "kmz entry %s is 4GB or more", psEntry->pszName );
+        psKmz->bFailed = TRUE;
+        return CE_Failure;
+    }
+    psEntry->nCrc = (GUInt32) psKmz->nCrc;
+    psEntry->nSize = psKmz->nEntrySize;
+    psEntry->nCompressedSize = psKmz->nEntryCompressedSize;
+
+    PutUInt32( abySizes, psEntry->nCrc );
+    PutUInt32( abySizes + 4, (GUInt32) psEntry->nCompressedSize );
+    PutUInt32( abySizes + 8, (GUInt32) psEntry->nSize );
+    if( VSIFSeekL( psKmz->fp, psEntry->nOffset + 14, SEEK_SET ) != 0 ||
+        VSIFWriteL( abySizes, 1, 12, psKmz->fp ) != 12 ||
+        VSIFSeekL( psKmz->fp, psKmz->nOffset, SEEK_SET ) != 0 )
+    {
+        CPLError( CE_Failure, CPLE_FileIO, "Failed to write %s",
+                  psKmz->pszTmpFilename );
+        psKmz->bFailed = TRUE;
+        return CE_Failure;
+    }
+    return CE_None;
+}
+
+/*
+** Write a whole entry from memory.
+*/
+CPLErr RLKmzAddFile( RLKmzWriter *psKmz, const char *pszName,
+                     const void *pData, size_t nBytes, int bCompress )
+{
+    if( BeginEntry( psKmz, pszName, bCompress, MAX( nBytes, 1 ) ) !=
+        CE_None )
+        return CE_Failure;
+    RLKmzWrite( pData, nBytes, psKmz );
+    return RLKmzEndFile( psKmz );
+}
+
+/*
+** Bytes written to all entries so far, before compression.
+*/
+GUIntBig RLKmzGetBytesWritten( const RLKmzWriter *psKmz )
+{
+    return psKmz ? psKmz->nBytesWritten : 0;
+}
@@ -0,0 +1,222 @@
+/******************************************************************************
+*
+*  Project:  rl2kmz
+*  Purpose:  per stage timing and memory instrumentation
+*  Author:   Kyle Shannon <kyle at pobox dot com>
+*
+*******************************************************************************
+*
+* This is free and unencumbered software released into the public domain.
+*
+* Anyone is free to copy, modify, publish, use, compile, sell, or
+* distribute this software, either in source code form or as a compiled
+* binary, for any purpose, commercial or non-commercial, and by any
+* means.
+*
+* In jurisdictions that recognize copyright laws, the author or authors
+* of this software dedicate any and all copyright interest in the
+* software to the public domain. We make this dedication for the benefit
+* of the public at large and to the detriment of our heirs and
+* successors. We intend this dedication to be an overt act of
+* relinquishment in perpetuity of all present and future rights to this
+* software under copyright law.
+*
+* THIS SOFTWARE WAS DEVELOPED AT THE ROCKY MOUNTAIN RESEARCH STATION (RMRS)
+* MISSOULA FIRE SCIENCES LABORATORY BY EMPLOYEES OF THE FEDERAL GOVERNMENT
+* IN THE COURSE OF THEIR OFFICIAL DUTIES. PURSUANT TO TITLE 17 SECTION 105
+* OF THE UNITED STATES CODE, THIS SOFTWARE IS NOT SUBJECT TO COPYRIGHT
+* PROTECTION AND IS IN THE PUBLIC DOMAIN. RMRS MISSOULA FIRE SCIENCES
+* LABORATORY ASSUMES NO RESPONSIBILITY WHATSOEVER FOR ITS USE BY OTHER
+* PARTIES,  AND MAKES NO GUARANTEES, EXPRESSED OR IMPLIED, ABOUT ITS QUALITY,
+* RELIABILITY, OR ANY OTHER CHARACTERISTIC.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+* IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+* OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+* ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+* OTHER DEALINGS IN THE SOFTWARE.
+*
+* For more information, please refer to <http://unlicense.org>
+*
+******************************************************************************/
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <time.h>
+#endif
+
+#include "cpl_atomic_ops.h"
+#include "cpl_conv.h"
+
+#include "rlperf.h"
+
+/*
+** Monotonic wall clock in seconds.
+*/
+double RLPerfGetWallTime( void )
+{
+#ifdef _WIN32
+    LARGE_INTEGER nCount, nFrequency;
+    QueryPerformanceCounter( &nCount );
+    QueryPerformanceFrequency( &nFrequency );
+    return (double) nCount.QuadPart / (double) nFrequency.QuadPart;
+#else
+    struct timespec sTime;
+    clock_gettime( CLOCK_MONOTONIC, &sTime );
+    return sTime.tv_sec + sTime.tv_nsec * 1e-9;
+#endif
+}
+
+/*
+** User and system CPU time of the whole process in seconds, all threads.
+*/
+double RLPerfGetCPUTime( void )
+{
+#ifdef _WIN32
+    FILETIME sCreate, sExit, sKernel, sUser;
+    ULARGE_INTEGER nKernel, nUser;
+    if( !GetProcessTimes( GetCurrentProcess(), &sCreate, &sExit, &sKernel,
+                          &sUser ) )
+        return 0.0;
+    nKernel.LowPart = sKernel.dwLowDateTime;
+    nKernel.HighPart = sKernel.dwHighDateTime;
+    nUser.LowPart = sUser.dwLowDateTime;
+    nUser.HighPart = sUser.dwHighDateTime;
+    return ( nKernel.QuadPart + nUser.QuadPart ) * 1e-7;
+#else
+    struct rusage sUsage;
+    if( getrusage( RUSAGE_SELF, &sUsage ) != 0 )
+        return 0.0;
+    return sUsage.ru_utime.tv_sec + sUsage.ru_utime.tv_usec * 1e-6 +
+           sUsage.ru_stime.tv_sec + sUsage.ru_stime.tv_usec * 1e-6;
+#endif
+}
+
+/*
+** Peak resident set size of the process in kB, -1 where unknown.
+*/
+GIntBig RLPerfGetPeakRSS( void )
+{
+#ifdef _WIN32
+    return -1;
+#else
+    struct rusage sUsage;
+    if( getrusage( RUSAGE_SELF, &sUsage ) != 0 )
+        return -1;
+#ifdef __APPLE__
+    return (GIntBig) sUsage.ru_maxrss / 1024;
+#else
+    return (GIntBig) sUsage.ru_maxrss;
+#endif
+#endif
+}
+
+void RLPerfStart( RLPerf *psPerf )
+{
+    if( !psPerf )
+        return;
+    memset( psPerf, 0, sizeof( RLPerf ) );
+    psPerf->dfStartWall = RLPerfGetWallTime();
+    psPerf->dfStartCPU = RLPerfGetCPUTime();
+}
+
+/*
+** Start timing the stage pszStage, a string that outlives psPerf.  Returns
+** the stage for RLPerfEnd(), or -1.
+*/
+int RLPerfBegin( RLPerf *psPerf, const char *pszStage )
+{
+    RLPerfStage *psStage;
+    int iStage;
+
+    if( !psPerf )
+        return -1;
+    iStage = CPLAtomicInc( &psPerf->nStages ) - 1;
+    if( iStage >= RL_PERF_MAX_STAGES )
+        return -1;
+    psStage = psPerf->asStages + iStage;
+    psStage->pszName = pszStage;
+    psStage->nPeakRSS = -1;
+    psStage->dfStartWall = RLPerfGetWallTime();
+    psStage->dfStartCPU = RLPerfGetCPUTime();
+    return iStage;
+}
+
+void RLPerfEnd( RLPerf *psPerf, int iStage, GUIntBig nBytesRead,
+                GUIntBig nBytesWritten )
+{
+    RLPerfStage *psStage;
+
+    if( !psPerf || iStage < 0 || iStage >= RL_PERF_MAX_STAGES )
+        return;
+    psStage = psPerf->asStages + iStage;
+    psStage->dfWall = RLPerfGetWallTime() - psStage->dfStartWall;
+    psStage->dfCPU = RLPerfGetCPUTime() - psStage->dfStartCPU;
+    psStage->nBytesRead = nBytesRead;
+    psStage->nBytesWritten = nBytesWritten;
+    psStage->nPeakRSS = RLPerfGetPeakRSS();
+}
+
+/*
+** Append a JSON string.
+*/
+static void WriteJSONString( RLBuffer *psOut, const char *pszText )
+{
+    RLBufferAppend( psOut, "\"" );
+    for( ; pszText && *pszText != '\0'; pszText++ )
+    {
+        if( *pszText == '"' || *pszText == '\\' )
+            RLBufferPrintf( psOut, "\\%c", *pszText );
+        else if( (unsigned char) *pszText < 0x20 )
+            RLBufferPrintf( psOut, "\\u%04x", (unsigned char) *pszText );
+        else
+            RLBufferWrite( pszText, 1, psOut );
+    }
+    RLBufferAppend( psOut, "\"" );
+}
+
+/*
+** Append the record of one conversion to psOut as a single line of JSON,
+** with totals and the stages in the order they were started.
+*/
+void RLPerfWriteJSON( const RLPerf *psPerf, const char *pszSrcFile,
+                      const char *pszDstFile, CPLErr eErr,
+                      GUIntBig nOutputBytes, RLBuffer *psOut )
+{
+    const RLPerfStage *psStage;
+    int i, nStages;
+
+    if( !psPerf )
+        return;
+    RLBufferAppend( psOut, "{\"src\":" );
+    WriteJSONString( psOut, pszSrcFile );
+    RLBufferAppend( psOut, ",\"dst\":" );
+    WriteJSONString( psOut, pszDstFile );
+    RLBufferPrintf( psOut, ",\"status\":\"%s\",\"wall_s\":%.6f,"
+                    "\"cpu_s\":%.6f,\"peak_rss_kb\":" CPL_FRMT_GIB ","
+                    "\"output_bytes\":" CPL_FRMT_GUIB ",\"stages\":[",
+                    eErr == CE_None ? "ok" : "failed",
+                    RLPerfGetWallTime() - psPerf->dfStartWall,
+                    RLPerfGetCPUTime() - psPerf->dfStartCPU,
+                    RLPerfGetPeakRSS(), nOutputBytes );
+    nStages = MIN( psPerf->nStages, RL_PERF_MAX_STAGES );
+    for( i = 0; i < nStages; i++ )
+    {
+        psStage = psPerf->asStages + i;
+        RLBufferAppend( psOut, i ? ",{\"name\":" : "{\"name\":" );
+        WriteJSONString( psOut, psStage->pszName );
+        RLBufferPrintf( psOut, ",\"wall_s\":%.6f,\"cpu_s\":%.6f,"
+                        "\"bytes_read\":" CPL_FRMT_GUIB ","
+                        "\"bytes_written\":" CPL_FRMT_GUIB ","
+                        "\"peak_rss_kb\":" CPL_FRMT_GIB "}",
+                        psStage->dfWall, psStage->dfCPU,
+                        psStage->nBytesRead, psStage->nBytesWritten,
+                        psStage->nPeakRSS );
+    }
+    RLBufferAppend( psOut, "]}\n" );
+}
@@ -0,0 +1,100 @@
+/******************************************************************************
+*
+*  Project:  rl2kmz
+*  Purpose:  per stage timing and memory instrumentation
+*  Author:   Kyle Shannon <kyle at pobox dot com>
+*
+*******************************************************************************
+*
+* This is free and unencumbered software released into the public domain.
+*
+* Anyone is free to copy, modify, publish, use, compile, sell, or
+* distribute this software, either in source code form or as a compiled
+* binary, for any purpose, commercial or non-commercial, and by any
+* means.
+*
+* In jurisdictions that recognize copyright laws, the author or authors
+* of this software dedicate any and all copyright interest in the
+* software to the public domain. We make this dedication for the benefit
+* of the public at large and to the detriment of our heirs and
+* successors. We intend this dedication to be an overt act of
+* relinquishment in perpetuity of all present and future rights to this
+* software under copyright law.
+*
+* THIS SOFTWARE WAS DEVELOPED AT THE ROCKY MOUNTAIN RESEARCH STATION (RMRS)
+* MISSOULA FIRE SCIENCES LABORATORY BY EMPLOYEES OF THE FEDERAL GOVERNMENT
+* IN THE COURSE OF THEIR OFFICIAL DUTIES. PURSUANT TO TITLE 17 SECTION 105
+* OF THE UNITED STATES CODE, THIS SOFTWARE IS NOT SUBJECT TO COPYRIGHT
+* PROTECTION AND IS IN THE PUBLIC DOMAIN. RMRS MISSOULA FIRE SCIENCES
+* LABORATORY ASSUMES NO RESPONSIBILITY WHATSOEVER FOR ITS USE BY OTHER
+* PARTIES,  AND MAKES NO GUARANTEES, EXPRESSED OR IMPLIED, ABOUT ITS QUALITY,
+* RELIABILITY, OR ANY OTHER CHARACTERISTIC.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+* IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+* OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+* ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+* OTHER DEALINGS IN THE SOFTWARE.
+*
+* For more information, please refer to <http://unlicense.org>
+*
+******************************************************************************/
+
+#ifndef RLPERF_H_
+#define RLPERF_H_
+
+#include "cpl_error.h"
+
+#include "rlport.h"
+#include "rlutil.h"
+
+CPL_C_START
+
+#ifndef RL_PERF_MAX_STAGES
+#define RL_PERF_MAX_STAGES 16
+#endif
+
+typedef struct
+{
+    const char *pszName;
+    double dfStartWall;
+    double dfStartCPU;
+    /* Seconds spent, CPU time is of the whole process */
+    double dfWall;
+    double dfCPU;
+    GUIntBig nBytesRead;
+    GUIntBig nBytesWritten;
+    /* High water mark of the process in kB when the stage ended */
+    GIntBig nPeakRSS;
+} RLPerfStage;
+
+/*
+** Stages of one conversion.  Stages may run concurrently on different
+** threads, each ends its own.  Every function accepts a NULL RLPerf and
+** then does nothing, so instrumentation costs nothing when it is off.
+*/
+typedef struct
+{
+    double dfStartWall;
+    double dfStartCPU;
+    volatile int nStages;
+    RLPerfStage asStages[RL_PERF_MAX_STAGES];
+} RLPerf;
+
+double RLPerfGetWallTime( void );
+double RLPerfGetCPUTime( void );
+GIntBig RLPerfGetPeakRSS( void );
+
+void RLPerfStart( RLPerf *psPerf );
+int RLPerfBegin( RLPerf *psPerf, const char *pszStage );
+void RLPerfEnd( RLPerf *psPerf, int iStage, GUIntBig nBytesRead,
+                GUIntBig nBytesWritten );
+void RLPerfWriteJSON( const RLPerf *psPerf, const char *pszSrcFile,
+                      const char *pszDstFile, CPLErr eErr,
+                      GUIntBig nOutputBytes, RLBuffer *psOut );
+
+CPL_C_END
+
+#endif /* RLPERF_H_ */
@@ -0,0 +1,436 @@
+/******************************************************************************
+*
+*  Project:  rl2kmz
+*  Purpose:  streaming png encoder for the ground overlay
+*  Author:   Kyle Shannon <kyle at pobox dot com>
+*
+*******************************************************************************
+*
+* This is free and unencumbered software released into the public domain.
+*
+* Anyone is free to copy, modify, publish, use, compile, sell, or
+* distribute this software, either in source code form or as a compiled
+* binary, for any purpose, commercial or non-commercial, and by any
+* means.
+*
+* In jurisdictions that recognize copyright laws, the author or authors
+* of this software dedicate any and all copyright interest in the
+* software to the public domain. We make this dedication for the benefit
+* of the public at large and to the detriment of our heirs and
+* successors. We intend this dedication to be an overt act of
+* relinquishment in perpetuity of all present and future rights to this
+* software under copyright law.
+*
+* THIS SOFTWARE WAS DEVELOPED AT THE ROCKY MOUNTAIN RESEARCH STATION (RMRS)
+* MISSOULA FIRE SCIENCES LABORATORY BY EMPLOYEES OF THE FEDERAL GOVERNMENT
+* IN THE COURSE OF THEIR OFFICIAL DUTIES. PURSUANT TO TITLE 17 SECTION 105
+* OF THE UNITED STATES CODE, THIS SOFTWARE IS NOT SUBJECT TO COPYRIGHT
+* PROTECTION AND IS IN THE PUBLIC DOMAIN. RMRS MISSOULA FIRE SCIENCES
+* LABORATORY ASSUMES NO RESPONSIBILITY WHATSOEVER FOR ITS USE BY OTHER
+* PARTIES,  AND MAKES NO GUARANTEES, EXPRESSED OR IMPLIED, ABOUT ITS QUALITY,
+* RELIABILITY, OR ANY OTHER CHARACTERISTIC.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+* IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+* OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+* ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+* OTHER DEALINGS IN THE SOFTWARE.
+*
+* For more information, please refer to <http://unlicense.org>
+*
+******************************************************************************/
+
+#include <zlib.h>
+
+#include "cpl_conv.h"
+#include "cpl_string.h"
+
+#include "rlpng.h"
+
+/*
+** Compressed data is flushed to an IDAT chunk every time this much has
+** accumulated.
+*/
+#ifndef RL_PNG_IDAT_SIZE
+#define RL_PNG_IDAT_SIZE 65536
+#endif
+
+struct RLPngWriter
+{
+    int nXSize;
+    int nYSize;
+    int nBands;
+    int nRowsWritten;
+    int nFilter;
+    RLWriteFunc pfnWrite;
+    void *pUserData;
+    RLDeflater *psDeflater;
+    GByte *pabyRow;
+    GByte *pabyPrev;
+    GByte *pabyTry;
+    GByte *pabyIdat;
+    /* Bytes of pabyIdat waiting for an IDAT chunk */
+    size_t nIdatUsed;
+    CPLErr eErr;
+};
+
+/*
+** Defaults: zlib's level and strategy, no filtering, one stream.
+*/
+void RLPngInitOptions( RLPngOptions *psOptions )
+{
+    RLDeflateInitOptions( &psOptions->sDeflate );
+    psOptions->nFilter = RL_PNG_FILTER_NONE;
+}
+
+/*
+** Options from the config, png_filter, one of none, sub, up, average,
+** paeth or adaptive, and the png_ deflate keys of RLDeflateGetOptions().
+*/
+void RLPngGetOptions( char **papszConfig, RLPngOptions *psOptions )
+{
+    static const char * const apszFilters[] =
+        { "none", "sub", "up", "average", "paeth", "adaptive" };
+    const char *pszFilter;
+    int i;
+
+    RLPngInitOptions( psOptions );
+    RLDeflateGetOptions( papszConfig, "png", &psOptions->sDeflate );
+    pszFilter = CSLFetchNameValueDef( papszConfig, "png_filter", "none" );
+    for( i = 0; i < (int) ( sizeof( apszFilters ) / sizeof( char* ) ); i++ )
+    {
+        if( EQUAL( pszFilter, apszFilters[i] ) )
+        {
+            psOptions->nFilter = i;
+            return;
+        }
+    }
+    CPLError( CE_Warning, CPLE_AppDefined,
+              "Invalid png_filter %s, using none", pszFilter );
+}
+
+static void PutUInt32( GByte *pabyDst, GUInt32 nValue )
+{
+    pabyDst[0] = (GByte) ( nValue >> 24 );
+    pabyDst[1] = (GByte) ( nValue >> 16 );
+    pabyDst[2] = (GByte) ( nValue >> 8 );
+    pabyDst[3] = (GByte) nValue;
+}
+
+static CPLErr WriteChunk( RLPngWriter *psPng, const char *pszType,
+                          const GByte *pabyData, GUInt32 nLength )
+{
+    GByte abyHeader[8];
+    GByte abyCrc[4];
+    uLong nCrc;
+
+    if( psPng->eErr != CE_None )
+        return psPng->eErr;
+    PutUInt32( abyHeader, nLength );
+    memcpy( abyHeader + 4, pszType, 4 );
+    nCrc = crc32( 0L, abyHeader + 4, 4 );
+    if( nLength > 0 )
+        nCrc = crc32( nCrc, pabyData, nLength );
+    PutUInt32( abyCrc, (GUInt32) nCrc );
+    if( psPng->pfnWrite( abyHeader, 8, psPng->pUserData ) != 8 ||
+        ( nLength > 0 &&
+          psPng->pfnWrite( pabyData, nLength,
+                           psPng->pUserData ) != nLength ) ||
+        psPng->pfnWrite( abyCrc, 4, psPng->pUserData ) != 4 )
+    {
+        CPLError( CE_Failure, CPLE_FileIO, "Failed to write png chunk %s",
+                  pszType );
+        psPng->eErr = CE_Failure;
+    }
+    return psPng->eErr;
+}
+
+/*
+** Append compressed bytes, writing an IDAT chunk every time
+** RL_PNG_IDAT_SIZE have gathered.
+*/
+static size_t WriteIdat( const void *pData, size_t nBytes, void *pUserData )
+{
+    RLPngWriter *psPng = (RLPngWriter*) pUserData;
+    const GByte *pabyData = (const GByte*) pData;
+    size_t nLeft, nCopy;
+
+    for( nLeft = nBytes; nLeft > 0 && psPng->eErr == CE_None;
+         nLeft -= nCopy )
+    {
+        nCopy = MIN( nLeft, RL_PNG_IDAT_SIZE - psPng->nIdatUsed );
+        memcpy( psPng->pabyIdat + psPng->nIdatUsed, pabyData, nCopy );
+        psPng->nIdatUsed += nCopy;
+        pabyData += nCopy;
+        if( psPng->nIdatUsed == RL_PNG_IDAT_SIZE )
+        {
+            WriteChunk( psPng, "IDAT", psPng->pabyIdat, RL_PNG_IDAT_SIZE );
+            psPng->nIdatUsed = 0;
+        }
+    }
+    return psPng->eErr == CE_None ? nBytes : 0;
+}
+
+static int Paeth( int a, int b, int c )
+{
+    int p = a + b - c;
+    int pa = ABS( p - a ), pb = ABS( p - b ), pc = ABS( p - c );
+
+    if( pa <= pb && pa <= pc )
+        return a;
+    return pb <= pc ? b : c;
+}
+
+/*
+** Filter one row into pabyDst, the filter type byte then the row, given
+** the row above, all zero for the first.
+*/
+static void FilterRow( int nFilter, const GByte *pabyRow,
+                       const GByte *pabyPrev, size_t nRowBytes, int nBpp,
+                       GByte *pabyDst )
+{
+    size_t i;
+    int a, c;
+
+    pabyDst[0] = (GByte) nFilter;
+    pabyDst++;
+    if( nFilter == RL_PNG_FILTER_NONE )
+    {
+        memcpy( pabyDst, pabyRow, nRowBytes );
+        return;
+    }
+    for( i = 0; i < nRowBytes; i++ )
+    {
+        a = i >= (size_t) nBpp ? pabyRow[i - nBpp] : 0;
+        c = i >= (size_t) nBpp ? pabyPrev[i - nBpp] : 0;
+        switch( nFilter )
+        {
+          case RL_PNG_FILTER_SUB:
+            pabyDst[i] = (GByte) ( pabyRow[i] - a );
+            break;
+          case RL_PNG_FILTER_UP:
+            pabyDst[i] = (GByte) ( pabyRow[i] - pabyPrev[i] );
+            break;
+          case RL_PNG_FILTER_AVERAGE:
+            pabyDst[i] = (GByte) ( pabyRow[i] - ( a + pabyPrev[i] ) / 2 );
+            break;
+          default:
+            pabyDst[i] = (GByte) ( pabyRow[i] -
+                                   Paeth( a, pabyPrev[i], c ) );
+            break;
+        }
+    }
+}
+
+/*
+** Sum of the filtered bytes taken as signed, the usual guess at which
+** filter compresses best.
+*/
+static GUIntBig FilterCost( const GByte *pabyFiltered, size_t nRowBytes )
+{
+    GUIntBig nCost = 0;
+    size_t i;
+
+    for( i = 1; i <= nRowBytes; i++ )
+        nCost += pabyFiltered[i] < 128 ? pabyFiltered[i] :
+                                         256 - pabyFiltered[i];
+    return nCost;
+}
+
+/*
+** Filter the next row into pabyRow, trying each filter for adaptive.
+*/
+static void FilterNextRow( RLPngWriter *psPng, const GByte *pabySrc )
+{
+    size_t nRowBytes = (size_t) psPng->nXSize * psPng->nBands;
+    GUIntBig nCost, nBestCost = 0;
+    GByte *pabySwap;
+    int nFilter;
+
+    if( psPng->nFilter != RL_PNG_FILTER_ADAPTIVE )
+    {
+        FilterRow( psPng->nFilter, pabySrc, psPng->pabyPrev, nRowBytes,
+                   psPng->nBands, psPng->pabyRow );
+    }
+    else
+    {
+        for( nFilter = RL_PNG_FILTER_NONE; nFilter <= RL_PNG_FILTER_PAETH;
+             nFilter++ )
+        {
+            FilterRow( nFilter, pabySrc, psPng->pabyPrev, nRowBytes,
+                       psPng->nBands, psPng->pabyTry );
+            nCost = FilterCost( psPng->pabyTry, nRowBytes );
+            if( nFilter == RL_PNG_FILTER_NONE || nCost < nBestCost )
+            {
+                nBestCost = nCost;
+                pabySwap = psPng->pabyRow;
+                psPng->pabyRow = psPng->pabyTry;
+                psPng->pabyTry = pabySwap;
+            }
+        }
+    }
+    if( psPng->pabyPrev )
+        memcpy( psPng->pabyPrev, pabySrc, nRowBytes );
+}
+
+/*
+** Write the PLTE chunk and, if any entry isn't opaque, a tRNS chunk
+** holding alpha up to the last translucent entry.
+*/
+static CPLErr WritePalette( RLPngWriter *psPng, const GByte *pabyPalette,
+                            int nPaletteCount )
+{
+    GByte abyColors[3 * 256];
+    GByte abyAlpha[256];
+    int i, nAlphaCount = 0;
+
+    for( i = 0; i < nPaletteCount; i++ )
+    {
+        memcpy( abyColors + i * 3, pabyPalette + i * 4, 3 );
+        abyAlpha[i] = pabyPalette[i * 4 + 3];
+        if( abyAlpha[i] != 255 )
+            nAlphaCount = i + 1;
+    }
+    WriteChunk( psPng, "PLTE", abyColors, 3 * nPaletteCount );
+    if( nAlphaCount > 0 )
+        WriteChunk( psPng, "tRNS", abyAlpha, nAlphaCount );
+    return psPng->eErr;
+}
+
+static void FreeWriter( RLPngWriter *psPng )
+{
+    CPLFree( psPng->pabyRow );
+    CPLFree( psPng->pabyPrev );
+    CPLFree( psPng->pabyTry );
+    CPLFree( psPng->pabyIdat );
+    CPLFree( psPng );
+}
+
+/*
+** Start an 8 bit png, writing the signature and headers through pfnWrite.
+** nBands is 4 for RGBA, or 1 for palette indices into the nPaletteCount
+** RGBA entries of pabyPalette.  psOptions may be NULL for the defaults.
+** Rows are then pushed top to bottom with RLPngWriteRows().
+*/
+RLPngWriter * RLPngCreate( int nXSize, int nYSize, int nBands,
+                           const GByte *pabyPalette, int nPaletteCount,
+                           const RLPngOptions *psOptions,
+                           RLWriteFunc pfnWrite, void *pUserData )
+{
+    static const GByte abySignature[8] =
+        { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+    RLPngWriter *psPng;
+    RLPngOptions sOptions;
+    GByte abyHeader[13];
+    size_t nRowBytes;
+
+    if( !( nBands == 4 ||
+           ( nBands == 1 && pabyPalette && nPaletteCount > 0 &&
+             nPaletteCount <= 256 ) ) )
+    {
+        CPLError( CE_Failure, CPLE_NotSupported,
+                  "Unsupported png layout, %d band(s) with %d palette " \
+                  "entries", nBands, nPaletteCount );
+        return NULL;
+    }
+
+    if( psOptions )
+        sOptions = *psOptions;
+    else
+        RLPngInitOptions( &sOptions );
+    psPng = (RLPngWriter*) CPLCalloc( sizeof( RLPngWriter ), 1 );
+    psPng->nXSize = nXSize;
+    psPng->nYSize = nYSize;
+    psPng->nBands = nBands;
+    psPng->nFilter = sOptions.nFilter;
+    if( psPng->nFilter < RL_PNG_FILTER_NONE ||
+        psPng->nFilter > RL_PNG_FILTER_ADAPTIVE )
+        psPng->nFilter = RL_PNG_FILTER_NONE;
+    psPng->pfnWrite = pfnWrite;
+    psPng->pUserData = pUserData;
+    nRowBytes = (size_t) nXSize * nBands;
+    psPng->pabyRow = (GByte*) CPLMalloc( nRowBytes + 1 );
+    if( psPng->nFilter != RL_PNG_FILTER_NONE )
+        psPng->pabyPrev = (GByte*) CPLCalloc( nRowBytes, 1 );
+    if( psPng->nFilter == RL_PNG_FILTER_ADAPTIVE )
+        psPng->pabyTry = (GByte*) CPLMalloc( nRowBytes + 1 );
+    psPng->pabyIdat = (GByte*) CPLMalloc( RL_PNG_IDAT_SIZE );
+    psPng->psDeflater = RLDeflateCreate( TRUE, &sOptions.sDeflate,
+                                         (GUIntBig) ( nRowBytes + 1 ) *
+                                         nYSize, WriteIdat, psPng );
+    if( !psPng->psDeflater )
+    {
+        FreeWriter( psPng );
+        return NULL;
+    }
+
+    if( pfnWrite( abySignature, 8, pUserData ) != 8 )
+    {
+        CPLError( CE_Failure, CPLE_FileIO, "Failed to write png signature" );
+        psPng->eErr = CE_Failure;
+    }
+    PutUInt32( abyHeader, (GUInt32) nXSize );
+    PutUInt32( abyHeader + 4, (GUInt32) nYSize );
+    abyHeader[8] = 8;   /* bit depth */
+    abyHeader[9] = nBands == 4 ? 6 : 3;   /* truecolour alpha or palette */
+    abyHeader[10] = 0;  /* deflate */
+    abyHeader[11] = 0;  /* adaptive filtering */
+    abyHeader[12] = 0;  /* no interlace */
+    WriteChunk( psPng, "IHDR", abyHeader, 13 );
+    if( nBands == 1 )
+        WritePalette( psPng, pabyPalette, nPaletteCount );
+    return psPng;
+}
+
+/*
+** Filter and compress nRows pixel interleaved rows.
+*/
+CPLErr RLPngWriteRows( RLPngWriter *psPng, const GByte *pabyRows,
+                       int nRows )
+{
+    size_t nRowBytes = (size_t) psPng->nXSize * psPng->nBands;
+    int i;
+
+    if( psPng->nRowsWritten + nRows > psPng->nYSize )
+    {
+        CPLError( CE_Failure, CPLE_AppDefined,
+                  "Too many rows written to png" );
+        psPng->eErr = CE_Failure;
+    }
+    for( i = 0; i < nRows && psPng->eErr == CE_None; i++ )
+    {
+        FilterNextRow( psPng, pabyRows + i * nRowBytes );
+        if( RLDeflateWrite( psPng->psDeflater, psPng->pabyRow,
+                            nRowBytes + 1 ) != CE_None )
+            psPng->eErr = CE_Failure;
+        psPng->nRowsWritten++;
+    }
+    return psPng->eErr;
+}
+
+/*
+** Flush the compressed stream, write the trailer and free the writer.
+*/
+CPLErr RLPngFinish( RLPngWriter *psPng )
+{
+    CPLErr eErr;
+
+    if( psPng->eErr == CE_None && psPng->nRowsWritten != psPng->nYSize )
+    {
+        CPLError( CE_Failure, CPLE_AppDefined,
+                  "Only %d of %d png rows written", psPng->nRowsWritten,
+                  psPng->nYSize );
+        psPng->eErr = CE_Failure;
+    }
+    if( RLDeflateFinish( psPng->psDeflater ) != CE_None )
+        psPng->eErr = CE_Failure;
+    if( psPng->eErr == CE_None && psPng->nIdatUsed > 0 )
+        WriteChunk( psPng, "IDAT", psPng->pabyIdat,
+                    (GUInt32) psPng->nIdatUsed );
+    WriteChunk( psPng, "IEND", NULL, 0 );
+    eErr = psPng->eErr;
+    FreeWriter( psPng );
+    return eErr;
+}
@@ -0,0 +1,91 @@
+/******************************************************************************
+*
+*  Project:  rl2kmz
+*  Purpose:  streaming png encoder for the ground overlay
+*  Author:   Kyle Shannon <kyle at pobox dot com>
+*
+*******************************************************************************
+*
+* This is free and unencumbered software released into the public domain.
+*
+* Anyone is free to copy, modify, publish, use, compile, sell, or
+* distribute this software, either in source code form or as a compiled
+* binary, for any purpose, commercial or non-commercial, and by any
+* means.
+*
+* In jurisdictions that recognize copyright laws, the author or authors
+* of this software dedicate any and all copyright interest in the
+* software to the public domain. We make this dedication for the benefit
+* of the public at large and to the detriment of our heirs and
+* successors. We intend this dedication to be an overt act of
+* relinquishment in perpetuity of all present and future rights to this
+* software under copyright law.
+*
+* THIS SOFTWARE WAS DEVELOPED AT THE ROCKY MOUNTAIN RESEARCH STATION (RMRS)
+* MISSOULA FIRE SCIENCES LABORATORY BY EMPLOYEES OF THE FEDERAL GOVERNMENT
+* IN THE COURSE OF THEIR OFFICIAL DUTIES. PURSUANT TO TITLE 17 SECTION 105
+* OF THE UNITED STATES CODE, THIS SOFTWARE IS NOT SUBJECT TO COPYRIGHT
+* PROTECTION AND IS IN THE PUBLIC DOMAIN. RMRS MISSOULA FIRE SCIENCES
+* LABORATORY ASSUMES NO RESPONSIBILITY WHATSOEVER FOR ITS USE BY OTHER
+* PARTIES,  AND MAKES NO GUARANTEES, EXPRESSED OR IMPLIED, ABOUT ITS QUALITY,
+* RELIABILITY, OR ANY OTHER CHARACTERISTIC.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+* IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+* OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+* ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+* OTHER DEALINGS IN THE SOFTWARE.
+*
+* For more information, please refer to <http://unlicense.org>
+*
+******************************************************************************/
+
+#ifndef RLPNG_H_
+#define RLPNG_H_
+
+#include "cpl_error.h"
+
+#include "rlport.h"
+#include "rldeflate.h"
+#include "rlutil.h"
+
+CPL_C_START
+
+/*
+** Row filters, the png filter types and a per row choice among them.
+*/
+#define RL_PNG_FILTER_NONE      0
+#define RL_PNG_FILTER_SUB       1
+#define RL_PNG_FILTER_UP        2
+#define RL_PNG_FILTER_AVERAGE   3
+#define RL_PNG_FILTER_PAETH     4
+#define RL_PNG_FILTER_ADAPTIVE  5
+
+/*
+** How the image data is filtered and compressed.  With nThreads above 1
+** in sDeflate large images are deflated on that many threads.
+*/
+typedef struct
+{
+    RLDeflateOptions sDeflate;
+    int nFilter;
+} RLPngOptions;
+
+typedef struct RLPngWriter RLPngWriter;
+
+void RLPngInitOptions( RLPngOptions *psOptions );
+void RLPngGetOptions( char **papszConfig, RLPngOptions *psOptions );
+
+RLPngWriter * RLPngCreate( int nXSize, int nYSize, int nBands,
+                           const GByte *pabyPalette, int nPaletteCount,
+                           const RLPngOptions *psOptions,
+                           RLWriteFunc pfnWrite, void *pUserData );
+CPLErr RLPngWriteRows( RLPngWriter *psPng, const GByte *pabyRows,
+                       int nRows );
+CPLErr RLPngFinish( RLPngWriter *psPng );
+
+CPL_C_END
+
+#endif /* RLPNG_H_ */
@@ -0,0 +1,739 @@
+/******************************************************************************
+*
+*  Project:  rl2kmz
+*  Purpose:  colourize the source grid
+*  Author:   Kyle Shannon <kyle at pobox dot com>
+*
+*******************************************************************************
+*
+* This is free and unencumbered software released into the public domain.
+*
+* Anyone is free to copy, modify, publish, use, compile, sell, or
+* distribute this software, either in source code form or as a compiled
+* binary, for any purpose, commercial or non-commercial, and by any
+* means.
+*
+* In jurisdictions that recognize copyright laws, the author or authors
+* of this software dedicate any and all copyright interest in the
+* software to the public domain. We make this dedication for the benefit
+* of the public at large and to the detriment of our heirs and
+* successors. We intend this dedication to be an overt act of
+* relinquishment in perpetuity of all present and future rights to this
+* software under copyright law.
+*
+* THIS SOFTWARE WAS DEVELOPED AT THE ROCKY MOUNTAIN RESEARCH STATION (RMRS)
+* MISSOULA FIRE SCIENCES LABORATORY BY EMPLOYEES OF THE FEDERAL GOVERNMENT
+* IN THE COURSE OF THEIR OFFICIAL DUTIES. PURSUANT TO TITLE 17 SECTION 105
+* OF THE UNITED STATES CODE, THIS SOFTWARE IS NOT SUBJECT TO COPYRIGHT
+* PROTECTION AND IS IN THE PUBLIC DOMAIN. RMRS MISSOULA FIRE SCIENCES
+* LABORATORY ASSUMES NO RESPONSIBILITY WHATSOEVER FOR ITS USE BY OTHER
+* PARTIES,  AND MAKES NO GUARANTEES, EXPRESSED OR IMPLIED, ABOUT ITS QUALITY,
+* RELIABILITY, OR ANY OTHER CHARACTERISTIC.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+* IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+* OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+* ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+* OTHER DEALINGS IN THE SOFTWARE.
+*
+* For more information, please refer to <http://unlicense.org>
+*
+******************************************************************************/
+
+#include <limits.h>
+
+#include "cpl_atomic_ops.h"
+#include "cpl_conv.h"
+#include "cpl_multiproc.h"
+#include "cpl_string.h"
+
+#include "rlpng.h"
+#include "rlraster.h"
+
+typedef struct
+{
+    GDALDatasetH hSrcDS;
+    int bReopen;
+    const RLColorTable *psTable;
+    const GInt32 *pnNoData;
+    GInt32 nNoData;
+    int nXSize;
+    int nYSize;
+    int nChunkXSize;
+    int nChunkYSize;
+    int nChunksPerRow;
+    int nChunkCount;
+    volatile int nNextChunk;
+    volatile int nErrors;
+    int nBands;
+    GByte *pabyDst;
+    /* Extent of the non-transparent pixels, merged from every worker */
+    int bTrackWindow;
+    CPLMutex *hMutex;
+    int nMinX;
+    int nMinY;
+    int nMaxX;
+    int nMaxY;
+    /* Cells of the classes marked keep, merged from every worker */
+    RLStrikeIndex *psStrikes;
+} RLColorizeJob;
+
+/*
+** Classify into RGBA (nBands == 4) or palette indices (nBands == 1).  The
+** span of pixels that aren't fully transparent, palette entry 0 or alpha 0,
+** is found on the way when pnFirst and pnLast aren't NULL, FALSE being
+** returned when there are none.
+*/
+static int ClassifyPixels( const RLColorTable *psTable,
+                           const GInt32 *panSrc, const GInt32 *pnNoData,
+                           GByte *pabyDst, size_t nCount, int nBands,
+                           size_t *pnFirst, size_t *pnLast )
+{
+    if( nBands == 1 )
+        return RLClassifyInt32ToIndex( psTable, panSrc, pnNoData, pabyDst,
+                                       nCount, pnFirst, pnLast );
+    return RLClassifyInt32( psTable, panSrc, pnNoData, pabyDst, nCount,
+                            pnFirst, pnLast );
+}
+
+/*
+** Pull chunks off the job until there are none left.  Each chunk is read
+** with one RasterIO call and classified straight into the interleaved
+** output buffer, rows of a chunk never overlap another chunk so no locking
+** is needed.  Without an output buffer rows are classified into a scratch
+** row, only to track the extent of the data.  The classifier finds the
+** span of data in each row, folded into the extent of the chunk and then
+** of the worker.  Strikes and extents are merged at the end.
+*/
+static void ColorizeWorker( void *pData )
+{
+    RLColorizeJob *psJob = (RLColorizeJob*) pData;
+    GDALDatasetH hDS;
+    GDALRasterBandH hBand;
+    GInt32 *panChunk;
+    GByte *pabyRow = NULL, *pabyOut;
+    const GInt32 *panLine;
+    RLStrikeIndex sStrikes;
+    size_t nFirst, nLast;
+    int iChunk, nXOff, nYOff, nXValid, nYValid, iLine;
+    int nMinX = INT_MAX, nMinY = INT_MAX, nMaxX = -1, nMaxY = -1;
+    int nChunkMinX, nChunkMinY, nChunkMaxX, nChunkMaxY;
+    int i, iClass, bScanStrikes;
+    CPLErr eErr;
+
+    memset( &sStrikes, 0, sizeof( sStrikes ) );
+    bScanStrikes = psJob->psStrikes &&
+                   psJob->psTable->nKeepMin <= psJob->psTable->nKeepMax;
+
+    hDS = psJob->hSrcDS;
+    if( psJob->bReopen )
+    {
+        hDS = GDALOpenEx( GDALGetDescription( psJob->hSrcDS ),
+                          GDAL_OF_READONLY | GDAL_OF_RASTER |
+                          GDAL_OF_VERBOSE_ERROR, NULL, NULL, NULL );
+        if( !hDS )
+        {
+            CPLAtomicInc( &psJob->nErrors );
+            return;
+        }
+    }
+    hBand = GDALGetRasterBand( hDS, 1 );
+    panChunk = (GInt32*) VSIMalloc3( sizeof( GInt32 ), psJob->nChunkXSize,
+                                     psJob->nChunkYSize );
+    if( !psJob->pabyDst )
+        pabyRow = (GByte*) VSIMalloc2( psJob->nChunkXSize, psJob->nBands );
+    if( !panChunk || ( !psJob->pabyDst && !pabyRow ) )
+    {
+        VSIFree( panChunk );
+        VSIFree( pabyRow );
+        CPLError( CE_Failure, CPLE_OutOfMemory,
+                  "Could not allocate colourize buffer" );
+        CPLAtomicInc( &psJob->nErrors );
+        if( psJob->bReopen )
+            GDALClose( hDS );
+        return;
+    }
+
+    while( ( iChunk = CPLAtomicInc( &psJob->nNextChunk ) - 1 ) <
+           psJob->nChunkCount )
+    {
+        if( psJob->nErrors > 0 )
+            break;
+        nXOff = ( iChunk % psJob->nChunksPerRow ) * psJob->nChunkXSize;
+        nYOff = ( iChunk / psJob->nChunksPerRow ) * psJob->nChunkYSize;
+        nXValid = MIN( psJob->nChunkXSize, psJob->nXSize - nXOff );
+        nYValid = MIN( psJob->nChunkYSize, psJob->nYSize - nYOff );
+        eErr = GDALRasterIO( hBand, GF_Read, nXOff, nYOff, nXValid, nYValid,
+                             panChunk, nXValid, nYValid, GDT_Int32, 0, 0 );
+        if( eErr != CE_None )
+        {
+            CPLAtomicInc( &psJob->nErrors );
+            break;
+        }
+        nChunkMinX = nChunkMinY = INT_MAX;
+        nChunkMaxX = nChunkMaxY = -1;
+        for( iLine = 0; iLine < nYValid && psJob->nErrors == 0; iLine++ )
+        {
+            panLine = panChunk + (size_t) iLine * nXValid;
+            for( i = 0; bScanStrikes && i < nXValid; i++ )
+            {
+                if( psJob->pnNoData && panLine[i] == *psJob->pnNoData )
+                    continue;
+                iClass = RLGetKeptClass( psJob->psTable, panLine[i] );
+                if( iClass >= 0 &&
+                    RLAddStrike( &sStrikes, nXOff + i, nYOff + iLine,
+                                 iClass ) != RL_OK )
+                {
+                    CPLAtomicInc( &psJob->nErrors );
+                    break;
+                }
+            }
+            if( psJob->pabyDst )
+                pabyOut = psJob->pabyDst +
+                          ( (size_t) ( nYOff + iLine ) * psJob->nXSize +
+                            nXOff ) * psJob->nBands;
+            else
+                pabyOut = pabyRow;
+            if( ClassifyPixels( psJob->psTable, panLine, psJob->pnNoData,
+                                pabyOut, nXValid, psJob->nBands,
+                                psJob->bTrackWindow ? &nFirst : NULL,
+                                &nLast ) )
+            {
+                nChunkMinX = MIN( nChunkMinX, (int) nFirst );
+                nChunkMaxX = MAX( nChunkMaxX, (int) nLast );
+                nChunkMinY = MIN( nChunkMinY, iLine );
+                nChunkMaxY = iLine;
+            }
+        }
+        if( nChunkMaxY >= 0 )
+        {
+            nMinX = MIN( nMinX, nXOff + nChunkMinX );
+            nMaxX = MAX( nMaxX, nXOff + nChunkMaxX );
+            nMinY = MIN( nMinY, nYOff + nChunkMinY );
+            nMaxY = MAX( nMaxY, nYOff + nChunkMaxY );
+        }
+    }
+    if( psJob->bTrackWindow && nMaxX >= 0 )
+    {
+        CPLCreateOrAcquireMutex( &psJob->hMutex, 1000.0 );
+        psJob->nMinX = MIN( psJob->nMinX, nMinX );
+        psJob->nMinY = MIN( psJob->nMinY, nMinY );
+        psJob->nMaxX = MAX( psJob->nMaxX, nMaxX );
+        psJob->nMaxY = MAX( psJob->nMaxY, nMaxY );
+        CPLReleaseMutex( psJob->hMutex );
+    }
+    if( sStrikes.nCount > 0 )
+    {
+        CPLCreateOrAcquireMutex( &psJob->hMutex, 1000.0 );
+        if( RLAppendStrikes( psJob->psStrikes, &sStrikes ) != RL_OK )
+            CPLAtomicInc( &psJob->nErrors );
+        CPLReleaseMutex( psJob->hMutex );
+    }
+    RLClearStrikeIndex( &sStrikes );
+    VSIFree( panChunk );
+    VSIFree( pabyRow );
+    if( psJob->bReopen )
+        GDALClose( hDS );
+}
+
+/*
+** Colourize band 1 of hSrcDS into pabyDst, which holds nXSize * nYSize
+** pixel interleaved RGBA values when nBands is 4, or palette indices when
+** nBands is 1.  The band is read in chunks aligned on its
+** natural blocks, spread over nThreads workers that each open their own
+** handle on the source.  MEM sources, like those from RLWrapGrid(), are
+** read straight from memory and shared by the workers instead.  Other
+** sources that can't be reopened are colourized on the calling thread.
+**
+** If panWindow is not NULL it receives the x offset, y offset, width and
+** height of the pixels that aren't fully transparent, with a width of 0
+** when there are none.  pabyDst may be NULL to only find that window.
+**
+** If psStrikes is not NULL the cells of the classes marked keep are added
+** to it in row, then column order, a sparse index of the strikes found in
+** the same pass.
+*/
+CPLErr RLColorizeDataset( GDALDatasetH hSrcDS, const RLColorTable *psTable,
+                          int nThreads, int nBands, GByte *pabyDst,
+                          int *panWindow, RLStrikeIndex *psStrikes )
+{
+    RLColorizeJob sJob;
+    GDALRasterBandH hBand;
+    CPLJoinableThread **pahThreads;
+    GDALDatasetH hTestDS;
+    GDALDriverH hDriver;
+    int nBlockXSize, nBlockYSize, nChunkRows, i;
+
+    memset( &sJob, 0, sizeof( sJob ) );
+    hBand = GDALGetRasterBand( hSrcDS, 1 );
+    sJob.hSrcDS = hSrcDS;
+    sJob.psTable = psTable;
+    if( RLGetNoDataInt32( hBand, &sJob.nNoData ) )
+        sJob.pnNoData = &sJob.nNoData;
+    sJob.nXSize = GDALGetRasterXSize( hSrcDS );
+    sJob.nYSize = GDALGetRasterYSize( hSrcDS );
+    sJob.nBands = nBands;
+    sJob.pabyDst = pabyDst;
+    sJob.bTrackWindow = panWindow != NULL;
+    sJob.psStrikes = psStrikes;
+    sJob.nMinX = sJob.nMinY = INT_MAX;
+    sJob.nMaxX = sJob.nMaxY = -1;
+
+    GDALGetBlockSize( hBand, &nBlockXSize, &nBlockYSize );
+    nBlockXSize = MAX( 1, MIN( nBlockXSize, sJob.nXSize ) );
+    nBlockYSize = MAX( 1, MIN( nBlockYSize, sJob.nYSize ) );
+    nChunkRows = MAX( 1, RL_MIN_CHUNK_PIXELS /
+                         ( nBlockXSize * nBlockYSize ) );
+    sJob.nChunkXSize = nBlockXSize;
+    sJob.nChunkYSize = MIN( nBlockYSize * nChunkRows, sJob.nYSize );
+    sJob.nChunksPerRow = ( sJob.nXSize + sJob.nChunkXSize - 1 ) /
+                         sJob.nChunkXSize;
+    sJob.nChunkCount = sJob.nChunksPerRow *
+                       ( ( sJob.nYSize + sJob.nChunkYSize - 1 ) /
+                         sJob.nChunkYSize );
+
+    nThreads = MAX( 1, MIN( nThreads, sJob.nChunkCount ) );
+    hDriver = GDALGetDatasetDriver( hSrcDS );
+    if( nThreads > 1 &&
+        !( hDriver && EQUAL( GDALGetDriverShortName( hDriver ), "MEM" ) ) )
+    {
+        hTestDS = GDALOpenEx( GDALGetDescription( hSrcDS ),
+                              GDAL_OF_READONLY | GDAL_OF_RASTER,
+                              NULL, NULL, NULL );
+        if( hTestDS )
+        {
+            GDALClose( hTestDS );
+            sJob.bReopen = TRUE;
+        }
+        else
+            nThreads = 1;
+    }
+    CPLDebug( "RL2KMZ", "Colourizing %d chunks of %dx%d on %d thread(s)",
+              sJob.nChunkCount, sJob.nChunkXSize, sJob.nChunkYSize,
+              nThreads );
+
+    if( nThreads == 1 )
+    {
+        ColorizeWorker( &sJob );
+    }
+    else
+    {
+        pahThreads = (CPLJoinableThread**)
+            CPLMalloc( sizeof( CPLJoinableThread* ) * nThreads );
+        for( i = 0; i < nThreads; i++ )
+            pahThreads[i] = CPLCreateJoinableThread( ColorizeWorker, &sJob );
+        for( i = 0; i < nThreads; i++ )
+        {
+            if( pahThreads[i] )
+                CPLJoinThread( pahThreads[i] );
+            else
+                CPLAtomicInc( &sJob.nErrors );
+        }
+        CPLFree( pahThreads );
+    }
+    if( sJob.hMutex )
+        CPLDestroyMutex( sJob.hMutex );
+    if( sJob.nErrors > 0 )
+    {
+        CPLError( CE_Failure, CPLE_AppDefined,
+                  "Failed to colourize %s", GDALGetDescription( hSrcDS ) );
+        return CE_Failure;
+    }
+    if( psStrikes )
+    {
+        RLSortStrikes( psStrikes );
+        CPLDebug( "RL2KMZ", "%d strikes in %s", psStrikes->nCount,
+                  GDALGetDescription( hSrcDS ) );
+    }
+    if( panWindow )
+    {
+        memset( panWindow, 0, sizeof( int ) * 4 );
+        if( sJob.nMaxX >= 0 )
+        {
+            panWindow[0] = sJob.nMinX;
+            panWindow[1] = sJob.nMinY;
+            panWindow[2] = sJob.nMaxX - sJob.nMinX + 1;
+            panWindow[3] = sJob.nMaxY - sJob.nMinY + 1;
+        }
+        CPLDebug( "RL2KMZ", "Data window %d,%d %dx%d of %dx%d",
+                  panWindow[0], panWindow[1], panWindow[2], panWindow[3],
+                  sJob.nXSize, sJob.nYSize );
+    }
+    return CE_None;
+}
+
+/*
+** Fill one strip of the window, as Int32 values when classifying and as
+** nBands pixel interleaved bytes otherwise.
+*/
+typedef CPLErr (*RLStripReader)( void *pArg, int nXOff, int nYOff,
+                                 int nXSize, int nYSize, void *pBuffer );
+
+static CPLErr ReadBandStrip( void *pArg, int nXOff, int nYOff, int nXSize,
+                             int nYSize, void *pBuffer )
+{
+    GDALDatasetH hDS = (GDALDatasetH) pArg;
+    GDALRasterBandH hBand = GDALGetRasterBand( hDS, 1 );
+    int nBands;
+
+    if( GDALGetRasterDataType( hBand ) != GDT_Byte )
+        return GDALRasterIO( hBand, GF_Read, nXOff, nYOff, nXSize, nYSize,
+                             pBuffer, nXSize, nYSize, GDT_Int32, 0, 0 );
+    nBands = GDALGetRasterCount( hDS );
+    return GDALDatasetRasterIO( hDS, GF_Read, nXOff, nYOff, nXSize, nYSize,
+                                pBuffer, nXSize, nYSize, GDT_Byte, nBands,
+                                NULL, nBands, nBands * nXSize, 1 );
+}
+
+static CPLErr ReadGridStrip( void *pArg, int nXOff, int nYOff, int nXSize,
+                             int nYSize, void *pBuffer )
+{
+    return RLReadWarpedGrid( (RLWarpedGrid*) pArg, nXOff, nYOff, nXSize,
+                             nYSize, (GInt32*) pBuffer );
+}
+
+/*
+** Stream the window panWindow of a raster nXSize by nYSize (all of it when
+** panWindow is NULL) from pfnRead through the classifier and png writer.
+*/
+static CPLErr EncodeStrips( int nXSize, int nYSize, const int *panWindow,
+                            int nStripRows,
+                            int bClassify, const GInt32 *pnNoData,
+                            const RLColorTable *psTable, int bPalette,
+                            const RLPngOptions *psOptions,
+                            RLStripReader pfnRead, void *pReadArg,
+                            RLWriteFunc pfnWrite, void *pUserData )
+{
+    RLPngWriter *psPng;
+    GInt32 *panStrip = NULL;
+    GByte *pabyStrip;
+    int nBands, nRows, iLine, nXOff = 0, nYOff = 0;
+    CPLErr eErr = CE_None;
+
+    if( bPalette && psTable->nPaletteCount == 0 )
+    {
+        CPLError( CE_Failure, CPLE_AppDefined,
+                  "Colour table has too many colours for a palette" );
+        return CE_Failure;
+    }
+    if( panWindow )
+    {
+        if( panWindow[0] < 0 || panWindow[1] < 0 || panWindow[2] < 1 ||
+            panWindow[3] < 1 || panWindow[0] + panWindow[2] > nXSize ||
+            panWindow[1] + panWindow[3] > nYSize )
+        {
+            CPLError( CE_Failure, CPLE_IllegalArg,
+                      "Invalid png window %d,%d %dx%d", panWindow[0],
+                      panWindow[1], panWindow[2], panWindow[3] );
+            return CE_Failure;
+        }
+        nXOff = panWindow[0];
+        nYOff = panWindow[1];
+        nXSize = panWindow[2];
+        nYSize = panWindow[3];
+    }
+    nBands = bPalette ? 1 : 4;
+    nStripRows = MAX( 1, MIN( nStripRows, nYSize ) );
+
+    pabyStrip = (GByte*) VSIMalloc3( nBands, nXSize, nStripRows );
+    if( bClassify )
+        panStrip = (GInt32*) VSIMalloc3( sizeof( GInt32 ), nXSize,
+                                         nStripRows );
+    if( !pabyStrip || ( bClassify && !panStrip ) )
+    {
+        CPLError( CE_Failure, CPLE_OutOfMemory,
+                  "Could not allocate png strip buffers" );
+        VSIFree( pabyStrip );
+        VSIFree( panStrip );
+        return CE_Failure;
+    }
+
+    psPng = RLPngCreate( nXSize, nYSize, nBands, psTable->pabyPalette,
+                         psTable->nPaletteCount, psOptions, pfnWrite,
+                         pUserData );
+    if( !psPng )
+    {
+        VSIFree( pabyStrip );
+        VSIFree( panStrip );
+        return CE_Failure;
+    }
+    for( iLine = 0; iLine < nYSize && eErr == CE_None; iLine += nRows )
+    {
+        nRows = MIN( nStripRows, nYSize - iLine );
+        if( bClassify )
+        {
+            eErr = pfnRead( pReadArg, nXOff, nYOff + iLine, nXSize, nRows,
+                            panStrip );
+            if( eErr == CE_None )
+                ClassifyPixels( psTable, panStrip, pnNoData, pabyStrip,
+                                (size_t) nXSize * nRows, nBands, NULL,
+                                NULL );
+        }
+        else
+        {
+            eErr = pfnRead( pReadArg, nXOff, nYOff + iLine, nXSize, nRows,
+                            pabyStrip );
+        }
+        if( eErr == CE_None )
+            eErr = RLPngWriteRows( psPng, pabyStrip, nRows );
+    }
+    if( RLPngFinish( psPng ) != CE_None )
+        eErr = CE_Failure;
+    VSIFree( pabyStrip );
+    VSIFree( panStrip );
+    return eErr;
+}
+
+/*
+** Stream hDS into a png through pfnWrite, paletted with tRNS transparency
+** when bPalette is set and RGBA otherwise.  An Int32 band 1 is classified
+** a strip at a time on the way to the encoder.  A Byte dataset is taken as
+** already classified, one band of palette indices or four RGBA bands.
+** Strips follow the block height of band 1 so a warped VRT is warped one
+** row of blocks at a time.  panWindow, the x offset, y offset, width and
+** height of the part to encode, may be NULL for the whole dataset.
+** psOptions, the png filter and compression, may be NULL for the defaults.
+*/
+CPLErr RLEncodePng( GDALDatasetH hDS, const int *panWindow,
+                    const RLColorTable *psTable, int bPalette,
+                    const RLPngOptions *psOptions,
+                    RLWriteFunc pfnWrite, void *pUserData )
+{
+    GDALRasterBandH hBand;
+    GInt32 nNoData;
+    const GInt32 *pnNoData = NULL;
+    int bClassify, nBlockXSize, nBlockYSize;
+
+    hBand = GDALGetRasterBand( hDS, 1 );
+    bClassify = GDALGetRasterDataType( hBand ) != GDT_Byte;
+    if( !bClassify && GDALGetRasterCount( hDS ) != ( bPalette ? 1 : 4 ) )
+    {
+        CPLError( CE_Failure, CPLE_AppDefined,
+                  "Byte dataset band count does not match png format" );
+        return CE_Failure;
+    }
+    if( bClassify && RLGetNoDataInt32( hBand, &nNoData ) )
+        pnNoData = &nNoData;
+    GDALGetBlockSize( hBand, &nBlockXSize, &nBlockYSize );
+    return EncodeStrips( GDALGetRasterXSize( hDS ), GDALGetRasterYSize( hDS ),
+                         panWindow, nBlockYSize, bClassify, pnNoData,
+                         psTable, bPalette, psOptions, ReadBandStrip, hDS,
+                         pfnWrite, pUserData );
+}
+
+/*
+** Classify a warped grid and stream it to pfnWrite as a png, as
+** RLEncodePng does for an Int32 dataset.
+*/
+CPLErr RLEncodeWarpedGridPng( RLWarpedGrid *psGrid, const int *panWindow,
+                              const RLColorTable *psTable, int bPalette,
+                              const RLPngOptions *psOptions,
+                              RLWriteFunc pfnWrite, void *pUserData )
+{
+    GInt32 nNoData;
+    int nXSize, nYSize, nBlockYSize;
+
+    RLGetWarpedGridInfo( psGrid, &nXSize, &nYSize, &nBlockYSize, NULL,
+                         &nNoData );
+    return EncodeStrips( nXSize, nYSize, panWindow, nBlockYSize, TRUE,
+                         &nNoData, psTable, bPalette, psOptions, ReadGridStrip,
+                         psGrid, pfnWrite, pUserData );
+}
+
+/*
+** Stream the window panWindow of a warped grid into several pngs at once,
+** full resolution and reduced with RLReduceClasses(), so the grid is
+** warped and read only once.  Strips are a whole number of blocks of
+** every target.
+*/
+CPLErr RLEncodeWarpedGridPngs( RLWarpedGrid *psGrid, const int *panWindow,
+                               const RLColorTable *psTable, int bPalette,
+                               const RLPngOptions *psOptions,
+                               const RLPngTarget *pasTargets, int nTargets )
+{
+    RLPngWriter **papsPngs;
+    GInt32 *panStrip, *panReduced;
+    GByte *pabyStrip;
+    GInt32 nNoData;
+    int nXSize, nYSize, nBlockYSize, nStripRows, nBands, nFactor, nRows;
+    int nDstXSize, nDstRows, iLine, i, a, b;
+    CPLErr eErr = CE_None;
+
+    RLGetWarpedGridInfo( psGrid, &nXSize, &nYSize, &nBlockYSize, NULL,
+                         &nNoData );
+    if( bPalette && psTable->nPaletteCount == 0 )
+    {
+        CPLError( CE_Failure, CPLE_AppDefined,
+                  "Colour table has too many colours for a palette" );
+        return CE_Failure;
+    }
+    if( panWindow[0] < 0 || panWindow[1] < 0 || panWindow[2] < 1 ||
+        panWindow[3] < 1 || panWindow[0] + panWindow[2] > nXSize ||
+        panWindow[1] + panWindow[3] > nYSize )
+    {
+        CPLError( CE_Failure, CPLE_IllegalArg,
+                  "Invalid png window %d,%d %dx%d", panWindow[0],
+                  panWindow[1], panWindow[2], panWindow[3] );
+        return CE_Failure;
+    }
+    nXSize = panWindow[2];
+    nYSize = panWindow[3];
+    nBands = bPalette ? 1 : 4;
+
+    /* Least common multiple of the factors, then as many as a block */
+    nStripRows = 1;
+    for( i = 0; i < nTargets; i++ )
+    {
+        nFactor = MAX( 1, pasTargets[i].nFactor );
+        for( a = nStripRows, b = nFactor; b != 0; )
+        {
+            nRows = a % b;
+            a = b;
+            b = nRows;
+        }
+        nStripRows = nStripRows / a * nFactor;
+    }
+    nStripRows *= MAX( 1, nBlockYSize / nStripRows );
+    nStripRows = MIN( nStripRows, nYSize );
+
+    papsPngs = (RLPngWriter**) CPLCalloc( sizeof( RLPngWriter* ),
+                                          nTargets );
+    panStrip = (GInt32*) VSIMalloc3( sizeof( GInt32 ), nXSize, nStripRows );
+    panReduced = (GInt32*) VSIMalloc3( sizeof( GInt32 ), nXSize,
+                                       nStripRows );
+    pabyStrip = (GByte*) VSIMalloc3( nBands, nXSize, nStripRows );
+    if( !panStrip || !panReduced || !pabyStrip )
+    {
+        CPLError( CE_Failure, CPLE_OutOfMemory,
+                  "Could not allocate png strip buffers" );
+        eErr = CE_Failure;
+    }
+    for( i = 0; i < nTargets && eErr == CE_None; i++ )
+    {
+        nFactor = MAX( 1, pasTargets[i].nFactor );
+        papsPngs[i] = RLPngCreate( ( nXSize + nFactor - 1 ) / nFactor,
+                                   ( nYSize + nFactor - 1 ) / nFactor,
+                                   nBands, psTable->pabyPalette,
+                                   psTable->nPaletteCount, psOptions,
+                                   pasTargets[i].pfnWrite,
+                                   pasTargets[i].pUserData );
+        if( !papsPngs[i] )
+            eErr = CE_Failure;
+    }
+    for( iLine = 0; iLine < nYSize && eErr == CE_None; iLine += nRows )
+    {
+        nRows = MIN( nStripRows, nYSize - iLine );
+        eErr = RLReadWarpedGrid( psGrid, panWindow[0], panWindow[1] + iLine,
+                                 nXSize, nRows, panStrip );
+        for( i = 0; i < nTargets && eErr == CE_None; i++ )
+        {
+            nFactor = MAX( 1, pasTargets[i].nFactor );
+            nDstXSize = ( nXSize + nFactor - 1 ) / nFactor;
+            nDstRows = ( nRows + nFactor - 1 ) / nFactor;
+            if( nFactor == 1 )
+            {
+                ClassifyPixels( psTable, panStrip, &nNoData, pabyStrip,
+                                (size_t) nXSize * nRows, nBands, NULL,
+                                NULL );
+            }
+            else
+            {
+                RLReduceClasses( psTable, panStrip, nXSize, nRows, &nNoData,
+                                 nFactor, panReduced );
+                ClassifyPixels( psTable, panReduced, &nNoData, pabyStrip,
+                                (size_t) nDstXSize * nDstRows, nBands, NULL,
+                                NULL );
+            }
+            eErr = RLPngWriteRows( papsPngs[i], pabyStrip, nDstRows );
+        }
+    }
+    for( i = 0; i < nTargets; i++ )
+    {
+        if( papsPngs[i] && RLPngFinish( papsPngs[i] ) != CE_None )
+            eErr = CE_Failure;
+    }
+    CPLFree( papsPngs );
+    VSIFree( panStrip );
+    VSIFree( panReduced );
+    VSIFree( pabyStrip );
+    return eErr;
+}
+
+/*
+** Wrap a pixel interleaved buffer in a MEM dataset without copying it.  The
+** buffer must outlive the dataset.
+*/
+GDALDatasetH RLWrapBuffer( GByte *pabyData, int nXSize, int nYSize,
+                           int nBands, const double *padfGeoTransform,
+                           const char *pszWkt )
+{
+    GDALDatasetH hDS;
+    char **papszOptions = NULL;
+    char szPointer[64];
+    int nChars, i;
+
+    hDS = GDALCreate( GDALGetDriverByName( "MEM" ), "", nXSize, nYSize, 0,
+                      GDT_Byte, NULL );
+    if( !hDS )
+        return NULL;
+    for( i = 0; i < nBands; i++ )
+    {
+        nChars = CPLPrintPointer( szPointer, pabyData + i,
+                                  sizeof( szPointer ) );
+        szPointer[nChars] = '\0';
+        papszOptions = CSLSetNameValue( papszOptions, "DATAPOINTER",
+                                        szPointer );
+        papszOptions = CSLSetNameValue( papszOptions, "PIXELOFFSET",
+                                        CPLSPrintf( "%d", nBands ) );
+        papszOptions = CSLSetNameValue( papszOptions, "LINEOFFSET",
+                                        CPLSPrintf( "%d", nBands * nXSize ) );
+        if( GDALAddBand( hDS, GDT_Byte, papszOptions ) != CE_None )
+        {
+            CSLDestroy( papszOptions );
+            GDALClose( hDS );
+            return NULL;
+        }
+    }
+    CSLDestroy( papszOptions );
+    GDALSetGeoTransform( hDS, (double*) padfGeoTransform );
+    GDALSetProjection( hDS, pszWkt );
+    return hDS;
+}
+
+/*
+** Wrap a rain and lightning grid already in memory in an Int32 MEM dataset
+** without copying it, for RLProcessDataset().  pnNoData and pszWkt may be
+** NULL.  The buffer must outlive the dataset.
+*/
+GDALDatasetH RLWrapGrid( GInt32 *panData, int nXSize, int nYSize,
+                         const double *padfGeoTransform,
+                         const GInt32 *pnNoData, const char *pszWkt )
+{
+    GDALDatasetH hDS;
+    char **papszOptions = NULL;
+    char szPointer[64];
+    int nChars;
+
+    hDS = GDALCreate( GDALGetDriverByName( "MEM" ), "", nXSize, nYSize, 0,
+                      GDT_Int32, NULL );
+    if( !hDS )
+        return NULL;
+    nChars = CPLPrintPointer( szPointer, panData, sizeof( szPointer ) );
+    szPointer[nChars] = '\0';
+    papszOptions = CSLSetNameValue( papszOptions, "DATAPOINTER", szPointer );
+    if( GDALAddBand( hDS, GDT_Int32, papszOptions ) != CE_None )
+    {
+        CSLDestroy( papszOptions );
+        GDALClose( hDS );
+        return NULL;
+    }
+    CSLDestroy( papszOptions );
+    GDALSetGeoTransform( hDS, (double*) padfGeoTransform );
+    if( pnNoData )
+        GDALSetRasterNoDataValue( GDALGetRasterBand( hDS, 1 ), *pnNoData );
+    if( pszWkt )
+        GDALSetProjection( hDS, pszWkt );
+    return hDS;
+}
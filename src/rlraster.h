@@ -0,0 +1,106 @@
+/******************************************************************************
+*
+*  Project:  rl2kmz
+*  Purpose:  colourize the source grid
+*  Author:   Kyle Shannon <kyle at pobox dot com>
+*
+*******************************************************************************
+*
+* This is free and unencumbered software released into the public domain.
+*
+* Anyone is free to copy, modify, publish, use, compile, sell, or
+* distribute this software, either in source code form or as a compiled
+* binary, for any purpose, commercial or non-commercial, and by any
+* means.
+*
+* In jurisdictions that recognize copyright laws, the author or authors
+* of this software dedicate any and all copyright interest in the
+* software to the public domain. We make this dedication for the benefit
+* of the public at large and to the detriment of our heirs and
+* successors. We intend this dedication to be an overt act of
+* relinquishment in perpetuity of all present and future rights to this
+* software under copyright law.
+*
+* THIS SOFTWARE WAS DEVELOPED AT THE ROCKY MOUNTAIN RESEARCH STATION (RMRS)
+* MISSOULA FIRE SCIENCES LABORATORY BY EMPLOYEES OF THE FEDERAL GOVERNMENT
+* IN THE COURSE OF THEIR OFFICIAL DUTIES. PURSUANT TO TITLE 17 SECTION 105
+* OF THE UNITED STATES CODE, THIS SOFTWARE IS NOT SUBJECT TO COPYRIGHT
+* PROTECTION AND IS IN THE PUBLIC DOMAIN. RMRS MISSOULA FIRE SCIENCES
+* LABORATORY ASSUMES NO RESPONSIBILITY WHATSOEVER FOR ITS USE BY OTHER
+* PARTIES,  AND MAKES NO GUARANTEES, EXPRESSED OR IMPLIED, ABOUT ITS QUALITY,
+* RELIABILITY, OR ANY OTHER CHARACTERISTIC.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+* IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+* OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+* ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+* OTHER DEALINGS IN THE SOFTWARE.
+*
+* For more information, please refer to <http://unlicense.org>
+*
+******************************************************************************/
+
+#ifndef RLRASTER_H_
+#define RLRASTER_H_
+
+#include "gdal.h"
+
+#include "rlport.h"
+#include "rlcolor.h"
+#include "rlpng.h"
+#include "rlstrike.h"
+#include "rlutil.h"
+#include "rlwarp.h"
+
+CPL_C_START
+
+/*
+** Work units smaller than this many pixels are grown by whole blocks so
+** tiny or scanline blocks don't swamp the workers with tiny reads.
+*/
+#ifndef RL_MIN_CHUNK_PIXELS
+#define RL_MIN_CHUNK_PIXELS 65536
+#endif
+
+/*
+** One png of RLEncodeWarpedGridPngs(), each nFactor by nFactor block of
+** the window reduced to a pixel.
+*/
+typedef struct
+{
+    int nFactor;
+    RLWriteFunc pfnWrite;
+    void *pUserData;
+} RLPngTarget;
+
+CPLErr RLColorizeDataset( GDALDatasetH hSrcDS, const RLColorTable *psTable,
+                          int nThreads, int nBands, GByte *pabyDst,
+                          int *panWindow, RLStrikeIndex *psStrikes );
+
+CPLErr RLEncodePng( GDALDatasetH hDS, const int *panWindow,
+                    const RLColorTable *psTable, int bPalette,
+                    const RLPngOptions *psOptions,
+                    RLWriteFunc pfnWrite, void *pUserData );
+
+CPLErr RLEncodeWarpedGridPng( RLWarpedGrid *psGrid, const int *panWindow,
+                              const RLColorTable *psTable, int bPalette,
+                              const RLPngOptions *psOptions,
+                              RLWriteFunc pfnWrite, void *pUserData );
+CPLErr RLEncodeWarpedGridPngs( RLWarpedGrid *psGrid, const int *panWindow,
+                               const RLColorTable *psTable, int bPalette,
+                               const RLPngOptions *psOptions,
+                               const RLPngTarget *pasTargets,
+                               int nTargets );
+
+GDALDatasetH RLWrapBuffer( GByte *pabyData, int nXSize, int nYSize,
+                           int nBands, const double *padfGeoTransform,
+                           const char *pszWkt );
+GDALDatasetH RLWrapGrid( GInt32 *panData, int nXSize, int nYSize,
+                         const double *padfGeoTransform,
+                         const GInt32 *pnNoData, const char *pszWkt );
+
+CPL_C_END
+
+#endif /* RLRASTER_H_ */
@@ -0,0 +1,344 @@
+/******************************************************************************
+*
+*  Project:  rl2kmz
+*  Purpose:  sparse lightning strike index and its point layer
+*  Author:   Kyle Shannon <kyle at pobox dot com>
+*
+*******************************************************************************
+*
+* This is free and unencumbered software released into the public domain.
+*
+* Anyone is free to copy, modify, publish, use, compile, sell, or
+* distribute this software, either in source code form or as a compiled
+* binary, for any purpose, commercial or non-commercial, and by any
+* means.
+*
+* In jurisdictions that recognize copyright laws, the author or authors
+* of this software dedicate any and all copyright interest in the
+* software to the public domain. We make this dedication for the benefit
+* of the public at large and to the detriment of our heirs and
+* successors. We intend this dedication to be an overt act of
+* relinquishment in perpetuity of all present and future rights to this
+* software under copyright law.
+*
+* THIS SOFTWARE WAS DEVELOPED AT THE ROCKY MOUNTAIN RESEARCH STATION (RMRS)
+* MISSOULA FIRE SCIENCES LABORATORY BY EMPLOYEES OF THE FEDERAL GOVERNMENT
+* IN THE COURSE OF THEIR OFFICIAL DUTIES. PURSUANT TO TITLE 17 SECTION 105
+* OF THE UNITED STATES CODE, THIS SOFTWARE IS NOT SUBJECT TO COPYRIGHT
+* PROTECTION AND IS IN THE PUBLIC DOMAIN. RMRS MISSOULA FIRE SCIENCES
+* LABORATORY ASSUMES NO RESPONSIBILITY WHATSOEVER FOR ITS USE BY OTHER
+* PARTIES,  AND MAKES NO GUARANTEES, EXPRESSED OR IMPLIED, ABOUT ITS QUALITY,
+* RELIABILITY, OR ANY OTHER CHARACTERISTIC.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+* IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+* OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+* ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+* OTHER DEALINGS IN THE SOFTWARE.
+*
+* For more information, please refer to <http://unlicense.org>
+*
+******************************************************************************/
+
+#include "cpl_conv.h"
+#include "cpl_string.h"
+#include "gdal_alg.h"
+
+#include "rlkml.h"
+#include "rlstrike.h"
+
+/*
+** Clustering key of one strike, the grid cell and class it falls in.
+*/
+typedef struct
+{
+    GUIntBig nKey;
+    int iStrike;
+} RLStrikeKey;
+
+/*
+** Append a strike.  Returns RL_ERR if the list can't grow.
+*/
+int RLAddStrike( RLStrikeIndex *psIndex, int nX, int nY, int iClass )
+{
+    RLStrike *pasStrikes;
+    RLStrike *psStrike;
+    int nAlloc;
+
+    if( psIndex->nCount == psIndex->nAlloc )
+    {
+        nAlloc = MAX( 64, psIndex->nAlloc * 2 );
+        pasStrikes = (RLStrike*) VSIRealloc( psIndex->pasStrikes,
+                                             sizeof( RLStrike ) * nAlloc );
+        if( !pasStrikes )
+        {
+            CPLError( CE_Failure, CPLE_OutOfMemory,
+                      "Could not grow the strike index" );
+            return RL_ERR;
+        }
+        psIndex->pasStrikes = pasStrikes;
+        psIndex->nAlloc = nAlloc;
+    }
+    psStrike = psIndex->pasStrikes + psIndex->nCount++;
+    psStrike->nX = nX;
+    psStrike->nY = nY;
+    psStrike->iClass = iClass;
+    psStrike->dfLon = 0.0;
+    psStrike->dfLat = 0.0;
+    return RL_OK;
+}
+
+/*
+** Append every strike of psSrc to psDst.
+*/
+int RLAppendStrikes( RLStrikeIndex *psDst, const RLStrikeIndex *psSrc )
+{
+    const RLStrike *psStrike;
+    int i;
+
+    for( i = 0; i < psSrc->nCount; i++ )
+    {
+        psStrike = psSrc->pasStrikes + i;
+        if( RLAddStrike( psDst, psStrike->nX, psStrike->nY,
+                         psStrike->iClass ) != RL_OK )
+            return RL_ERR;
+        psDst->pasStrikes[psDst->nCount - 1].dfLon = psStrike->dfLon;
+        psDst->pasStrikes[psDst->nCount - 1].dfLat = psStrike->dfLat;
+    }
+    return RL_OK;
+}
+
+static int CompareStrikes( const void *a, const void *b )
+{
+    const RLStrike *psA = (const RLStrike*) a;
+    const RLStrike *psB = (const RLStrike*) b;
+
+    if( psA->nY != psB->nY )
+        return psA->nY < psB->nY ? -1 : 1;
+    if( psA->nX != psB->nX )
+        return psA->nX < psB->nX ? -1 : 1;
+    return 0;
+}
+
+/*
+** Put the strikes in row, then column order, whatever order the workers
+** found them in.
+*/
+void RLSortStrikes( RLStrikeIndex *psIndex )
+{
+    if( psIndex->nCount > 1 )
+        qsort( psIndex->pasStrikes, psIndex->nCount, sizeof( RLStrike ),
+               CompareStrikes );
+}
+
+void RLClearStrikeIndex( RLStrikeIndex *psIndex )
+{
+    VSIFree( psIndex->pasStrikes );
+    memset( psIndex, 0, sizeof( RLStrikeIndex ) );
+}
+
+/*
+** Place each strike at the centre of its cell of hSrcDS in pszDstWkt,
+** which should be geographic.  Strikes that don't transform are dropped.
+*/
+CPLErr RLGeoreferenceStrikes( RLStrikeIndex *psIndex, GDALDatasetH hSrcDS,
+                              const char *pszSrcWkt,
+                              const char *pszDstWkt )
+{
+    void *hTransformArg;
+    double *padfX, *padfY, *padfZ;
+    int *pabSuccess;
+    int i, nKept;
+
+    if( psIndex->nCount == 0 )
+        return CE_None;
+    hTransformArg = GDALCreateGenImgProjTransformer( hSrcDS, pszSrcWkt, NULL,
+                                                     pszDstWkt, FALSE, 0.0,
+                                                     0 );
+    if( !hTransformArg )
+        return CE_Failure;
+    padfX = (double*) VSIMalloc2( sizeof( double ), psIndex->nCount );
+    padfY = (double*) VSIMalloc2( sizeof( double ), psIndex->nCount );
+    padfZ = (double*) VSICalloc( sizeof( double ), psIndex->nCount );
+    pabSuccess = (int*) VSIMalloc2( sizeof( int ), psIndex->nCount );
+    if( !padfX || !padfY || !padfZ || !pabSuccess )
+    {
+        CPLError( CE_Failure, CPLE_OutOfMemory,
+                  "Could not allocate %d strike points", psIndex->nCount );
+        VSIFree( padfX );
+        VSIFree( padfY );
+        VSIFree( padfZ );
+        VSIFree( pabSuccess );
+        GDALDestroyGenImgProjTransformer( hTransformArg );
+        return CE_Failure;
+    }
+    for( i = 0; i < psIndex->nCount; i++ )
+    {
+        padfX[i] = psIndex->pasStrikes[i].nX + 0.5;
+        padfY[i] = psIndex->pasStrikes[i].nY + 0.5;
+    }
+    GDALGenImgProjTransform( hTransformArg, FALSE, psIndex->nCount, padfX,
+                             padfY, padfZ, pabSuccess );
+    nKept = 0;
+    for( i = 0; i < psIndex->nCount; i++ )
+    {
+        if( !pabSuccess[i] )
+            continue;
+        psIndex->pasStrikes[nKept] = psIndex->pasStrikes[i];
+        psIndex->pasStrikes[nKept].dfLon = padfX[i];
+        psIndex->pasStrikes[nKept].dfLat = padfY[i];
+        nKept++;
+    }
+    if( nKept < psIndex->nCount )
+        CPLDebug( "RL2KMZ", "Dropped %d strikes that didn't transform",
+                  psIndex->nCount - nKept );
+    psIndex->nCount = nKept;
+    VSIFree( padfX );
+    VSIFree( padfY );
+    VSIFree( padfZ );
+    VSIFree( pabSuccess );
+    GDALDestroyGenImgProjTransformer( hTransformArg );
+    return CE_None;
+}
+
+static int CompareStrikeKeys( const void *a, const void *b )
+{
+    const RLStrikeKey *psA = (const RLStrikeKey*) a;
+    const RLStrikeKey *psB = (const RLStrikeKey*) b;
+
+    if( psA->nKey != psB->nKey )
+        return psA->nKey < psB->nKey ? -1 : 1;
+    return psA->iStrike - psB->iStrike;
+}
+
+/*
+** Write one clustered level, a placemark at the mean position of the
+** strikes of each class in each of nCells by nCells cells over padfBox,
+** named by their count.  pasKeys is scratch of one key per strike.
+*/
+static void WriteClusters( const RLStrikeIndex *psIndex, int nClassCount,
+                           const double *padfBox, int nCells,
+                           RLStrikeKey *pasKeys, RLBuffer *psKml )
+{
+    const RLStrike *psStrike;
+    char szName[32], szStyle[32];
+    double dfCellX, dfCellY, dfLon, dfLat;
+    int i, j, nX, nY;
+
+    dfCellX = ( padfBox[2] - padfBox[3] ) / nCells;
+    dfCellY = ( padfBox[0] - padfBox[1] ) / nCells;
+    for( i = 0; i < psIndex->nCount; i++ )
+    {
+        psStrike = psIndex->pasStrikes + i;
+        nX = dfCellX > 0.0 ?
+             (int) ( ( psStrike->dfLon - padfBox[3] ) / dfCellX ) : 0;
+        nY = dfCellY > 0.0 ?
+             (int) ( ( padfBox[0] - psStrike->dfLat ) / dfCellY ) : 0;
+        nX = MAX( 0, MIN( nX, nCells - 1 ) );
+        nY = MAX( 0, MIN( nY, nCells - 1 ) );
+        pasKeys[i].nKey = ( (GUIntBig) nY * nCells + nX ) * nClassCount +
+                          psStrike->iClass;
+        pasKeys[i].iStrike = i;
+    }
+    qsort( pasKeys, psIndex->nCount, sizeof( RLStrikeKey ),
+           CompareStrikeKeys );
+
+    for( i = 0; i < psIndex->nCount; i = j )
+    {
+        dfLon = 0.0;
+        dfLat = 0.0;
+        for( j = i; j < psIndex->nCount && pasKeys[j].nKey == pasKeys[i].nKey;
+             j++ )
+        {
+            dfLon += psIndex->pasStrikes[pasKeys[j].iStrike].dfLon;
+            dfLat += psIndex->pasStrikes[pasKeys[j].iStrike].dfLat;
+        }
+        psStrike = psIndex->pasStrikes + pasKeys[i].iStrike;
+        snprintf( szName, sizeof( szName ), "%d", j - i );
+        snprintf( szStyle, sizeof( szStyle ), j - i > 1 ?
+                  "strike_%d_group" : "strike_%d", psStrike->iClass );
+        RLKmlWritePoint( psKml, j - i > 1 ? szName : NULL, szStyle,
+                         dfLon / ( j - i ), dfLat / ( j - i ) );
+    }
+}
+
+/*
+** Write the georeferenced strikes as a kml document of point placemarks
+** styled by class, pabyColors holding the RGBA colour of each class of
+** psTable.  Above RL_STRIKE_CLUSTER_MIN strikes they are shown as
+** nLevels grid clustered levels under regions as the view zooms in, the
+** single strikes last.  The regions cover padfBox and the strikes.
+*/
+void RLWriteStrikeKml( const RLStrikeIndex *psIndex,
+                       const RLColorTable *psTable, const GByte *pabyColors,
+                       const double *padfBox, int nLevels, RLBuffer *psKml )
+{
+    const RLStrike *psStrike;
+    RLStrikeKey *pasKeys = NULL;
+    char szStyle[32];
+    double adfBox[4];
+    int i, iLevel;
+
+    memcpy( adfBox, padfBox, sizeof( adfBox ) );
+    for( i = 0; i < psIndex->nCount; i++ )
+    {
+        psStrike = psIndex->pasStrikes + i;
+        adfBox[0] = MAX( adfBox[0], psStrike->dfLat );
+        adfBox[1] = MIN( adfBox[1], psStrike->dfLat );
+        adfBox[2] = MAX( adfBox[2], psStrike->dfLon );
+        adfBox[3] = MIN( adfBox[3], psStrike->dfLon );
+    }
+    if( psIndex->nCount < RL_STRIKE_CLUSTER_MIN )
+        nLevels = 0;
+    if( nLevels > 0 )
+    {
+        pasKeys = (RLStrikeKey*) VSIMalloc2( sizeof( RLStrikeKey ),
+                                             psIndex->nCount );
+        if( !pasKeys )
+        {
+            CPLDebug( "RL2KMZ", "No memory to cluster %d strikes",
+                      psIndex->nCount );
+            nLevels = 0;
+        }
+    }
+
+    RLKmlBeginDocument( psKml, "strikes" );
+    for( i = 0; i < psTable->nClassCount; i++ )
+    {
+        if( !psTable->pasClasses[i].bKeep )
+            continue;
+        snprintf( szStyle, sizeof( szStyle ), "strike_%d", i );
+        RLKmlWriteIconStyle( psKml, szStyle, RL_STRIKE_ICON,
+                             pabyColors + i * 4, 0.5, 0.0 );
+        snprintf( szStyle, sizeof( szStyle ), "strike_%d_group", i );
+        RLKmlWriteIconStyle( psKml, szStyle, RL_STRIKE_ICON,
+                             pabyColors + i * 4, 1.0, 0.8 );
+    }
+    for( iLevel = 0; iLevel < nLevels; iLevel++ )
+    {
+        RLKmlBeginFolder( psKml, CPLSPrintf( "level %d", iLevel ) );
+        RLKmlWriteRegion( psKml, adfBox,
+                          iLevel == 0 ? 0 : RL_STRIKE_LOD << ( iLevel - 1 ),
+                          RL_STRIKE_LOD << iLevel );
+        WriteClusters( psIndex, psTable->nClassCount, adfBox,
+                       RL_STRIKE_CLUSTER_CELLS << iLevel, pasKeys, psKml );
+        RLKmlEndFolder( psKml );
+    }
+    RLKmlBeginFolder( psKml, "strikes" );
+    if( nLevels > 0 )
+        RLKmlWriteRegion( psKml, adfBox, RL_STRIKE_LOD << ( nLevels - 1 ),
+                          -1 );
+    for( i = 0; i < psIndex->nCount; i++ )
+    {
+        psStrike = psIndex->pasStrikes + i;
+        snprintf( szStyle, sizeof( szStyle ), "strike_%d",
+                  psStrike->iClass );
+        RLKmlWritePoint( psKml, NULL, szStyle, psStrike->dfLon,
+                         psStrike->dfLat );
+    }
+    RLKmlEndFolder( psKml );
+    RLKmlEndDocument( psKml );
+    VSIFree( pasKeys );
+}
@@ -0,0 +1,136 @@
+/******************************************************************************
+*
+*  Project:  rl2kmz
+*  Purpose:  sparse lightning strike index and its point layer
+*  Author:   Kyle Shannon <kyle at pobox dot com>
+*
+*******************************************************************************
+*
+* This is free and unencumbered software released into the public domain.
+*
+* Anyone is free to copy, modify, publish, use, compile, sell, or
+* distribute this software, either in source code form or as a compiled
+* binary, for any purpose, commercial or non-commercial, and by any
+* means.
+*
+* In jurisdictions that recognize copyright laws, the author or authors
+* of this software dedicate any and all copyright interest in the
+* software to the public domain. We make this dedication for the benefit
+* of the public at large and to the detriment of our heirs and
+* successors. We intend this dedication to be an overt act of
+* relinquishment in perpetuity of all present and future rights to this
+* software under copyright law.
+*
+* THIS SOFTWARE WAS DEVELOPED AT THE ROCKY MOUNTAIN RESEARCH STATION (RMRS)
+* MISSOULA FIRE SCIENCES LABORATORY BY EMPLOYEES OF THE FEDERAL GOVERNMENT
+* IN THE COURSE OF THEIR OFFICIAL DUTIES. PURSUANT TO TITLE 17 SECTION 105
+* OF THE UNITED STATES CODE, THIS SOFTWARE IS NOT SUBJECT TO COPYRIGHT
+* PROTECTION AND IS IN THE PUBLIC DOMAIN. RMRS MISSOULA FIRE SCIENCES
+* LABORATORY ASSUMES NO RESPONSIBILITY WHATSOEVER FOR ITS USE BY OTHER
+* PARTIES,  AND MAKES NO GUARANTEES, EXPRESSED OR IMPLIED, ABOUT ITS QUALITY,
+* RELIABILITY, OR ANY OTHER CHARACTERISTIC.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+* IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+* OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+* ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+* OTHER DEALINGS IN THE SOFTWARE.
+*
+* For more information, please refer to <http://unlicense.org>
+*
+******************************************************************************/
+
+#ifndef RLSTRIKE_H_
+#define RLSTRIKE_H_
+
+#include "gdal.h"
+
+#include "rlport.h"
+#include "rlcolor.h"
+#include "rlutil.h"
+
+CPL_C_START
+
+/*
+** Entry of the strike point layer in the kmz.
+*/
+#define RL_STRIKE_KML "strikes.kml"
+
+/*
+** Icon of the strike placemarks, tinted with the colour of their class.
+*/
+#ifndef RL_STRIKE_ICON
+#define RL_STRIKE_ICON \
+    "http://maps.google.com/mapfiles/kml/shapes/shaded_dot.png"
+#endif
+
+/*
+** Default number of clustered levels above the single strikes.
+*/
+#ifndef RL_STRIKE_LEVELS
+#define RL_STRIKE_LEVELS 3
+#endif
+
+/*
+** Cells across the clustering grid of the coarsest level, each finer
+** level doubles them.
+*/
+#ifndef RL_STRIKE_CLUSTER_CELLS
+#define RL_STRIKE_CLUSTER_CELLS 16
+#endif
+
+/*
+** Screen size in pixels of the strike box where the coarsest level hands
+** over to the next, each finer level doubles it.
+*/
+#ifndef RL_STRIKE_LOD
+#define RL_STRIKE_LOD 512
+#endif
+
+/*
+** No clustering below this many strikes, they are all drawn.
+*/
+#ifndef RL_STRIKE_CLUSTER_MIN
+#define RL_STRIKE_CLUSTER_MIN 200
+#endif
+
+/*
+** A grid cell of a class marked keep, a lightning strike.  dfLon and
+** dfLat are filled in by RLGeoreferenceStrikes().
+*/
+typedef struct
+{
+    int nX;
+    int nY;
+    int iClass;
+    double dfLon;
+    double dfLat;
+} RLStrike;
+
+/*
+** Growable list of strikes, zero initialized when empty.
+*/
+typedef struct
+{
+    int nCount;
+    int nAlloc;
+    RLStrike *pasStrikes;
+} RLStrikeIndex;
+
+int RLAddStrike( RLStrikeIndex *psIndex, int nX, int nY, int iClass );
+int RLAppendStrikes( RLStrikeIndex *psDst, const RLStrikeIndex *psSrc );
+void RLSortStrikes( RLStrikeIndex *psIndex );
+void RLClearStrikeIndex( RLStrikeIndex *psIndex );
+
+CPLErr RLGeoreferenceStrikes( RLStrikeIndex *psIndex, GDALDatasetH hSrcDS,
+                              const char *pszSrcWkt,
+                              const char *pszDstWkt );
+void RLWriteStrikeKml( const RLStrikeIndex *psIndex,
+                       const RLColorTable *psTable, const GByte *pabyColors,
+                       const double *padfBox, int nLevels, RLBuffer *psKml );
+
+CPL_C_END
+
+#endif /* RLSTRIKE_H_ */
@@ -0,0 +1,441 @@
+/******************************************************************************
+*
+*  Project:  rl2kmz
+*  Purpose:  regionated super-overlay tile pyramid
+*  Author:   Kyle Shannon <kyle at pobox dot com>
+*
+*******************************************************************************
+*
+* This is free and unencumbered software released into the public domain.
+*
+* Anyone is free to copy, modify, publish, use, compile, sell, or
+* distribute this software, either in source code form or as a compiled
+* binary, for any purpose, commercial or non-commercial, and by any
+* means.
+*
+* In jurisdictions that recognize copyright laws, the author or authors
+* of this software dedicate any and all copyright interest in the
+* software to the public domain. We make this dedication for the benefit
+* of the public at large and to the detriment of our heirs and
+* successors. We intend this dedication to be an overt act of
+* relinquishment in perpetuity of all present and future rights to this
+* software under copyright law.
+*
+* THIS SOFTWARE WAS DEVELOPED AT THE ROCKY MOUNTAIN RESEARCH STATION (RMRS)
+* MISSOULA FIRE SCIENCES LABORATORY BY EMPLOYEES OF THE FEDERAL GOVERNMENT
+* IN THE COURSE OF THEIR OFFICIAL DUTIES. PURSUANT TO TITLE 17 SECTION 105
+* OF THE UNITED STATES CODE, THIS SOFTWARE IS NOT SUBJECT TO COPYRIGHT
+* PROTECTION AND IS IN THE PUBLIC DOMAIN. RMRS MISSOULA FIRE SCIENCES
+* LABORATORY ASSUMES NO RESPONSIBILITY WHATSOEVER FOR ITS USE BY OTHER
+* PARTIES,  AND MAKES NO GUARANTEES, EXPRESSED OR IMPLIED, ABOUT ITS QUALITY,
+* RELIABILITY, OR ANY OTHER CHARACTERISTIC.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+* IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+* OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+* ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+* OTHER DEALINGS IN THE SOFTWARE.
+*
+* For more information, please refer to <http://unlicense.org>
+*
+******************************************************************************/
+
+#include "cpl_atomic_ops.h"
+#include "cpl_conv.h"
+#include "cpl_multiproc.h"
+#include "cpl_string.h"
+
+#include "rlkml.h"
+#include "rlpng.h"
+#include "rltile.h"
+#include "rlutil.h"
+
+typedef struct
+{
+    RLWarpedGrid *psGrid;
+    const RLColorTable *psTable;
+    int bPalette;
+    int nBands;
+    /* Tiles are encoded on one thread each */
+    RLPngOptions sPngOptions;
+    int nTileSize;
+    int anWindow[4];
+    double adfGeoTransform[6];
+    GInt32 nNoData;
+    RLKmzWriter *psKmz;
+    char *pszDir;
+    int nMaxLevel;
+    int *panTilesX;
+    int *panTilesY;
+    /* Per level flags, set for tiles with any data at full resolution */
+    GByte **papabyHasData;
+    /* The level being rendered */
+    int nLevel;
+    volatile int nNextTile;
+    volatile int nErrors;
+    /* Held while writing, the archive takes one entry at a time */
+    CPLMutex *hWriteMutex;
+} RLTileJob;
+
+/*
+** Pixel window, in the warped grid, and sample step of a tile.
+*/
+static void TileExtent( const RLTileJob *psJob, int nLevel, int nTileX,
+                        int nTileY, int *pnXOff, int *pnYOff, int *pnXSize,
+                        int *pnYSize, int *pnStep )
+{
+    int nStep, nSpan;
+
+    nStep = 1 << ( psJob->nMaxLevel - nLevel );
+    nSpan = psJob->nTileSize * nStep;
+    *pnXOff = psJob->anWindow[0] + nTileX * nSpan;
+    *pnYOff = psJob->anWindow[1] + nTileY * nSpan;
+    *pnXSize = ( MIN( nSpan, psJob->anWindow[2] - nTileX * nSpan ) +
+                 nStep - 1 ) / nStep;
+    *pnYSize = ( MIN( nSpan, psJob->anWindow[3] - nTileY * nSpan ) +
+                 nStep - 1 ) / nStep;
+    *pnStep = nStep;
+}
+
+/*
+** North, south, east and west edges of a tile.
+*/
+static void TileBounds( const RLTileJob *psJob, int nLevel, int nTileX,
+                        int nTileY, double *padfBox )
+{
+    const double *padfGT = psJob->adfGeoTransform;
+    int nXOff, nYOff, nXSize, nYSize, nStep;
+
+    TileExtent( psJob, nLevel, nTileX, nTileY, &nXOff, &nYOff, &nXSize,
+                &nYSize, &nStep );
+    padfBox[0] = padfGT[3] + padfGT[5] * nYOff;
+    padfBox[1] = padfGT[3] + padfGT[5] * ( nYOff + nYSize * nStep );
+    padfBox[2] = padfGT[0] + padfGT[1] * ( nXOff + nXSize * nStep );
+    padfBox[3] = padfGT[0] + padfGT[1] * nXOff;
+}
+
+/*
+** Write the kml of a tile: its region, its ground overlay if it has one,
+** and a network link to every child tile that has data.  Tiles fade out
+** once they're drawn at twice their size, where their children take over,
+** except at the finest level.
+*/
+static int WriteTileKml( RLTileJob *psJob, int nLevel, int nTileX,
+                         int nTileY, int bOverlay )
+{
+    RLBuffer sKml;
+    double adfBox[4];
+    int nChildX, nChildY, nMinLod, nMaxLod, iChild;
+    CPLErr eErr;
+
+    memset( &sKml, 0, sizeof( sKml ) );
+    nMinLod = nLevel == 0 ? 0 : psJob->nTileSize / 2;
+    nMaxLod = nLevel == psJob->nMaxLevel ? -1 : psJob->nTileSize * 2;
+    TileBounds( psJob, nLevel, nTileX, nTileY, adfBox );
+
+    RLKmlBeginDocument( &sKml, CPLSPrintf( "%d/%d/%d", nLevel, nTileX,
+                                           nTileY ) );
+    RLKmlWriteRegion( &sKml, adfBox, nMinLod, nMaxLod );
+    if( bOverlay )
+        RLKmlWriteGroundOverlay( &sKml, NULL, CPLSPrintf( "%d.png", nTileY ),
+                                 nLevel, adfBox );
+    for( iChild = 0; nLevel < psJob->nMaxLevel && iChild < 4; iChild++ )
+    {
+        nChildX = nTileX * 2 + iChild % 2;
+        nChildY = nTileY * 2 + iChild / 2;
+        if( nChildX >= psJob->panTilesX[nLevel + 1] ||
+            nChildY >= psJob->panTilesY[nLevel + 1] ||
+            !psJob->papabyHasData[nLevel + 1][nChildY *
+                                              psJob->panTilesX[nLevel + 1] +
+                                              nChildX] )
+        {
+            continue;
+        }
+        TileBounds( psJob, nLevel + 1, nChildX, nChildY, adfBox );
+        RLKmlWriteNetworkLink( &sKml,
+                               CPLSPrintf( "%d/%d/%d", nLevel + 1, nChildX,
+                                           nChildY ),
+                               CPLSPrintf( "../../%d/%d/%d.kml", nLevel + 1,
+                                           nChildX, nChildY ),
+                               adfBox, psJob->nTileSize / 2, -1 );
+    }
+    RLKmlEndDocument( &sKml );
+
+    eErr = RLKmzAddFile( psJob->psKmz,
+                         CPLSPrintf( "%s/%d/%d/%d.kml", psJob->pszDir,
+                                     nLevel, nTileX, nTileY ),
+                         sKml.pabyData, sKml.nSize, TRUE );
+    RLBufferFree( &sKml );
+    return eErr == CE_None ? RL_OK : RL_ERR;
+}
+
+/*
+** Tiles are already deflated, store them.
+*/
+static int WriteTilePng( RLTileJob *psJob, int nLevel, int nTileX,
+                         int nTileY, const RLBuffer *psPng )
+{
+    if( RLKmzAddFile( psJob->psKmz,
+                      CPLSPrintf( "%s/%d/%d/%d.png", psJob->pszDir, nLevel,
+                                  nTileX, nTileY ),
+                      psPng->pabyData, psPng->nSize, FALSE ) != CE_None )
+    {
+        return RL_ERR;
+    }
+    return RL_OK;
+}
+
+/*
+** Sample, classify and encode one tile into psPng.  *pbHasData is set if
+** any pixel of the tile isn't transparent.
+*/
+static CPLErr RenderTile( RLTileJob *psJob, int nLevel, int nTileX,
+                          int nTileY, GInt32 *panData, GByte *pabyTile,
+                          RLBuffer *psPng, int *pbHasData )
+{
+    RLPngWriter *psPngWriter;
+    size_t nCount, nFirst, nLast;
+    int nXOff, nYOff, nXSize, nYSize, nStep;
+    CPLErr eErr;
+
+    TileExtent( psJob, nLevel, nTileX, nTileY, &nXOff, &nYOff, &nXSize,
+                &nYSize, &nStep );
+    eErr = RLReadWarpedGridSampled( psJob->psGrid, nXOff, nYOff, nXSize,
+                                    nYSize, nStep, panData );
+    if( eErr != CE_None )
+        return eErr;
+
+    nCount = (size_t) nXSize * nYSize;
+    if( psJob->bPalette )
+        *pbHasData = RLClassifyInt32ToIndex( psJob->psTable, panData,
+                                             &psJob->nNoData, pabyTile,
+                                             nCount, &nFirst, &nLast );
+    else
+        *pbHasData = RLClassifyInt32( psJob->psTable, panData,
+                                      &psJob->nNoData, pabyTile, nCount,
+                                      &nFirst, &nLast );
+    if( !*pbHasData )
+        return CE_None;
+
+    psPng->nSize = 0;
+    psPngWriter = RLPngCreate( nXSize, nYSize, psJob->nBands,
+                               psJob->psTable->pabyPalette,
+                               psJob->psTable->nPaletteCount,
+                               &psJob->sPngOptions, RLBufferWrite, psPng );
+    if( !psPngWriter )
+        return CE_Failure;
+    eErr = RLPngWriteRows( psPngWriter, pabyTile, nYSize );
+    if( RLPngFinish( psPngWriter ) != CE_None )
+        eErr = CE_Failure;
+    return eErr;
+}
+
+/*
+** Render the tiles of the current level.  Tiles are pulled off the job
+** and rendered without locking, the archive writes are serialized.
+*/
+static void TileWorker( void *pData )
+{
+    RLTileJob *psJob = (RLTileJob*) pData;
+    RLBuffer sPng;
+    GInt32 *panData;
+    GByte *pabyTile;
+    int nLevel, nTileCount, iTile, nTileX, nTileY, bHasData, nRet;
+
+    memset( &sPng, 0, sizeof( sPng ) );
+    nLevel = psJob->nLevel;
+    nTileCount = psJob->panTilesX[nLevel] * psJob->panTilesY[nLevel];
+    panData = (GInt32*) VSIMalloc3( sizeof( GInt32 ), psJob->nTileSize,
+                                    psJob->nTileSize );
+    pabyTile = (GByte*) VSIMalloc3( psJob->nBands, psJob->nTileSize,
+                                    psJob->nTileSize );
+    if( !panData || !pabyTile )
+    {
+        CPLError( CE_Failure, CPLE_OutOfMemory,
+                  "Could not allocate tile buffers" );
+        CPLAtomicInc( &psJob->nErrors );
+        VSIFree( panData );
+        VSIFree( pabyTile );
+        return;
+    }
+
+    while( ( iTile = CPLAtomicInc( &psJob->nNextTile ) - 1 ) < nTileCount )
+    {
+        if( psJob->nErrors > 0 )
+            break;
+        /* Coarser tiles know from their children whether to bother */
+        if( nLevel < psJob->nMaxLevel &&
+            !psJob->papabyHasData[nLevel][iTile] )
+        {
+            continue;
+        }
+        nTileX = iTile % psJob->panTilesX[nLevel];
+        nTileY = iTile / psJob->panTilesX[nLevel];
+        if( RenderTile( psJob, nLevel, nTileX, nTileY, panData, pabyTile,
+                        &sPng, &bHasData ) != CE_None )
+        {
+            CPLAtomicInc( &psJob->nErrors );
+            break;
+        }
+        if( nLevel == psJob->nMaxLevel )
+            psJob->papabyHasData[nLevel][iTile] = (GByte) bHasData;
+        /* The top tile is always written, it is linked from doc.kml */
+        if( nLevel == psJob->nMaxLevel && !bHasData && nLevel > 0 )
+            continue;
+
+        CPLCreateOrAcquireMutex( &psJob->hWriteMutex, 1000.0 );
+        nRet = RL_OK;
+        if( bHasData )
+            nRet = WriteTilePng( psJob, nLevel, nTileX, nTileY, &sPng );
+        if( nRet == RL_OK )
+            nRet = WriteTileKml( psJob, nLevel, nTileX, nTileY, bHasData );
+        CPLReleaseMutex( psJob->hWriteMutex );
+        if( nRet != RL_OK )
+        {
+            CPLError( CE_Failure, CPLE_FileIO, "Could not write tile %d/%d/%d",
+                      nLevel, nTileX, nTileY );
+            CPLAtomicInc( &psJob->nErrors );
+            break;
+        }
+    }
+    RLBufferFree( &sPng );
+    VSIFree( panData );
+    VSIFree( pabyTile );
+}
+
+/*
+** Write the window panWindow of psGrid to psKmz as a super-overlay under
+** the directory pszDir: a pyramid of nTileSize tiles, each a kml with a
+** Region and Lod, a ground overlay and network links to its children,
+** named level/x/y.
+** Level 0 is a single tile over the whole window, each level below halves
+** the pixel size, down to full resolution.  The finest level is rendered
+** first and tiles without any data are left out of the whole pyramid.
+** Tiles of a level are rendered on nThreads threads, each png deflated on
+** the thread of its tile whatever psOptions asks for.
+*/
+CPLErr RLWriteSuperOverlay( RLWarpedGrid *psGrid, const int *panWindow,
+                            const RLColorTable *psTable, int bPalette,
+                            const RLPngOptions *psOptions, int nTileSize,
+                            int nThreads, RLKmzWriter *psKmz,
+                            const char *pszDir )
+{
+    RLTileJob sJob;
+    CPLJoinableThread **pahThreads;
+    int nLevel, nSpan, nTileCount, nLevelThreads, iTile, iChild;
+    int nTileX, nTileY, nChildX, nChildY, i;
+
+    if( bPalette && psTable->nPaletteCount == 0 )
+    {
+        CPLError( CE_Failure, CPLE_AppDefined,
+                  "Colour table has too many colours for a palette" );
+        return CE_Failure;
+    }
+    memset( &sJob, 0, sizeof( sJob ) );
+    sJob.psGrid = psGrid;
+    sJob.psTable = psTable;
+    sJob.bPalette = bPalette;
+    sJob.nBands = bPalette ? 1 : 4;
+    if( psOptions )
+        sJob.sPngOptions = *psOptions;
+    else
+        RLPngInitOptions( &sJob.sPngOptions );
+    sJob.sPngOptions.sDeflate.nThreads = 1;
+    sJob.nTileSize = MAX( 16, nTileSize );
+    memcpy( sJob.anWindow, panWindow, sizeof( sJob.anWindow ) );
+    RLGetWarpedGridInfo( psGrid, NULL, NULL, NULL, sJob.adfGeoTransform,
+                         &sJob.nNoData );
+    sJob.psKmz = psKmz;
+    sJob.pszDir = CPLStrdup( pszDir );
+
+    while( ( sJob.nTileSize << sJob.nMaxLevel ) <
+           MAX( panWindow[2], panWindow[3] ) )
+    {
+        sJob.nMaxLevel++;
+    }
+    sJob.panTilesX = (int*) CPLMalloc( sizeof( int ) *
+                                       ( sJob.nMaxLevel + 1 ) );
+    sJob.panTilesY = (int*) CPLMalloc( sizeof( int ) *
+                                       ( sJob.nMaxLevel + 1 ) );
+    sJob.papabyHasData =
+        (GByte**) CPLCalloc( sizeof( GByte* ), sJob.nMaxLevel + 1 );
+    for( nLevel = 0; nLevel <= sJob.nMaxLevel; nLevel++ )
+    {
+        nSpan = sJob.nTileSize << ( sJob.nMaxLevel - nLevel );
+        sJob.panTilesX[nLevel] = ( panWindow[2] + nSpan - 1 ) / nSpan;
+        sJob.panTilesY[nLevel] = ( panWindow[3] + nSpan - 1 ) / nSpan;
+        sJob.papabyHasData[nLevel] =
+            (GByte*) CPLCalloc( 1, (size_t) sJob.panTilesX[nLevel] *
+                                   sJob.panTilesY[nLevel] );
+    }
+    CPLDebug( "RL2KMZ", "Super-overlay of %d levels, %dx%d tiles at the " \
+              "finest", sJob.nMaxLevel + 1, sJob.panTilesX[sJob.nMaxLevel],
+              sJob.panTilesY[sJob.nMaxLevel] );
+
+    pahThreads = (CPLJoinableThread**)
+        CPLMalloc( sizeof( CPLJoinableThread* ) * MAX( 1, nThreads ) );
+    for( nLevel = sJob.nMaxLevel; nLevel >= 0 && sJob.nErrors == 0;
+         nLevel-- )
+    {
+        /* A tile has data if any of its children do */
+        for( iTile = 0; nLevel < sJob.nMaxLevel &&
+             iTile < sJob.panTilesX[nLevel] * sJob.panTilesY[nLevel]; iTile++ )
+        {
+            nTileX = iTile % sJob.panTilesX[nLevel];
+            nTileY = iTile / sJob.panTilesX[nLevel];
+            for( iChild = 0; iChild < 4; iChild++ )
+            {
+                nChildX = nTileX * 2 + iChild % 2;
+                nChildY = nTileY * 2 + iChild / 2;
+                if( nChildX < sJob.panTilesX[nLevel + 1] &&
+                    nChildY < sJob.panTilesY[nLevel + 1] &&
+                    sJob.papabyHasData[nLevel + 1][nChildY *
+                                      sJob.panTilesX[nLevel + 1] + nChildX] )
+                {
+                    sJob.papabyHasData[nLevel][iTile] = TRUE;
+                }
+            }
+        }
+        /* Keep the top tile so doc.kml always has something to link to */
+        if( nLevel == 0 && nLevel < sJob.nMaxLevel )
+            sJob.papabyHasData[0][0] = TRUE;
+
+        sJob.nLevel = nLevel;
+        sJob.nNextTile = 0;
+        nTileCount = sJob.panTilesX[nLevel] * sJob.panTilesY[nLevel];
+        nLevelThreads = MAX( 1, MIN( nThreads, nTileCount ) );
+        if( nLevelThreads == 1 )
+        {
+            TileWorker( &sJob );
+            continue;
+        }
+        for( i = 0; i < nLevelThreads; i++ )
+            pahThreads[i] = CPLCreateJoinableThread( TileWorker, &sJob );
+        for( i = 0; i < nLevelThreads; i++ )
+        {
+            if( pahThreads[i] )
+                CPLJoinThread( pahThreads[i] );
+            else
+                CPLAtomicInc( &sJob.nErrors );
+        }
+    }
+    CPLFree( pahThreads );
+
+    for( nLevel = 0; nLevel <= sJob.nMaxLevel; nLevel++ )
+        CPLFree( sJob.papabyHasData[nLevel] );
+    CPLFree( sJob.papabyHasData );
+    CPLFree( sJob.panTilesX );
+    CPLFree( sJob.panTilesY );
+    CPLFree( sJob.pszDir );
+    if( sJob.hWriteMutex )
+        CPLDestroyMutex( sJob.hWriteMutex );
+    if( sJob.nErrors > 0 )
+    {
+        CPLError( CE_Failure, CPLE_AppDefined,
+                  "Failed to write the super-overlay" );
+        return CE_Failure;
+    }
+    return CE_None;
+}
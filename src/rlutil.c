@@ -0,0 +1,186 @@
+/******************************************************************************
+*
+*  Project:  rl2kmz
+*  Purpose:  small helpers shared by the rl2kmz modules
+*  Author:   Kyle Shannon <kyle at pobox dot com>
+*
+*******************************************************************************
+*
+* This is free and unencumbered software released into the public domain.
+*
+* Anyone is free to copy, modify, publish, use, compile, sell, or
+* distribute this software, either in source code form or as a compiled
+* binary, for any purpose, commercial or non-commercial, and by any
+* means.
+*
+* In jurisdictions that recognize copyright laws, the author or authors
+* of this software dedicate any and all copyright interest in the
+* software to the public domain. We make this dedication for the benefit
+* of the public at large and to the detriment of our heirs and
+* successors. We intend this dedication to be an overt act of
+* relinquishment in perpetuity of all present and future rights to this
+* software under copyright law.
+*
+* THIS SOFTWARE WAS DEVELOPED AT THE ROCKY MOUNTAIN RESEARCH STATION (RMRS)
+* MISSOULA FIRE SCIENCES LABORATORY BY EMPLOYEES OF THE FEDERAL GOVERNMENT
+* IN THE COURSE OF THEIR OFFICIAL DUTIES. PURSUANT TO TITLE 17 SECTION 105
+* OF THE UNITED STATES CODE, THIS SOFTWARE IS NOT SUBJECT TO COPYRIGHT
+* PROTECTION AND IS IN THE PUBLIC DOMAIN. RMRS MISSOULA FIRE SCIENCES
+* LABORATORY ASSUMES NO RESPONSIBILITY WHATSOEVER FOR ITS USE BY OTHER
+* PARTIES,  AND MAKES NO GUARANTEES, EXPRESSED OR IMPLIED, ABOUT ITS QUALITY,
+* RELIABILITY, OR ANY OTHER CHARACTERISTIC.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+* IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+* OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+* ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+* OTHER DEALINGS IN THE SOFTWARE.
+*
+* For more information, please refer to <http://unlicense.org>
+*
+******************************************************************************/
+
+#include "cpl_conv.h"
+#include "cpl_string.h"
+
+#include "rlutil.h"
+
+/*
+** Parse a thread count, either a number or ALL_CPUS like GDAL_NUM_THREADS.
+** NULL means ALL_CPUS.
+*/
+int RLGetThreadCount( const char *pszValue )
+{
+    int nThreads;
+    if( pszValue == NULL || EQUAL( pszValue, "ALL_CPUS" ) )
+        return CPLGetNumCPUs();
+    nThreads = atoi( pszValue );
+    if( nThreads < 1 )
+    {
+        CPLError( CE_Warning, CPLE_AppDefined,
+                  "Invalid thread count %s, using 1", pszValue );
+        nThreads = 1;
+    }
+    return nThreads;
+}
+
+/*
+** RLWriteFunc for a VSILFILE.
+*/
+size_t RLVSIWrite( const void *pData, size_t nBytes, void *pUserData )
+{
+    return VSIFWriteL( pData, 1, nBytes, (VSILFILE*) pUserData );
+}
+
+/*
+** RLWriteFunc appending to an RLBuffer, growing it geometrically.
+*/
+size_t RLBufferWrite( const void *pData, size_t nBytes, void *pUserData )
+{
+    RLBuffer *psBuffer = (RLBuffer*) pUserData;
+    GByte *pabyNew;
+    size_t nAlloc;
+
+    if( psBuffer->nSize + nBytes > psBuffer->nAlloc )
+    {
+        nAlloc = MAX( psBuffer->nAlloc * 2, psBuffer->nSize + nBytes );
+        nAlloc = MAX( nAlloc, 4096 );
+        pabyNew = (GByte*) VSIRealloc( psBuffer->pabyData, nAlloc );
+        if( !pabyNew )
+            return 0;
+        psBuffer->pabyData = pabyNew;
+        psBuffer->nAlloc = nAlloc;
+    }
+    memcpy( psBuffer->pabyData + psBuffer->nSize, pData, nBytes );
+    psBuffer->nSize += nBytes;
+    return nBytes;
+}
+
+/*
+** Append a string to an RLBuffer, without formatting it.
+*/
+size_t RLBufferAppend( RLBuffer *psBuffer, const char *pszText )
+{
+    return RLBufferWrite( pszText, strlen( pszText ), psBuffer );
+}
+
+/*
+** Append formatted text to an RLBuffer.
+*/
+size_t RLBufferPrintf( RLBuffer *psBuffer, const char *pszFormat, ... )
+{
+    va_list args;
+    char *pszText = NULL;
+    size_t nWritten = 0;
+    int nChars;
+
+    va_start( args, pszFormat );
+    nChars = CPLVASPrintf( &pszText, pszFormat, args );
+    va_end( args );
+    if( nChars > 0 )
+        nWritten = RLBufferWrite( pszText, nChars, psBuffer );
+    CPLFree( pszText );
+    return nWritten;
+}
+
+void RLBufferFree( RLBuffer *psBuffer )
+{
+    VSIFree( psBuffer->pabyData );
+    psBuffer->pabyData = NULL;
+    psBuffer->nSize = 0;
+    psBuffer->nAlloc = 0;
+}
+
+GUIntBig RLHashBytes( GUIntBig nHash, const void *pData, size_t nBytes )
+{
+    const GByte *pabyData = (const GByte*) pData;
+    size_t i;
+    for( i = 0; i < nBytes; i++ )
+    {
+        nHash ^= pabyData[i];
+        nHash *= (GUIntBig) 0x100000001b3ULL;
+    }
+    return nHash;
+}
+
+/*
+** Hash a string including its terminator, so consecutive strings can't run
+** into each other.  NULL hashes like the empty string.
+*/
+GUIntBig RLHashString( GUIntBig nHash, const char *pszString )
+{
+    if( pszString == NULL )
+        pszString = "";
+    return RLHashBytes( nHash, pszString, strlen( pszString ) + 1 );
+}
+
+/*
+** Fold the contents of pszFile into *pnHash, read a block at a time so
+** any size of file streams through.  Returns FALSE if it can't be read.
+*/
+int RLHashFile( const char *pszFile, GUIntBig *pnHash )
+{
+    VSILFILE *fp;
+    GByte *pabyBlock;
+    GUIntBig nHash = *pnHash;
+    size_t nRead;
+    int bOK;
+
+    fp = VSIFOpenL( pszFile, "rb" );
+    if( !fp )
+        return FALSE;
+    pabyBlock = (GByte*) CPLMalloc( RL_HASH_BLOCK_SIZE );
+    do
+    {
+        nRead = VSIFReadL( pabyBlock, 1, RL_HASH_BLOCK_SIZE, fp );
+        nHash = RLHashBytes( nHash, pabyBlock, nRead );
+    } while( nRead == RL_HASH_BLOCK_SIZE );
+    bOK = VSIFEofL( fp );
+    VSIFCloseL( fp );
+    CPLFree( pabyBlock );
+    if( bOK )
+        *pnHash = nHash;
+    return bOK;
+}
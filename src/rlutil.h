@@ -0,0 +1,98 @@
+/******************************************************************************
+*
+*  Project:  rl2kmz
+*  Purpose:  small helpers shared by the rl2kmz modules
+*  Author:   Kyle Shannon <kyle at pobox dot com>
+*
+*******************************************************************************
+*
+* This is free and unencumbered software released into the public domain.
+*
+* Anyone is free to copy, modify, publish, use, compile, sell, or
+* distribute this software, either in source code form or as a compiled
+* binary, for any purpose, commercial or non-commercial, and by any
+* means.
+*
+* In jurisdictions that recognize copyright laws, the author or authors
+* of this software dedicate any and all copyright interest in the
+* software to the public domain. We make this dedication for the benefit
+* of the public at large and to the detriment of our heirs and
+* successors. We intend this dedication to be an overt act of
+* relinquishment in perpetuity of all present and future rights to this
+* software under copyright law.
+*
+* THIS SOFTWARE WAS DEVELOPED AT THE ROCKY MOUNTAIN RESEARCH STATION (RMRS)
+* MISSOULA FIRE SCIENCES LABORATORY BY EMPLOYEES OF THE FEDERAL GOVERNMENT
+* IN THE COURSE OF THEIR OFFICIAL DUTIES. PURSUANT TO TITLE 17 SECTION 105
+* OF THE UNITED STATES CODE, THIS SOFTWARE IS NOT SUBJECT TO COPYRIGHT
+* PROTECTION AND IS IN THE PUBLIC DOMAIN. RMRS MISSOULA FIRE SCIENCES
+* LABORATORY ASSUMES NO RESPONSIBILITY WHATSOEVER FOR ITS USE BY OTHER
+* PARTIES,  AND MAKES NO GUARANTEES, EXPRESSED OR IMPLIED, ABOUT ITS QUALITY,
+* RELIABILITY, OR ANY OTHER CHARACTERISTIC.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+* IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+* OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+* ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+* OTHER DEALINGS IN THE SOFTWARE.
+*
+* For more information, please refer to <http://unlicense.org>
+*
+******************************************************************************/
+
+#ifndef RLUTIL_H_
+#define RLUTIL_H_
+
+#include "cpl_vsi.h"
+
+#include "rlport.h"
+
+CPL_C_START
+
+/*
+** Sink for encoded output, returns the number of bytes consumed.
+*/
+typedef size_t (*RLWriteFunc)( const void *pData, size_t nBytes,
+                               void *pUserData );
+
+size_t RLVSIWrite( const void *pData, size_t nBytes, void *pUserData );
+
+/*
+** Growable memory buffer, an RLWriteFunc sink with RLBufferWrite.
+*/
+typedef struct
+{
+    GByte *pabyData;
+    size_t nSize;
+    size_t nAlloc;
+} RLBuffer;
+
+size_t RLBufferWrite( const void *pData, size_t nBytes, void *pUserData );
+void RLBufferFree( RLBuffer *psBuffer );
+size_t RLBufferAppend( RLBuffer *psBuffer, const char *pszText );
+size_t RLBufferPrintf( RLBuffer *psBuffer, const char *pszFormat, ... )
+    CPL_PRINT_FUNC_FORMAT( 2, 3 );
+
+int RLGetThreadCount( const char *pszValue );
+
+/*
+** 64 bit FNV-1a, for cache keys rather than anything adversarial.
+*/
+#define RL_HASH_INIT ((GUIntBig) 0xcbf29ce484222325ULL)
+
+/*
+** Bytes read at a time by RLHashFile().
+*/
+#ifndef RL_HASH_BLOCK_SIZE
+#define RL_HASH_BLOCK_SIZE ( 1024 * 1024 )
+#endif
+
+GUIntBig RLHashBytes( GUIntBig nHash, const void *pData, size_t nBytes );
+GUIntBig RLHashString( GUIntBig nHash, const char *pszString );
+int RLHashFile( const char *pszFile, GUIntBig *pnHash );
+
+CPL_C_END
+
+#endif /* RLUTIL_H_ */
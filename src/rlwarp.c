@@ -0,0 +1,1134 @@
+/******************************************************************************
+*
+*  Project:  rl2kmz
+*  Purpose:  reproject the rain/lightning grid
+*  Author:   Kyle Shannon <kyle at pobox dot com>
+*
+*******************************************************************************
+*
+* This is free and unencumbered software released into the public domain.
+*
+* Anyone is free to copy, modify, publish, use, compile, sell, or
+* distribute this software, either in source code form or as a compiled
+* binary, for any purpose, commercial or non-commercial, and by any
+* means.
+*
+* In jurisdictions that recognize copyright laws, the author or authors
+* of this software dedicate any and all copyright interest in the
+* software to the public domain. We make this dedication for the benefit
+* of the public at large and to the detriment of our heirs and
+* successors. We intend this dedication to be an overt act of
+* relinquishment in perpetuity of all present and future rights to this
+* software under copyright law.
+*
+* THIS SOFTWARE WAS DEVELOPED AT THE ROCKY MOUNTAIN RESEARCH STATION (RMRS)
+* MISSOULA FIRE SCIENCES LABORATORY BY EMPLOYEES OF THE FEDERAL GOVERNMENT
+* IN THE COURSE OF THEIR OFFICIAL DUTIES. PURSUANT TO TITLE 17 SECTION 105
+* OF THE UNITED STATES CODE, THIS SOFTWARE IS NOT SUBJECT TO COPYRIGHT
+* PROTECTION AND IS IN THE PUBLIC DOMAIN. RMRS MISSOULA FIRE SCIENCES
+* LABORATORY ASSUMES NO RESPONSIBILITY WHATSOEVER FOR ITS USE BY OTHER
+* PARTIES,  AND MAKES NO GUARANTEES, EXPRESSED OR IMPLIED, ABOUT ITS QUALITY,
+* RELIABILITY, OR ANY OTHER CHARACTERISTIC.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+* IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+* OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+* ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+* OTHER DEALINGS IN THE SOFTWARE.
+*
+* For more information, please refer to <http://unlicense.org>
+*
+******************************************************************************/
+
+#include <math.h>
+
+#include "cpl_atomic_ops.h"
+#include "cpl_conv.h"
+#include "cpl_multiproc.h"
+#include "cpl_string.h"
+#include "cpl_virtualmem.h"
+#include "gdal_alg.h"
+#include "gdalwarper.h"
+
+#include "rlcolor.h"
+#include "rlutil.h"
+#include "rlwarp.h"
+
+#define RL_WARP_INDEX_MAGIC "RLWIDX1"
+
+/*
+** Default working memory of the warp stage, in bytes.
+*/
+#ifndef RL_WARP_MEMORY
+#define RL_WARP_MEMORY ( 256.0 * 1024 * 1024 )
+#endif
+
+/*
+** Points sampled along each edge of a destination window to find the
+** source window under it.
+*/
+#define RL_WARP_EDGE_SAMPLES 21
+
+/*
+** Pixels added around a destination window found from a source window.
+*/
+#define RL_WARP_WINDOW_PAD 2
+
+/*
+** Rows gathered per strip from an index map.
+*/
+#ifndef RL_WARP_INDEX_BLOCK_YSIZE
+#define RL_WARP_INDEX_BLOCK_YSIZE 256
+#endif
+
+/*
+** Header of a cached warp index file, followed by nDstXSize * nDstYSize
+** GUInt32 source pixel offsets in native byte order.  The cache is local
+** to a host, it is not meant to be portable.
+*/
+typedef struct
+{
+    char szMagic[8];
+    GUIntBig nKey;
+    GInt32 nSrcXSize;
+    GInt32 nSrcYSize;
+    GInt32 nDstXSize;
+    GInt32 nDstYSize;
+    double adfSrcGeoTransform[6];
+    double adfDstGeoTransform[6];
+} RLWarpIndexHeader;
+
+/*
+** A warp operation with its own transformer and source dataset handle, run
+** by one thread at a time.
+*/
+typedef struct
+{
+    GDALDatasetH hSrcDS;
+    int bOwnsDS;
+    void *hTransformArg;
+    GDALWarpOperationH hWarpOp;
+    CPLMutex *hMutex;
+    int nUsers;
+} RLWarpWorker;
+
+struct RLWarpedGrid
+{
+    int nXSize;
+    int nYSize;
+    int nBlockYSize;
+    double adfGeoTransform[6];
+    GInt32 nNoData;
+
+    /*
+    ** Warp operations, run a chunk at a time.  The first is on the
+    ** caller's dataset, one is added on a handle of its own for each
+    ** thread reading at the same time.
+    */
+    GDALDatasetH hSrcDS;
+    char *pszSrcWkt;
+    char *pszDstWkt;
+    int bHasNoData;
+    double dfMemory;
+    int bReopen;
+    RLWarpWorker **papsWorkers;
+    int nWorkers;
+    CPLMutex *hWorkerMutex;
+
+    /* Index map gather */
+    int nSrcXSize;
+    int nSrcYSize;
+    double adfSrcGeoTransform[6];
+    GInt32 *panSrcData;
+    /* Borrowed from the grid cloned for a clone */
+    const GUInt32 *panIndex;
+    VSILFILE *fpIndex;
+    CPLVirtualMem *psIndexMem;
+    GByte *pabyIndexFile;
+};
+
+/*
+** Key an index map on everything that determines it: the source geometry
+** and the srs pair.
+*/
+static GUIntBig WarpIndexKey( GDALDatasetH hSrcDS,
+                              const double *padfSrcGeoTransform,
+                              const char *pszSrcWkt, const char *pszDstWkt )
+{
+    GUIntBig nKey;
+    GInt32 anSize[2];
+
+    anSize[0] = GDALGetRasterXSize( hSrcDS );
+    anSize[1] = GDALGetRasterYSize( hSrcDS );
+    nKey = RLHashString( RL_HASH_INIT, RL_WARP_INDEX_MAGIC );
+    nKey = RLHashBytes( nKey, padfSrcGeoTransform, sizeof( double ) * 6 );
+    nKey = RLHashBytes( nKey, anSize, sizeof( anSize ) );
+    nKey = RLHashString( nKey, pszSrcWkt );
+    nKey = RLHashString( nKey, pszDstWkt );
+    return nKey;
+}
+
+/*
+** Map a cached index file, checking it really belongs to this source.  The
+** header and the file size are checked before anything is mapped, so a
+** truncated or foreign file is never trusted.
+*/
+static int LoadWarpIndex( RLWarpedGrid *psGrid, const char *pszPath,
+                          GUIntBig nKey, const double *padfSrcGeoTransform )
+{
+    RLWarpIndexHeader sHeader;
+    VSILFILE *fp;
+    const GByte *pabyBase;
+    vsi_l_offset nExpected = 0;
+    vsi_l_offset nSize;
+
+    /* Sized through the handle, the name may be renamed over meanwhile */
+    fp = VSIFOpenL( pszPath, "rb" );
+    if( !fp )
+        return RL_ERR;
+    VSIFSeekL( fp, 0, SEEK_END );
+    nSize = VSIFTellL( fp );
+    VSIFSeekL( fp, 0, SEEK_SET );
+    if( nSize >= sizeof( sHeader ) &&
+        VSIFReadL( &sHeader, sizeof( sHeader ), 1, fp ) == 1 &&
+        sHeader.nDstXSize > 0 && sHeader.nDstYSize > 0 )
+    {
+        nExpected = sizeof( sHeader ) + (vsi_l_offset) sizeof( GUInt32 ) *
+                    sHeader.nDstXSize * sHeader.nDstYSize;
+    }
+    if( nExpected == 0 ||
+        memcmp( sHeader.szMagic, RL_WARP_INDEX_MAGIC,
+                sizeof( RL_WARP_INDEX_MAGIC ) ) != 0 ||
+        sHeader.nKey != nKey ||
+        sHeader.nSrcXSize != psGrid->nSrcXSize ||
+        sHeader.nSrcYSize != psGrid->nSrcYSize ||
+        memcmp( sHeader.adfSrcGeoTransform, padfSrcGeoTransform,
+                sizeof( double ) * 6 ) != 0 ||
+        nSize != nExpected )
+    {
+        CPLDebug( "RL2KMZ", "Stale warp index %s", pszPath );
+        VSIFCloseL( fp );
+        return RL_ERR;
+    }
+
+    /*
+    ** Only files on disk can be mapped, others such as the /vsimem/ index
+    ** of a series are read.  Mapping those would only raise an error.
+    */
+    if( CPLIsVirtualMemFileMapAvailable() && !STARTS_WITH( pszPath, "/vsi" ) )
+        psGrid->psIndexMem =
+            CPLVirtualMemFileMapNew( fp, 0, nExpected, VIRTUALMEM_READONLY,
+                                     NULL, NULL );
+    if( psGrid->psIndexMem )
+    {
+        psGrid->fpIndex = fp;
+        pabyBase = (const GByte*) CPLVirtualMemGetAddr( psGrid->psIndexMem );
+    }
+    else
+    {
+        VSIFCloseL( fp );
+        /* Checked again, it may have been replaced in between */
+        if( !VSIIngestFile( NULL, pszPath, &psGrid->pabyIndexFile,
+                            &nSize, -1 ) ||
+            nSize != nExpected ||
+            memcmp( psGrid->pabyIndexFile, &sHeader,
+                    sizeof( sHeader ) ) != 0 )
+        {
+            return RL_ERR;
+        }
+        pabyBase = psGrid->pabyIndexFile;
+    }
+
+    psGrid->nXSize = sHeader.nDstXSize;
+    psGrid->nYSize = sHeader.nDstYSize;
+    memcpy( psGrid->adfGeoTransform, sHeader.adfDstGeoTransform,
+            sizeof( double ) * 6 );
+    psGrid->panIndex = (const GUInt32*) ( pabyBase + sizeof( sHeader ) );
+    return RL_OK;
+}
+
+/*
+** Create a transformer from the destination grid to hSrcDS, with the
+** destination grid suggested by GDAL as the warped VRT would use.
+*/
+static void * CreateTransformer( GDALDatasetH hSrcDS, const char *pszSrcWkt,
+                                 const char *pszDstWkt,
+                                 double *padfDstGeoTransform,
+                                 int *pnDstXSize, int *pnDstYSize )
+{
+    void *hTransformArg;
+
+    hTransformArg = GDALCreateGenImgProjTransformer( hSrcDS, pszSrcWkt, NULL,
+                                                     pszDstWkt, FALSE, 0.0,
+                                                     0 );
+    if( !hTransformArg )
+        return NULL;
+    if( GDALSuggestedWarpOutput( hSrcDS, GDALGenImgProjTransform,
+                                 hTransformArg, padfDstGeoTransform,
+                                 pnDstXSize, pnDstYSize ) != CE_None )
+    {
+        GDALDestroyGenImgProjTransformer( hTransformArg );
+        return NULL;
+    }
+    GDALSetGenImgProjTransformerDstGeoTransform( hTransformArg,
+                                                 padfDstGeoTransform );
+    return hTransformArg;
+}
+
+/*
+** Compute the destination grid and the source pixel under every
+** destination pixel centre, the same nearest neighbour lookup the warper
+** does, and store it in pszPath.
+*/
+static int BuildWarpIndex( GDALDatasetH hSrcDS, const char *pszSrcWkt,
+                           const char *pszDstWkt, const char *pszPath,
+                           GUIntBig nKey, const double *padfSrcGeoTransform )
+{
+    static volatile int nIndexBuilds = 0;
+    RLWarpIndexHeader sHeader;
+    void *hTransformArg;
+    double *padfX, *padfY, *padfZ;
+    int *panSuccess;
+    GUInt32 *panRow;
+    VSILFILE *fp;
+    const char *pszTmpPath;
+    int nDstXSize, nDstYSize, iLine, iPixel, nSrcX, nSrcY;
+    int nRet = RL_OK;
+
+    memset( &sHeader, 0, sizeof( sHeader ) );
+    hTransformArg = CreateTransformer( hSrcDS, pszSrcWkt, pszDstWkt,
+                                       sHeader.adfDstGeoTransform,
+                                       &nDstXSize, &nDstYSize );
+    if( !hTransformArg )
+        return RL_ERR;
+
+    strcpy( sHeader.szMagic, RL_WARP_INDEX_MAGIC );
+    sHeader.nKey = nKey;
+    sHeader.nSrcXSize = GDALGetRasterXSize( hSrcDS );
+    sHeader.nSrcYSize = GDALGetRasterYSize( hSrcDS );
+    sHeader.nDstXSize = nDstXSize;
+    sHeader.nDstYSize = nDstYSize;
+    memcpy( sHeader.adfSrcGeoTransform, padfSrcGeoTransform,
+            sizeof( double ) * 6 );
+
+    /*
+    ** Threads of one process may build the same index at once, each
+    ** writes a file of its own and the last rename wins.
+    */
+    pszTmpPath = CPLSPrintf( "%s.%d.%d.tmp", pszPath, (int) CPLGetPID(),
+                             CPLAtomicInc( &nIndexBuilds ) );
+    fp = VSIFOpenL( pszTmpPath, "wb" );
+    if( !fp )
+    {
+        CPLError( CE_Warning, CPLE_FileIO, "Could not create %s",
+                  pszTmpPath );
+        GDALDestroyGenImgProjTransformer( hTransformArg );
+        return RL_ERR;
+    }
+    pszTmpPath = CPLStrdup( pszTmpPath );
+
+    padfX = (double*) CPLMalloc( sizeof( double ) * nDstXSize );
+    padfY = (double*) CPLMalloc( sizeof( double ) * nDstXSize );
+    padfZ = (double*) CPLMalloc( sizeof( double ) * nDstXSize );
+    panSuccess = (int*) CPLMalloc( sizeof( int ) * nDstXSize );
+    panRow = (GUInt32*) CPLMalloc( sizeof( GUInt32 ) * nDstXSize );
+
+    if( VSIFWriteL( &sHeader, sizeof( sHeader ), 1, fp ) != 1 )
+        nRet = RL_ERR;
+    for( iLine = 0; iLine < nDstYSize && nRet == RL_OK; iLine++ )
+    {
+        for( iPixel = 0; iPixel < nDstXSize; iPixel++ )
+        {
+            padfX[iPixel] = iPixel + 0.5;
+            padfY[iPixel] = iLine + 0.5;
+            padfZ[iPixel] = 0.0;
+        }
+        GDALGenImgProjTransform( hTransformArg, TRUE, nDstXSize,
+                                 padfX, padfY, padfZ, panSuccess );
+        for( iPixel = 0; iPixel < nDstXSize; iPixel++ )
+        {
+            panRow[iPixel] = RL_WARP_INDEX_NONE;
+            if( !panSuccess[iPixel] )
+                continue;
+            nSrcX = (int) floor( padfX[iPixel] + 1e-10 );
+            nSrcY = (int) floor( padfY[iPixel] + 1e-10 );
+            if( nSrcX < 0 || nSrcX >= sHeader.nSrcXSize ||
+                nSrcY < 0 || nSrcY >= sHeader.nSrcYSize )
+                continue;
+            panRow[iPixel] = (GUInt32) nSrcY * sHeader.nSrcXSize + nSrcX;
+        }
+        if( VSIFWriteL( panRow, sizeof( GUInt32 ), nDstXSize, fp ) !=
+            (size_t) nDstXSize )
+        {
+            nRet = RL_ERR;
+        }
+    }
+    if( VSIFCloseL( fp ) != 0 )
+        nRet = RL_ERR;
+    if( nRet == RL_OK && VSIRename( pszTmpPath, pszPath ) != 0 )
+        nRet = RL_ERR;
+    if( nRet != RL_OK )
+    {
+        CPLError( CE_Warning, CPLE_FileIO, "Could not write warp index %s",
+                  pszPath );
+        VSIUnlink( pszTmpPath );
+    }
+
+    CPLFree( padfX );
+    CPLFree( padfY );
+    CPLFree( padfZ );
+    CPLFree( panSuccess );
+    CPLFree( panRow );
+    CPLFree( (void*) pszTmpPath );
+    GDALDestroyGenImgProjTransformer( hTransformArg );
+    return nRet;
+}
+
+/*
+** Read the whole source band into memory for gathering through the index
+** map.
+*/
+static int ReadIndexSource( RLWarpedGrid *psGrid, GDALDatasetH hSrcDS )
+{
+    psGrid->panSrcData = (GInt32*) VSIMalloc3( sizeof( GInt32 ),
+                                               psGrid->nSrcXSize,
+                                               psGrid->nSrcYSize );
+    if( !psGrid->panSrcData )
+    {
+        CPLError( CE_Failure, CPLE_OutOfMemory,
+                  "Could not allocate source grid" );
+        return RL_ERR;
+    }
+    if( GDALRasterIO( GDALGetRasterBand( hSrcDS, 1 ), GF_Read, 0, 0,
+                      psGrid->nSrcXSize, psGrid->nSrcYSize,
+                      psGrid->panSrcData, psGrid->nSrcXSize,
+                      psGrid->nSrcYSize, GDT_Int32, 0, 0 ) != CE_None )
+    {
+        return RL_ERR;
+    }
+    return RL_OK;
+}
+
+/*
+** Set up the gather backend from the index map cached in pszCacheDir,
+** building the map first on a cache miss.  The source band is read into
+** memory once, every row after that is a plain gather.
+*/
+static int OpenIndexBackend( RLWarpedGrid *psGrid, GDALDatasetH hSrcDS,
+                             const char *pszSrcWkt, const char *pszDstWkt,
+                             const char *pszCacheDir )
+{
+    double adfSrcGeoTransform[6];
+    GUIntBig nKey;
+    const char *pszPath;
+
+    psGrid->nSrcXSize = GDALGetRasterXSize( hSrcDS );
+    psGrid->nSrcYSize = GDALGetRasterYSize( hSrcDS );
+    if( (GUIntBig) psGrid->nSrcXSize * psGrid->nSrcYSize >=
+        RL_WARP_INDEX_NONE )
+    {
+        CPLDebug( "RL2KMZ", "Grid too large for a 32 bit warp index" );
+        return RL_ERR;
+    }
+    GDALGetGeoTransform( hSrcDS, adfSrcGeoTransform );
+    nKey = WarpIndexKey( hSrcDS, adfSrcGeoTransform, pszSrcWkt, pszDstWkt );
+    VSIMkdir( pszCacheDir, 0755 );
+    pszPath = CPLStrdup( CPLFormFilename( pszCacheDir,
+                         CPLSPrintf( "warp_" CPL_FRMT_GUIB, nKey ),
+                         "idx" ) );
+
+    if( LoadWarpIndex( psGrid, pszPath, nKey,
+                       adfSrcGeoTransform ) != RL_OK )
+    {
+        CPLDebug( "RL2KMZ", "Building warp index %s", pszPath );
+        if( BuildWarpIndex( hSrcDS, pszSrcWkt, pszDstWkt, pszPath, nKey,
+                            adfSrcGeoTransform ) != RL_OK ||
+            LoadWarpIndex( psGrid, pszPath, nKey,
+                           adfSrcGeoTransform ) != RL_OK )
+        {
+            CPLFree( (void*) pszPath );
+            return RL_ERR;
+        }
+    }
+    CPLFree( (void*) pszPath );
+    memcpy( psGrid->adfSrcGeoTransform, adfSrcGeoTransform,
+            sizeof( adfSrcGeoTransform ) );
+    psGrid->nBlockYSize = RL_WARP_INDEX_BLOCK_YSIZE;
+    return ReadIndexSource( psGrid, hSrcDS );
+}
+
+static void CloseIndexBackend( RLWarpedGrid *psGrid )
+{
+    if( psGrid->psIndexMem )
+        CPLVirtualMemFree( psGrid->psIndexMem );
+    if( psGrid->fpIndex )
+        VSIFCloseL( psGrid->fpIndex );
+    VSIFree( psGrid->pabyIndexFile );
+    VSIFree( psGrid->panSrcData );
+    psGrid->psIndexMem = NULL;
+    psGrid->fpIndex = NULL;
+    psGrid->pabyIndexFile = NULL;
+    psGrid->panSrcData = NULL;
+    psGrid->panIndex = NULL;
+}
+
+/*
+** Set up a nearest neighbour warp of the single Int32 band of hSrcDS
+** through hTransformArg, which the worker takes over.  Source nodata is
+** carried through, and pixels with no source are set to the destination
+** nodata value so they classify as transparent.
+*/
+static RLWarpWorker * CreateWarpWorker( RLWarpedGrid *psGrid,
+                                        GDALDatasetH hSrcDS,
+                                        void *hTransformArg,
+                                        const char *pszThreads )
+{
+    GDALWarpOptions *psWarpOptions;
+    RLWarpWorker *psWorker;
+
+    psWarpOptions = GDALCreateWarpOptions();
+    psWarpOptions->hSrcDS = hSrcDS;
+    psWarpOptions->eResampleAlg = GRA_NearestNeighbour;
+    psWarpOptions->dfWarpMemoryLimit = psGrid->dfMemory;
+    psWarpOptions->nBandCount = 1;
+    psWarpOptions->panSrcBands = (int*) CPLMalloc( sizeof( int ) );
+    psWarpOptions->panSrcBands[0] = 1;
+    psWarpOptions->panDstBands = (int*) CPLMalloc( sizeof( int ) );
+    psWarpOptions->panDstBands[0] = 1;
+    psWarpOptions->eWorkingDataType = GDT_Int32;
+    if( psGrid->bHasNoData )
+    {
+        psWarpOptions->padfSrcNoDataReal =
+            (double*) CPLMalloc( sizeof( double ) );
+        psWarpOptions->padfSrcNoDataReal[0] = psGrid->nNoData;
+    }
+    psWarpOptions->padfDstNoDataReal = (double*) CPLMalloc( sizeof( double ) );
+    psWarpOptions->padfDstNoDataReal[0] = psGrid->nNoData;
+    psWarpOptions->papszWarpOptions =
+        CSLSetNameValue( psWarpOptions->papszWarpOptions, "INIT_DEST",
+                         "NO_DATA" );
+    psWarpOptions->papszWarpOptions =
+        CSLSetNameValue( psWarpOptions->papszWarpOptions, "NUM_THREADS",
+                         pszThreads ? pszThreads : "ALL_CPUS" );
+    psWarpOptions->pfnTransformer = GDALGenImgProjTransform;
+    psWarpOptions->pTransformerArg = hTransformArg;
+
+    psWorker = (RLWarpWorker*) CPLCalloc( sizeof( RLWarpWorker ), 1 );
+    psWorker->hSrcDS = hSrcDS;
+    psWorker->hTransformArg = hTransformArg;
+    psWorker->hWarpOp = GDALCreateWarpOperation( psWarpOptions );
+    GDALDestroyWarpOptions( psWarpOptions );
+    if( !psWorker->hWarpOp )
+    {
+        GDALDestroyGenImgProjTransformer( hTransformArg );
+        CPLFree( psWorker );
+        return NULL;
+    }
+    return psWorker;
+}
+
+static void DestroyWarpWorker( RLWarpWorker *psWorker )
+{
+    GDALDestroyWarpOperation( psWorker->hWarpOp );
+    GDALDestroyGenImgProjTransformer( psWorker->hTransformArg );
+    if( psWorker->bOwnsDS )
+        GDALClose( psWorker->hSrcDS );
+    if( psWorker->hMutex )
+        CPLDestroyMutex( psWorker->hMutex );
+    CPLFree( psWorker );
+}
+
+/*
+** Warp worker on a new handle of the source dataset.  Readers added this
+** way already run side by side, so the warper runs one thread in each.
+*/
+static RLWarpWorker * OpenWarpWorker( RLWarpedGrid *psGrid )
+{
+    RLWarpWorker *psWorker;
+    GDALDatasetH hDS;
+    void *hTransformArg;
+
+    hDS = GDALOpenEx( GDALGetDescription( psGrid->hSrcDS ),
+                      GDAL_OF_READONLY | GDAL_OF_RASTER, NULL, NULL, NULL );
+    if( !hDS )
+        return NULL;
+    hTransformArg = GDALCreateGenImgProjTransformer( hDS, psGrid->pszSrcWkt,
+                                                     NULL, psGrid->pszDstWkt,
+                                                     FALSE, 0.0, 0 );
+    if( !hTransformArg )
+    {
+        GDALClose( hDS );
+        return NULL;
+    }
+    GDALSetGenImgProjTransformerDstGeoTransform( hTransformArg,
+                                                 psGrid->adfGeoTransform );
+    psWorker = CreateWarpWorker( psGrid, hDS, hTransformArg, "1" );
+    if( !psWorker )
+    {
+        GDALClose( hDS );
+        return NULL;
+    }
+    psWorker->bOwnsDS = TRUE;
+    return psWorker;
+}
+
+/*
+** Take the least used warp worker, first adding one for this thread if
+** they are all busy and the source can be opened again, and lock it.
+*/
+static RLWarpWorker * AcquireWarpWorker( RLWarpedGrid *psGrid )
+{
+    RLWarpWorker *psWorker, *psNew;
+    int i;
+
+    CPLCreateOrAcquireMutex( &psGrid->hWorkerMutex, 1000.0 );
+    psWorker = psGrid->papsWorkers[0];
+    for( i = 1; i < psGrid->nWorkers; i++ )
+    {
+        if( psGrid->papsWorkers[i]->nUsers < psWorker->nUsers )
+            psWorker = psGrid->papsWorkers[i];
+    }
+    if( psWorker->nUsers > 0 && psGrid->bReopen )
+    {
+        psNew = OpenWarpWorker( psGrid );
+        if( psNew )
+        {
+            psGrid->papsWorkers = (RLWarpWorker**)
+                CPLRealloc( psGrid->papsWorkers, sizeof( RLWarpWorker* ) *
+                            ( psGrid->nWorkers + 1 ) );
+            psGrid->papsWorkers[psGrid->nWorkers++] = psNew;
+            psWorker = psNew;
+            CPLDebug( "RL2KMZ", "Warping on %d handles", psGrid->nWorkers );
+        }
+        else
+        {
+            /* Not a file we can open again, share what we have */
+            psGrid->bReopen = FALSE;
+        }
+    }
+    psWorker->nUsers++;
+    CPLReleaseMutex( psGrid->hWorkerMutex );
+    CPLCreateOrAcquireMutex( &psWorker->hMutex, 1000.0 );
+    return psWorker;
+}
+
+static void ReleaseWarpWorker( RLWarpedGrid *psGrid, RLWarpWorker *psWorker )
+{
+    CPLReleaseMutex( psWorker->hMutex );
+    CPLCreateOrAcquireMutex( &psGrid->hWorkerMutex, 1000.0 );
+    psWorker->nUsers--;
+    CPLReleaseMutex( psGrid->hWorkerMutex );
+}
+
+/*
+** Set up the warp of hSrcDS on the destination grid.  The first worker
+** runs NUM_THREADS threads within each chunk, and chunks are sized so the
+** source and destination windows of one chunk fit in dfMemory bytes.
+*/
+static int OpenWarpBackend( RLWarpedGrid *psGrid, GDALDatasetH hSrcDS,
+                            const char *pszSrcWkt, const char *pszDstWkt,
+                            int bHasNoData, const char *pszThreads,
+                            double dfMemory )
+{
+    RLWarpWorker *psWorker;
+    void *hTransformArg;
+    double dfRowBytes;
+
+    psGrid->hSrcDS = hSrcDS;
+    psGrid->pszSrcWkt = CPLStrdup( pszSrcWkt );
+    psGrid->pszDstWkt = CPLStrdup( pszDstWkt );
+    psGrid->bHasNoData = bHasNoData;
+    psGrid->dfMemory = dfMemory;
+    psGrid->bReopen = TRUE;
+    psGrid->nSrcXSize = GDALGetRasterXSize( hSrcDS );
+    psGrid->nSrcYSize = GDALGetRasterYSize( hSrcDS );
+    hTransformArg = CreateTransformer( hSrcDS, pszSrcWkt, pszDstWkt,
+                                       psGrid->adfGeoTransform,
+                                       &psGrid->nXSize, &psGrid->nYSize );
+    if( !hTransformArg )
+        return RL_ERR;
+    psWorker = CreateWarpWorker( psGrid, hSrcDS, hTransformArg, pszThreads );
+    if( !psWorker )
+        return RL_ERR;
+    psGrid->papsWorkers = (RLWarpWorker**) CPLMalloc( sizeof( psWorker ) );
+    psGrid->papsWorkers[0] = psWorker;
+    psGrid->nWorkers = 1;
+
+    /*
+    ** A destination row costs its own Int32 values plus its share of the
+    ** source, doubled for the slack in the source window of a chunk.
+    */
+    dfRowBytes = sizeof( GInt32 ) * ( psGrid->nXSize + 2.0 *
+                 psGrid->nSrcXSize * psGrid->nSrcYSize / psGrid->nYSize );
+    psGrid->nBlockYSize = (int) MIN( psGrid->nYSize,
+                                     MAX( 1.0, dfMemory / dfRowBytes ) );
+    CPLDebug( "RL2KMZ", "Warping %dx%d in chunks of %d rows",
+              psGrid->nXSize, psGrid->nYSize, psGrid->nBlockYSize );
+    return RL_OK;
+}
+
+static void CloseWarpBackend( RLWarpedGrid *psGrid )
+{
+    int i;
+
+    for( i = 0; i < psGrid->nWorkers; i++ )
+        DestroyWarpWorker( psGrid->papsWorkers[i] );
+    CPLFree( psGrid->papsWorkers );
+    if( psGrid->hWorkerMutex )
+        CPLDestroyMutex( psGrid->hWorkerMutex );
+    CPLFree( psGrid->pszSrcWkt );
+    CPLFree( psGrid->pszDstWkt );
+    psGrid->papsWorkers = NULL;
+    psGrid->nWorkers = 0;
+    psGrid->hWorkerMutex = NULL;
+    psGrid->pszSrcWkt = NULL;
+    psGrid->pszDstWkt = NULL;
+}
+
+/*
+** Find the source window under a destination window by transforming
+** points along its edges, padded a pixel each way.  Returns FALSE if the
+** window falls entirely outside the source.
+*/
+static int ComputeSourceWindow( RLWarpedGrid *psGrid, void *hTransformArg,
+                                int nXOff, int nYOff, int nXSize, int nYSize,
+                                int *pnSrcXOff, int *pnSrcYOff,
+                                int *pnSrcXSize, int *pnSrcYSize )
+{
+    double adfX[RL_WARP_EDGE_SAMPLES * 4];
+    double adfY[RL_WARP_EDGE_SAMPLES * 4];
+    double adfZ[RL_WARP_EDGE_SAMPLES * 4];
+    int anSuccess[RL_WARP_EDGE_SAMPLES * 4];
+    double dfMinX, dfMinY, dfMaxX, dfMaxY, dfRatio;
+    int i, nPoints = 0, nFailed = 0;
+
+    for( i = 0; i < RL_WARP_EDGE_SAMPLES; i++ )
+    {
+        dfRatio = i / (double) ( RL_WARP_EDGE_SAMPLES - 1 );
+        adfX[nPoints] = nXOff + dfRatio * nXSize;
+        adfY[nPoints++] = nYOff;
+        adfX[nPoints] = nXOff + dfRatio * nXSize;
+        adfY[nPoints++] = nYOff + nYSize;
+        adfX[nPoints] = nXOff;
+        adfY[nPoints++] = nYOff + dfRatio * nYSize;
+        adfX[nPoints] = nXOff + nXSize;
+        adfY[nPoints++] = nYOff + dfRatio * nYSize;
+    }
+    memset( adfZ, 0, sizeof( adfZ ) );
+    GDALGenImgProjTransform( hTransformArg, TRUE, nPoints, adfX, adfY,
+                             adfZ, anSuccess );
+
+    dfMinX = dfMinY = HUGE_VAL;
+    dfMaxX = dfMaxY = -HUGE_VAL;
+    for( i = 0; i < nPoints; i++ )
+    {
+        if( !anSuccess[i] )
+        {
+            nFailed++;
+            continue;
+        }
+        dfMinX = MIN( dfMinX, adfX[i] );
+        dfMinY = MIN( dfMinY, adfY[i] );
+        dfMaxX = MAX( dfMaxX, adfX[i] );
+        dfMaxY = MAX( dfMaxY, adfY[i] );
+    }
+    if( nFailed > 0 )
+    {
+        /* Edges we can't follow, take the whole source to be safe */
+        dfMinX = dfMinY = 0.0;
+        dfMaxX = psGrid->nSrcXSize;
+        dfMaxY = psGrid->nSrcYSize;
+    }
+    *pnSrcXOff = (int) MAX( 0.0, floor( dfMinX ) - 1 );
+    *pnSrcYOff = (int) MAX( 0.0, floor( dfMinY ) - 1 );
+    *pnSrcXSize = (int) MIN( (double) psGrid->nSrcXSize,
+                             ceil( dfMaxX ) + 1 ) - *pnSrcXOff;
+    *pnSrcYSize = (int) MIN( (double) psGrid->nSrcYSize,
+                             ceil( dfMaxY ) + 1 ) - *pnSrcYOff;
+    return *pnSrcXSize > 0 && *pnSrcYSize > 0;
+}
+
+/*
+** Warp the single Int32 band of hSrcDS from pszSrcWkt to pszDstWkt with
+** nearest neighbour resampling.  When the source has no usable nodata value
+** RL_WARP_NODATA is used on the destination.  Options:
+**
+**   CACHE_DIR=path     keep the destination to source index map in path and
+**                      gather rows through it instead of running the warper.
+**                      A /vsimem/ path keeps it in memory.
+**   MAX_MEMORY=bytes   don't hold anything the size of the grid in memory.
+**                      The index map gathers from the whole source grid, so
+**                      CACHE_DIR is only used if that fits.
+**   NUM_THREADS=n      warper threads, a number or ALL_CPUS.
+**   WARP_MEMORY=bytes  working memory of one warp chunk.
+*/
+RLWarpedGrid * RLCreateWarpedGrid( GDALDatasetH hSrcDS,
+                                   const char *pszSrcWkt,
+                                   const char *pszDstWkt,
+                                   char **papszOptions )
+{
+    RLWarpedGrid *psGrid;
+    const char *pszCacheDir;
+    double dfMemory, dfMaxMemory;
+    int bHasNoData;
+
+    psGrid = (RLWarpedGrid*) CPLCalloc( sizeof( RLWarpedGrid ), 1 );
+    bHasNoData = RLGetNoDataInt32( GDALGetRasterBand( hSrcDS, 1 ),
+                                   &psGrid->nNoData );
+    if( !bHasNoData )
+        psGrid->nNoData = RL_WARP_NODATA;
+
+    pszCacheDir = CSLFetchNameValue( papszOptions, "CACHE_DIR" );
+    dfMaxMemory = CPLAtof( CSLFetchNameValueDef( papszOptions, "MAX_MEMORY",
+                                                 "0" ) );
+    /* An index map read rather than mapped would count against it too */
+    if( pszCacheDir && dfMaxMemory > 0.0 &&
+        ( !CPLIsVirtualMemFileMapAvailable() ||
+          (double) sizeof( GInt32 ) * GDALGetRasterXSize( hSrcDS ) *
+          GDALGetRasterYSize( hSrcDS ) > dfMaxMemory ) )
+    {
+        CPLDebug( "RL2KMZ", "Source grid over MAX_MEMORY, warping without " \
+                  "the index map" );
+        pszCacheDir = NULL;
+    }
+    if( pszCacheDir )
+    {
+        if( OpenIndexBackend( psGrid, hSrcDS, pszSrcWkt, pszDstWkt,
+                              pszCacheDir ) == RL_OK )
+        {
+            return psGrid;
+        }
+        CloseIndexBackend( psGrid );
+        CPLError( CE_Warning, CPLE_AppDefined,
+                  "Warp index cache unavailable, using the warper" );
+    }
+
+    dfMemory = CPLAtof( CSLFetchNameValueDef( papszOptions, "WARP_MEMORY",
+                                              "0" ) );
+    if( dfMemory <= 0.0 )
+        dfMemory = RL_WARP_MEMORY;
+    if( OpenWarpBackend( psGrid, hSrcDS, pszSrcWkt, pszDstWkt, bHasNoData,
+                         CSLFetchNameValue( papszOptions, "NUM_THREADS" ),
+                         dfMemory ) != RL_OK )
+    {
+        CloseWarpBackend( psGrid );
+        CPLFree( psGrid );
+        return NULL;
+    }
+    return psGrid;
+}
+
+/*
+** Warped grid of hSrcDS gathered through the index map of psGrid, for a
+** series of grids on the same geometry.  Only hSrcDS is read, no
+** transformer is set up and no index is built or loaded.  psGrid must
+** outlive the clone.  Returns NULL if psGrid isn't gathered through an
+** index map, or hSrcDS isn't the size and geotransform of its source.
+*/
+RLWarpedGrid * RLCloneWarpedGrid( const RLWarpedGrid *psGrid,
+                                  GDALDatasetH hSrcDS )
+{
+    RLWarpedGrid *psClone;
+    double adfSrcGeoTransform[6];
+
+    if( !psGrid->panIndex ||
+        GDALGetRasterXSize( hSrcDS ) != psGrid->nSrcXSize ||
+        GDALGetRasterYSize( hSrcDS ) != psGrid->nSrcYSize ||
+        GDALGetGeoTransform( hSrcDS, adfSrcGeoTransform ) != CE_None ||
+        memcmp( adfSrcGeoTransform, psGrid->adfSrcGeoTransform,
+                sizeof( adfSrcGeoTransform ) ) != 0 )
+    {
+        return NULL;
+    }
+    psClone = (RLWarpedGrid*) CPLCalloc( sizeof( RLWarpedGrid ), 1 );
+    psClone->nXSize = psGrid->nXSize;
+    psClone->nYSize = psGrid->nYSize;
+    psClone->nBlockYSize = psGrid->nBlockYSize;
+    memcpy( psClone->adfGeoTransform, psGrid->adfGeoTransform,
+            sizeof( psGrid->adfGeoTransform ) );
+    psClone->nSrcXSize = psGrid->nSrcXSize;
+    psClone->nSrcYSize = psGrid->nSrcYSize;
+    memcpy( psClone->adfSrcGeoTransform, adfSrcGeoTransform,
+            sizeof( adfSrcGeoTransform ) );
+    psClone->panIndex = psGrid->panIndex;
+    if( !RLGetNoDataInt32( GDALGetRasterBand( hSrcDS, 1 ),
+                           &psClone->nNoData ) )
+        psClone->nNoData = RL_WARP_NODATA;
+    if( ReadIndexSource( psClone, hSrcDS ) != RL_OK )
+    {
+        RLDestroyWarpedGrid( psClone );
+        return NULL;
+    }
+    return psClone;
+}
+
+void RLDestroyWarpedGrid( RLWarpedGrid *psGrid )
+{
+    if( !psGrid )
+        return;
+    CloseWarpBackend( psGrid );
+    CloseIndexBackend( psGrid );
+    CPLFree( psGrid );
+}
+
+void RLGetWarpedGridInfo( const RLWarpedGrid *psGrid, int *pnXSize,
+                          int *pnYSize, int *pnBlockYSize,
+                          double *padfGeoTransform, GInt32 *pnNoData )
+{
+    if( pnXSize )
+        *pnXSize = psGrid->nXSize;
+    if( pnYSize )
+        *pnYSize = psGrid->nYSize;
+    if( pnBlockYSize )
+        *pnBlockYSize = MAX( 1, MIN( psGrid->nBlockYSize, psGrid->nYSize ) );
+    if( padfGeoTransform )
+        memcpy( padfGeoTransform, psGrid->adfGeoTransform,
+                sizeof( double ) * 6 );
+    if( pnNoData )
+        *pnNoData = psGrid->nNoData;
+}
+
+/*
+** Geotransform and size RLCreateWarpedGrid() gives the warped grid of
+** hSrcDS, without setting up a warp.
+*/
+CPLErr RLSuggestWarpedGrid( GDALDatasetH hSrcDS, const char *pszSrcWkt,
+                            const char *pszDstWkt, double *padfGeoTransform,
+                            int *pnXSize, int *pnYSize )
+{
+    void *hTransformArg;
+
+    hTransformArg = CreateTransformer( hSrcDS, pszSrcWkt, pszDstWkt,
+                                       padfGeoTransform, pnXSize, pnYSize );
+    if( !hTransformArg )
+        return CE_Failure;
+    GDALDestroyGenImgProjTransformer( hTransformArg );
+    return CE_None;
+}
+
+/*
+** North, south, east and west edges of a pixel window of a grid with the
+** geotransform padfGeoTransform.
+*/
+void RLGetGridBox( const double *padfGeoTransform, int nXOff, int nYOff,
+                   int nXSize, int nYSize, double *padfBox )
+{
+    const double *padfGT = padfGeoTransform;
+
+    padfBox[0] = padfGT[3] + padfGT[4] * nXOff + padfGT[5] * nYOff;
+    padfBox[1] = padfGT[3] + padfGT[4] * nXOff +
+                 padfGT[5] * ( nYOff + nYSize );
+    padfBox[2] = padfGT[0] + padfGT[1] * ( nXOff + nXSize ) +
+                 padfGT[2] * nYOff;
+    padfBox[3] = padfGT[0] + padfGT[1] * nXOff + padfGT[2] * nYOff;
+}
+
+/*
+** Read a window of the warped grid into panData, nXSize values per row.
+** Reads may come from several threads, each runs a warp worker of its own.
+*/
+CPLErr RLReadWarpedGrid( RLWarpedGrid *psGrid, int nXOff, int nYOff,
+                         int nXSize, int nYSize, GInt32 *panData )
+{
+    const GUInt32 *panIndex;
+    RLWarpWorker *psWorker;
+    GUInt32 nIndex;
+    int iLine, iPixel, nSrcXOff, nSrcYOff, nSrcXSize, nSrcYSize;
+    size_t i;
+    CPLErr eErr;
+
+    if( nXOff < 0 || nYOff < 0 || nXOff + nXSize > psGrid->nXSize ||
+        nYOff + nYSize > psGrid->nYSize )
+    {
+        CPLError( CE_Failure, CPLE_IllegalArg,
+                  "Window %d,%d %dx%d outside of warped grid", nXOff, nYOff,
+                  nXSize, nYSize );
+        return CE_Failure;
+    }
+    if( psGrid->nWorkers > 0 )
+    {
+        /*
+        ** GDALWarpRegionToBuffer() only writes the pixels it finds a
+        ** source for, INIT_DEST is left to GDALWarpRegion().
+        */
+        for( i = 0; i < (size_t) nXSize * nYSize; i++ )
+            panData[i] = psGrid->nNoData;
+        eErr = CE_None;
+        psWorker = AcquireWarpWorker( psGrid );
+        if( ComputeSourceWindow( psGrid, psWorker->hTransformArg, nXOff,
+                                 nYOff, nXSize, nYSize, &nSrcXOff,
+                                 &nSrcYOff, &nSrcXSize, &nSrcYSize ) )
+        {
+            eErr = GDALWarpRegionToBuffer( psWorker->hWarpOp, nXOff, nYOff,
+                                           nXSize, nYSize, panData,
+                                           GDT_Int32, nSrcXOff, nSrcYOff,
+                                           nSrcXSize, nSrcYSize );
+        }
+        ReleaseWarpWorker( psGrid, psWorker );
+        return eErr;
+    }
+    for( iLine = 0; iLine < nYSize; iLine++ )
+    {
+        panIndex = psGrid->panIndex +
+                   (size_t) ( nYOff + iLine ) * psGrid->nXSize + nXOff;
+        for( iPixel = 0; iPixel < nXSize; iPixel++ )
+        {
+            nIndex = panIndex[iPixel];
+            *panData++ = nIndex == RL_WARP_INDEX_NONE ?
+                         psGrid->nNoData : psGrid->panSrcData[nIndex];
+        }
+    }
+    return CE_None;
+}
+
+/*
+** Read every nStep'th pixel of the warped grid, nXSize by nYSize samples
+** from nXOff, nYOff, a nearest neighbour decimation for coarse tiles.
+*/
+CPLErr RLReadWarpedGridSampled( RLWarpedGrid *psGrid, int nXOff, int nYOff,
+                                int nXSize, int nYSize, int nStep,
+                                GInt32 *panData )
+{
+    GInt32 *panRow;
+    GUInt32 nIndex;
+    const GUInt32 *panIndex;
+    int nSpan, iLine, iPixel;
+    CPLErr eErr = CE_None;
+
+    if( nStep == 1 )
+        return RLReadWarpedGrid( psGrid, nXOff, nYOff, nXSize, nYSize,
+                                 panData );
+    nSpan = ( nXSize - 1 ) * nStep + 1;
+    if( nXOff < 0 || nYOff < 0 || nXOff + nSpan > psGrid->nXSize ||
+        nYOff + ( nYSize - 1 ) * nStep + 1 > psGrid->nYSize )
+    {
+        CPLError( CE_Failure, CPLE_IllegalArg,
+                  "Sampled window %d,%d %dx%d step %d outside of warped grid",
+                  nXOff, nYOff, nXSize, nYSize, nStep );
+        return CE_Failure;
+    }
+    if( psGrid->panIndex )
+    {
+        for( iLine = 0; iLine < nYSize; iLine++ )
+        {
+            panIndex = psGrid->panIndex +
+                       (size_t) ( nYOff + iLine * nStep ) * psGrid->nXSize +
+                       nXOff;
+            for( iPixel = 0; iPixel < nXSize; iPixel++ )
+            {
+                nIndex = panIndex[(size_t) iPixel * nStep];
+                *panData++ = nIndex == RL_WARP_INDEX_NONE ?
+                             psGrid->nNoData : psGrid->panSrcData[nIndex];
+            }
+        }
+        return CE_None;
+    }
+
+    /* The warper only works on whole windows, warp each sampled row */
+    panRow = (GInt32*) VSIMalloc2( sizeof( GInt32 ), nSpan );
+    if( !panRow )
+    {
+        CPLError( CE_Failure, CPLE_OutOfMemory,
+                  "Could not allocate sample row" );
+        return CE_Failure;
+    }
+    for( iLine = 0; iLine < nYSize && eErr == CE_None; iLine++ )
+    {
+        eErr = RLReadWarpedGrid( psGrid, nXOff, nYOff + iLine * nStep, nSpan,
+                                 1, panRow );
+        for( iPixel = 0; iPixel < nXSize; iPixel++ )
+            *panData++ = panRow[(size_t) iPixel * nStep];
+    }
+    VSIFree( panRow );
+    return eErr;
+}
+
+/*
+** Find the window of the destination grid covering the window panSrcWindow
+** (x offset, y offset, width, height) of hSrcDS.  The edges of the source
+** window are followed into the destination every few pixels, the result
+** padded by RL_WARP_WINDOW_PAD pixels and clipped to the grid.  If an edge
+** can't be transformed the whole grid is used.  Returns FALSE if the
+** window misses the grid.
+*/
+int RLMapSourceWindow( GDALDatasetH hSrcDS, const char *pszSrcWkt,
+                       const char *pszDstWkt,
+                       const double *padfDstGeoTransform, int nDstXSize,
+                       int nDstYSize, const int *panSrcWindow,
+                       int *panDstWindow )
+{
+    void *hTransformArg;
+    double *padfX, *padfY, *padfZ;
+    int *panSuccess;
+    double dfMinX, dfMinY, dfMaxX, dfMaxY, dfRatio;
+    int nSamples, nPoints = 0, i, bFailed = FALSE;
+
+    hTransformArg = GDALCreateGenImgProjTransformer( hSrcDS, pszSrcWkt, NULL,
+                                                     pszDstWkt, FALSE, 0.0,
+                                                     0 );
+    if( !hTransformArg )
+        return FALSE;
+    GDALSetGenImgProjTransformerDstGeoTransform( hTransformArg,
+                                                 padfDstGeoTransform );
+
+    nSamples = MAX( panSrcWindow[2], panSrcWindow[3] ) / 4 + 1;
+    nSamples = MAX( RL_WARP_EDGE_SAMPLES, MIN( nSamples, 4096 ) );
+    padfX = (double*) CPLMalloc( sizeof( double ) * nSamples * 4 );
+    padfY = (double*) CPLMalloc( sizeof( double ) * nSamples * 4 );
+    padfZ = (double*) CPLCalloc( sizeof( double ), nSamples * 4 );
+    panSuccess = (int*) CPLMalloc( sizeof( int ) * nSamples * 4 );
+    for( i = 0; i < nSamples; i++ )
+    {
+        dfRatio = i / (double) ( nSamples - 1 );
+        padfX[nPoints] = panSrcWindow[0] + dfRatio * panSrcWindow[2];
+        padfY[nPoints++] = panSrcWindow[1];
+        padfX[nPoints] = panSrcWindow[0] + dfRatio * panSrcWindow[2];
+        padfY[nPoints++] = panSrcWindow[1] + panSrcWindow[3];
+        padfX[nPoints] = panSrcWindow[0];
+        padfY[nPoints++] = panSrcWindow[1] + dfRatio * panSrcWindow[3];
+        padfX[nPoints] = panSrcWindow[0] + panSrcWindow[2];
+        padfY[nPoints++] = panSrcWindow[1] + dfRatio * panSrcWindow[3];
+    }
+    GDALGenImgProjTransform( hTransformArg, FALSE, nPoints, padfX, padfY,
+                             padfZ, panSuccess );
+
+    dfMinX = dfMinY = HUGE_VAL;
+    dfMaxX = dfMaxY = -HUGE_VAL;
+    for( i = 0; i < nPoints; i++ )
+    {
+        if( !panSuccess[i] )
+        {
+            bFailed = TRUE;
+            break;
+        }
+        dfMinX = MIN( dfMinX, padfX[i] );
+        dfMinY = MIN( dfMinY, padfY[i] );
+        dfMaxX = MAX( dfMaxX, padfX[i] );
+        dfMaxY = MAX( dfMaxY, padfY[i] );
+    }
+    CPLFree( padfX );
+    CPLFree( padfY );
+    CPLFree( padfZ );
+    CPLFree( panSuccess );
+    GDALDestroyGenImgProjTransformer( hTransformArg );
+
+    if( bFailed )
+    {
+        panDstWindow[0] = 0;
+        panDstWindow[1] = 0;
+        panDstWindow[2] = nDstXSize;
+        panDstWindow[3] = nDstYSize;
+        return TRUE;
+    }
+    panDstWindow[0] = (int) MAX( 0.0, floor( dfMinX ) - RL_WARP_WINDOW_PAD );
+    panDstWindow[1] = (int) MAX( 0.0, floor( dfMinY ) - RL_WARP_WINDOW_PAD );
+    panDstWindow[2] = (int) MIN( (double) nDstXSize,
+                                 ceil( dfMaxX ) + RL_WARP_WINDOW_PAD ) -
+                      panDstWindow[0];
+    panDstWindow[3] = (int) MIN( (double) nDstYSize,
+                                 ceil( dfMaxY ) + RL_WARP_WINDOW_PAD ) -
+                      panDstWindow[1];
+    return panDstWindow[2] > 0 && panDstWindow[3] > 0;
+}
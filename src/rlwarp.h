@@ -0,0 +1,107 @@
+/******************************************************************************
+*
+*  Project:  rl2kmz
+*  Purpose:  reproject the rain/lightning grid
+*  Author:   Kyle Shannon <kyle at pobox dot com>
+*
+*******************************************************************************
+*
+* This is free and unencumbered software released into the public domain.
+*
+* Anyone is free to copy, modify, publish, use, compile, sell, or
+* distribute this software, either in source code form or as a compiled
+* binary, for any purpose, commercial or non-commercial, and by any
+* means.
+*
+* In jurisdictions that recognize copyright laws, the author or authors
+* of this software dedicate any and all copyright interest in the
+* software to the public domain. We make this dedication for the benefit
+* of the public at large and to the detriment of our heirs and
+* successors. We intend this dedication to be an overt act of
+* relinquishment in perpetuity of all present and future rights to this
+* software under copyright law.
+*
+* THIS SOFTWARE WAS DEVELOPED AT THE ROCKY MOUNTAIN RESEARCH STATION (RMRS)
+* MISSOULA FIRE SCIENCES LABORATORY BY EMPLOYEES OF THE FEDERAL GOVERNMENT
+* IN THE COURSE OF THEIR OFFICIAL DUTIES. PURSUANT TO TITLE 17 SECTION 105
+* OF THE UNITED STATES CODE, THIS SOFTWARE IS NOT SUBJECT TO COPYRIGHT
+* PROTECTION AND IS IN THE PUBLIC DOMAIN. RMRS MISSOULA FIRE SCIENCES
+* LABORATORY ASSUMES NO RESPONSIBILITY WHATSOEVER FOR ITS USE BY OTHER
+* PARTIES,  AND MAKES NO GUARANTEES, EXPRESSED OR IMPLIED, ABOUT ITS QUALITY,
+* RELIABILITY, OR ANY OTHER CHARACTERISTIC.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+* IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+* OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+* ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+* OTHER DEALINGS IN THE SOFTWARE.
+*
+* For more information, please refer to <http://unlicense.org>
+*
+******************************************************************************/
+
+#ifndef RLWARP_H_
+#define RLWARP_H_
+
+#include "gdal.h"
+
+#include "rlport.h"
+
+CPL_C_START
+
+/*
+** Destination nodata used when the source grid has none.
+*/
+#ifndef RL_WARP_NODATA
+#define RL_WARP_NODATA (-2147483647 - 1)
+#endif
+
+/*
+** Destination pixels in a warp index with no source pixel.
+*/
+#define RL_WARP_INDEX_NONE 0xFFFFFFFFU
+
+/*
+** The single Int32 band of the source grid, warped to WGS84.  Rows are
+** produced on demand a chunk at a time, either by the GDAL warper or by
+** gathering through a cached destination to source index map.
+*/
+typedef struct RLWarpedGrid RLWarpedGrid;
+
+RLWarpedGrid * RLCreateWarpedGrid( GDALDatasetH hSrcDS,
+                                   const char *pszSrcWkt,
+                                   const char *pszDstWkt,
+                                   char **papszOptions );
+RLWarpedGrid * RLCloneWarpedGrid( const RLWarpedGrid *psGrid,
+                                  GDALDatasetH hSrcDS );
+void RLDestroyWarpedGrid( RLWarpedGrid *psGrid );
+
+void RLGetWarpedGridInfo( const RLWarpedGrid *psGrid, int *pnXSize,
+                          int *pnYSize, int *pnBlockYSize,
+                          double *padfGeoTransform, GInt32 *pnNoData );
+
+CPLErr RLSuggestWarpedGrid( GDALDatasetH hSrcDS, const char *pszSrcWkt,
+                            const char *pszDstWkt, double *padfGeoTransform,
+                            int *pnXSize, int *pnYSize );
+
+void RLGetGridBox( const double *padfGeoTransform, int nXOff, int nYOff,
+                   int nXSize, int nYSize, double *padfBox );
+
+CPLErr RLReadWarpedGrid( RLWarpedGrid *psGrid, int nXOff, int nYOff,
+                         int nXSize, int nYSize, GInt32 *panData );
+
+CPLErr RLReadWarpedGridSampled( RLWarpedGrid *psGrid, int nXOff, int nYOff,
+                                int nXSize, int nYSize, int nStep,
+                                GInt32 *panData );
+
+int RLMapSourceWindow( GDALDatasetH hSrcDS, const char *pszSrcWkt,
+                       const char *pszDstWkt,
+                       const double *padfDstGeoTransform, int nDstXSize,
+                       int nDstYSize, const int *panSrcWindow,
+                       int *panDstWindow );
+
+CPL_C_END
+
+#endif /* RLWARP_H_ */